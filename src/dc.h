@@ -44,6 +44,37 @@ typedef struct DC_Context *DC_ContextPtr;
 struct DC_Calculation;
 typedef struct DC_Calculation *DC_CalculationPtr;
 
+/**
+ * @brief A calculation along with its derivatives by each of its arguments.
+ *
+ * @sa DC_CompileGradient
+ */
+struct DC_Gradient;
+typedef struct DC_Gradient *DC_GradientPtr;
+
+/**
+ * @brief A calculation that can be called directly.
+ *
+ * This uses the platform's C calling convention, not DC_API.
+ *
+ * @sa DC_GetNativeFunction
+ */
+typedef float (*DC_NativeFunction)(const float *args);
+
+/**
+ * @brief The argument names of calculations, indexed for fast lookup.
+ *
+ * Compiling with a schema finds each argument name with a hash lookup rather
+ * than comparing it to every name in turn, which is much faster for
+ * calculations with many arguments. One schema can be used for any number of
+ * compiles.
+ *
+ * @sa DC_CreateArgSchema
+ * @sa DC_CompileWithSchema
+ */
+struct DC_ArgSchema;
+typedef struct DC_ArgSchema *DC_ArgSchemaPtr;
+
 /**
  * @brief Optional bytecode representation of a calculation.
  *
@@ -70,6 +101,199 @@ DC_ContextPtr DC_API DC_CreateContext(void);
  */
 void DC_API DC_FreeContext(struct DC_Context *ctx);
 
+/**
+ * @brief Maximum number of idle code pages a context keeps for reuse.
+ *
+ * When calculations are freed, any pages that no longer hold calculations are
+ * kept and reused for new calculations. Once more than this number of pages
+ * are idle, the extra pages are returned to the OS. Setting this to zero
+ * returns pages as soon as they are unused.
+ *
+ * This is only used by the JIT backends.
+ */
+#define DC_OPTION_MAX_FREE_PAGES 1
+
+/**
+ * @brief Whether sin and cos use inline SSE code rather than the x87 unit.
+ *
+ * When non-zero (the default), sin and cos are computed with SSE range
+ * reduction and a polynomial, which is much faster than fsin/fcos. The
+ * absolute error is below 2e-7 for |x| up to 1e4 and below 1.5e-6 for |x| up
+ * to 1e5. Larger arguments are not checked, so set this to zero to use
+ * fsin/fcos for calculations that need them.
+ *
+ * This only affects calculations compiled after it is set, and is only used
+ * by the JIT backends. Double precision calculations always use fsin/fcos.
+ */
+#define DC_OPTION_FAST_TRIG 2
+
+/**
+ * @brief Whether calculations are computed in double precision.
+ *
+ * When non-zero, calculations compiled after this is set keep their constants
+ * and intermediate values as doubles. The default is zero, which uses floats.
+ *
+ * Either DC_Calculate or DC_CalculateDouble can run any calculation. The
+ * arguments and result are converted when they do not match the precision
+ * that the calculation was compiled with, so DC_CalculateDouble is the
+ * fastest way to run double precision calculations.
+ *
+ * Double precision calculations have no packed code for DC_CalculateBatch,
+ * and DC_GetNativeFunction returns NULL for them.
+ */
+#define DC_OPTION_DOUBLE 3
+
+/**
+ * @brief Whether the compiler may rewrite calculations in ways that can change
+ * how they round.
+ *
+ * When non-zero, addition and multiplication are treated as associative, so
+ * that "x + 1 + 2" compiles as "x + 3" and "2 * x * 3" as "x * 6". Identities
+ * that do not hold for the sign of zero or for infinities and NaN, such as
+ * "x * 0 = 0" and "x + 0 = x", are also used. The default is zero, which
+ * only uses rewrites that give exactly the same results.
+ *
+ * This only affects calculations compiled after it is set.
+ */
+#define DC_OPTION_FAST_MATH 4
+
+/**
+ * @brief Whether compiled calculations are shared between identical compiles.
+ *
+ * When non-zero, compiling a calculation with the same source, argument names,
+ * and options as a calculation that has not been freed yet returns that same
+ * calculation instead of compiling it again. Differences in whitespace that do
+ * not change the meaning of the source are ignored. The default is zero.
+ *
+ * Each compile that returns a shared calculation must still be matched by a
+ * call to DC_Free, and the calculation is only freed once all of them have
+ * been made. Calculations compiled with bytecode are never shared.
+ *
+ * The cache also keeps the parsed and optimized form of calculations it has
+ * compiled after they are freed, up to DC_OPTION_MAX_FREE_CACHED of them.
+ * Compiling the same calculation again then only generates the code. This can
+ * be saved to a file and loaded in a later run, see DC_SaveCache.
+ *
+ * @sa DC_GetCacheStatistics
+ * @sa DC_ClearCache
+ */
+#define DC_OPTION_CACHE 5
+
+/**
+ * @brief Number of calls after which a calculation is compiled to native code.
+ *
+ * When non-zero, new calculations are not compiled by the backend right away.
+ * They run on the bytecode interpreter instead, which is much cheaper to
+ * create, and count how many times they are called. The call that brings a
+ * calculation to this many calls compiles it and switches it to the compiled
+ * code, which later calls then run. This lets calculations that are only run a
+ * few times skip the cost of compiling them. Batches count as one call for
+ * each set of arguments. The default is zero, which compiles every calculation
+ * right away.
+ *
+ * If something else is being compiled in the context on another thread at the
+ * time, the calculation keeps being interpreted and is promoted by a later
+ * call. Calculations are promoted with the options they were compiled with.
+ *
+ * This has no effect if the library was built without bytecode support. The
+ * soft backend interprets every calculation anyway, so this only changes when
+ * that happens.
+ *
+ * @sa DC_PromoteCalculations
+ */
+#define DC_OPTION_TIER_THRESHOLD 6
+
+/**
+ * @brief Maximum number of freed calculations that DC_OPTION_CACHE keeps.
+ *
+ * Once more than this number of calculations have been freed, the ones that
+ * were freed longest ago are removed from the cache. Calculations loaded with
+ * DC_LoadCache do not count towards this, and are kept until DC_ClearCache is
+ * called. Setting this to zero removes calculations as soon as they are freed.
+ * The default is 256.
+ */
+#define DC_OPTION_MAX_FREE_CACHED 7
+
+/**
+ * @brief Compiles the calculations that have reached DC_OPTION_TIER_THRESHOLD.
+ *
+ * Calculations are promoted automatically by their calls, so this is only
+ * needed to promote the ones whose calls were made while something else was
+ * compiling, or when the threshold is lowered, at a time of the caller's
+ * choosing. Calculations in the context can keep running on other threads.
+ * Each call to a calculation being promoted either interprets it or runs the
+ * finished code, and never code that is still being written.
+ *
+ * @param ctx The context to promote calculations in.
+ * @return The number of calculations that were promoted.
+ */
+unsigned DC_API DC_PromoteCalculations(struct DC_Context *ctx);
+
+/**
+ * @brief Sets an option on a context.
+ *
+ * @param ctx The context to change.
+ * @param option The option to set, such as DC_OPTION_MAX_FREE_PAGES.
+ * @param value The new value for the option.
+ * @return Non-zero if the option is supported, zero otherwise.
+ */
+int DC_API DC_SetOption(struct DC_Context *ctx, int option, unsigned value);
+
+/**
+ * @brief Gets how well DC_OPTION_CACHE is working.
+ *
+ * @param ctx The context to check.
+ * @param out_hits Receives the number of compiles that found a calculation.
+ * @param out_misses Receives the number of compiles that did not.
+ * @param out_num_calculations Receives the number of different calculations
+ *   in the cache, including ones that have been freed or loaded but not
+ *   compiled yet and are still kept.
+ */
+void DC_API DC_GetCacheStatistics(const struct DC_Context *ctx,
+    unsigned long *out_hits,
+    unsigned long *out_misses,
+    unsigned *out_num_calculations);
+
+/**
+ * @brief Saves the calculations in the cache to a file.
+ *
+ * The file holds the parsed and optimized calculations rather than the
+ * generated code, so it can be loaded on any machine and with any backend.
+ *
+ * @param ctx The context with the cache to save.
+ * @param path The file to write.
+ * @return Non-zero on success, zero if the file could not be written.
+ *
+ * @sa DC_OPTION_CACHE
+ */
+int DC_API DC_SaveCache(const struct DC_Context *ctx, const char *path);
+
+/**
+ * @brief Adds the calculations from a file made by DC_SaveCache to the cache.
+ *
+ * Loaded calculations are used by later compiles that have the same source,
+ * argument names, and options when DC_OPTION_CACHE is set, which skips parsing
+ * and optimizing them. Calculations that are already in the cache and ones
+ * that are not valid are skipped.
+ *
+ * @param ctx The context with the cache to add to.
+ * @param path The file to read.
+ * @return The number of calculations that were added, which is zero if the
+ *   file does not exist or was not made by DC_SaveCache.
+ */
+int DC_API DC_LoadCache(struct DC_Context *ctx, const char *path);
+
+/**
+ * @brief Removes the calculations in the cache that are not in use.
+ *
+ * This removes the calculations that have been freed and the ones loaded with
+ * DC_LoadCache that have not been compiled. Calculations that have not been
+ * freed stay in the cache.
+ *
+ * @param ctx The context with the cache to clear.
+ */
+void DC_API DC_ClearCache(struct DC_Context *ctx);
+
 #define DC_COMPILE_KEEP_GOING 1
 
 /**
@@ -80,26 +304,51 @@ void DC_API DC_FreeContext(struct DC_Context *ctx);
  *
  * The language that DCJIT implements is defined as:
  *
- * <expression> ::= <factor> [<mulop> <factor>]
+ * <calculation> ::= {'let' <name> '=' <expression> ';'} <expression>
+ * <expression> ::= <comparison> ['?' <expression> ':' <expression>]
+ * <comparison> ::= <sum> [<cmpop> <sum>]
+ * <cmpop>      ::= '<' | '<=' | '>' | '>=' | '==' | '!='
+ * <sum>        ::= <factor> [<mulop> <factor>]
  * <mulop>      ::= '*' | '/'
- * <factor>     ::= <term> [<addop> <term>]
+ * <factor>     ::= <power> [<addop> <power>]
  * <addop>      ::= '+' | '-'
+ * <power>      ::= <term> ['^' <power>]
  * <term>       ::= <builtin> | '(' <expression> ')' | <number> | <argument>
- * <builtin>    ::= <func> '(' <expression> ')'
- * <func>       ::= 'sin' | 'cos' | 'sqrt'
+ * <builtin>    ::= <func> '(' <expression> ')' |
+ *                  <func2> '(' <expression> ',' <expression> ')'
+ * <func>       ::= 'sin' | 'cos' | 'sqrt' | 'tan' | 'exp' | 'log' | 'abs' |
+ *                  'floor'
+ * <func2>      ::= 'atan2' | 'min' | 'max'
  * <number>     ::= '.' {0-9}+ | {0-9}+ ['.' {0-9}*]
- * <argument>   ::= '$'{0-9}+ | {a-zA-Z_}
+ * <argument>   ::= '$'{0-9}+ | <name>
+ * <name>       ::= {a-zA-Z_}+
  *
  * The compiler will compute any constant expressions. For instance, the
  * expression "97.1 * sin(11 + 0.9)" would be fully calculated at compile time
  * and the calculation would just return the pre-computed result. This can be
  * suppressed by defining DC_OPTIMIZE to 0, which is useful for debugging.
  *
- * Usually, it's best to use DC_CompileCalculations and batch all compilation
- * into a single call. This will significantly reduce the amount of memory used
- * since otherwise each calculation will use an entire page (which is 4 KB on
- * x86, and either 4KB or 4 MB on amd64, for instance) where otherwise the
- * calculations can be grouped into a few pages.
+ * The '^' operator raises its left side to the power of its right side, and
+ * is right associative. Integer constant exponents from -64 to 64 are
+ * calculated with multiplications, so "x^-3" is "1/(x*x*x)" and is valid for
+ * any left side. Any other exponent is only valid for a positive left side.
+ *
+ * atan2(y, x) is the angle of the point (x, y). min(a, b) and max(a, b) give
+ * b if either is NaN.
+ *
+ * Comparisons are 1.0 when true and 0.0 when false. Every comparison with NaN
+ * is false except '!='. "c ? a : b" is a when c is not zero (including NaN)
+ * and b when it is zero. Both a and b are calculated, there is no branching.
+ *
+ * "let d = sqrt(dx*dx+dy*dy); k*(l-d)/d" binds d to its expression, which is
+ * only calculated once. A bound name can be used in the expressions after it,
+ * and hides an argument with the same name.
+ *
+ * Calculations compiled in the same context are packed together into shared
+ * pages, so many small calculations will only use a few pages (which are 4 KB
+ * on x86, and either 4KB or 4 MB on amd64, for instance). A page is only
+ * returned once every calculation on it has been freed. A calculation that is
+ * bigger than a page gets enough pages of its own.
  *
  * @param ctx The context to compile the calcuation in.
  * @param source Source code for the calculation
@@ -119,7 +368,8 @@ DC_CalculationPtr DC_API DC_CompileCalculation(struct DC_Context *ctx,
  *
  * @note Bytecode is only used for the root-finding API.
  *
- * Bytecode is not used for running any calculations.
+ * Bytecode is not used for running any calculations, but a calculation can be
+ * compiled from it later with DC_CompileFromBytecode.
  *
  * @param ctx The context to compile the calcuation in.
  * @param source Source code for the calculation
@@ -163,10 +413,9 @@ void DC_API DC_Compile(struct DC_Context *ctx,
 /**
  * @brief Compiles a set of calculations.
  *
- * This is more efficient than DC_Compile for compiling multiple calculations,
- * as each otherwise each calculation will use an entire page (which is 4 KB on
- * x86, and either 4KB or 4 MB on amd64, for instance) where otherwise the
- * calculations can be grouped into a few pages.
+ * This is equivalent to calling DC_CompileCalculation for each calculation.
+ * Like DC_CompileCalculation, the calculations are grouped into a few shared
+ * pages.
  *
  * Ordinarily, this function will halt immediately if a calculation cannot be
  * compiled. If @p flags includes DC_COMPILE_KEEP_GOING then compilation will
@@ -200,6 +449,152 @@ int DC_API DC_CompileCalculations(struct DC_Context *ctx,
     struct DC_Calculation **out_calculations,
     const char **out_error);
 
+/**
+ * @brief Creates a schema of argument names.
+ *
+ * The names are copied, so @p arg_names does not need to outlive the schema.
+ * If more than one argument has the same name, the name refers to the first of
+ * them, the same as when compiling with an array of names.
+ *
+ * @param num_args Number of arguments.
+ * @param arg_names Aliases for the arguments.
+ * @return The new schema, which must be freed with DC_FreeArgSchema.
+ */
+DC_ArgSchemaPtr DC_API DC_CreateArgSchema(unsigned num_args,
+    const char *const *arg_names);
+
+/**
+ * @brief Frees a schema.
+ *
+ * Calculations compiled with the schema are not affected.
+ */
+void DC_API DC_FreeArgSchema(struct DC_ArgSchema *schema);
+
+/**
+ * @brief Gets the number of arguments in a schema.
+ */
+unsigned DC_API DC_GetArgSchemaSize(const struct DC_ArgSchema *schema);
+
+/**
+ * @brief Compile a calculation using a schema for the argument names.
+ *
+ * This is equivalent to DC_Compile with the names that @p schema was created
+ * with.
+ *
+ * @sa DC_Compile
+ * @sa DC_CreateArgSchema
+ */
+void DC_API DC_CompileWithSchema(struct DC_Context *ctx,
+    const char *source,
+    const struct DC_ArgSchema *schema,
+    const char **out_error,
+    DC_CalculationPtr *out_optional_calculation,
+    DC_BytecodePtr *out_optional_bytecode);
+
+/**
+ * @brief Compiles a set of calculations using schemas for the argument names.
+ *
+ * This is equivalent to DC_CompileCalculations, with the arguments of each
+ * calculation given by an element of @p schemas. The same schema can be used
+ * for any number of the calculations.
+ *
+ * @sa DC_CompileCalculations
+ * @sa DC_CreateArgSchema
+ */
+int DC_API DC_CompileCalculationsWithSchemas(struct DC_Context *ctx,
+    int flags,
+    unsigned num_calculations,
+    const char *const *sources,
+    const struct DC_ArgSchema *const *schemas,
+    struct DC_Calculation **out_calculations,
+    const char **out_error);
+
+/**
+ * @brief Compiles a calculation with some of its arguments fixed to constants.
+ *
+ * This is useful for arguments that do not change for many calls, since the
+ * bound values are folded into the calculation the same as numbers written in
+ * the source. Parts of the calculation that only use bound arguments are then
+ * calculated once here instead of on every call.
+ *
+ * The calculation still takes @p num_args arguments, but the elements of the
+ * args array for bound arguments are ignored. Specialized calculations are
+ * never shared through DC_OPTION_CACHE.
+ *
+ * @param ctx The context to compile the calculation in.
+ * @param source Source code for the calculation, see DC_CompileCalculation.
+ * @param num_args Number of arguments to the calculation.
+ * @param arg_names Aliases for the arguments.
+ * @param mask Bit i is set to bind argument i. Only the first 32 arguments
+ *   can be bound, and higher bits are ignored.
+ * @param values The value of each bound argument, indexed the same as the
+ *   arguments. Elements for arguments that are not bound are not read.
+ * @param out_error Receives the error message, or NULL if there is none.
+ * @return The new calculation, or NULL if there was an error.
+ */
+DC_CalculationPtr DC_API DC_Specialize(struct DC_Context *ctx,
+    const char *source,
+    unsigned num_args,
+    const char *const *arg_names,
+    unsigned long mask,
+    const double *values,
+    const char **out_error);
+
+/**
+ * @brief Compiles a calculation from bytecode.
+ *
+ * This gives the same calculation as compiling the source that the bytecode
+ * was generated from, without parsing any source. The bytecode is not
+ * changed, and can be freed afterwards. The calculation uses the options that
+ * are set on the context now, not the ones the bytecode was generated with.
+ * Calculations compiled from bytecode are never shared through
+ * DC_OPTION_CACHE.
+ *
+ * @param ctx The context to compile the calculation in.
+ * @param bc Bytecode from DC_CompileBytecode or DC_Compile.
+ * @param num_args Number of arguments to the calculation. This must be at
+ *   least the number of arguments that the bytecode was generated with.
+ * @return The new calculation, or NULL if the bytecode is not valid or the
+ *   library was built without bytecode support.
+ *
+ * @sa DC_CompileBytecode
+ */
+DC_CalculationPtr DC_API DC_CompileFromBytecode(struct DC_Context *ctx,
+    const struct DC_Bytecode *bc,
+    unsigned num_args);
+
+/**
+ * @brief Compiles a calculation and its gradient.
+ *
+ * The derivatives are found exactly from the source when it is compiled, so
+ * there are no finite differences. The value and all of the derivatives are
+ * compiled into a single calculation, so subexpressions that they share are
+ * only calculated once each time the gradient is run. For example, the
+ * derivative of sqrt(x) by x uses the value of sqrt(x) again.
+ *
+ * Parts of the calculation that do not use an argument have a derivative of
+ * exactly zero by that argument. Comparisons and floor have a derivative of
+ * zero. min, max, abs, and conditionals have the derivative of the value that
+ * they choose, and min and max choose the second operand for ties.
+ *
+ * Gradients are never shared through DC_OPTION_CACHE, and are compiled by the
+ * backend right away even when DC_OPTION_TIER_THRESHOLD is set.
+ *
+ * @param ctx The context to compile the gradient in.
+ * @param source Source code for the calculation, see DC_CompileCalculation.
+ * @param num_args Number of arguments to the calculation.
+ * @param arg_names Aliases for the arguments.
+ * @param out_error Receives the error message, or NULL if there is none.
+ * @return The new gradient, or NULL if there was an error.
+ *
+ * @sa DC_CalculateGradient
+ */
+DC_GradientPtr DC_API DC_CompileGradient(struct DC_Context *ctx,
+    const char *source,
+    unsigned num_args,
+    const char *const *arg_names,
+    const char **out_error);
+
 /**
  * @brief Frees the out_error from DC_Compile
  */
@@ -207,14 +602,119 @@ void DC_API DC_FreeError(const char *error);
 
 /**
  * @brief Frees a calculation
+ *
+ * If the calculation is shared through DC_OPTION_CACHE, this only releases one
+ * reference to it.
  */
 void DC_API DC_Free(struct DC_Context *ctx, struct DC_Calculation *);
 
+/**
+ * @brief Frees a gradient
+ */
+void DC_API DC_FreeGradient(struct DC_Context *ctx, struct DC_Gradient *grad);
+
 /**
  * @brief Runs a calculation.
  */
 float DC_API DC_Calculate(const struct DC_Calculation *, const float *args);
 
+/**
+ * @brief Runs a calculation with double precision arguments and result.
+ *
+ * @sa DC_OPTION_DOUBLE
+ */
+double DC_API DC_CalculateDouble(const struct DC_Calculation *calc,
+    const double *args);
+
+/**
+ * @brief Gets a function that runs a calculation directly.
+ *
+ * Calling the result with args is the same as DC_Calculate(calc, args), but
+ * calls straight into the generated code. The function is valid until the
+ * calculation is freed, and can be called while other calculations are
+ * compiled in the same context.
+ *
+ * @return The function, or NULL if the backend does not generate native code,
+ *     the calculation uses DC_OPTION_DOUBLE, or the calculation has not been
+ *     promoted yet with DC_OPTION_TIER_THRESHOLD.
+ */
+DC_NativeFunction DC_API DC_GetNativeFunction(const struct DC_Calculation *calc);
+
+/**
+ * @brief Runs a calculation on many sets of arguments.
+ *
+ * The arguments are in structure-of-arrays order, so argument a of set i is
+ * at args[(a * n) + i]. The result for set i is written to out[i].
+ *
+ * The JIT backends run four sets at once using packed SSE code. Calculations
+ * that use x87 sin/cos (when DC_OPTION_FAST_TRIG is zero) have no packed
+ * code, and run one set at a time instead. The results are the same as
+ * calling DC_Calculate for each set.
+ *
+ * @param calc The calculation to run.
+ * @param n Number of sets of arguments.
+ * @param args Arguments, with all n values of each argument together.
+ * @param out Receives the n results.
+ */
+void DC_API DC_CalculateBatch(const struct DC_Calculation *calc,
+    unsigned n,
+    const float *args,
+    float *out);
+
+/**
+ * @brief Runs a calculation and its gradient.
+ *
+ * @param grad The gradient to run.
+ * @param args Arguments to the calculation.
+ * @param out Receives the value of the calculation, and then the derivative by
+ *   each argument in order. This has room for one more than the number of
+ *   arguments.
+ */
+void DC_API DC_CalculateGradient(const struct DC_Gradient *grad,
+    const float *args,
+    float *out);
+
+/**
+ * @brief Runs a calculation and its gradient with double precision.
+ *
+ * @sa DC_CalculateGradient
+ * @sa DC_OPTION_DOUBLE
+ */
+void DC_API DC_CalculateGradientDouble(const struct DC_Gradient *grad,
+    const double *args,
+    double *out);
+
+/**
+ * @brief Finds where a calculation is zero as one of its arguments varies.
+ *
+ * This uses Newton's method with the exact derivative from the bytecode, and
+ * bisects when a Newton step would leave the bracket or converges slowly. The
+ * root is always found once the bracket contains a sign change, and the values
+ * are calculated with double precision.
+ *
+ * This is only available when the library is built with the root finder.
+ *
+ * @param bc Bytecode of the calculation, see DC_CompileBytecode.
+ * @param arg_num The argument to solve for.
+ * @param args Arguments to the calculation. The element for @p arg_num is
+ *   ignored.
+ * @param low One end of the bracket to search.
+ * @param high The other end of the bracket to search.
+ * @param tolerance The root is found once the last step is no larger than
+ *   this.
+ * @param out_root Receives the root, or NaN if no root was found.
+ * @return Non-zero if a root was found, or zero if the calculation does not
+ *   change sign between @p low and @p high or did not converge after 100
+ *   iterations.
+ */
+int DC_API DC_FindRoot(const struct DC_Bytecode *bc,
+    unsigned arg_num,
+    const float *args,
+    float low,
+    float high,
+    float tolerance,
+    float *out_root);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
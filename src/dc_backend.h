@@ -21,15 +21,34 @@ struct DC_X_Context;
 struct DC_X_Calculation;
 struct DC_X_CalculationBuilder;
 
+/* Same as DC_NativeFunction. */
+typedef float (*DC_X_NativeFunction)(const float *args);
+
 struct DC_X_Context *DC_X_CreateContext(void);
 void DC_X_FreeContext(struct DC_X_Context *ctx);
 
+/* Returns non-zero if the option is supported by the backend. */
+int DC_X_SetOption(struct DC_X_Context *ctx, int option, unsigned value);
+
+/* Returns the value of an option, or zero if it is not supported. */
+unsigned DC_X_GetOption(const struct DC_X_Context *ctx, int option);
+
 struct DC_X_CalculationBuilder *DC_X_CreateCalculationBuilder(
     struct DC_X_Context *ctx);
 
+/* Changes an option for a single builder, which starts with the context's
+ * options. This must be done before anything is built. Returns non-zero if the
+ * option is supported by the backend. */
+int DC_X_SetBuilderOption(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    int option,
+    unsigned value);
+
+/* Immediates are always given as doubles. Backends using single precision
+ * convert them when building. */
 void DC_X_BuildPushImmediate(struct DC_X_Context *ctx,
     struct DC_X_CalculationBuilder *bld,
-    float value);
+    double value);
 
 void DC_X_BuildPushArg(struct DC_X_Context *ctx,
     struct DC_X_CalculationBuilder *bld,
@@ -47,9 +66,72 @@ void DC_X_BuildMul(struct DC_X_Context *ctx,
 void DC_X_BuildDiv(struct DC_X_Context *ctx,
     struct DC_X_CalculationBuilder *bld);
 
+/* Raises the second value on the stack to the power of the top. Integer
+ * exponents are expanded into multiplications before reaching the backend,
+ * so the JIT only needs to support positive bases. */
+void DC_X_BuildPow(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld);
+
+void DC_X_BuildAtan2(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld);
+
+void DC_X_BuildMin(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld);
+
+void DC_X_BuildMax(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld);
+
+/* Comparisons push 1.0 if the second value on the stack compares true with the
+ * top, and 0.0 otherwise. Comparisons with NaN are false, except NotEqual. */
+void DC_X_BuildLess(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld);
+
+void DC_X_BuildLessEqual(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld);
+
+void DC_X_BuildEqual(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld);
+
+void DC_X_BuildNotEqual(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld);
+
+/* Pops the condition from the top of the stack and then the value for a zero
+ * condition, and leaves the third value if the condition was not zero. A NaN
+ * condition is not zero. */
+void DC_X_BuildSelect(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld);
+
 void DC_X_BuildPop(struct DC_X_Context *ctx,
     struct DC_X_CalculationBuilder *bld);
 
+/* Pushes a copy of the top of the stack. */
+void DC_X_BuildDup(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld);
+
+/* Temporaries hold values that are used more than once in a calculation.
+ * DC_X_BuildReserveTemps is called before anything else is built if the
+ * calculation uses any temporaries. */
+void DC_X_BuildReserveTemps(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned short num_temps);
+
+/* Copies the top of the stack into a temporary, without popping it. */
+void DC_X_BuildStoreTemp(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned short temp);
+
+void DC_X_BuildPushTemp(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned short temp);
+
+/* Copies the top of the stack into an argument, without popping it. This gives
+ * a calculation more than one result, and the calculation must then be run
+ * with arguments that can be written and that have room for the stored
+ * arguments. A stored argument is never read by the calculation. */
+void DC_X_BuildStoreArg(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned short arg_num);
+
 void DC_X_BuildSin(struct DC_X_Context *ctx,
     struct DC_X_CalculationBuilder *bld);
 
@@ -59,6 +141,21 @@ void DC_X_BuildCos(struct DC_X_Context *ctx,
 void DC_X_BuildSqrt(struct DC_X_Context *ctx,
     struct DC_X_CalculationBuilder *bld);
 
+void DC_X_BuildTan(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld);
+
+void DC_X_BuildExp(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld);
+
+void DC_X_BuildLog(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld);
+
+void DC_X_BuildAbs(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld);
+
+void DC_X_BuildFloor(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld);
+
 void DC_X_AbandonCalculation(struct DC_X_Context *ctx,
     struct DC_X_CalculationBuilder *bld);
 
@@ -78,6 +175,38 @@ void DC_X_BuildDivArg(struct DC_X_Context *ctx,
     struct DC_X_CalculationBuilder *bld,
     unsigned short arg);
 
+void DC_X_BuildPowArg(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned short arg);
+
+void DC_X_BuildAtan2Arg(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned short arg);
+
+void DC_X_BuildMinArg(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned short arg);
+
+void DC_X_BuildMaxArg(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned short arg);
+
+void DC_X_BuildLessArg(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned short arg);
+
+void DC_X_BuildLessEqualArg(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned short arg);
+
+void DC_X_BuildEqualArg(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned short arg);
+
+void DC_X_BuildNotEqualArg(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned short arg);
+
 void DC_X_BuildSinArg(struct DC_X_Context *ctx,
     struct DC_X_CalculationBuilder *bld,
     unsigned short arg);
@@ -90,21 +219,73 @@ void DC_X_BuildSqrtArg(struct DC_X_Context *ctx,
     struct DC_X_CalculationBuilder *bld,
     unsigned short arg);
 
+void DC_X_BuildTanArg(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned short arg);
+
+void DC_X_BuildExpArg(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned short arg);
+
+void DC_X_BuildLogArg(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned short arg);
+
+void DC_X_BuildAbsArg(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned short arg);
+
+void DC_X_BuildFloorArg(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned short arg);
+
 void DC_X_BuildAddImm(struct DC_X_Context *ctx,
     struct DC_X_CalculationBuilder *bld,
-    float imm);
+    double imm);
 
 void DC_X_BuildSubImm(struct DC_X_Context *ctx,
     struct DC_X_CalculationBuilder *bld,
-    float imm);
+    double imm);
 
 void DC_X_BuildMulImm(struct DC_X_Context *ctx,
     struct DC_X_CalculationBuilder *bld,
-    float imm);
+    double imm);
 
 void DC_X_BuildDivImm(struct DC_X_Context *ctx,
     struct DC_X_CalculationBuilder *bld,
-    float imm);
+    double imm);
+
+void DC_X_BuildPowImm(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    double imm);
+
+void DC_X_BuildAtan2Imm(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    double imm);
+
+void DC_X_BuildMinImm(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    double imm);
+
+void DC_X_BuildMaxImm(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    double imm);
+
+void DC_X_BuildLessImm(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    double imm);
+
+void DC_X_BuildLessEqualImm(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    double imm);
+
+void DC_X_BuildEqualImm(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    double imm);
+
+void DC_X_BuildNotEqualImm(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    double imm);
 
 struct DC_X_Calculation *DC_X_FinalizeCalculation(struct DC_X_Context *ctx,
     struct DC_X_CalculationBuilder *bld);
@@ -113,6 +294,18 @@ void DC_X_Free(struct DC_X_Context *ctx, struct DC_X_Calculation *calc);
 
 float DC_X_Calculate(const struct DC_X_Calculation *calc, const float *args);
 
+double DC_X_CalculateDouble(const struct DC_X_Calculation *calc,
+    const double *args);
+
+/* Returns NULL if the backend cannot create native functions. */
+DC_X_NativeFunction DC_X_GetNativeFunction(const struct DC_X_Calculation *calc);
+
+/* Argument a for set i is args[(a * n) + i], see DC_CalculateBatch. */
+void DC_X_CalculateBatch(const struct DC_X_Calculation *calc,
+    unsigned n,
+    const float *args,
+    float *out);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -6,6 +6,8 @@
 
 #include "dc_bc.h"
 #include "dc_bytecode.hpp"
+#include "dc_interpreter.hpp"
+#include "dc_ir.h"
 
 // Interface for the bytecode object to be called from C.
 //
@@ -22,7 +24,7 @@ void DC_BC_FreeBytecode(struct DC_Bytecode *bc){
     delete (DC::Bytecode::Bytecode*)bc;
 }
 
-void DC_BC_BuildPushImmediate(struct DC_Bytecode *bc, float value){
+void DC_BC_BuildPushImmediate(struct DC_Bytecode *bc, double value){
     ((DC::Bytecode::Bytecode*)bc)->writeImmediate(value);
 }
 
@@ -34,6 +36,26 @@ void DC_BC_BuildPop(struct DC_Bytecode *bc){
     ((DC::Bytecode::Bytecode*)bc)->writeUnary<DC::Bytecode::ePop>();
 }
 
+void DC_BC_BuildDup(struct DC_Bytecode *bc){
+    ((DC::Bytecode::Bytecode*)bc)->writeUnary<DC::Bytecode::eDup>();
+}
+
+void DC_BC_BuildSelect(struct DC_Bytecode *bc){
+    ((DC::Bytecode::Bytecode*)bc)->writeSelect();
+}
+
+void DC_BC_BuildReserveTemps(struct DC_Bytecode *bc, unsigned short num_temps){
+    ((DC::Bytecode::Bytecode*)bc)->reserveTemps(num_temps);
+}
+
+void DC_BC_BuildStoreTemp(struct DC_Bytecode *bc, unsigned short temp){
+    ((DC::Bytecode::Bytecode*)bc)->writeStoreTemp(temp);
+}
+
+void DC_BC_BuildPushTemp(struct DC_Bytecode *bc, unsigned short temp){
+    ((DC::Bytecode::Bytecode*)bc)->writePushTemp(temp);
+}
+
 #define DC_BC_BINARY_OP(NAME) \
 void DC_BC_Build ## NAME(struct DC_Bytecode *bc){ \
     ((DC::Bytecode::Bytecode*)bc)->writeBinary<DC::Bytecode::e ## NAME>(); \
@@ -41,7 +63,7 @@ void DC_BC_Build ## NAME(struct DC_Bytecode *bc){ \
 void DC_BC_Build ## NAME ## Arg(struct DC_Bytecode *bc, unsigned short arg){ \
     ((DC::Bytecode::Bytecode*)bc)->writeBinaryArgument<DC::Bytecode::e ## NAME>(arg); \
 } \
-void DC_BC_Build ## NAME ## Imm(struct DC_Bytecode *bc, float imm){ \
+void DC_BC_Build ## NAME ## Imm(struct DC_Bytecode *bc, double imm){ \
     ((DC::Bytecode::Bytecode*)bc)->writeBinaryImmediate<DC::Bytecode::e ## NAME>(imm); \
 }
 
@@ -49,6 +71,14 @@ DC_BC_BINARY_OP(Add)
 DC_BC_BINARY_OP(Sub)
 DC_BC_BINARY_OP(Div)
 DC_BC_BINARY_OP(Mul)
+DC_BC_BINARY_OP(Pow)
+DC_BC_BINARY_OP(Atan2)
+DC_BC_BINARY_OP(Min)
+DC_BC_BINARY_OP(Max)
+DC_BC_BINARY_OP(Less)
+DC_BC_BINARY_OP(LessEqual)
+DC_BC_BINARY_OP(Equal)
+DC_BC_BINARY_OP(NotEqual)
 
 #define DC_BC_UNARY_OP(NAME) \
 void DC_BC_Build ## NAME(struct DC_Bytecode *bc){ \
@@ -61,3 +91,175 @@ void DC_BC_Build ## NAME ## Arg(struct DC_Bytecode *bc, unsigned short arg){ \
 DC_BC_UNARY_OP(Sin)
 DC_BC_UNARY_OP(Cos)
 DC_BC_UNARY_OP(Sqrt)
+DC_BC_UNARY_OP(Tan)
+DC_BC_UNARY_OP(Exp)
+DC_BC_UNARY_OP(Log)
+DC_BC_UNARY_OP(Abs)
+DC_BC_UNARY_OP(Floor)
+
+float DC_BC_Calculate(const struct DC_Bytecode *bc,
+    int use_double,
+    const float *args){
+    const DC::Bytecode::Bytecode &code = *(const DC::Bytecode::Bytecode*)bc;
+    if(use_double)
+        return static_cast<float>(DC::Bytecode::RunLocal<double>(code, args));
+    else
+        return DC::Bytecode::RunLocal<float>(code, args);
+}
+
+double DC_BC_CalculateDouble(const struct DC_Bytecode *bc,
+    int use_double,
+    const double *args){
+    const DC::Bytecode::Bytecode &code = *(const DC::Bytecode::Bytecode*)bc;
+    if(use_double)
+        return DC::Bytecode::RunLocal<double>(code, args);
+    else
+        return DC::Bytecode::RunLocal<float>(code, args);
+}
+
+void DC_BC_CalculateBatch(const struct DC_Bytecode *bc,
+    int use_double,
+    unsigned n,
+    const float *args,
+    float *out){
+    const DC::Bytecode::Bytecode &code = *(const DC::Bytecode::Bytecode*)bc;
+    if(use_double)
+        DC::Bytecode::RunBatch<double>(code, n, args, out);
+    else
+        DC::Bytecode::RunBatch<float>(code, n, args, out);
+}
+
+static enum DC_IR_Op dc_bc_binary_ir_op(DC::Bytecode::BinaryType op){
+    switch(op){
+        case DC::Bytecode::eAdd: return eIRAdd;
+        case DC::Bytecode::eSub: return eIRSub;
+        case DC::Bytecode::eDiv: return eIRDiv;
+        case DC::Bytecode::eMul: return eIRMul;
+        case DC::Bytecode::ePow: return eIRPow;
+        case DC::Bytecode::eAtan2: return eIRAtan2;
+        case DC::Bytecode::eMin: return eIRMin;
+        case DC::Bytecode::eMax: return eIRMax;
+        case DC::Bytecode::eLess: return eIRLess;
+        case DC::Bytecode::eLessEqual: return eIRLessEqual;
+        case DC::Bytecode::eEqual: return eIREqual;
+        case DC::Bytecode::eNotEqual: return eIRNotEqual;
+    }
+    // Not a valid op, which the caller checks for.
+    return eIRImmediate;
+}
+
+static enum DC_IR_Op dc_bc_unary_ir_op(DC::Bytecode::UnaryType op){
+    switch(op){
+        case DC::Bytecode::eSin: return eIRSin;
+        case DC::Bytecode::eCos: return eIRCos;
+        case DC::Bytecode::eSqrt: return eIRSqrt;
+        case DC::Bytecode::eTan: return eIRTan;
+        case DC::Bytecode::eExp: return eIRExp;
+        case DC::Bytecode::eLog: return eIRLog;
+        case DC::Bytecode::eAbs: return eIRAbs;
+        case DC::Bytecode::eFloor: return eIRFloor;
+        case DC::Bytecode::ePop: // Handled by the caller
+        case DC::Bytecode::eDup:
+            break;
+    }
+    return eIRImmediate;
+}
+
+// Runs the bytecode on a stack of IR nodes instead of values. Temporaries
+// hold the node that was stored in them.
+int DC_BC_ToIR(const struct DC_Bytecode *bc,
+    unsigned num_args,
+    struct DC_IR *ir,
+    unsigned *out_root){
+    
+    const DC::Bytecode::Bytecode &code = *(const DC::Bytecode::Bytecode*)bc;
+    DC::Bytecode::Bytecode::iterator iter = code.begin(), end = code.end();
+    const unsigned no_node = ~0u;
+    std::vector<unsigned> stack, temps(code.numTemps(), no_node);
+    
+    while(iter != end){
+        switch(iter.opType()){
+            case DC::Bytecode::eImmediate:
+                stack.push_back(DC_IR_AddImmediate(ir, iter.readImmediate()));
+                continue;
+            case DC::Bytecode::eArgument:
+                {
+                    const unsigned short arg_num = iter.readArgument();
+                    if(arg_num >= num_args)
+                        return 0;
+                    stack.push_back(DC_IR_AddArgument(ir, arg_num));
+                }
+                continue;
+            case DC::Bytecode::eStoreTemp:
+                {
+                    const unsigned short temp = iter.readTemp();
+                    if(temp >= temps.size() || stack.empty())
+                        return 0;
+                    temps[temp] = stack.back();
+                }
+                continue;
+            case DC::Bytecode::ePushTemp:
+                {
+                    const unsigned short temp = iter.readTemp();
+                    if(temp >= temps.size() || temps[temp] == no_node)
+                        return 0;
+                    stack.push_back(temps[temp]);
+                }
+                continue;
+            case DC::Bytecode::eUnary:
+                {
+                    const DC::Bytecode::UnaryType op = iter.readUnaryOp();
+                    if(stack.empty())
+                        return 0;
+                    if(op == DC::Bytecode::ePop){
+                        stack.pop_back();
+                    }
+                    else if(op == DC::Bytecode::eDup){
+                        const unsigned node = stack.back();
+                        stack.push_back(node);
+                    }
+                    else{
+                        const enum DC_IR_Op ir_op = dc_bc_unary_ir_op(op);
+                        if(ir_op == eIRImmediate)
+                            return 0;
+                        stack.back() = DC_IR_AddUnary(ir, ir_op, stack.back());
+                    }
+                }
+                continue;
+            case DC::Bytecode::eBinary:
+                {
+                    const enum DC_IR_Op ir_op =
+                        dc_bc_binary_ir_op(iter.readBinaryOp());
+                    if(ir_op == eIRImmediate || stack.size() < 2)
+                        return 0;
+                    const unsigned b = stack.back();
+                    stack.pop_back();
+                    stack.back() = DC_IR_AddBinary(ir, ir_op, stack.back(), b);
+                }
+                continue;
+            case DC::Bytecode::eSelect:
+                iter.readSelect();
+                if(stack.size() < 3)
+                    return 0;
+                {
+                    const unsigned condition = stack.back();
+                    stack.pop_back();
+                    const unsigned if_zero = stack.back();
+                    stack.pop_back();
+                    stack.back() =
+                        DC_IR_AddSelect(ir, condition, stack.back(), if_zero);
+                }
+                continue;
+            case DC::Bytecode::eStoreArg:
+                // Bytecode with more than one result has no single root.
+                return 0;
+        }
+        // Not a valid op type.
+        return 0;
+    }
+    
+    if(stack.size() != 1)
+        return 0;
+    out_root[0] = stack.back();
+    return 1;
+}
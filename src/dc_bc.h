@@ -18,13 +18,14 @@ extern "C" {
 #endif
 
 struct DC_Bytecode;
+struct DC_IR;
 
 /* Note that in the dummied backend, this will return NULL. */
 struct DC_Bytecode *DC_BC_CreateBytecode(void);
 
 void DC_BC_FreeBytecode(struct DC_Bytecode *bc);
 
-void DC_BC_BuildPushImmediate(struct DC_Bytecode *bc, float value);
+void DC_BC_BuildPushImmediate(struct DC_Bytecode *bc, double value);
 
 void DC_BC_BuildPushArg(struct DC_Bytecode *bc, unsigned short arg_num);
 
@@ -36,14 +37,51 @@ void DC_BC_BuildMul(struct DC_Bytecode *bc);
 
 void DC_BC_BuildDiv(struct DC_Bytecode *bc);
 
+void DC_BC_BuildPow(struct DC_Bytecode *bc);
+
+void DC_BC_BuildAtan2(struct DC_Bytecode *bc);
+
+void DC_BC_BuildMin(struct DC_Bytecode *bc);
+
+void DC_BC_BuildMax(struct DC_Bytecode *bc);
+
+void DC_BC_BuildLess(struct DC_Bytecode *bc);
+
+void DC_BC_BuildLessEqual(struct DC_Bytecode *bc);
+
+void DC_BC_BuildEqual(struct DC_Bytecode *bc);
+
+void DC_BC_BuildNotEqual(struct DC_Bytecode *bc);
+
+void DC_BC_BuildSelect(struct DC_Bytecode *bc);
+
 void DC_BC_BuildPop(struct DC_Bytecode *bc);
 
+void DC_BC_BuildDup(struct DC_Bytecode *bc);
+
+/* See DC_X_BuildReserveTemps */
+void DC_BC_BuildReserveTemps(struct DC_Bytecode *bc, unsigned short num_temps);
+
+void DC_BC_BuildStoreTemp(struct DC_Bytecode *bc, unsigned short temp);
+
+void DC_BC_BuildPushTemp(struct DC_Bytecode *bc, unsigned short temp);
+
 void DC_BC_BuildSin(struct DC_Bytecode *bc);
 
 void DC_BC_BuildCos(struct DC_Bytecode *bc);
 
 void DC_BC_BuildSqrt(struct DC_Bytecode *bc);
 
+void DC_BC_BuildTan(struct DC_Bytecode *bc);
+
+void DC_BC_BuildExp(struct DC_Bytecode *bc);
+
+void DC_BC_BuildLog(struct DC_Bytecode *bc);
+
+void DC_BC_BuildAbs(struct DC_Bytecode *bc);
+
+void DC_BC_BuildFloor(struct DC_Bytecode *bc);
+
 void DC_BC_BuildAddArg(struct DC_Bytecode *bc, unsigned short arg);
 
 void DC_BC_BuildSubArg(struct DC_Bytecode *bc, unsigned short arg);
@@ -52,19 +90,87 @@ void DC_BC_BuildMulArg(struct DC_Bytecode *bc, unsigned short arg);
 
 void DC_BC_BuildDivArg(struct DC_Bytecode *bc, unsigned short arg);
 
+void DC_BC_BuildPowArg(struct DC_Bytecode *bc, unsigned short arg);
+
+void DC_BC_BuildAtan2Arg(struct DC_Bytecode *bc, unsigned short arg);
+
+void DC_BC_BuildMinArg(struct DC_Bytecode *bc, unsigned short arg);
+
+void DC_BC_BuildMaxArg(struct DC_Bytecode *bc, unsigned short arg);
+
+void DC_BC_BuildLessArg(struct DC_Bytecode *bc, unsigned short arg);
+
+void DC_BC_BuildLessEqualArg(struct DC_Bytecode *bc, unsigned short arg);
+
+void DC_BC_BuildEqualArg(struct DC_Bytecode *bc, unsigned short arg);
+
+void DC_BC_BuildNotEqualArg(struct DC_Bytecode *bc, unsigned short arg);
+
 void DC_BC_BuildSinArg(struct DC_Bytecode *bc, unsigned short arg);
 
 void DC_BC_BuildCosArg(struct DC_Bytecode *bc, unsigned short arg);
 
 void DC_BC_BuildSqrtArg(struct DC_Bytecode *bc, unsigned short arg);
 
-void DC_BC_BuildAddImm(struct DC_Bytecode *bc, float imm);
+void DC_BC_BuildTanArg(struct DC_Bytecode *bc, unsigned short arg);
+
+void DC_BC_BuildExpArg(struct DC_Bytecode *bc, unsigned short arg);
+
+void DC_BC_BuildLogArg(struct DC_Bytecode *bc, unsigned short arg);
+
+void DC_BC_BuildAbsArg(struct DC_Bytecode *bc, unsigned short arg);
+
+void DC_BC_BuildFloorArg(struct DC_Bytecode *bc, unsigned short arg);
+
+void DC_BC_BuildAddImm(struct DC_Bytecode *bc, double imm);
+
+void DC_BC_BuildSubImm(struct DC_Bytecode *bc, double imm);
+
+void DC_BC_BuildMulImm(struct DC_Bytecode *bc, double imm);
+
+void DC_BC_BuildDivImm(struct DC_Bytecode *bc, double imm);
+
+void DC_BC_BuildPowImm(struct DC_Bytecode *bc, double imm);
+
+void DC_BC_BuildAtan2Imm(struct DC_Bytecode *bc, double imm);
+
+void DC_BC_BuildMinImm(struct DC_Bytecode *bc, double imm);
+
+void DC_BC_BuildMaxImm(struct DC_Bytecode *bc, double imm);
+
+void DC_BC_BuildLessImm(struct DC_Bytecode *bc, double imm);
+
+void DC_BC_BuildLessEqualImm(struct DC_Bytecode *bc, double imm);
+
+void DC_BC_BuildEqualImm(struct DC_Bytecode *bc, double imm);
+
+void DC_BC_BuildNotEqualImm(struct DC_Bytecode *bc, double imm);
+
+/* Runs bytecode with the interpreter. use_double selects the precision that
+ * the values are calculated with, see DC_OPTION_DOUBLE. The dummied backend
+ * always returns zero. */
+float DC_BC_Calculate(const struct DC_Bytecode *bc,
+    int use_double,
+    const float *args);
 
-void DC_BC_BuildSubImm(struct DC_Bytecode *bc, float imm);
+double DC_BC_CalculateDouble(const struct DC_Bytecode *bc,
+    int use_double,
+    const double *args);
 
-void DC_BC_BuildMulImm(struct DC_Bytecode *bc, float imm);
+/* Argument a for set i is args[(a * n) + i], see DC_CalculateBatch. */
+void DC_BC_CalculateBatch(const struct DC_Bytecode *bc,
+    int use_double,
+    unsigned n,
+    const float *args,
+    float *out);
 
-void DC_BC_BuildDivImm(struct DC_Bytecode *bc, float imm);
+/* Adds the expression in bytecode to ir, and sets out_root to it. Returns
+ * zero if the bytecode is not valid, including when it uses an argument that
+ * is not less than num_args. The dummied backend always returns zero. */
+int DC_BC_ToIR(const struct DC_Bytecode *bc,
+    unsigned num_args,
+    struct DC_IR *ir,
+    unsigned *out_root);
 
 #ifdef __cplusplus
 } // extern "C"
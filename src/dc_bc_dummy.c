@@ -5,6 +5,7 @@
 #include "dc_bc.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 /* Dummy implementation of bytecode for when the library is compiled without
  * the interpreter or root-finding support (or when C++ is not available).
@@ -14,7 +15,7 @@ struct DC_Bytecode *DC_BC_CreateBytecode(void){ return NULL; }
 
 void DC_BC_FreeBytecode(struct DC_Bytecode *bc) { (void)bc; }
 
-void DC_BC_BuildPushImmediate(struct DC_Bytecode *bc, float value) {
+void DC_BC_BuildPushImmediate(struct DC_Bytecode *bc, double value) {
     (void)bc; (void)value;
 }
 
@@ -23,6 +24,20 @@ void DC_BC_BuildPushArg(struct DC_Bytecode *bc, unsigned short arg_num) {
 }
 
 void DC_BC_BuildPop(struct DC_Bytecode *bc) { (void)bc; }
+void DC_BC_BuildDup(struct DC_Bytecode *bc) { (void)bc; }
+void DC_BC_BuildSelect(struct DC_Bytecode *bc) { (void)bc; }
+
+void DC_BC_BuildReserveTemps(struct DC_Bytecode *bc, unsigned short n) {
+    (void)bc; (void)n;
+}
+
+void DC_BC_BuildStoreTemp(struct DC_Bytecode *bc, unsigned short temp) {
+    (void)bc; (void)temp;
+}
+
+void DC_BC_BuildPushTemp(struct DC_Bytecode *bc, unsigned short temp) {
+    (void)bc; (void)temp;
+}
 
 #define DC_BC_UNOP(NAME)\
 void DC_BC_Build ## NAME (struct DC_Bytecode *bc) { (void)bc; } \
@@ -32,7 +47,7 @@ void DC_BC_Build ## NAME ## Arg(struct DC_Bytecode *bc, unsigned short a) { \
 
 #define DC_BC_BINOP(NAME)\
 DC_BC_UNOP(NAME) \
-void DC_BC_Build ## NAME ## Imm(struct DC_Bytecode *bc, float x) { \
+void DC_BC_Build ## NAME ## Imm(struct DC_Bytecode *bc, double x) { \
     (void)bc; (void)x; \
 }
 
@@ -40,7 +55,51 @@ DC_BC_BINOP(Add)
 DC_BC_BINOP(Sub)
 DC_BC_BINOP(Mul)
 DC_BC_BINOP(Div)
+DC_BC_BINOP(Pow)
+DC_BC_BINOP(Atan2)
+DC_BC_BINOP(Min)
+DC_BC_BINOP(Max)
+DC_BC_BINOP(Less)
+DC_BC_BINOP(LessEqual)
+DC_BC_BINOP(Equal)
+DC_BC_BINOP(NotEqual)
 
 DC_BC_UNOP(Cos)
 DC_BC_UNOP(Sin)
 DC_BC_UNOP(Sqrt)
+DC_BC_UNOP(Tan)
+DC_BC_UNOP(Exp)
+DC_BC_UNOP(Log)
+DC_BC_UNOP(Abs)
+DC_BC_UNOP(Floor)
+
+float DC_BC_Calculate(const struct DC_Bytecode *bc,
+    int use_double,
+    const float *args) {
+    (void)bc; (void)use_double; (void)args;
+    return 0.0f;
+}
+
+double DC_BC_CalculateDouble(const struct DC_Bytecode *bc,
+    int use_double,
+    const double *args) {
+    (void)bc; (void)use_double; (void)args;
+    return 0.0;
+}
+
+void DC_BC_CalculateBatch(const struct DC_Bytecode *bc,
+    int use_double,
+    unsigned n,
+    const float *args,
+    float *out) {
+    (void)bc; (void)use_double; (void)args;
+    memset(out, 0, sizeof(float) * n);
+}
+
+int DC_BC_ToIR(const struct DC_Bytecode *bc,
+    unsigned num_args,
+    struct DC_IR *ir,
+    unsigned *out_root) {
+    (void)bc; (void)num_args; (void)ir; (void)out_root;
+    return 0;
+}
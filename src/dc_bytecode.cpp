@@ -6,6 +6,8 @@
 
 #include "dc_bytecode.hpp"
 
+#include <assert.h>
+
 typedef DC::Bytecode::Bytecode::byte byte;
 
 namespace DC {
@@ -33,16 +35,38 @@ static inline void write<byte>(std::vector<byte> &vector, byte that){
 
 namespace Bytecode {
 
-void Bytecode::writeImmediate(float imm){
+void Bytecode::writeImmediate(double imm){
+    push();
     write<byte>(m_bytecode, static_cast<byte>(eImmediate));
-    write<float>(m_bytecode, imm);
+    write<double>(m_bytecode, imm);
 }
 
 void Bytecode::writeArgument(unsigned short arg){
+    push();
     write<byte>(m_bytecode, static_cast<byte>(eArgument));
     write<unsigned short>(m_bytecode, arg);
 }
 
+void Bytecode::writeStoreTemp(unsigned short temp){
+    assert(temp < m_num_temps);
+    assert(m_depth != 0);
+    write<byte>(m_bytecode, static_cast<byte>(eStoreTemp));
+    write<unsigned short>(m_bytecode, temp);
+}
+
+void Bytecode::writePushTemp(unsigned short temp){
+    assert(temp < m_num_temps);
+    push();
+    write<byte>(m_bytecode, static_cast<byte>(ePushTemp));
+    write<unsigned short>(m_bytecode, temp);
+}
+
+void Bytecode::writeStoreArg(unsigned short arg){
+    assert(m_depth != 0);
+    write<byte>(m_bytecode, static_cast<byte>(eStoreArg));
+    write<unsigned short>(m_bytecode, arg);
+}
+
 BinaryType Bytecode::iterator::readBinaryOp(){
     return static_cast<BinaryType>((*m_iter++) >> 4);
 }
@@ -51,9 +75,9 @@ UnaryType Bytecode::iterator::readUnaryOp(){
     return static_cast<UnaryType>((*m_iter++) >> 4);
 }
 
-float Bytecode::iterator::readImmediate(){
+double Bytecode::iterator::readImmediate(){
     m_iter++;
-    return read<float>(m_iter);
+    return read<double>(m_iter);
 }
 
 unsigned short Bytecode::iterator::readArgument(){
@@ -61,6 +85,15 @@ unsigned short Bytecode::iterator::readArgument(){
     return read<unsigned short>(m_iter);
 }
 
+unsigned short Bytecode::iterator::readTemp(){
+    m_iter++;
+    return read<unsigned short>(m_iter);
+}
+
+void Bytecode::iterator::readSelect(){
+    m_iter++;
+}
+
 Bytecode::iterator Bytecode::begin() const{
     return iterator(m_bytecode.begin());
 }
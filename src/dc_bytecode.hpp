@@ -19,8 +19,16 @@
 //
 // Argument pushes are converted to argument indices at compile time, so all
 // argument values are index-only.
+//
+// Temporaries hold values that are used more than once. They are numbered
+// like arguments, and the interpreter keeps them at the bottom of its stack.
+//
+// The depth of the stack is tracked as the code is written, so the
+// interpreter knows how much stack it needs before it starts and does not
+// check each op.
 
 #include <string.h>
+#include <assert.h>
 #include <vector>
 #include <stack>
 
@@ -35,7 +43,11 @@ enum OpType {
     eArgument,
     eImmediate,
     eUnary,
-    eBinary
+    eBinary,
+    eStoreTemp, // Copies the top of the stack into a temporary
+    ePushTemp,
+    eSelect, // Pops a condition and two values, and pushes one of the values
+    eStoreArg // Copies the top of the stack into an argument
 };
 
 // Binary operation type.
@@ -43,7 +55,15 @@ enum BinaryType {
     eAdd,
     eSub,
     eDiv,
-    eMul
+    eMul,
+    ePow,
+    eAtan2,
+    eMin,
+    eMax,
+    eLess, // Comparisons push 1.0 if true, or 0.0 if false
+    eLessEqual,
+    eEqual,
+    eNotEqual
 };
 
 // Unary operation type.
@@ -51,7 +71,13 @@ enum UnaryType {
     eSin,
     eCos,
     eSqrt,
-    ePop
+    eTan,
+    eExp,
+    eLog,
+    eAbs,
+    eFloor,
+    ePop,
+    eDup // Pushes a copy of the top of the stack
 };
 
 // Bytecode container.
@@ -61,6 +87,20 @@ public:
 
 private:
     std::vector<byte> m_bytecode;
+    unsigned short m_num_temps;
+    // Values on the stack after the code so far, and the most there have
+    // been. Neither includes the temporaries.
+    unsigned m_depth, m_max_depth;
+    
+    inline void push(){
+        if(++m_depth > m_max_depth)
+            m_max_depth = m_depth;
+    }
+    
+    inline void pop(unsigned n){
+        assert(m_depth >= n);
+        m_depth -= n;
+    }
     
     template<BinaryType OpType>
     static inline byte EncodeBinary(){
@@ -74,6 +114,11 @@ private:
     
 public:
     
+    Bytecode()
+      : m_num_temps(0)
+      , m_depth(0)
+      , m_max_depth(0){}
+    
     class iterator {
         std::vector<byte>::const_iterator m_iter;
         
@@ -107,22 +152,56 @@ public:
         
         UnaryType readUnaryOp();
         
-        float readImmediate();
+        // Immediates are stored as doubles, so that the same bytecode can be
+        // run at either precision.
+        double readImmediate();
         
         unsigned short readArgument();
+        
+        unsigned short readTemp();
+        
+        void readSelect();
     };
     
-    void writeImmediate(float imm);
+    void writeImmediate(double imm);
     
     void writeArgument(unsigned short arg);
     
+    inline void reserveTemps(unsigned short num_temps){
+        m_num_temps = num_temps;
+    }
+    
+    inline unsigned short numTemps() const { return m_num_temps; }
+    
+    inline unsigned depth() const { return m_depth; }
+    
+    // The number of values the interpreter needs room for, including the
+    // temporaries.
+    inline unsigned stackSize() const { return m_num_temps + m_max_depth; }
+    
+    void writeStoreTemp(unsigned short temp);
+    
+    void writePushTemp(unsigned short temp);
+    
+    // Stores are only used by calculations with more than one result, see
+    // DC_X_BuildStoreArg. The argument is read with readArgument.
+    void writeStoreArg(unsigned short arg);
+    
+    // The stack holds the value for a non-zero condition, the value for a
+    // zero condition, and then the condition on top.
+    inline void writeSelect(){
+        pop(2);
+        m_bytecode.push_back(static_cast<byte>(eSelect));
+    }
+    
     template<BinaryType OpType>
     inline void writeBinary(){
+        pop(1);
         m_bytecode.push_back(EncodeBinary<OpType>());
     }
     
     template<BinaryType OpType>
-    inline void writeBinaryImmediate(float imm){
+    inline void writeBinaryImmediate(double imm){
         writeImmediate(imm);
         writeBinary<OpType>();
     }
@@ -135,11 +214,17 @@ public:
     
     template<UnaryType OpType>
     inline void writeUnary(){
+        if(OpType == ePop)
+            pop(1);
+        else if(OpType == eDup)
+            push();
+        else
+            assert(m_depth != 0);
         m_bytecode.push_back(EncodeUnary<OpType>());
     }
     
     template<UnaryType OpType>
-    inline void writeUnaryImmediate(float imm){
+    inline void writeUnaryImmediate(double imm){
         writeImmediate(imm);
         writeUnary<OpType>();
     }
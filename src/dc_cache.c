@@ -0,0 +1,442 @@
+/* Copyright (c) 2018, Transnat Games
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "dc_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define DC_CACHE_INITIAL_BUCKETS 16
+
+/* The number of freed calculations a cache keeps by default. This can be
+ * changed per context with DC_OPTION_MAX_FREE_CACHED. */
+#ifndef DC_CACHE_DEFAULT_MAX_FREE
+#define DC_CACHE_DEFAULT_MAX_FREE 256
+#endif
+
+/* Files start with the magic, the version, the length of the tag and the tag,
+ * and the number of entries. Each entry is then the length of its key, the
+ * length of its data, the key, and the data. Numbers are four bytes, little
+ * endian. */
+#define DC_CACHE_MAGIC "DCJC"
+#define DC_CACHE_VERSION 1
+
+static unsigned dc_cache_hash_key(const char *key, unsigned long key_length){
+    unsigned long hash = 0, i;
+    for(i = 0; i < key_length; i++)
+        hash = (hash * 31) + (unsigned char)key[i];
+    return (unsigned)(hash ^ (hash >> 16));
+}
+
+static unsigned dc_cache_hash_calculation(const struct DC_Calculation *calc){
+    /* Hash the bytes of the pointer, since it may not fit in a long. */
+    const unsigned char *const bytes = (const unsigned char *)&calc;
+    unsigned long hash = 0;
+    unsigned i;
+    for(i = 0; i < sizeof(calc); i++)
+        hash = (hash * 31) + bytes[i];
+    return (unsigned)(hash ^ (hash >> 16));
+}
+
+void DC_Cache_Init(struct DC_Cache *cache){
+    cache->by_key = NULL;
+    cache->by_calculation = NULL;
+    cache->newest_free = NULL;
+    cache->oldest_free = NULL;
+    cache->num_buckets = 0;
+    cache->num_entries = 0;
+    cache->num_free = 0;
+    cache->max_free = DC_CACHE_DEFAULT_MAX_FREE;
+    cache->hits = 0;
+    cache->misses = 0;
+}
+
+void DC_Cache_Destroy(struct DC_Cache *cache){
+    unsigned i;
+    for(i = 0; i < cache->num_buckets; i++){
+        struct DC_CacheEntry *entry = cache->by_key[i];
+        while(entry != NULL){
+            struct DC_CacheEntry *const next = entry->next_by_key;
+            free(entry);
+            entry = next;
+        }
+    }
+    free(cache->by_key);
+    free(cache->by_calculation);
+}
+
+/* Doubles the number of buckets, and moves every entry into the new ones. */
+static void dc_cache_grow(struct DC_Cache *cache){
+    const unsigned num_buckets = (cache->num_buckets == 0) ?
+        DC_CACHE_INITIAL_BUCKETS : (cache->num_buckets << 1);
+    const unsigned mask = num_buckets - 1;
+    struct DC_CacheEntry **const by_key =
+        calloc(num_buckets, sizeof(struct DC_CacheEntry*));
+    struct DC_CacheEntry **const by_calculation =
+        calloc(num_buckets, sizeof(struct DC_CacheEntry*));
+    unsigned i;
+    
+    for(i = 0; i < cache->num_buckets; i++){
+        struct DC_CacheEntry *entry = cache->by_key[i];
+        while(entry != NULL){
+            struct DC_CacheEntry *const next = entry->next_by_key;
+            const unsigned n = entry->key_hash & mask;
+            entry->next_by_key = by_key[n];
+            by_key[n] = entry;
+            if(entry->calc != NULL){
+                const unsigned c =
+                    dc_cache_hash_calculation(entry->calc) & mask;
+                entry->next_by_calculation = by_calculation[c];
+                by_calculation[c] = entry;
+            }
+            entry = next;
+        }
+    }
+    
+    free(cache->by_key);
+    free(cache->by_calculation);
+    cache->by_key = by_key;
+    cache->by_calculation = by_calculation;
+    cache->num_buckets = num_buckets;
+}
+
+static struct DC_CacheEntry *dc_cache_lookup(const struct DC_Cache *cache,
+    const char *key,
+    unsigned long key_length){
+    
+    if(cache->num_buckets != 0){
+        const unsigned hash = dc_cache_hash_key(key, key_length);
+        struct DC_CacheEntry *entry =
+            cache->by_key[hash & (cache->num_buckets - 1)];
+        while(entry != NULL){
+            if(entry->key_hash == hash &&
+                entry->key_length == key_length &&
+                memcmp(DC_CACHE_ENTRY_KEY(entry), key, key_length) == 0){
+                
+                return entry;
+            }
+            entry = entry->next_by_key;
+        }
+    }
+    return NULL;
+}
+
+struct DC_CacheEntry *DC_Cache_Find(struct DC_Cache *cache,
+    const char *key,
+    unsigned long key_length){
+    
+    struct DC_CacheEntry *const entry =
+        dc_cache_lookup(cache, key, key_length);
+    if(entry != NULL)
+        cache->hits++;
+    else
+        cache->misses++;
+    return entry;
+}
+
+struct DC_CacheEntry *DC_Cache_Add(struct DC_Cache *cache,
+    const char *key,
+    unsigned long key_length,
+    const unsigned char *data,
+    unsigned long data_length){
+    
+    struct DC_CacheEntry *const entry =
+        malloc(sizeof(struct DC_CacheEntry) + key_length + data_length);
+    unsigned n;
+    
+    if(cache->num_entries >= cache->num_buckets)
+        dc_cache_grow(cache);
+    
+    memcpy(entry + 1, key, key_length);
+    memcpy((char*)(entry + 1) + key_length, data, data_length);
+    entry->calc = NULL;
+    entry->next_by_calculation = NULL;
+    entry->key_length = key_length;
+    entry->data_length = data_length;
+    entry->key_hash = dc_cache_hash_key(key, key_length);
+    entry->references = 0;
+    entry->loaded = 0;
+    entry->newer_free = NULL;
+    entry->older_free = NULL;
+    
+    n = entry->key_hash & (cache->num_buckets - 1);
+    entry->next_by_key = cache->by_key[n];
+    cache->by_key[n] = entry;
+    cache->num_entries++;
+    return entry;
+}
+
+/* Removes an entry from the free list. */
+static void dc_cache_unlink_free(struct DC_Cache *cache,
+    struct DC_CacheEntry *entry){
+    
+    if(entry->newer_free != NULL)
+        entry->newer_free->older_free = entry->older_free;
+    else
+        cache->newest_free = entry->older_free;
+    if(entry->older_free != NULL)
+        entry->older_free->newer_free = entry->newer_free;
+    else
+        cache->oldest_free = entry->newer_free;
+    entry->newer_free = NULL;
+    entry->older_free = NULL;
+    cache->num_free--;
+}
+
+/* Frees an entry with no calculation, removing it from the by_key table and
+ * from the free list. */
+static void dc_cache_remove(struct DC_Cache *cache,
+    struct DC_CacheEntry *entry){
+    
+    struct DC_CacheEntry **link =
+        cache->by_key + (entry->key_hash & (cache->num_buckets - 1));
+    assert(entry->calc == NULL);
+    while(link[0] != entry)
+        link = &(link[0]->next_by_key);
+    link[0] = entry->next_by_key;
+    if(!entry->loaded)
+        dc_cache_unlink_free(cache, entry);
+    cache->num_entries--;
+    free(entry);
+}
+
+/* Removes the least recently freed entries until there are at most max_free
+ * of them. */
+static void dc_cache_trim(struct DC_Cache *cache){
+    while(cache->num_free > cache->max_free)
+        dc_cache_remove(cache, cache->oldest_free);
+}
+
+void DC_Cache_Use(struct DC_Cache *cache,
+    struct DC_CacheEntry *entry,
+    struct DC_Calculation *calc){
+    
+    if(entry->calc == NULL){
+        const unsigned c =
+            dc_cache_hash_calculation(calc) & (cache->num_buckets - 1);
+        assert(entry->references == 0);
+        /* New entries from DC_Cache_Add are not in the free list yet. */
+        if(entry->newer_free != NULL || cache->newest_free == entry)
+            dc_cache_unlink_free(cache, entry);
+        entry->calc = calc;
+        entry->next_by_calculation = cache->by_calculation[c];
+        cache->by_calculation[c] = entry;
+    }
+    entry->references++;
+}
+
+int DC_Cache_Release(struct DC_Cache *cache, struct DC_Calculation *calc){
+    struct DC_CacheEntry **link, *entry;
+    if(cache->num_buckets == 0)
+        return 1;
+    
+    link = cache->by_calculation +
+        (dc_cache_hash_calculation(calc) & (cache->num_buckets - 1));
+    while(link[0] != NULL && link[0]->calc != calc)
+        link = &(link[0]->next_by_calculation);
+    
+    entry = link[0];
+    if(entry == NULL)
+        return 1;
+    assert(entry->references != 0);
+    if(--entry->references != 0)
+        return 0;
+    
+    /* This was the last reference. The entry keeps its data, so that the
+     * calculation can be made again without parsing it. */
+    link[0] = entry->next_by_calculation;
+    entry->next_by_calculation = NULL;
+    entry->calc = NULL;
+    if(!entry->loaded){
+        entry->older_free = cache->newest_free;
+        if(cache->newest_free != NULL)
+            cache->newest_free->newer_free = entry;
+        else
+            cache->oldest_free = entry;
+        cache->newest_free = entry;
+        cache->num_free++;
+        dc_cache_trim(cache);
+    }
+    return 1;
+}
+
+void DC_Cache_SetMaxFree(struct DC_Cache *cache, unsigned max_free){
+    cache->max_free = max_free;
+    dc_cache_trim(cache);
+}
+
+void DC_Cache_Clear(struct DC_Cache *cache){
+    unsigned i;
+    for(i = 0; i < cache->num_buckets; i++){
+        struct DC_CacheEntry *entry = cache->by_key[i];
+        while(entry != NULL){
+            struct DC_CacheEntry *const next = entry->next_by_key;
+            if(entry->calc == NULL)
+                dc_cache_remove(cache, entry);
+            entry = next;
+        }
+    }
+    assert(cache->num_free == 0);
+}
+
+static int dc_cache_write_int(FILE *file, unsigned long value){
+    unsigned char data[4];
+    unsigned i;
+    for(i = 0; i < 4; i++){
+        data[i] = (unsigned char)(value & 0xFF);
+        value >>= 8;
+    }
+    return fwrite(data, 4, 1, file) == 1;
+}
+
+static int dc_cache_read_int(FILE *file, unsigned long *out_value){
+    unsigned char data[4];
+    if(fread(data, 4, 1, file) != 1)
+        return 0;
+    out_value[0] = data[0] |
+        ((unsigned long)data[1] << 8) |
+        ((unsigned long)data[2] << 16) |
+        ((unsigned long)data[3] << 24);
+    return 1;
+}
+
+int DC_Cache_Save(const struct DC_Cache *cache,
+    const char *path,
+    const char *tag){
+    
+    const unsigned long tag_length = strlen(tag);
+    FILE *const file = fopen(path, "wb");
+    unsigned i;
+    int ok;
+    
+    if(file == NULL)
+        return 0;
+    
+    ok = fwrite(DC_CACHE_MAGIC, 4, 1, file) == 1 &&
+        dc_cache_write_int(file, DC_CACHE_VERSION) &&
+        dc_cache_write_int(file, tag_length) &&
+        fwrite(tag, 1, tag_length, file) == tag_length &&
+        dc_cache_write_int(file, cache->num_entries);
+    
+    for(i = 0; ok && i < cache->num_buckets; i++){
+        const struct DC_CacheEntry *entry = cache->by_key[i];
+        while(ok && entry != NULL){
+            const unsigned long size = entry->key_length + entry->data_length;
+            ok = dc_cache_write_int(file, entry->key_length) &&
+                dc_cache_write_int(file, entry->data_length) &&
+                fwrite(entry + 1, 1, size, file) == size;
+            entry = entry->next_by_key;
+        }
+    }
+    
+    if(fclose(file) != 0)
+        ok = 0;
+    return ok;
+}
+
+/* Reads the start of a file, and checks that it has the tag. */
+static int dc_cache_read_header(FILE *file,
+    const char *tag,
+    unsigned long *out_count){
+    
+    const unsigned long tag_length = strlen(tag);
+    unsigned long version, length, i;
+    char magic[4];
+    
+    if(fread(magic, 4, 1, file) != 1 ||
+        memcmp(magic, DC_CACHE_MAGIC, 4) != 0 ||
+        !dc_cache_read_int(file, &version) ||
+        version != DC_CACHE_VERSION ||
+        !dc_cache_read_int(file, &length) ||
+        length != tag_length){
+        
+        return 0;
+    }
+    for(i = 0; i < tag_length; i++){
+        if(getc(file) != (unsigned char)tag[i])
+            return 0;
+    }
+    return dc_cache_read_int(file, out_count);
+}
+
+/* Gets the number of bytes after the current position in a file. */
+static int dc_cache_remaining(FILE *file, unsigned long *out_remaining){
+    const long position = ftell(file);
+    long size;
+    if(position < 0 || fseek(file, 0, SEEK_END) != 0)
+        return 0;
+    size = ftell(file);
+    if(size < position || fseek(file, position, SEEK_SET) != 0)
+        return 0;
+    out_remaining[0] = (unsigned long)(size - position);
+    return 1;
+}
+
+int DC_Cache_Load(struct DC_Cache *cache,
+    const char *path,
+    const char *tag,
+    DC_Cache_Validator validator){
+    
+    FILE *const file = fopen(path, "rb");
+    unsigned long count, remaining, i, buffer_size = 0;
+    char *buffer = NULL;
+    int num_added = 0;
+    
+    if(file == NULL)
+        return -1;
+    if(!dc_cache_read_header(file, tag, &count) ||
+        !dc_cache_remaining(file, &remaining)){
+        
+        fclose(file);
+        return -1;
+    }
+    
+    for(i = 0; i < count; i++){
+        unsigned long key_length, data_length, size;
+        if(!dc_cache_read_int(file, &key_length) ||
+            !dc_cache_read_int(file, &data_length))
+            break;
+        
+        /* The lengths come from the file, so they may be anything. Checking
+         * them against the size of the file keeps the buffer reasonable. */
+        if(remaining < 8 ||
+            key_length > remaining - 8 ||
+            data_length > remaining - 8 - key_length)
+            break;
+        size = key_length + data_length;
+        remaining -= 8 + size;
+        
+        if(size > buffer_size){
+            char *const new_buffer = realloc(buffer, size);
+            if(new_buffer == NULL)
+                break;
+            buffer = new_buffer;
+            buffer_size = size;
+        }
+        if(size != 0 && fread(buffer, 1, size, file) != size)
+            break;
+        
+        if(validator(buffer,
+                key_length,
+                (const unsigned char *)buffer + key_length,
+                data_length) &&
+            dc_cache_lookup(cache, buffer, key_length) == NULL){
+            
+            DC_Cache_Add(cache,
+                buffer,
+                key_length,
+                (const unsigned char *)buffer + key_length,
+                data_length)->loaded = 1;
+            num_added++;
+        }
+    }
+    
+    free(buffer);
+    fclose(file);
+    return num_added;
+}
@@ -0,0 +1,125 @@
+/* Copyright (c) 2018, Transnat Games
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef LIBDCJIT_DC_CACHE_H
+#define LIBDCJIT_DC_CACHE_H
+#pragma once
+
+/* Cache of compiled calculations, for DC_OPTION_CACHE.
+ *
+ * Calculations are found by a key, which is made by the caller from everything
+ * that the compiled code depends on. Each entry also holds data that the
+ * caller can compile the calculation from again, which is what is saved to
+ * files. Entries loaded from a file have no calculation until they are used.
+ *
+ * Entries whose calculations have been freed are kept for reuse, up to
+ * max_free of them. Past that the least recently freed entries are removed.
+ * Entries loaded from a file are always kept, since the file bounds them.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct DC_Calculation;
+
+/* The key and then the data are stored right after the entry. calc is NULL
+ * while the entry is not used, and the entry is only in the by_calculation
+ * table when it has a calculation. references is the number of uses that have
+ * not been released.
+ *
+ * Entries that are not used and were not loaded are in the cache's free list,
+ * linked by newer_free and older_free. */
+struct DC_CacheEntry {
+    struct DC_CacheEntry *next_by_key, *next_by_calculation;
+    struct DC_CacheEntry *newer_free, *older_free;
+    struct DC_Calculation *calc;
+    unsigned long key_length, data_length;
+    unsigned key_hash;
+    unsigned references;
+    unsigned loaded;
+};
+
+#define DC_CACHE_ENTRY_KEY(ENTRY) ((const char *)((ENTRY) + 1))
+#define DC_CACHE_ENTRY_DATA(ENTRY) \
+    ((const unsigned char *)((ENTRY) + 1) + (ENTRY)->key_length)
+
+/* by_key and by_calculation are hash tables of entries, which are linked in
+ * both tables. num_buckets is always a power of two.
+ *
+ * newest_free and oldest_free are the ends of the free list, which has
+ * num_free entries. */
+struct DC_Cache {
+    struct DC_CacheEntry **by_key, **by_calculation;
+    struct DC_CacheEntry *newest_free, *oldest_free;
+    unsigned num_buckets, num_entries;
+    unsigned num_free, max_free;
+    unsigned long hits, misses;
+};
+
+/* Checks an entry that is being loaded. Returns non-zero if it can be used. */
+typedef int (*DC_Cache_Validator)(const char *key,
+    unsigned long key_length,
+    const unsigned char *data,
+    unsigned long data_length);
+
+void DC_Cache_Init(struct DC_Cache *cache);
+
+/* Frees the entries, but not their calculations. */
+void DC_Cache_Destroy(struct DC_Cache *cache);
+
+/* Returns the entry with the key, or NULL if there is none. This updates the
+ * hit and miss counts. */
+struct DC_CacheEntry *DC_Cache_Find(struct DC_Cache *cache,
+    const char *key,
+    unsigned long key_length);
+
+/* Adds an entry with no calculation. The key and data are copied. */
+struct DC_CacheEntry *DC_Cache_Add(struct DC_Cache *cache,
+    const char *key,
+    unsigned long key_length,
+    const unsigned char *data,
+    unsigned long data_length);
+
+/* Adds a reference to an entry. calc is the calculation for the entry, which
+ * is ignored if the entry already has one. */
+void DC_Cache_Use(struct DC_Cache *cache,
+    struct DC_CacheEntry *entry,
+    struct DC_Calculation *calc);
+
+/* Releases a reference to a calculation. Returns non-zero if the calculation
+ * should be freed, which is when it was the last reference or when the
+ * calculation is not in the cache. The entry is kept without a calculation
+ * after the last reference, so it can still be used and saved, unless that
+ * puts the free list over max_free. */
+int DC_Cache_Release(struct DC_Cache *cache, struct DC_Calculation *calc);
+
+/* Sets max_free, and removes the least recently freed entries that are over
+ * it. */
+void DC_Cache_SetMaxFree(struct DC_Cache *cache, unsigned max_free);
+
+/* Removes every entry that has no calculation, including loaded entries. */
+void DC_Cache_Clear(struct DC_Cache *cache);
+
+/* Writes every entry to a file. tag identifies what made the file, and a file
+ * is only loaded with the same tag. Returns non-zero on success. */
+int DC_Cache_Save(const struct DC_Cache *cache,
+    const char *path,
+    const char *tag);
+
+/* Adds the entries from a file, except for ones with keys that are already
+ * in the cache or that validator rejects. These are never removed by max_free. Returns the number of entries that
+ * were added, or -1 if the file could not be read or does not match. */
+int DC_Cache_Load(struct DC_Cache *cache,
+    const char *path,
+    const char *tag,
+    DC_Cache_Validator validator);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* LIBDCJIT_DC_CACHE_H */
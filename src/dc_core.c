@@ -4,13 +4,15 @@
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
 
-/* This file contains the DC language parser. It calls the DC_X functions to
- * actually compile the code (or write the AST if the interpreter backend is
- * being used).
+/* This file contains the DC language parser. It builds an expression DAG (see
+ * dc_ir.h), which is then lowered to the DC_X functions to actually compile
+ * the code (or write the AST if the interpreter backend is being used).
  */
 
 #include "dc.h"
 #include "dc_bc.h"
+#include "dc_ir.h"
+#include "dc_cache.h"
 #include "dc_backend.h"
 
 /* needed for strncpy on some systems */
@@ -21,19 +23,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <math.h>
-
-#ifndef DC_OPTIMIZE
-#define DC_OPTIMIZE 1
-#endif
-
-#ifndef DC_OPTIMIZE_FETCH
-#define DC_OPTIMIZE_FETCH DC_OPTIMIZE
-#endif
-
-#ifndef DC_OPTIMIZE_INTRINSIC
-#define DC_OPTIMIZE_INTRINSIC DC_OPTIMIZE
-#endif
+#include <assert.h>
 
 #ifdef _MSC_VER
     #define DC_STRNCPY(DST, LEN, TXT) strncpy_s((DST), (LEN),  (TXT), _TRUNCATE)
@@ -50,196 +40,225 @@
  * Parsing overview:
  *
  * DCJIT uses a fairly basic recursive descent parser. The ParseOperation
- * struct defines operators, and the language has two levels of operator
- * precedence. These are defined by parse_mul_ops and parse_add_ops, which use
- * the parse_generic function and specific data for the operators.
- *
- * All values encountered (parsed in parse_term) are considered "pushed",
- * "arguments", or "immediates".
- *
- * Pushed values have already had code generated that pushes the value onto the
- * stack.
+ * struct defines operators, and the language has five levels of operator
+ * precedence. The `^' operator binds tightest and is right associative, and
+ * is parsed by parse_pow_ops. The next two levels are defined by
+ * parse_mul_ops and parse_add_ops, which use the parse_generic function and
+ * specific data for the operators. Comparisons are parsed by
+ * parse_compare_ops, since some of their operators are two characters long.
+ * The loosest is the `?' `:' select, which is parsed by parse_select and is
+ * right associative.
  *
- * Argument values are indicated using their index into the argument list that
- * will be passed when the calculation is run. These will usually have to be
- * pushed, or used with an operator callback that can accept an argument index.
+ * A calculation can start with `let' bindings, which are parsed by
+ * parse_calculation. A bound name is just another name for the node of its
+ * expression, which parse_value looks up before the argument names.
  *
- * Immediate values are constant expression values. These are propogated
- * upwards in the parser, and using callbacks on the ParseOperation all
- * subexpressions that consist solely of constant values are fully calculated
- * at runtime.
+ * The parser does not generate any code itself. Every term parsed is added as
+ * a node to the expression DAG in dc_ir.h, and once the whole expression is
+ * parsed it is lowered to the backend and bytecode builders. The lowering
+ * pass handles choosing the argument and immediate forms of operations.
  *
- * TODO: Adding transitive properties (a+b+c = a+c+b) and identity values
- * (a = a+0, a = a*1.0) could allow even more aggressive constant expression
- * evaluation.
- *
- * How values are actually written for each operation is implemented in
- * parse_generic. Much of the code exists to handle the different value types,
- * which is mostly there for optimization.
+ * Subexpressions that consist solely of constant values are fully calculated
+ * as their nodes are created. Operations are also simplified as they are
+ * created, removing identities such as a*1.0 and a-(-b). With
+ * DC_OPTION_FAST_MATH set, chains of additions and multiplications are
+ * reassociated (a+1+b+2 = a+b+3) so that all of their constants are folded.
  *
  * There are some terms which are "builtins". These consist of a function name
- * and a subexpression, such as "sin(<expression)". They are parsed as a single
- * term, and if possible an immediate result is returned. Otherwise, this will
- * result in a pushed value.
+ * and one or two comma separated subexpressions, such as "sin(<expression>)"
+ * or "min(<expression>, <expression>)". They are parsed as a single term, and
+ * result in a unary or binary node.
  */
 
-/* This is the type of result of parse_term. */
+/* This is the type of result of parse_value, and of the other parsing
+ * functions. Only parse_value returns eTermImmediate or eTermArgument, the
+ * other functions return eTermNode once the term is added to the DAG.
+ * parse_value also returns eTermNode for names bound with `let'. */
 enum TermResultType {
     eTermImmediate,
     eTermArgument,
-    eTermPushed,
+    eTermNode,
     eTermSyntaxError,
     eTermInvalidArgNumber,
     eTermInvalidArgName
 };
 
-/* The output of parse_term. The active member (if any) is indicated by the
+/* The output of parse_value. The active member (if any) is indicated by the
  * type, in a TermResultType
  */
 union TermType {
     double immediate;
     unsigned short argument;
+    unsigned node;
 };
 
-/* Typedef for operations to calculate immediate results. */
-typedef double(*arithmetic_operation)(double, double);
-
-/* The build_push_* functions are the callbacks to perform codegen for an
- * arithmetic/trig operation.
- */
-
-/* Typedef for operations to calculate results on fully pushed values. */
-typedef void (*build_push_operation)(struct DC_X_Context*,
-    struct DC_X_CalculationBuilder*);
-/* Typedef for operations to calculate results with one pushed value and one
- * argument. */
-typedef void (*build_push_arg_operation)(struct DC_X_Context*,
-    struct DC_X_CalculationBuilder*,
-    unsigned short);
-/* Typedef for operations to calculate results with one pushed value and one
- * immediate value. Note that if both values are immediate, the
- * arithmetic_operation callback is used and the immediate result is propagated
- * upward through the parser. */
-typedef void (*build_push_imm_operation)(struct DC_X_Context*,
-    struct DC_X_CalculationBuilder*,
-    float);
-
-/* Typedef for bytecode operations on fully pushed values. */
-typedef void (*bytecode_push_operation)(struct DC_Bytecode*);
-/* Typedef for bytecode operations with one pushed value and one
- * argument. */
-typedef void (*bytecode_push_arg_operation)(struct DC_Bytecode*,
-    unsigned short);
-/* Typedef for operations to calculate results with one pushed value and one
- * immediate value. Note that if both values are immediate, the
- * arithmetic_operation callback is used and the immediate result is propagated
- * upward through the parser. */
-typedef void (*bytecode_push_imm_operation)(struct DC_Bytecode*,float);
-
-/* Immediate operation to add. */
-static double arithmetic_operation_add(double a, double b) { return a + b; }
-/* Immediate operation to subtract. */
-static double arithmetic_operation_sub(double a, double b) { return a - b; }
-/* Immediate operation to multiply. */
-static double arithmetic_operation_mul(double a, double b) { return a * b; }
-/* Immediate operation to divide. */
-static double arithmetic_operation_div(double a, double b) { return a / b; }
-/* Immediate operation to calculate sine. */
-static double arithmetic_operation_sin(double a){ return sin(a); }
-/* Immediate operation to calculate cosine. */
-static double arithmetic_operation_cos(double a){ return cos(a); }
-/* Immediate operation to calculate square root. */
-static double arithmetic_operation_sqrt(double a){ return sqrt(a); }
-
 /* Defines an operator in the language. */
 struct ParseOperation {
     char operator_char; /* Operator character. */
-    /* Callback for this operator with two immediate values. */
-    arithmetic_operation immediate_op;
-    /* Callback for this operator with two pushed values. */
-    build_push_operation build_op;
-    /* Callback for this operator with one pushed value and one argument. */
-    build_push_arg_operation build_arg_op;
-    build_push_imm_operation build_imm_op;
-    /* Callback for bytecode with two pushed values. */
-    bytecode_push_operation bytecode_op;
-    /* Callback for bytecode with one pushed value and one argument. */
-    bytecode_push_arg_operation bytecode_arg_op;
-    bytecode_push_imm_operation bytecode_imm_op;
+    enum DC_IR_Op op; /* Node to create for the operator. */
 };
 
-#define DC_BUILD_OPS(NAME)\
-    DC_X_Build ## NAME, DC_X_Build ## NAME ## Arg, DC_X_Build ## NAME ## Imm,\
-    DC_BC_Build ## NAME, DC_BC_Build ## NAME ## Arg, DC_BC_Build ## NAME ## Imm
-
 /* ParseOperation data for mul_ops 
  * TODO: Remainder will go here.
  */
 #define DC_NUM_MUL_OPS 2
 static const struct ParseOperation dc_mul_ops[DC_NUM_MUL_OPS] = {
-    {'*', arithmetic_operation_mul, DC_BUILD_OPS(Mul)},
-    {'/', arithmetic_operation_div, DC_BUILD_OPS(Div)}
+    {'*', eIRMul},
+    {'/', eIRDiv}
 };
 
 /* ParseOperation data for add_ops */
 #define DC_NUM_ADD_OPS 2
 static const struct ParseOperation dc_add_ops[DC_NUM_ADD_OPS] = {
-    {'+', arithmetic_operation_add, DC_BUILD_OPS(Add)},
-    {'-', arithmetic_operation_sub, DC_BUILD_OPS(Sub)}
+    {'+', eIRAdd},
+    {'-', eIRSub}
 };
 
-/* Unary operation typedef. This is only used in the "builtin" terms. */
-typedef double(*unary_operation)(double);
-typedef enum TermResultType(*parser_callback)(struct DC_X_Context *ctx,
-    struct DC_X_CalculationBuilder *bld,
-    struct DC_Bytecode *bc,
+typedef enum TermResultType(*parser_callback)(struct DC_IR *ir,
     char error_text[0x100],
     const char **source_ptr,
-    unsigned num_args,
-    const char *const *arg_names,
-    union TermType *out_term);
+    const struct DC_ArgSchema *schema,
+    unsigned *out_node);
 
-DC_ContextPtr DC_API_CALL DC_CreateContext(void){
-    return (struct DC_Context *)DC_X_CreateContext();
+/* The backend's context, and the state that is kept by the core. The cache is
+ * only searched and added to when use_cache is set, but calculations already
+ * in the cache are always released through it.
+ *
+ * tiered is a list of the calculations that have not been promoted yet, see
+ * DC_OPTION_TIER_THRESHOLD.
+ *
+ * lock is held while the backend's context or tiered is changed, since a
+ * calculation can be promoted by a call on any thread. */
+struct DC_Context {
+    struct DC_X_Context *x;
+    struct DC_Cache cache;
+    unsigned use_cache;
+    unsigned tier_threshold;
+    struct DC_Calculation *tiered;
+    volatile long lock;
+};
+
+/* The calculations that the API returns. x is the backend's calculation.
+ *
+ * Tiered calculations start with x NULL, and are run by interpreting bc while
+ * num_calls counts the calls. They keep the nodes they were parsed into in ir,
+ * and the options they were compiled with, to be compiled by the backend once
+ * they are promoted. x is only set once the backend's calculation is
+ * complete, so a call on another thread either interprets bc or runs the
+ * finished calculation. bc is kept until the calculation is freed, since a
+ * call could still be interpreting it after the promotion. ctx is the context
+ * that the calculation is promoted in. */
+struct DC_Calculation {
+    struct DC_Context *ctx;
+    struct DC_X_Calculation *volatile x;
+    struct DC_Bytecode *bc;
+    unsigned char *ir;
+    unsigned long ir_length;
+    volatile unsigned long num_calls;
+    unsigned use_double, fast_trig;
+    struct DC_Calculation *next_tiered, *prev_tiered;
+};
+
+/* A gradient is a single backend calculation of the value, which also stores
+ * the derivative by argument i to argument num_args+i. use_double is the
+ * precision that it was compiled with. */
+struct DC_Gradient {
+    struct DC_X_Calculation *x;
+    unsigned num_args, use_double;
+};
+
+/* Gradients are run on a copy of their arguments followed by room for the
+ * derivatives, which is on the stack unless there are many arguments. */
+#define DC_GRADIENT_STACK_ARGS 16
+
+/* Makes every write before this visible to other threads before any write
+ * after it. This is what lets a promoted calculation be swapped in while other
+ * threads are running it. */
+#if defined(__GNUC__)
+#define DC_WRITE_BARRIER() __sync_synchronize()
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define DC_WRITE_BARRIER() _ReadWriteBarrier()
+#else
+#define DC_WRITE_BARRIER()
+#endif
+
+/* DC_TRY_LOCK takes a lock if it is free, and is non-zero if it did. Without
+ * atomics it only keeps a promotion from starting inside another one on the
+ * same thread. */
+#if defined(__GNUC__)
+#define DC_TRY_LOCK(LOCK) (__sync_lock_test_and_set(&(LOCK), 1) == 0)
+#define DC_UNLOCK(LOCK) __sync_lock_release(&(LOCK))
+#elif defined(_MSC_VER)
+#define DC_TRY_LOCK(LOCK) (_InterlockedExchange(&(LOCK), 1) == 0)
+#define DC_UNLOCK(LOCK) _InterlockedExchange(&(LOCK), 0)
+#else
+#define DC_TRY_LOCK(LOCK) ((LOCK) == 0 && ((LOCK) = 1))
+#define DC_UNLOCK(LOCK) ((LOCK) = 0)
+#endif
+
+/* Waits for a context's lock. It is only held for as long as it takes to
+ * create, promote, or free a calculation. */
+static void dc_lock(struct DC_Context *ctx){
+    while(!DC_TRY_LOCK(ctx->lock)){}
 }
 
-void DC_API_CALL DC_FreeContext(struct DC_Context *ctx){
-    DC_X_FreeContext((struct DC_X_Context *)ctx);
+static void dc_unlock(struct DC_Context *ctx){
+    DC_UNLOCK(ctx->lock);
 }
 
-void DC_API DC_FreeBytecode(struct DC_Bytecode *bc){
-    DC_BC_FreeBytecode(bc);
+DC_ContextPtr DC_API_CALL DC_CreateContext(void){
+    struct DC_Context *const ctx = malloc(sizeof(struct DC_Context));
+    ctx->x = DC_X_CreateContext();
+    DC_Cache_Init(&(ctx->cache));
+    ctx->use_cache = 0;
+    ctx->tier_threshold = 0;
+    ctx->tiered = NULL;
+    ctx->lock = 0;
+    return ctx;
 }
 
-static void dc_build_push_arg(struct DC_X_Context *ctx, 
-    struct DC_X_CalculationBuilder *bld,
-    struct DC_Bytecode *bc,
-    unsigned short arg){
-    if(bld != NULL)
-        DC_X_BuildPushArg(ctx, bld, arg);
-    if(bc != NULL)
-        DC_BC_BuildPushArg(bc, arg);
+void DC_API_CALL DC_FreeContext(struct DC_Context *ctx){
+    assert(ctx->tiered == NULL);
+    DC_Cache_Destroy(&(ctx->cache));
+    DC_X_FreeContext(ctx->x);
+    free(ctx);
 }
 
-static void dc_build_push_imm(struct DC_X_Context *ctx, 
-    struct DC_X_CalculationBuilder *bld,
-    struct DC_Bytecode *bc,
-    float imm){
-    if(bld != NULL)
-        DC_X_BuildPushImmediate(ctx, bld, imm);
-    if(bc != NULL)
-        DC_BC_BuildPushImmediate(bc, imm);
+int DC_API_CALL DC_SetOption(struct DC_Context *ctx,
+    int option,
+    unsigned value){
+    int ok;
+    if(option == DC_OPTION_CACHE){
+        ctx->use_cache = (value != 0);
+        return 1;
+    }
+    if(option == DC_OPTION_TIER_THRESHOLD){
+        ctx->tier_threshold = value;
+        return 1;
+    }
+    if(option == DC_OPTION_MAX_FREE_CACHED){
+        DC_Cache_SetMaxFree(&(ctx->cache), value);
+        return 1;
+    }
+    dc_lock(ctx);
+    ok = DC_X_SetOption(ctx->x, option, value);
+    dc_unlock(ctx);
+    return ok;
 }
 
-static void dc_build_push_op(struct DC_X_Context *ctx, 
-    struct DC_X_CalculationBuilder *bld,
-    struct DC_Bytecode *bc,
-    build_push_operation calc_operation,
-    bytecode_push_operation bc_operation){
-    if(bld != NULL)
-        calc_operation(ctx, bld);
-    if(bc != NULL)
-        bc_operation(bc);
+void DC_API_CALL DC_GetCacheStatistics(const struct DC_Context *ctx,
+    unsigned long *out_hits,
+    unsigned long *out_misses,
+    unsigned *out_num_calculations){
+    
+    out_hits[0] = ctx->cache.hits;
+    out_misses[0] = ctx->cache.misses;
+    out_num_calculations[0] = ctx->cache.num_entries;
+}
+
+void DC_API DC_FreeBytecode(struct DC_Bytecode *bc){
+    DC_BC_FreeBytecode(bc);
 }
 
 /* Skips whitespace. */
@@ -247,7 +266,7 @@ static const char *skip_whitespace(const char *source){
 skip_whitespace_next_char:
     {
         const int c = *source;
-        if(c == ' ' || c == '\t'){
+        if(c == ' ' || c == '\t' || c == '\n' || c == '\r'){
             source++;
             goto skip_whitespace_next_char;
         }
@@ -256,6 +275,152 @@ skip_whitespace_next_char:
     return source;
 }
 
+/* Returns the length of the name at the start of source, which is zero if
+ * there is no name. Names are used for arguments and `let' bindings. */
+static unsigned name_length(const char *source){
+    unsigned length = 0;
+next_char:
+    {
+        const int c = source[length];
+        if(c == '_' ||
+            (c >= 'a' && c <= 'z') ||
+            (c >= 'A' && c <= 'Z') ||
+            (c & 0x80)){
+            length++;
+            goto next_char;
+        }
+    }
+    
+    return length;
+}
+
+/* The names of a calculation's arguments. table is an open addressed hash
+ * table of argument numbers plus one, so that zero marks an empty entry.
+ * table_size is a power of two, and at least twice the number of arguments.
+ *
+ * Schemas that are only used for one compile have no table, and the names are
+ * searched in order instead. */
+struct DC_ArgSchema {
+    unsigned num_args;
+    const char *const *arg_names;
+    unsigned *table;
+    unsigned table_size;
+};
+
+#define DC_ARG_SCHEMA_INITIAL_TABLE_SIZE 16
+
+static unsigned dc_hash_name(const char *name, unsigned length){
+    unsigned long hash = 0;
+    unsigned i;
+    for(i = 0; i < length; i++)
+        hash = (hash * 31) + (unsigned char)name[i];
+    return (unsigned)(hash ^ (hash >> 16));
+}
+
+/* Sets up a schema for a single compile. */
+static void dc_init_arg_schema(struct DC_ArgSchema *schema,
+    unsigned num_args,
+    const char *const *arg_names){
+    
+    schema->num_args = num_args;
+    schema->arg_names = arg_names;
+    schema->table = NULL;
+    schema->table_size = 0;
+}
+
+/* Finds the number of an argument by name. Returns zero if there is no
+ * argument with that name. If more than one argument has the name, the first
+ * of them is found. */
+static int dc_find_arg(const struct DC_ArgSchema *schema,
+    const char *name,
+    unsigned length,
+    unsigned *out_arg){
+    
+    unsigned i;
+    if(schema->table != NULL){
+        const unsigned mask = schema->table_size - 1;
+        for(i = dc_hash_name(name, length) & mask;
+            schema->table[i] != 0;
+            i = (i + 1) & mask){
+            
+            const unsigned arg_num = schema->table[i] - 1;
+            const char *const arg = schema->arg_names[arg_num];
+            if(strncmp(name, arg, length) == 0 && arg[length] == 0){
+                out_arg[0] = arg_num;
+                return 1;
+            }
+        }
+        return 0;
+    }
+    else{
+        for(i = 0; i < schema->num_args; i++){
+            const char *const arg = schema->arg_names[i];
+            if(strncmp(name, arg, length) == 0 && arg[length] == 0){
+                out_arg[0] = i;
+                return 1;
+            }
+        }
+        return 0;
+    }
+}
+
+DC_ArgSchemaPtr DC_API_CALL DC_CreateArgSchema(unsigned num_args,
+    const char *const *arg_names){
+    
+    struct DC_ArgSchema *const schema = malloc(sizeof(struct DC_ArgSchema));
+    unsigned long names_size = 0;
+    unsigned i, table_size = DC_ARG_SCHEMA_INITIAL_TABLE_SIZE;
+    char **names;
+    char *name_data;
+    
+    /* The names are copied, so that the caller's names don't need to outlive
+     * the schema. The strings are stored after the array of pointers. */
+    for(i = 0; i < num_args; i++)
+        names_size += strlen(arg_names[i]) + 1;
+    names = malloc((sizeof(char*) * num_args) + names_size);
+    name_data = (char*)(names + num_args);
+    for(i = 0; i < num_args; i++){
+        const unsigned long length = strlen(arg_names[i]) + 1;
+        names[i] = memcpy(name_data, arg_names[i], length);
+        name_data += length;
+    }
+    
+    while(table_size < num_args * 2)
+        table_size <<= 1;
+    
+    schema->num_args = num_args;
+    schema->arg_names = (const char *const *)names;
+    schema->table = calloc(table_size, sizeof(unsigned));
+    schema->table_size = table_size;
+    
+    for(i = 0; i < num_args; i++){
+        const unsigned length = (unsigned)strlen(names[i]);
+        unsigned arg_num;
+        /* Only the first of any duplicate names is added, to match searching
+         * the names in order. */
+        if(!dc_find_arg(schema, names[i], length, &arg_num)){
+            const unsigned mask = table_size - 1;
+            unsigned n = dc_hash_name(names[i], length) & mask;
+            while(schema->table[n] != 0)
+                n = (n + 1) & mask;
+            schema->table[n] = i + 1;
+        }
+    }
+    return schema;
+}
+
+void DC_API_CALL DC_FreeArgSchema(struct DC_ArgSchema *schema){
+    if(schema != NULL){
+        free((void*)schema->arg_names);
+        free(schema->table);
+        free(schema);
+    }
+}
+
+unsigned DC_API_CALL DC_GetArgSchemaSize(const struct DC_ArgSchema *schema){
+    return schema->num_args;
+}
+
 /* Parses an integer.
  * 
  * This is used for argument numbers, and to parse the whole and decimal parts
@@ -288,6 +453,17 @@ parse_done:
     return val;
 }
 
+/* Parses digits into a double. Unlike parse_integer, this does not overflow
+ * for long literals, which matters for double precision calculations. */
+static double parse_digits(const char **const source_ptr){
+    double val = 0.0;
+    const char *source = *source_ptr;
+    while(*source >= '0' && *source <= '9')
+        val = (val * 10.0) + (double)(*source++ - '0');
+    source_ptr[0] = source;
+    return val;
+}
+
 /* Parses a double-precision floating point number. */
 static double parse_double(const char **const source_ptr){
     int negate = 0;
@@ -299,26 +475,25 @@ static double parse_double(const char **const source_ptr){
             source++;
     }
     {
-        const unsigned long numerator = parse_integer(&source);
+        const double numerator = parse_digits(&source);
         if(*source == '.'){
             const char *start = ++source;
-            unsigned divider = 1;
-            const unsigned long fraction_int = parse_integer(&source);
+            double divider = 1.0;
+            const double fraction_int = parse_digits(&source);
             
             source_ptr[0] = source;
             while(start++ != source)
-                divider *= 10;
+                divider *= 10.0;
             
             {
-                const double fraction = ((double)fraction_int) / ((double)divider);
-                const double value = ((double)numerator) + fraction;
-                return (double)(negate ? (-value) : value);
+                const double fraction = fraction_int / divider;
+                const double value = numerator + fraction;
+                return negate ? (-value) : value;
             }
         }
         else{
-            const double value = (double)numerator;
             source_ptr[0] = source;
-            return negate ? (-value) : value;
+            return negate ? (-numerator) : numerator;
         }
     }
 }
@@ -334,23 +509,21 @@ union TermResult {
 };
 
 /* This is the general entry point to parse an expression */
-static enum TermResultType parse_add_ops(struct DC_X_Context *ctx,
-    struct DC_X_CalculationBuilder *bld,
-    struct DC_Bytecode *bc,
+static enum TermResultType parse_select(struct DC_IR *ir,
     char error_text[0x100],
     const char **source_ptr,
-    unsigned num_args,
-    const char *const *arg_names,
-    union TermType *out_term);
+    const struct DC_ArgSchema *schema,
+    unsigned *out_node);
 
-/* Parses a value. This can be a literal, or an argument name or number.
+/* Parses a value. This can be a literal, a name bound with `let', or an
+ * argument name or number. Bound names hide arguments with the same name.
  * Does not use the same data format as the other parsing functions, as the
  * caller will need to make decisions about what to with the result depending
  * on the operation.
  */
-static enum TermResultType parse_value(const char **source_ptr,
-    unsigned num_args,
-    const char *const *arg_names,
+static enum TermResultType parse_value(const struct DC_IR *ir,
+    const char **source_ptr,
+    const struct DC_ArgSchema *schema,
     union TermResult *out_result){
     
     const char *source = *source_ptr;
@@ -374,13 +547,14 @@ static enum TermResultType parse_value(const char **source_ptr,
 
 #define DC_TERM_SUCCESS_ARG(VALUE) DC_TERM_SUCCCESS(eTermArgument, argument, (VALUE))
 #define DC_TERM_SUCCESS_IMM(VALUE) DC_TERM_SUCCCESS(eTermImmediate, immediate, (VALUE))
+#define DC_TERM_SUCCESS_NODE(VALUE) DC_TERM_SUCCCESS(eTermNode, node, (VALUE))
 
     switch(*source){
         case '$':
             source++;
             {
                 const unsigned long arg_num = parse_integer(&source);
-                if(arg_num < 0x10000 && arg_num < num_args)
+                if(arg_num < 0x10000 && arg_num < schema->num_args)
                     return DC_TERM_SUCCESS_ARG((unsigned short)arg_num);
                 else
                     return DC_TERM_FAIL_INTEGER(eTermInvalidArgNumber, arg_num);
@@ -400,167 +574,158 @@ static enum TermResultType parse_value(const char **source_ptr,
         case '9':
             return DC_TERM_SUCCESS_IMM(parse_double(&source));
         default:
-            /* Parse an arg name */
+            /* Parse a bound name or an arg name */
             {
                 const char *const arg_name_start = source;
-                unsigned arg_num = 0, arg_name_size = 0;
-            next_char:
-                {
-                    const int c = source[arg_name_size];
-                    if(c == '_' ||
-                        (c >= 'a' && c <= 'z') ||
-                        (c >= 'A' && c <= 'Z') ||
-                        (c & 0x80)){
-                        arg_name_size++;
-                        goto next_char;
-                    }
-                }
+                const unsigned arg_name_size = name_length(source);
+                unsigned arg_num, node;
             
             source += arg_name_size;
             
-            next_arg_name:
-                if(arg_num == num_args){
-                    return DC_TERM_FAIL_STRING(eTermInvalidArgName,
-                        arg_name_start,
-                        arg_name_size);
-                }
-                else{
-                    const char *const arg = arg_names[arg_num];
-                    if(strncmp(arg_name_start, arg, arg_name_size) == 0 &&
-                        arg[arg_name_size] == 0){
-                        return DC_TERM_SUCCESS_ARG(arg_num);
-                    }
-                    else{
-                        arg_num++;
-                        goto next_arg_name;
-                    }
-                }
+            if(arg_name_size != 0 &&
+                DC_IR_FindBinding(ir, arg_name_start, arg_name_size, &node)){
+                return DC_TERM_SUCCESS_NODE(node);
+            }
+            
+            if(dc_find_arg(schema, arg_name_start, arg_name_size, &arg_num))
+                return DC_TERM_SUCCESS_ARG((unsigned short)arg_num);
+            else
+                return DC_TERM_FAIL_STRING(eTermInvalidArgName,
+                    arg_name_start,
+                    arg_name_size);
             }
     }
 }
 
-/* Parses a parenthesized expression. This will use the parse_add_ops function
- * to parse the inner statement.
+/* Parses a parenthesized list of count expressions separated by commas. This
+ * will use the parse_select function to parse each expression.
  */
-static enum TermResultType parse_parens(struct DC_X_Context *ctx,
-    struct DC_X_CalculationBuilder *bld,
-    struct DC_Bytecode *bc,
+static enum TermResultType parse_list(struct DC_IR *ir,
     char error_text[0x100],
     const char **source_ptr,
-    unsigned num_args,
-    const char *const *arg_names,
-    union TermType *out_term){
+    const struct DC_ArgSchema *schema,
+    unsigned count,
+    unsigned *out_nodes){
     
-    if(**source_ptr == '('){
-        const char *source = skip_whitespace(source_ptr[0]+1);
-        const enum TermResultType type = parse_add_ops(ctx,
-            bld,
-            bc,
+    const char *source = source_ptr[0];
+    unsigned i;
+    if(*source != '('){
+        DC_STRNCPY(error_text, 0xFF, "Expected (");
+        return eTermSyntaxError;
+    }
+    for(i = 0; i < count; i++){
+        enum TermResultType type;
+        /* Skip past the ( or , */
+        source = skip_whitespace(source + 1);
+        type = parse_select(ir,
             error_text,
             &source,
-            num_args,
-            arg_names,
-            out_term);
+            schema,
+            out_nodes + i);
+        if(type != eTermNode)
+            return type;
         source = skip_whitespace(source);
-        if(type == eTermImmediate || type == eTermArgument || type == eTermPushed){
-            if(*source++ != ')'){
-                DC_STRNCPY(error_text, 0xFF, "Expected )");
-                return eTermSyntaxError;
-            }
-            source_ptr[0] = source;
+        if(i + 1 == count && *source != ')'){
+            DC_STRNCPY(error_text, 0xFF, "Expected )");
+            return eTermSyntaxError;
+        }
+        if(i + 1 != count && *source != ','){
+            DC_STRNCPY(error_text, 0xFF, "Expected ,");
+            return eTermSyntaxError;
         }
-        return type;
-    }
-    else{
-        DC_STRNCPY(error_text, 0xFF, "Expected (");
-        return eTermSyntaxError;
     }
+    source_ptr[0] = source + 1;
+    return eTermNode;
 }
 
-/* Parses a builtin, which is a parenthesized expression and a unary operation
- * to perform on that operation or to push to the JIT. */
-static enum TermResultType builtin(struct DC_X_Context *ctx,
-    struct DC_X_CalculationBuilder *bld,
-    struct DC_Bytecode *bc,
+/* Parses a parenthesized expression. */
+static enum TermResultType parse_parens(struct DC_IR *ir,
     char error_text[0x100],
     const char **source_ptr,
-    unsigned num_args,
-    const char *const *arg_names,
-    union TermType *out_term,
-    unary_operation immediate_operation,
-    build_push_operation calc_operation,
-    bytecode_push_operation bc_operation){
+    const struct DC_ArgSchema *schema,
+    unsigned *out_node){
     
-    /* Builtins are: <atom> '(' <expression> ')'
+    return parse_list(ir,
+        error_text,
+        source_ptr,
+        schema,
+        1,
+        out_node);
+}
+
+/* Parses a builtin, which is a parenthesized list of expressions and an
+ * operation to perform on them. Binary operations take two expressions, and
+ * unary operations take one. */
+static enum TermResultType builtin(struct DC_IR *ir,
+    char error_text[0x100],
+    const char **source_ptr,
+    const struct DC_ArgSchema *schema,
+    unsigned *out_node,
+    enum DC_IR_Op op){
+    
+    /* Builtins are: <atom> '(' <expression> [',' <expression>] ')'
      * The atom should already have been consumed, so we can begin by parsing
-     * the parenthesized expression.
+     * the parenthesized list.
      */
-    const enum TermResultType type = parse_parens(ctx,
-        bld, bc, error_text, source_ptr, num_args, arg_names, out_term);
-    if(type == eTermImmediate){
-        /* If intrinsics can be optimized, then we can apply the operation */
-        if(DC_OPTIMIZE_INTRINSIC){
-            out_term->immediate = immediate_operation(out_term->immediate);
-        }
-        else{
-            dc_build_push_imm(ctx, bld, bc, (float)out_term->immediate);
-            dc_build_push_op(ctx, bld, bc, calc_operation, bc_operation);
-            return eTermPushed;
-        }
-    }
-    else if(type == eTermArgument){
-        dc_build_push_arg(ctx, bld, bc, out_term->argument);
-        dc_build_push_op(ctx, bld, bc, calc_operation, bc_operation);
-        return eTermPushed;
-    }
-    else if(type == eTermPushed){
-        dc_build_push_op(ctx, bld, bc, calc_operation, bc_operation);
+    unsigned operands[2];
+    const unsigned count = DC_IR_IS_BINARY(op) ? 2 : 1;
+    const enum TermResultType type = parse_list(ir,
+        error_text, source_ptr, schema, count, operands);
+    if(type == eTermNode){
+        out_node[0] = (count == 2) ?
+            DC_IR_AddBinary(ir, op, operands[0], operands[1]) :
+            DC_IR_AddUnary(ir, op, operands[0]);
     }
     return type;
-}   
+}
 
 /* Parses a term, which can be a value, a parenthesized expression, or a
  * builtin operation */
-static enum TermResultType parse_term(struct DC_X_Context *ctx,
-    struct DC_X_CalculationBuilder *bld,
-    struct DC_Bytecode *bc,
+static enum TermResultType parse_term(struct DC_IR *ir,
     char error_text[0x100],
     const char **source_ptr,
-    unsigned num_args,
-    const char *const *arg_names,
-    union TermType *out_term){
+    const struct DC_ArgSchema *schema,
+    unsigned *out_node){
     
     union TermResult result;
     enum TermResultType type;
     /* Check for a parentheszied expression. */
     if(**source_ptr == '('){
-        return parse_parens(ctx,
-            bld, bc, error_text, source_ptr, num_args, arg_names, out_term);
+        return parse_parens(ir,
+            error_text, source_ptr, schema, out_node);
     }
 
-    /* Builtins are <atom> '(' <expression> ')'
+    /* Builtins are <atom> '(' <expression> [',' <expression>] ')'
      * Search for the <atom> '(', since then we can re-use the parenthesized
-     * expression parsing logic for the argument. */
-#define DC_BUILTIN(NAME, IMMEDIATE, PUSH) do{\
+     * list parsing logic for the arguments. */
+#define DC_BUILTIN(NAME, OP) do{\
         if(strncmp(*source_ptr, ( NAME "(" ), sizeof(NAME))==0){\
             source_ptr[0] += sizeof(NAME) - 1;\
-            return builtin(ctx, bld, bc, error_text, source_ptr, num_args,\
-                arg_names, out_term, (IMMEDIATE), DC_X_ ## PUSH, DC_BC_ ## PUSH);\
+            return builtin(ir, error_text, source_ptr, schema,\
+                out_node, (OP));\
         }\
     }while(0)
 
-    DC_BUILTIN("sin", arithmetic_operation_sin, BuildSin);
-    DC_BUILTIN("cos", arithmetic_operation_cos, BuildCos);
-    DC_BUILTIN("sqrt", arithmetic_operation_sqrt, BuildSqrt);
+    DC_BUILTIN("sin", eIRSin);
+    DC_BUILTIN("cos", eIRCos);
+    DC_BUILTIN("sqrt", eIRSqrt);
+    DC_BUILTIN("tan", eIRTan);
+    DC_BUILTIN("exp", eIRExp);
+    DC_BUILTIN("log", eIRLog);
+    DC_BUILTIN("abs", eIRAbs);
+    DC_BUILTIN("floor", eIRFloor);
+    DC_BUILTIN("atan2", eIRAtan2);
+    DC_BUILTIN("min", eIRMin);
+    DC_BUILTIN("max", eIRMax);
     
     /* If it wasn't a builtin or a parenthesized expression, it is a value. */
-    type = parse_value(source_ptr, num_args, arg_names, &result);
+    type = parse_value(ir, source_ptr, schema, &result);
     switch(type){
         /* Convert any errors to error text. */
         case eTermSyntaxError:
             break;
         case eTermInvalidArgNumber:
-            if(num_args == 0)
+            if(schema->num_args == 0)
                 snprintf(error_text, 0x100,
                     "Arg %li is over the maximum of none", result.int_error);
             else
@@ -568,7 +733,7 @@ static enum TermResultType parse_term(struct DC_X_Context *ctx,
                     0x100,
                     "Arg %li is over the maximum of %u",
                     result.int_error,
-                    num_args-1);
+                    schema->num_args-1);
             break;
         case eTermInvalidArgName:
         {
@@ -586,225 +751,646 @@ static enum TermResultType parse_term(struct DC_X_Context *ctx,
         }
             break;
         case eTermImmediate:
-            if(DC_OPTIMIZE){
-                out_term->immediate = result.term.immediate;
-            }
-            else{
-                dc_build_push_imm(ctx, bld, bc, (float)result.term.immediate);
-                type = eTermPushed;
-            }
+            out_node[0] = DC_IR_AddImmediate(ir, result.term.immediate);
+            type = eTermNode;
             break;
         case eTermArgument:
-            if(DC_OPTIMIZE){
-                out_term->argument = result.term.argument;
-            }
-            else{
-                dc_build_push_arg(ctx, bld, bc, result.term.argument);
-                type = eTermPushed;
-            }
+            out_node[0] = DC_IR_AddArgument(ir, result.term.argument);
+            type = eTermNode;
             break;
-        case eTermPushed:
+        case eTermNode:
+            out_node[0] = result.term.node;
             break;
     }
     return type;
 }
 
-static enum TermResultType parse_generic(struct DC_X_Context *ctx,
-    struct DC_X_CalculationBuilder *bld,
-    struct DC_Bytecode *bc,
+static enum TermResultType parse_generic(struct DC_IR *ir,
     char error_text[0x100],
     const char **source_ptr,
-    unsigned num_args,
-    const char *const *arg_names,
-    union TermType *out_term,
+    const struct DC_ArgSchema *schema,
+    unsigned *out_node,
     parser_callback parse_callback,
     const struct ParseOperation *operations,
     unsigned num_operations){
     
-    union TermType term;
+    unsigned node;
     const char *source;
     enum TermResultType type = parse_callback(
-        ctx, bld, bc, error_text, source_ptr, num_args, arg_names, &term);
+        ir, error_text, source_ptr, schema, &node);
     
-    switch(type){
-        case eTermPushed:
-            /* FALLTHROUGH */
-        case eTermImmediate:
-            /* FALLTHROUGH */
-        case eTermArgument:
-            source = skip_whitespace(*source_ptr);
-            while(*source != '\0'){
-                unsigned i;
-                source = skip_whitespace(source);
-                for(i = 0; i < num_operations; i++){
-                    if(*source == operations[i].operator_char){
-                        union TermType next_term;
-                        enum TermResultType next_type;
-                        
-                        /* Skip past the operator. */
-                        source = skip_whitespace(++source);
-                        
-                        next_type = parse_callback(ctx, bld, bc,
-                            error_text,
-                            &source,
-                            num_args,
-                            arg_names,
-                            &next_term);
-                        
-                        if(next_type == eTermImmediate){
-                            if(type == eTermImmediate){
-                                term.immediate = operations[i].immediate_op(
-                                    term.immediate, next_term.immediate);
-                            }
-                            else{
-                                const float imm = (float)next_term.immediate;
-                                /* Flush the first argument */
-                                if(type == eTermArgument){
-                                    /* TODO: We /might/ be able to label
-                                     * operators that are transitive and
-                                     * re-order the arguments here. */
-                                    dc_build_push_arg(ctx,
-                                        bld, bc, term.argument);
-                                    type = eTermPushed;
-                                }
-                                /* else the arg was pushed. */
-                                
-                                /* TODO: We could parse the next term and then
-                                 * flush? */
-                                if(DC_OPTIMIZE_FETCH){
-                                    if(bld != NULL)
-                                        operations[i].build_imm_op(ctx, bld, imm);
-                                    if(bc != NULL)
-                                        operations[i].bytecode_imm_op(bc, imm);
-                                }
-                                else{
-                                    dc_build_push_imm(ctx, bld, bc, imm);
-                                    dc_build_push_op(ctx, bld, bc,
-                                        operations[i].build_op,
-                                        operations[i].bytecode_op);
-                                }
-                            }
-                            break;
-                        }
-                        else if(next_type == eTermArgument){
-                            const unsigned short arg = next_term.argument;
-                            /* Flush the first argument */
-                            if(type == eTermImmediate){
-                                const float imm = (float)term.immediate;
-                                dc_build_push_imm(ctx, bld, bc, imm);
-                                type = eTermPushed;
-                            }
-                            else if(type == eTermArgument){
-                                dc_build_push_arg(ctx, bld, bc, term.argument);
-                                type = eTermPushed;
-                            }
-                            
-                            if(DC_OPTIMIZE_FETCH){
-                                if(bld != NULL)
-                                    operations[i].build_arg_op(ctx, bld, arg);
-                                if(bc != NULL)
-                                    operations[i].bytecode_arg_op(bc, arg);
-                            }
-                            else{
-                                dc_build_push_arg(ctx, bld, bc, arg);
-                                dc_build_push_op(ctx, bld, bc,
-                                    operations[i].build_op,
-                                    operations[i].bytecode_op);
-                            }
-                            break;
-                        }
-                        else if(next_type == eTermPushed){
-                            /* TODO: This seems like it's incorrect? */
-                            /* Flush the first argument */
-                            if(type == eTermImmediate){
-                                const float imm = (float)term.immediate;
-                                dc_build_push_imm(ctx, bld, bc, imm);
-                                type = eTermPushed;
-                            }
-                            else if(type == eTermArgument){
-                                dc_build_push_arg(ctx, bld, bc, term.argument);
-                                type = eTermPushed;
-                            }
-                            dc_build_push_op(ctx, bld, bc,
-                                operations[i].build_op,
-                                operations[i].bytecode_op);
-                            break;
-                        }
-                        else{
-                            /* Handle all errors */
-                            return next_type;
-                        }
-                    }
-                }
-                
-                /* We did not find a matching operation. */
-                if(i == num_operations)
-                    break;
-            }
-            
-            source_ptr[0] = source;
-            if(type == eTermImmediate){
-                out_term->immediate = term.immediate;
-            }
-            else if(type == eTermArgument){
-                out_term->argument = term.argument;
-            }
+    if(type != eTermNode)
+        return type;
+    
+    source = skip_whitespace(*source_ptr);
+    while(*source != '\0'){
+        unsigned i, next_node;
+        source = skip_whitespace(source);
+        for(i = 0; i < num_operations; i++){
+            if(*source == operations[i].operator_char)
+                break;
+        }
+        
+        /* We did not find a matching operation. */
+        if(i == num_operations)
+            break;
+        
+        /* Skip past the operator. */
+        source = skip_whitespace(++source);
+        
+        type = parse_callback(ir,
+            error_text,
+            &source,
+            schema,
+            &next_node);
+        
+        /* Handle all errors */
+        if(type != eTermNode)
             return type;
-        default:
+        
+        /* Operators are left associative, so the node so far is always the
+         * first operand. */
+        node = DC_IR_AddBinary(ir, operations[i].op, node, next_node);
+    }
+    
+    source_ptr[0] = source;
+    out_node[0] = node;
+    return eTermNode;
+}
+
+/* Implements parsing terms separated by `^'. Unlike the other operators, this
+ * is right associative, so x^y^z is x^(y^z). */
+static enum TermResultType parse_pow_ops(struct DC_IR *ir,
+    char error_text[0x100],
+    const char **source_ptr,
+    const struct DC_ArgSchema *schema,
+    unsigned *out_node){
+    
+    unsigned node, exponent;
+    const char *source;
+    enum TermResultType type = parse_term(
+        ir, error_text, source_ptr, schema, &node);
+    
+    if(type != eTermNode)
+        return type;
+    
+    source = skip_whitespace(*source_ptr);
+    if(*source == '^'){
+        /* Skip past the operator. */
+        source = skip_whitespace(++source);
+        
+        type = parse_pow_ops(ir,
+            error_text,
+            &source,
+            schema,
+            &exponent);
+        
+        if(type != eTermNode)
             return type;
+        
+        node = DC_IR_AddBinary(ir, eIRPow, node, exponent);
     }
-    fputs("INTERNAL ERROR\n", stderr);
-    abort();
-    return 0;
+    
+    source_ptr[0] = source;
+    out_node[0] = node;
+    return eTermNode;
 }
 
-/* Implements parsing terms separated by `/' and `*' */
-static enum TermResultType parse_mul_ops(struct DC_X_Context *ctx,
-    struct DC_X_CalculationBuilder *bld,
-    struct DC_Bytecode *bc,
+/* Implements parsing terms separated by `/' and `*', calling into
+ * parse_pow_ops for each term. */
+static enum TermResultType parse_mul_ops(struct DC_IR *ir,
     char error_text[0x100],
     const char **source_ptr,
-    unsigned num_args,
-    const char *const *arg_names,
-    union TermType *out_term){
+    const struct DC_ArgSchema *schema,
+    unsigned *out_node){
     
-    return parse_generic(ctx,
-        bld,
-        bc,
+    return parse_generic(ir,
         error_text,
         source_ptr,
-        num_args,
-        arg_names,
-        out_term,
-        parse_term,
+        schema,
+        out_node,
+        parse_pow_ops,
         dc_mul_ops,
         DC_NUM_MUL_OPS);
 }
 
 /* Implements parsing terms separated by `+' and `-', calling into
  * parse_mul_ops for each term. */
-static enum TermResultType parse_add_ops(struct DC_X_Context *ctx,
-    struct DC_X_CalculationBuilder *bld,
-    struct DC_Bytecode *bc,
+static enum TermResultType parse_add_ops(struct DC_IR *ir,
     char error_text[0x100],
     const char **source_ptr,
-    unsigned num_args,
-    const char *const *arg_names,
-    union TermType *out_term){
+    const struct DC_ArgSchema *schema,
+    unsigned *out_node){
     
-    return parse_generic(ctx,
-        bld,
-        bc,
+    return parse_generic(ir,
         error_text,
         source_ptr,
-        num_args,
-        arg_names,
-        out_term,
+        schema,
+        out_node,
         parse_mul_ops,
         dc_add_ops,
         DC_NUM_ADD_OPS);
 }
 
+/* Defines a comparison operator. swap is set for `>' and `>=', which are
+ * created as `<' and `<=' with the operands reversed. */
+struct CompareOperation {
+    char text[3];
+    unsigned char swap;
+    enum DC_IR_Op op;
+};
+
+/* Two character operators must come before the one character operators that
+ * they start with. */
+#define DC_NUM_COMPARE_OPS 6
+static const struct CompareOperation dc_compare_ops[DC_NUM_COMPARE_OPS] = {
+    {"<=", 0, eIRLessEqual},
+    {">=", 1, eIRLessEqual},
+    {"==", 0, eIREqual},
+    {"!=", 0, eIRNotEqual},
+    {"<", 0, eIRLess},
+    {">", 1, eIRLess}
+};
+
+/* Implements parsing sums separated by comparison operators, calling into
+ * parse_add_ops for each sum. */
+static enum TermResultType parse_compare_ops(struct DC_IR *ir,
+    char error_text[0x100],
+    const char **source_ptr,
+    const struct DC_ArgSchema *schema,
+    unsigned *out_node){
+    
+    unsigned node;
+    const char *source;
+    enum TermResultType type = parse_add_ops(
+        ir, error_text, source_ptr, schema, &node);
+    
+    if(type != eTermNode)
+        return type;
+    
+    source = skip_whitespace(*source_ptr);
+    while(*source != '\0'){
+        unsigned i, next_node, length = 0;
+        for(i = 0; i < DC_NUM_COMPARE_OPS; i++){
+            length = (unsigned)strlen(dc_compare_ops[i].text);
+            if(strncmp(source, dc_compare_ops[i].text, length) == 0)
+                break;
+        }
+        
+        /* We did not find a matching operation. */
+        if(i == DC_NUM_COMPARE_OPS)
+            break;
+        
+        /* Skip past the operator. */
+        source = skip_whitespace(source + length);
+        
+        type = parse_add_ops(ir,
+            error_text,
+            &source,
+            schema,
+            &next_node);
+        
+        if(type != eTermNode)
+            return type;
+        
+        source = skip_whitespace(source);
+        node = dc_compare_ops[i].swap ?
+            DC_IR_AddBinary(ir, dc_compare_ops[i].op, next_node, node) :
+            DC_IR_AddBinary(ir, dc_compare_ops[i].op, node, next_node);
+    }
+    
+    source_ptr[0] = source;
+    out_node[0] = node;
+    return eTermNode;
+}
+
+/* Implements parsing `<comparison> ? <expression> : <expression>'. The
+ * condition is true for any value other than zero. */
+static enum TermResultType parse_select(struct DC_IR *ir,
+    char error_text[0x100],
+    const char **source_ptr,
+    const struct DC_ArgSchema *schema,
+    unsigned *out_node){
+    
+    unsigned node, if_true, if_false;
+    const char *source;
+    enum TermResultType type = parse_compare_ops(
+        ir, error_text, source_ptr, schema, &node);
+    
+    if(type != eTermNode)
+        return type;
+    
+    source = skip_whitespace(*source_ptr);
+    if(*source == '?'){
+        /* Skip past the operator. */
+        source = skip_whitespace(++source);
+        
+        type = parse_select(ir,
+            error_text,
+            &source,
+            schema,
+            &if_true);
+        
+        if(type != eTermNode)
+            return type;
+        
+        source = skip_whitespace(source);
+        if(*source != ':'){
+            DC_STRNCPY(error_text, 0xFF, "Expected :");
+            return eTermSyntaxError;
+        }
+        source = skip_whitespace(++source);
+        
+        type = parse_select(ir,
+            error_text,
+            &source,
+            schema,
+            &if_false);
+        
+        if(type != eTermNode)
+            return type;
+        
+        node = DC_IR_AddSelect(ir, node, if_true, if_false);
+    }
+    
+    source_ptr[0] = source;
+    out_node[0] = node;
+    return eTermNode;
+}
+
+/* Implements parsing a whole calculation, which is any number of bindings
+ * followed by the expression for the result:
+ *   let <name> = <expression>; ... <expression>
+ * Bound names refer to the node of their expression, so a bound value is only
+ * calculated once no matter how many times it is used. */
+static enum TermResultType parse_calculation(struct DC_IR *ir,
+    char error_text[0x100],
+    const char **source_ptr,
+    const struct DC_ArgSchema *schema,
+    unsigned *out_node){
+    
+    const char *source = source_ptr[0];
+    while(strncmp(source, "let", 3) == 0 &&
+        skip_whitespace(source + 3) != source + 3){
+        
+        const char *name;
+        unsigned length, node;
+        enum TermResultType type;
+        
+        name = skip_whitespace(source + 3);
+        length = name_length(name);
+        if(length == 0){
+            DC_STRNCPY(error_text, 0xFF, "Expected a name after let");
+            return eTermSyntaxError;
+        }
+        
+        source = skip_whitespace(name + length);
+        if(*source != '=' || source[1] == '='){
+            DC_STRNCPY(error_text, 0xFF, "Expected =");
+            return eTermSyntaxError;
+        }
+        source = skip_whitespace(source + 1);
+        
+        type = parse_select(ir,
+            error_text,
+            &source,
+            schema,
+            &node);
+        
+        if(type != eTermNode)
+            return type;
+        
+        source = skip_whitespace(source);
+        if(*source != ';'){
+            DC_STRNCPY(error_text, 0xFF, "Expected ;");
+            return eTermSyntaxError;
+        }
+        source = skip_whitespace(source + 1);
+        
+        /* The name is bound after its expression, so it can't refer to
+         * itself. */
+        DC_IR_Bind(ir, name, length, node);
+    }
+    
+    source_ptr[0] = source;
+    return parse_select(ir,
+        error_text,
+        source_ptr,
+        schema,
+        out_node);
+}
+
+/* Whitespace after these characters, or before the second set, never changes
+ * how a calculation is parsed. */
+#define DC_CACHE_BEFORE_SPACE ")(*/^,;?:"
+#define DC_CACHE_AFTER_SPACE ")*/^,;?:+-<>"
+
+/* The number of options at the start of cache keys. */
+#define DC_CACHE_NUM_OPTIONS 3
+
+/* Makes the cache key for a calculation. This holds the options that change
+ * the generated code, the argument names, and the source with any whitespace
+ * that is not needed removed. */
+static char *dc_cache_key(const struct DC_Context *ctx,
+    const char *source,
+    const struct DC_ArgSchema *schema,
+    unsigned long *out_length){
+    
+    static const int options[DC_CACHE_NUM_OPTIONS] = {
+        DC_OPTION_FAST_TRIG,
+        DC_OPTION_DOUBLE,
+        DC_OPTION_FAST_MATH
+    };
+    const unsigned num_options = DC_CACHE_NUM_OPTIONS;
+    unsigned long size = num_options + 16 + strlen(source), length = 0;
+    unsigned i;
+    char *key;
+    
+    for(i = 0; i < schema->num_args; i++)
+        size += strlen(schema->arg_names[i]) + 1;
+    key = malloc(size);
+    
+    for(i = 0; i < num_options; i++)
+        key[length++] = (char)('0' + (DC_X_GetOption(ctx->x, options[i]) != 0));
+    
+    /* The names cannot contain a NUL, so this is the same for two schemas
+     * only if they have the same names. */
+    length += sprintf(key + length, "%u:", schema->num_args);
+    for(i = 0; i < schema->num_args; i++){
+        const unsigned long name_size = strlen(schema->arg_names[i]) + 1;
+        memcpy(key + length, schema->arg_names[i], name_size);
+        length += name_size;
+    }
+    
+    source = skip_whitespace(source);
+    while(*source != '\0'){
+        const char c = *source;
+        const char *const next = skip_whitespace(source + 1);
+        key[length++] = c;
+        if(next != source + 1 &&
+            *next != '\0' &&
+            strchr(DC_CACHE_BEFORE_SPACE, c) == NULL &&
+            strchr(DC_CACHE_AFTER_SPACE, *next) == NULL){
+            key[length++] = ' ';
+        }
+        source = next;
+    }
+    
+    assert(length <= size);
+    out_length[0] = length;
+    return key;
+}
+
+/* Writes the expression at root to a new backend calculation, with the options
+ * that calc was compiled with. */
+static struct DC_X_Calculation *dc_lower_calculation(struct DC_X_Context *ctx,
+    const struct DC_IR *ir,
+    unsigned root,
+    const struct DC_Calculation *calc){
+    
+    struct DC_X_CalculationBuilder *const bld =
+        DC_X_CreateCalculationBuilder(ctx);
+    DC_X_SetBuilderOption(ctx, bld, DC_OPTION_DOUBLE, calc->use_double);
+    DC_X_SetBuilderOption(ctx, bld, DC_OPTION_FAST_TRIG, calc->fast_trig);
+    DC_IR_Lower(ir, root, ctx, bld, NULL);
+    return DC_X_FinalizeCalculation(ctx, bld);
+}
+
+/* Creates a calculation of the expression at root. The calculation is tiered
+ * if DC_OPTION_TIER_THRESHOLD is set and bytecode is supported, and otherwise
+ * it is compiled by the backend right away. Returns NULL if the backend could
+ * not compile it. */
+static struct DC_Calculation *dc_create_calculation(struct DC_Context *ctx,
+    const struct DC_IR *ir,
+    unsigned root){
+    
+    struct DC_Calculation *const calc = malloc(sizeof(struct DC_Calculation));
+    calc->ctx = ctx;
+    calc->bc = (ctx->tier_threshold != 0) ? DC_BC_CreateBytecode() : NULL;
+    calc->ir = NULL;
+    calc->ir_length = 0;
+    calc->num_calls = 0;
+    calc->use_double = DC_X_GetOption(ctx->x, DC_OPTION_DOUBLE);
+    calc->fast_trig = DC_X_GetOption(ctx->x, DC_OPTION_FAST_TRIG);
+    calc->next_tiered = NULL;
+    calc->prev_tiered = NULL;
+    
+    dc_lock(ctx);
+    if(calc->bc == NULL){
+        calc->x = dc_lower_calculation(ctx->x, ir, root, calc);
+    }
+    else{
+        calc->x = NULL;
+        DC_IR_Lower(ir, root, ctx->x, NULL, calc->bc);
+        calc->ir_length = DC_IR_Serialize(ir, root, &(calc->ir));
+        calc->next_tiered = ctx->tiered;
+        if(ctx->tiered != NULL)
+            ctx->tiered->prev_tiered = calc;
+        ctx->tiered = calc;
+    }
+    dc_unlock(ctx);
+    if(calc->bc == NULL && calc->x == NULL){
+        free(calc);
+        return NULL;
+    }
+    return calc;
+}
+
+/* Removes a calculation from the list of tiered calculations if it is in the
+ * list, and frees its nodes. The context must be locked. */
+static void dc_untier_calculation(struct DC_Context *ctx,
+    struct DC_Calculation *calc){
+    
+    /* Calculations that are not in the list have no links. */
+    if(calc->prev_tiered != NULL)
+        calc->prev_tiered->next_tiered = calc->next_tiered;
+    else if(ctx->tiered == calc)
+        ctx->tiered = calc->next_tiered;
+    if(calc->next_tiered != NULL)
+        calc->next_tiered->prev_tiered = calc->prev_tiered;
+    calc->next_tiered = NULL;
+    calc->prev_tiered = NULL;
+    free(calc->ir);
+    calc->ir = NULL;
+}
+
+/* Compiles a tiered calculation with the backend, using the options that it
+ * was compiled with. Returns zero if the backend could not compile it, in which
+ * case the calculation stays tiered and counts its calls again from zero. The
+ * context must be locked. */
+static int dc_promote_calculation(struct DC_Context *ctx,
+    struct DC_Calculation *calc){
+    
+    struct DC_X_Calculation *x_calc;
+    struct DC_IR ir;
+    unsigned root;
+    int ok;
+    
+    DC_IR_Init(&ir);
+    ok = DC_IR_Deserialize(&ir, calc->ir, calc->ir_length, 0xFFFF, &root);
+    assert(ok);
+    (void)ok;
+    x_calc = dc_lower_calculation(ctx->x, &ir, root, calc);
+    DC_IR_Destroy(&ir);
+    if(x_calc == NULL){
+        calc->num_calls = 0;
+        return 0;
+    }
+    
+    DC_WRITE_BARRIER();
+    calc->x = x_calc;
+    dc_untier_calculation(ctx, calc);
+    return 1;
+}
+
+unsigned DC_API_CALL DC_PromoteCalculations(struct DC_Context *ctx){
+    struct DC_Calculation *calc;
+    unsigned num_promoted = 0;
+    dc_lock(ctx);
+    calc = ctx->tiered;
+    while(calc != NULL){
+        struct DC_Calculation *const next = calc->next_tiered;
+        if(calc->num_calls >= ctx->tier_threshold &&
+            dc_promote_calculation(ctx, calc)){
+            
+            num_promoted++;
+        }
+        calc = next;
+    }
+    dc_unlock(ctx);
+    return num_promoted;
+}
+
+/* Finds a calculation in the cache, if the cache is in use. Entries that were
+ * loaded from a file or whose calculation was freed are lowered again from
+ * their nodes, using ir. If the calculation is not found, out_key is set to
+ * the key to add the calculation with once it is compiled. out_key is set to
+ * NULL if the cache is not in use, or if the calculation was found but the
+ * backend could not compile it. */
+static struct DC_Calculation *dc_find_cached(struct DC_Context *ctx,
+    struct DC_IR *ir,
+    const char *source,
+    const struct DC_ArgSchema *schema,
+    char **out_key,
+    unsigned long *out_key_length){
+    
+    struct DC_CacheEntry *entry;
+    if(!ctx->use_cache){
+        out_key[0] = NULL;
+        return NULL;
+    }
+    
+    out_key[0] = dc_cache_key(ctx, source, schema, out_key_length);
+    entry = DC_Cache_Find(&(ctx->cache), out_key[0], out_key_length[0]);
+    if(entry == NULL)
+        return NULL;
+    
+    free(out_key[0]);
+    out_key[0] = NULL;
+    if(entry->calc == NULL){
+        struct DC_Calculation *calc;
+        unsigned root;
+        int ok;
+        DC_IR_Clear(ir);
+        ok = DC_IR_Deserialize(ir,
+            DC_CACHE_ENTRY_DATA(entry),
+            entry->data_length,
+            schema->num_args,
+            &root);
+        /* Entries are checked when they are loaded. */
+        assert(ok);
+        (void)ok;
+        if((calc = dc_create_calculation(ctx, ir, root)) == NULL){
+            /* The caller parses the source again, and reports the error. */
+            DC_IR_Clear(ir);
+            return NULL;
+        }
+        DC_Cache_Use(&(ctx->cache), entry, calc);
+    }
+    else{
+        DC_Cache_Use(&(ctx->cache), entry, NULL);
+    }
+    return entry->calc;
+}
+
+/* Adds a new calculation to the cache with the nodes it was compiled from, if
+ * it was not found by dc_find_cached, and frees the key. */
+static void dc_add_cached(struct DC_Context *ctx,
+    char *key,
+    unsigned long key_length,
+    const struct DC_IR *ir,
+    unsigned root,
+    struct DC_Calculation *calc){
+    
+    if(key != NULL){
+        if(calc != NULL){
+            unsigned char *data;
+            const unsigned long data_length =
+                DC_IR_Serialize(ir, root, &data);
+            struct DC_CacheEntry *const entry = DC_Cache_Add(&(ctx->cache),
+                key,
+                key_length,
+                data,
+                data_length);
+            DC_Cache_Use(&(ctx->cache), entry, calc);
+            free(data);
+        }
+        free(key);
+    }
+}
+
+/* Checks an entry from a cache file. The key starts with the options, and
+ * then the number of arguments, see dc_cache_key. */
+static int dc_validate_cached(const char *key,
+    unsigned long key_length,
+    const unsigned char *data,
+    unsigned long data_length){
+    
+    unsigned long i, num_args = 0;
+    for(i = DC_CACHE_NUM_OPTIONS;
+        i < key_length && key[i] >= '0' && key[i] <= '9';
+        i++){
+        
+        num_args = (num_args * 10) + (key[i] - '0');
+        if(num_args > 0xFFFF)
+            return 0;
+    }
+    if(i == DC_CACHE_NUM_OPTIONS || i == key_length || key[i] != ':')
+        return 0;
+    return DC_IR_Deserialize(NULL, data, data_length, (unsigned)num_args, NULL);
+}
+
+/* Tags cache files with the version of the nodes, since the data in the
+ * entries is serialized nodes. */
+#define DC_CACHE_TAG "ir1"
+
+int DC_API_CALL DC_SaveCache(const struct DC_Context *ctx, const char *path){
+    return DC_Cache_Save(&(ctx->cache), path, DC_CACHE_TAG);
+}
+
+int DC_API_CALL DC_LoadCache(struct DC_Context *ctx, const char *path){
+    const int num_loaded =
+        DC_Cache_Load(&(ctx->cache), path, DC_CACHE_TAG, dc_validate_cached);
+    return (num_loaded < 0) ? 0 : num_loaded;
+}
+
+void DC_API_CALL DC_ClearCache(struct DC_Context *ctx){
+    DC_Cache_Clear(&(ctx->cache));
+}
+
+/* The error for calculations that the backend could not compile, which only
+ * happens when it could not get memory for the code. */
+static const char dc_backend_error[] = "Out of memory for the code";
+
+/* Copies an error message for out_error, to be freed with DC_FreeError. */
+static const char *dc_copy_error(const char *error_msg){
+    const unsigned error_len = (unsigned)strnlen(error_msg, 0x100);
+    char *const error_txt = malloc(error_len+1);
+    memcpy(error_txt, error_msg, error_len);
+    error_txt[error_len] = '\0';
+    return error_txt;
+}
+
 DC_CalculationPtr DC_API_CALL DC_CompileCalculation(struct DC_Context *dc_ctx,
     const char *source,
     unsigned num_args,
@@ -835,115 +1421,143 @@ void DC_API DC_Compile(struct DC_Context *dc_ctx,
     DC_CalculationPtr *out_optional_calculation,
     DC_BytecodePtr *out_optional_bytecode){
     
-    struct DC_X_Context *const ctx = (struct DC_X_Context *)dc_ctx;
+    struct DC_ArgSchema schema;
+    dc_init_arg_schema(&schema, num_args, arg_names);
+    DC_CompileWithSchema(dc_ctx,
+        source,
+        &schema,
+        out_error,
+        out_optional_calculation,
+        out_optional_bytecode);
+}
+
+void DC_API DC_CompileWithSchema(struct DC_Context *dc_ctx,
+    const char *source,
+    const struct DC_ArgSchema *schema,
+    const char **out_error,
+    DC_CalculationPtr *out_optional_calculation,
+    DC_BytecodePtr *out_optional_bytecode){
+    
+    struct DC_X_Context *const ctx = dc_ctx->x;
     char error_msg[0x100];
+    struct DC_IR ir;
+    unsigned root;
+    char *key = NULL;
+    unsigned long key_length = 0;
     
-    struct DC_X_CalculationBuilder *const bld =
-        (out_optional_calculation) ?
-        DC_X_CreateCalculationBuilder(ctx) : NULL;
-    struct DC_Bytecode *const bc =
-        (out_optional_bytecode) ?
-        DC_BC_CreateBytecode() : NULL;
-    union TermType term;
+    DC_IR_Init(&ir);
+    
+    /* Bytecode is not cached, so the cache is only used when just the
+     * calculation is being compiled. */
+    if(out_optional_calculation != NULL && out_optional_bytecode == NULL){
+        struct DC_Calculation *const calc =
+            dc_find_cached(dc_ctx, &ir, source, schema, &key, &key_length);
+        if(calc != NULL){
+            out_error[0] = NULL;
+            out_optional_calculation[0] = calc;
+            DC_IR_Destroy(&ir);
+            return;
+        }
+    }
     
+    ir.fast_math = DC_X_GetOption(ctx, DC_OPTION_FAST_MATH);
     source = skip_whitespace(source);
-
     
-    switch(parse_add_ops(ctx,
-        bld,
-        bc,
+    if(parse_calculation(&ir,
         error_msg,
         &source,
-        num_args,
-        arg_names,
-        &term)){
-            case eTermImmediate:
-                dc_build_push_imm(ctx, bld, bc, (float)term.immediate);
-                out_error[0] = NULL;
-                if(out_optional_calculation){
-                    out_optional_calculation[0] =
-                        (struct DC_Calculation *)DC_X_FinalizeCalculation(ctx,
-                            bld);
-                }
-                if(out_optional_bytecode)
-                    out_optional_bytecode[0] = bc;
-                return;
-            case eTermArgument:
-                dc_build_push_arg(ctx, bld, bc, term.argument);
-                /* FALLTHROUGH */
-            case eTermPushed:
-                out_error[0] = NULL;
-                if(out_optional_calculation){
-                    out_optional_calculation[0] =
-                        (struct DC_Calculation *)DC_X_FinalizeCalculation(ctx,
-                            bld);
-                }
-                if(out_optional_bytecode)
-                    out_optional_bytecode[0] = bc;
-                return;
-            default:
-                {
-                    const unsigned error_len =
-                        (unsigned)strnlen(error_msg, 0x100);
-                    char *const error_txt = malloc(error_len+1);
-                    out_error[0] = memcpy(error_txt, error_msg, error_len);
-                    error_txt[error_len] = '\0';
-                }
-                if(out_optional_calculation)
-                    out_optional_calculation[0] = NULL;
-                if(out_optional_bytecode)
-                    out_optional_bytecode[0] = NULL;
-                return;
+        schema,
+        &root) == eTermNode){
+        
+        out_error[0] = NULL;
+        if(out_optional_calculation){
+            struct DC_Calculation *const calc =
+                dc_create_calculation(dc_ctx, &ir, root);
+            dc_add_cached(dc_ctx, key, key_length, &ir, root, calc);
+            key = NULL;
+            out_optional_calculation[0] = calc;
+            if(calc == NULL)
+                out_error[0] = dc_copy_error(dc_backend_error);
+        }
+        if(out_optional_bytecode){
+            struct DC_Bytecode *const bc = DC_BC_CreateBytecode();
+            DC_IR_Lower(&ir, root, ctx, NULL, bc);
+            out_optional_bytecode[0] = bc;
+        }
+    }
+    else{
+        out_error[0] = dc_copy_error(error_msg);
+        if(out_optional_calculation)
+            out_optional_calculation[0] = NULL;
+        if(out_optional_bytecode)
+            out_optional_bytecode[0] = NULL;
     }
-    fputs("INTERNAL ERROR\n", stderr);
-    abort();
+    free(key);
+    DC_IR_Destroy(&ir);
 }
 
-int DC_API_CALL DC_CompileCalculations(struct DC_Context *dc_ctx,
+/* Implements DC_CompileCalculations and DC_CompileCalculationsWithSchemas.
+ * If schemas is NULL, then each calculation uses a schema of its num_args and
+ * arg_names_array elements. */
+static int dc_compile_calculations(struct DC_Context *dc_ctx,
     int flags,
     unsigned num_calculations,
     const char *const *sources,
-    unsigned *num_args,
+    const unsigned *num_args,
     const char *const *const *arg_names_array,
+    const struct DC_ArgSchema *const *schemas,
     struct DC_Calculation **out_calculations,
     const char **out_error){
     
-    struct DC_X_Context *const ctx = (struct DC_X_Context *)dc_ctx;
+    struct DC_X_Context *const ctx = dc_ctx->x;
     char error_msg[0x100];
     unsigned i, first_error = 0;
+    struct DC_IR ir;
     
+    DC_IR_Init(&ir);
+    ir.fast_math = DC_X_GetOption(ctx, DC_OPTION_FAST_MATH);
     for(i = 0; i < num_calculations; i++){
-        struct DC_X_CalculationBuilder *const bld =
-            DC_X_CreateCalculationBuilder(ctx);
         const char *source = skip_whitespace(sources[i]);
-        const unsigned nargs = num_args[i];
-        const char *const *const args = arg_names_array[i];
-        union TermType term;
-        const enum TermResultType type = parse_add_ops(ctx,
-            bld, NULL, error_msg, &source, nargs, args, &term);
-        if(type == eTermImmediate){
-            DC_X_BuildPushImmediate(ctx, bld, (float)term.immediate);
-            out_calculations[i] = (struct DC_Calculation *)
-                DC_X_FinalizeCalculation(ctx, bld);
-            out_error[i] = NULL;
+        struct DC_ArgSchema arg_schema;
+        const struct DC_ArgSchema *schema;
+        unsigned root;
+        enum TermResultType type;
+        struct DC_Calculation *calc;
+        char *key;
+        unsigned long key_length;
+        
+        if(schemas != NULL){
+            schema = schemas[i];
         }
-        else if(type == eTermArgument){
-            DC_X_BuildPushArg(ctx, bld, term.argument);
-            out_calculations[i] = (struct DC_Calculation *)
-                DC_X_FinalizeCalculation(ctx, bld);
+        else{
+            dc_init_arg_schema(&arg_schema, num_args[i], arg_names_array[i]);
+            schema = &arg_schema;
+        }
+        
+        calc = dc_find_cached(dc_ctx, &ir, source, schema, &key, &key_length);
+        if(calc != NULL){
+            out_calculations[i] = calc;
             out_error[i] = NULL;
+            continue;
+        }
+        
+        /* The nodes are reused between calculations. */
+        DC_IR_Clear(&ir);
+        type = parse_calculation(&ir, error_msg, &source, schema, &root);
+        if(type == eTermNode){
+            calc = dc_create_calculation(dc_ctx, &ir, root);
+            dc_add_cached(dc_ctx, key, key_length, &ir, root, calc);
+            key = NULL;
         }
-        else if(type == eTermPushed){
-            out_calculations[i] = (struct DC_Calculation *)
-                DC_X_FinalizeCalculation(ctx, bld);
+        if(calc != NULL){
+            out_calculations[i] = calc;
             out_error[i] = NULL;
         }
         else{
-            const unsigned error_len = (unsigned)strnlen(error_msg, 0x100);
-            char *const error_txt = malloc(error_len+1);
-            out_error[i] = memcpy(error_txt, error_msg, error_len);
-            error_txt[error_len] = '\0';
+            out_error[i] = dc_copy_error(
+                (type == eTermNode) ? dc_backend_error : error_msg);
             out_calculations[i] = NULL;
+            free(key);
             
             first_error = i+1;
             if((flags & DC_COMPILE_KEEP_GOING) == 0){
@@ -954,18 +1568,317 @@ int DC_API_CALL DC_CompileCalculations(struct DC_Context *dc_ctx,
             }
         }
     }
+    DC_IR_Destroy(&ir);
     return first_error;
 }
 
+int DC_API_CALL DC_CompileCalculations(struct DC_Context *dc_ctx,
+    int flags,
+    unsigned num_calculations,
+    const char *const *sources,
+    unsigned *num_args,
+    const char *const *const *arg_names_array,
+    struct DC_Calculation **out_calculations,
+    const char **out_error){
+    
+    return dc_compile_calculations(dc_ctx,
+        flags,
+        num_calculations,
+        sources,
+        num_args,
+        arg_names_array,
+        NULL,
+        out_calculations,
+        out_error);
+}
+
+int DC_API_CALL DC_CompileCalculationsWithSchemas(struct DC_Context *dc_ctx,
+    int flags,
+    unsigned num_calculations,
+    const char *const *sources,
+    const struct DC_ArgSchema *const *schemas,
+    struct DC_Calculation **out_calculations,
+    const char **out_error){
+    
+    return dc_compile_calculations(dc_ctx,
+        flags,
+        num_calculations,
+        sources,
+        NULL,
+        NULL,
+        schemas,
+        out_calculations,
+        out_error);
+}
+
+DC_CalculationPtr DC_API_CALL DC_Specialize(struct DC_Context *dc_ctx,
+    const char *source,
+    unsigned num_args,
+    const char *const *arg_names,
+    unsigned long mask,
+    const double *values,
+    const char **out_error){
+    
+    struct DC_X_Context *const ctx = dc_ctx->x;
+    const int use_double = DC_X_GetOption(ctx, DC_OPTION_DOUBLE);
+    char error_msg[0x100];
+    double bound_values[DC_IR_MAX_BOUND_ARGS];
+    struct DC_ArgSchema schema;
+    struct DC_Calculation *calc = NULL;
+    struct DC_IR ir;
+    unsigned i, root;
+    
+    /* Bound values are rounded the same as arguments would be, so that the
+     * specialized calculation gives the same results. */
+    for(i = 0; i < num_args && i < DC_IR_MAX_BOUND_ARGS; i++){
+        if((mask >> i) & 1)
+            bound_values[i] = use_double ? values[i] : (float)values[i];
+    }
+    
+    dc_init_arg_schema(&schema, num_args, arg_names);
+    DC_IR_Init(&ir);
+    ir.fast_math = DC_X_GetOption(ctx, DC_OPTION_FAST_MATH);
+    ir.bound_args = mask;
+    ir.bound_values = bound_values;
+    source = skip_whitespace(source);
+    
+    /* Specialized calculations are not cached, since the key does not
+     * include the values. */
+    if(parse_calculation(&ir,
+        error_msg,
+        &source,
+        &schema,
+        &root) == eTermNode){
+        
+        calc = dc_create_calculation(dc_ctx, &ir, root);
+        out_error[0] =
+            (calc == NULL) ? dc_copy_error(dc_backend_error) : NULL;
+    }
+    else{
+        out_error[0] = dc_copy_error(error_msg);
+    }
+    DC_IR_Destroy(&ir);
+    return calc;
+}
+
+DC_CalculationPtr DC_API_CALL DC_CompileFromBytecode(struct DC_Context *dc_ctx,
+    const struct DC_Bytecode *bc,
+    unsigned num_args){
+    
+    struct DC_Calculation *calc = NULL;
+    struct DC_IR ir;
+    unsigned root;
+    
+    /* The bytecode is read back into the IR, so it is optimized and lowered
+     * the same as a parsed calculation. These are not cached, since there is
+     * no source to make a key from. */
+    DC_IR_Init(&ir);
+    ir.fast_math = DC_X_GetOption(dc_ctx->x, DC_OPTION_FAST_MATH);
+    if(bc != NULL && DC_BC_ToIR(bc, num_args, &ir, &root))
+        calc = dc_create_calculation(dc_ctx, &ir, root);
+    DC_IR_Destroy(&ir);
+    return calc;
+}
+
+DC_GradientPtr DC_API_CALL DC_CompileGradient(struct DC_Context *dc_ctx,
+    const char *source,
+    unsigned num_args,
+    const char *const *arg_names,
+    const char **out_error){
+    
+    char error_msg[0x100];
+    struct DC_ArgSchema schema;
+    struct DC_Gradient *grad = NULL;
+    struct DC_IR ir;
+    unsigned i, root;
+    
+    dc_init_arg_schema(&schema, num_args, arg_names);
+    DC_IR_Init(&ir);
+    ir.fast_math = DC_X_GetOption(dc_ctx->x, DC_OPTION_FAST_MATH);
+    source = skip_whitespace(source);
+    
+    if(parse_calculation(&ir,
+        error_msg,
+        &source,
+        &schema,
+        &root) == eTermNode){
+        
+        /* Every derivative is added to the same IR, and they are all lowered
+         * into one calculation, so the nodes that they share with the value
+         * and with each other are only calculated once. */
+        unsigned *const roots = malloc(sizeof(unsigned) * (num_args + 1));
+        struct DC_X_CalculationBuilder *bld;
+        struct DC_X_Calculation *x_calc;
+        roots[0] = root;
+        for(i = 0; i < num_args; i++)
+            roots[i + 1] = DC_IR_Differentiate(&ir, root, (unsigned short)i);
+        
+        dc_lock(dc_ctx);
+        bld = DC_X_CreateCalculationBuilder(dc_ctx->x);
+        DC_IR_LowerResults(&ir,
+            roots,
+            num_args + 1,
+            (unsigned short)num_args,
+            dc_ctx->x,
+            bld);
+        x_calc = DC_X_FinalizeCalculation(dc_ctx->x, bld);
+        dc_unlock(dc_ctx);
+        free(roots);
+        
+        if(x_calc != NULL){
+            grad = malloc(sizeof(struct DC_Gradient));
+            grad->x = x_calc;
+            grad->num_args = num_args;
+            grad->use_double = DC_X_GetOption(dc_ctx->x, DC_OPTION_DOUBLE);
+            out_error[0] = NULL;
+        }
+        else{
+            out_error[0] = dc_copy_error(dc_backend_error);
+        }
+    }
+    else{
+        out_error[0] = dc_copy_error(error_msg);
+    }
+    DC_IR_Destroy(&ir);
+    return grad;
+}
 
 void DC_API_CALL DC_FreeError(const char *error){
     free((void*)error);
 }
 
 void DC_API_CALL DC_Free(struct DC_Context *ctx, struct DC_Calculation *calc){
-    DC_X_Free((struct DC_X_Context *)ctx, (struct DC_X_Calculation*)calc);
+    if(DC_Cache_Release(&(ctx->cache), calc)){
+        dc_lock(ctx);
+        if(calc->x != NULL)
+            DC_X_Free(ctx->x, calc->x);
+        else
+            dc_untier_calculation(ctx, calc);
+        dc_unlock(ctx);
+        DC_BC_FreeBytecode(calc->bc);
+        free(calc);
+    }
+}
+
+void DC_API_CALL DC_FreeGradient(struct DC_Context *ctx,
+    struct DC_Gradient *grad){
+    
+    dc_lock(ctx);
+    DC_X_Free(ctx->x, grad->x);
+    dc_unlock(ctx);
+    free(grad);
+}
+
+/* Counts calls to a calculation that has not been promoted, and promotes it
+ * once it reaches the threshold. Calls on other threads can race to update the
+ * count, which at worst delays the promotion slightly. If the context is locked
+ * by a compile or a promotion on another thread, this keeps interpreting and a
+ * later call promotes the calculation instead. */
+static void dc_count_calls(const struct DC_Calculation *calc, unsigned n){
+    struct DC_Calculation *const tiered = (struct DC_Calculation *)calc;
+    struct DC_Context *const ctx = tiered->ctx;
+    tiered->num_calls += n;
+    if(tiered->num_calls >= ctx->tier_threshold && DC_TRY_LOCK(ctx->lock)){
+        /* Another thread could have promoted it first. */
+        if(tiered->x == NULL)
+            dc_promote_calculation(ctx, tiered);
+        dc_unlock(ctx);
+    }
 }
 
 float DC_API_CALL DC_Calculate(const struct DC_Calculation *calc, const float *args){
-    return DC_X_Calculate((const struct DC_X_Calculation *)calc, args);
+    const struct DC_X_Calculation *const x_calc = calc->x;
+    if(x_calc != NULL)
+        return DC_X_Calculate(x_calc, args);
+    dc_count_calls(calc, 1);
+    return DC_BC_Calculate(calc->bc, calc->use_double, args);
+}
+
+double DC_API_CALL DC_CalculateDouble(const struct DC_Calculation *calc,
+    const double *args){
+    const struct DC_X_Calculation *const x_calc = calc->x;
+    if(x_calc != NULL)
+        return DC_X_CalculateDouble(x_calc, args);
+    dc_count_calls(calc, 1);
+    return DC_BC_CalculateDouble(calc->bc, calc->use_double, args);
+}
+
+DC_NativeFunction DC_API_CALL DC_GetNativeFunction(
+    const struct DC_Calculation *calc){
+    const struct DC_X_Calculation *const x_calc = calc->x;
+    return (x_calc != NULL) ? DC_X_GetNativeFunction(x_calc) : NULL;
+}
+
+void DC_API_CALL DC_CalculateBatch(const struct DC_Calculation *calc,
+    unsigned n,
+    const float *args,
+    float *out){
+    const struct DC_X_Calculation *const x_calc = calc->x;
+    if(x_calc != NULL){
+        DC_X_CalculateBatch(x_calc, n, args, out);
+    }
+    else{
+        dc_count_calls(calc, n);
+        DC_BC_CalculateBatch(calc->bc, calc->use_double, n, args, out);
+    }
+}
+
+/* Runs a gradient with the arguments and results in either precision. Exactly
+ * one of float_args and double_args is not NULL, and the same for the results.
+ * The copy of the arguments is always in the precision that the gradient was
+ * compiled with, since the backend would otherwise convert it into a buffer of
+ * its own and the derivatives would be lost. */
+static void dc_calculate_gradient(const struct DC_Gradient *grad,
+    const float *float_args,
+    const double *double_args,
+    float *float_out,
+    double *double_out){
+    
+    const unsigned num_args = grad->num_args;
+    double stack_buffer[DC_GRADIENT_STACK_ARGS * 2];
+    double *const buffer = (num_args <= DC_GRADIENT_STACK_ARGS) ?
+        stack_buffer : malloc(sizeof(double) * num_args * 2);
+    float *const float_buffer = (float*)buffer;
+    double value;
+    unsigned i;
+    
+    for(i = 0; i < num_args; i++){
+        const double arg =
+            (float_args != NULL) ? float_args[i] : double_args[i];
+        if(grad->use_double)
+            buffer[i] = arg;
+        else
+            float_buffer[i] = (float)arg;
+    }
+    
+    value = grad->use_double ?
+        DC_X_CalculateDouble(grad->x, buffer) :
+        DC_X_Calculate(grad->x, float_buffer);
+    
+    for(i = 0; i <= num_args; i++){
+        const double result = (i == 0) ? value :
+            grad->use_double ?
+                buffer[num_args + i - 1] : float_buffer[num_args + i - 1];
+        if(float_out != NULL)
+            float_out[i] = (float)result;
+        else
+            double_out[i] = result;
+    }
+    
+    if(buffer != stack_buffer)
+        free(buffer);
+}
+
+void DC_API_CALL DC_CalculateGradient(const struct DC_Gradient *grad,
+    const float *args,
+    float *out){
+    
+    dc_calculate_gradient(grad, args, NULL, out, NULL);
+}
+
+void DC_API_CALL DC_CalculateGradientDouble(const struct DC_Gradient *grad,
+    const double *args,
+    double *out){
+    
+    dc_calculate_gradient(grad, NULL, args, NULL, out);
 }
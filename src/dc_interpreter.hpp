@@ -0,0 +1,212 @@
+// Copyright (c) 2018, Transnat Games
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#ifndef LIBDCJIT_DC_INTERPRETER_HPP
+#define LIBDCJIT_DC_INTERPRETER_HPP
+#pragma once
+
+// Interpreter for the bytecode in dc_bytecode.hpp. This is the soft backend,
+// and also runs tiered calculations before they are compiled by the JIT.
+
+#include "dc_bytecode.hpp"
+
+#include <vector>
+#include <math.h>
+#include <assert.h>
+
+namespace DC {
+namespace Bytecode {
+
+// Argument N is read from args[N * stride], which lets batches run directly
+// from their structure-of-arrays arguments. T is the type of the stack, and A
+// is the type of the arguments. stack must have room for bc.stackSize()
+// values, and the temporaries are at its bottom. The ops are not checked here,
+// since the depth of the stack was checked as the bytecode was written.
+template<typename T, typename A>
+inline T Run(const Bytecode &bc,
+    const A *args,
+    unsigned stride,
+    T *stack){
+    
+    Bytecode::iterator iter = bc.begin(), end = bc.end();
+    // top is the next free element of the stack.
+    T *top = stack + bc.numTemps();
+    while(iter != end){
+        switch(iter.opType()){
+            case eImmediate:
+                // Push an immediate onto the stack
+                *top++ = static_cast<T>(iter.readImmediate());
+                continue;
+            case eArgument:
+                // Push an argument onto the stack
+                {
+                    const unsigned short arg_num = iter.readArgument();
+                    *top++ = static_cast<T>(args[arg_num * stride]);
+                }
+                continue;
+            case eStoreTemp:
+                stack[iter.readTemp()] = top[-1];
+                continue;
+            case eStoreArg:
+                // Only calculations with more than one result store, and they
+                // are run with arguments that can be written.
+                {
+                    const unsigned short arg_num = iter.readArgument();
+                    const_cast<A*>(args)[arg_num * stride] =
+                        static_cast<A>(top[-1]);
+                }
+                continue;
+            case ePushTemp:
+                {
+                    const T value = stack[iter.readTemp()];
+                    *top++ = value;
+                }
+                continue;
+            case eUnary:
+                // Get the value to operate on.
+                // All unary ops work on the top value of the stack.
+                {
+                    const T value = top[-1];
+                    switch(iter.readUnaryOp()){
+                        case eSin:
+                            top[-1] = sin(value);
+                            continue;
+                        case eCos:
+                            top[-1] = cos(value);
+                            continue;
+                        case eSqrt:
+                            top[-1] = sqrt(value);
+                            continue;
+                        case eTan:
+                            top[-1] = tan(value);
+                            continue;
+                        case eExp:
+                            top[-1] = exp(value);
+                            continue;
+                        case eLog:
+                            top[-1] = log(value);
+                            continue;
+                        case eAbs:
+                            top[-1] = fabs(value);
+                            continue;
+                        case eFloor:
+                            top[-1] = floor(value);
+                            continue;
+                        case ePop:
+                            top--;
+                            continue;
+                        case eDup:
+                            *top++ = value;
+                            continue;
+                    }
+                }
+                assert(NULL == "Invalid unary op.");
+                continue;
+            case eBinary:
+                {
+                    const T value = *--top;
+                    switch(iter.readBinaryOp()){
+                        case eAdd:
+                            top[-1] += value;
+                            continue;
+                        case eSub:
+                            top[-1] -= value;
+                            continue;
+                        case eMul:
+                            top[-1] *= value;
+                            continue;
+                        case eDiv:
+                            top[-1] /= value;
+                            continue;
+                        case ePow:
+                            top[-1] = pow(top[-1], value);
+                            continue;
+                        case eAtan2:
+                            top[-1] = atan2(top[-1], value);
+                            continue;
+                        // These give the second operand for NaN, the same as
+                        // the JIT.
+                        case eMin:
+                            if(!(top[-1] < value))
+                                top[-1] = value;
+                            continue;
+                        case eMax:
+                            if(!(top[-1] > value))
+                                top[-1] = value;
+                            continue;
+                        case eLess:
+                            top[-1] = (top[-1] < value) ? 1 : 0;
+                            continue;
+                        case eLessEqual:
+                            top[-1] = (top[-1] <= value) ? 1 : 0;
+                            continue;
+                        case eEqual:
+                            top[-1] = (top[-1] == value) ? 1 : 0;
+                            continue;
+                        case eNotEqual:
+                            top[-1] = (top[-1] != value) ? 1 : 0;
+                            continue;
+                    }
+                }
+                assert(NULL == "Invalid binary op.");
+                continue;
+            case eSelect:
+                // A NaN condition is not zero, the same as the JIT.
+                iter.readSelect();
+                {
+                    const T condition = *--top;
+                    const T if_zero = *--top;
+                    if(condition == 0)
+                        top[-1] = if_zero;
+                }
+                continue;
+        }
+        assert(NULL == "Invalid op type.");
+        continue;
+    }
+    
+    assert(top == stack + bc.numTemps() + 1);
+    return top[-1];
+}
+
+// The most values that RunLocal keeps on the C++ stack. Bytecode that needs
+// more than this uses the heap instead, which only very deep expressions do.
+static const unsigned local_stack_size = 64;
+
+// Runs bytecode without allocating.
+template<typename T, typename A>
+inline T RunLocal(const Bytecode &bc, const A *args){
+    if(bc.stackSize() <= local_stack_size){
+        T stack[local_stack_size];
+        return Run(bc, args, 1, stack);
+    }
+    std::vector<T> stack(bc.stackSize());
+    return Run(bc, args, 1, &(stack[0]));
+}
+
+// Runs bytecode on n sets of arguments, see DC_CalculateBatch. The stack is
+// shared between all the sets.
+template<typename T>
+inline void RunBatch(const Bytecode &bc,
+    unsigned n,
+    const float *args,
+    float *out){
+    
+    T local_stack[local_stack_size];
+    std::vector<T> heap_stack;
+    T *stack = local_stack;
+    if(bc.stackSize() > local_stack_size){
+        heap_stack.resize(bc.stackSize());
+        stack = &(heap_stack[0]);
+    }
+    for(unsigned i = 0; i < n; i++)
+        out[i] = static_cast<float>(Run(bc, args + i, n, stack));
+}
+
+} // namespace Bytecode
+} // namespace DC
+
+#endif /* LIBDCJIT_DC_INTERPRETER_HPP */
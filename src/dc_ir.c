@@ -0,0 +1,1423 @@
+/* Copyright (c) 2018, Transnat Games
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include "dc_ir.h"
+#include "dc_bc.h"
+#include "dc_backend.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#define DC_IR_INITIAL_CAPACITY 16
+
+/* Typedef for operations to calculate results on fully pushed values. */
+typedef void (*build_push_operation)(struct DC_X_Context*,
+    struct DC_X_CalculationBuilder*);
+/* Typedef for operations to calculate results with one pushed value and one
+ * argument. The unary operations use this to operate on an argument. */
+typedef void (*build_push_arg_operation)(struct DC_X_Context*,
+    struct DC_X_CalculationBuilder*,
+    unsigned short);
+/* Typedef for operations to calculate results with one pushed value and one
+ * immediate value. */
+typedef void (*build_push_imm_operation)(struct DC_X_Context*,
+    struct DC_X_CalculationBuilder*,
+    double);
+
+/* The same as the above, but for bytecode. */
+typedef void (*bytecode_push_operation)(struct DC_Bytecode*);
+typedef void (*bytecode_push_arg_operation)(struct DC_Bytecode*,
+    unsigned short);
+typedef void (*bytecode_push_imm_operation)(struct DC_Bytecode*, double);
+
+/* Builder callbacks for an operation. Unary operations have no immediate
+ * forms, since those are folded. */
+struct DC_IR_Builders {
+    build_push_operation build_op;
+    build_push_arg_operation build_arg_op;
+    build_push_imm_operation build_imm_op;
+    bytecode_push_operation bytecode_op;
+    bytecode_push_arg_operation bytecode_arg_op;
+    bytecode_push_imm_operation bytecode_imm_op;
+};
+
+#define DC_IR_BINARY_BUILDERS(NAME) {\
+    DC_X_Build ## NAME, DC_X_Build ## NAME ## Arg, DC_X_Build ## NAME ## Imm,\
+    DC_BC_Build ## NAME, DC_BC_Build ## NAME ## Arg, DC_BC_Build ## NAME ## Imm\
+}
+
+#define DC_IR_UNARY_BUILDERS(NAME) {\
+    DC_X_Build ## NAME, DC_X_Build ## NAME ## Arg, NULL,\
+    DC_BC_Build ## NAME, DC_BC_Build ## NAME ## Arg, NULL\
+}
+
+/* Indexed by the op, starting at eIRAdd. Selects have their own builders. */
+static const struct DC_IR_Builders dc_ir_builders[] = {
+    DC_IR_BINARY_BUILDERS(Add),
+    DC_IR_BINARY_BUILDERS(Sub),
+    DC_IR_BINARY_BUILDERS(Mul),
+    DC_IR_BINARY_BUILDERS(Div),
+    DC_IR_BINARY_BUILDERS(Pow),
+    DC_IR_BINARY_BUILDERS(Atan2),
+    DC_IR_BINARY_BUILDERS(Min),
+    DC_IR_BINARY_BUILDERS(Max),
+    DC_IR_BINARY_BUILDERS(Less),
+    DC_IR_BINARY_BUILDERS(LessEqual),
+    DC_IR_BINARY_BUILDERS(Equal),
+    DC_IR_BINARY_BUILDERS(NotEqual),
+    DC_IR_UNARY_BUILDERS(Sin),
+    DC_IR_UNARY_BUILDERS(Cos),
+    DC_IR_UNARY_BUILDERS(Sqrt),
+    DC_IR_UNARY_BUILDERS(Tan),
+    DC_IR_UNARY_BUILDERS(Exp),
+    DC_IR_UNARY_BUILDERS(Log),
+    DC_IR_UNARY_BUILDERS(Abs),
+    DC_IR_UNARY_BUILDERS(Floor)
+};
+
+#define DC_IR_GET_BUILDERS(OP) (dc_ir_builders + ((OP) - eIRAdd))
+
+void DC_IR_Init(struct DC_IR *ir){
+    ir->nodes = NULL;
+    ir->num_nodes = 0;
+    ir->capacity = 0;
+    ir->table = NULL;
+    ir->table_size = 0;
+    ir->fast_math = 0;
+    ir->bindings = NULL;
+    ir->num_bindings = 0;
+    ir->bindings_capacity = 0;
+    ir->bound_args = 0;
+    ir->bound_values = NULL;
+}
+
+void DC_IR_Destroy(struct DC_IR *ir){
+    free(ir->nodes);
+    free(ir->table);
+    free(ir->bindings);
+}
+
+void DC_IR_Clear(struct DC_IR *ir){
+    ir->num_nodes = 0;
+    ir->num_bindings = 0;
+    if(ir->table != NULL)
+        memset(ir->table, 0, sizeof(unsigned) * ir->table_size);
+}
+
+static unsigned dc_ir_hash(const struct DC_IR_Node *node){
+    unsigned long hash = (unsigned long)node->op;
+    if(node->op == eIRImmediate){
+        /* Hash the bits, since -0.0 and 0.0 are different immediates. */
+        const unsigned char *const bytes =
+            (const unsigned char *)&(node->value.immediate);
+        unsigned i;
+        for(i = 0; i < sizeof(double); i++)
+            hash = (hash * 31) + bytes[i];
+    }
+    else if(node->op == eIRArgument){
+        hash = (hash * 31) + node->value.argument;
+    }
+    else{
+        hash = (hash * 31) + node->a;
+        hash = (hash * 31) + node->b;
+        hash = (hash * 31) + node->c;
+    }
+    return (unsigned)(hash ^ (hash >> 16));
+}
+
+static int dc_ir_same_node(const struct DC_IR_Node *x,
+    const struct DC_IR_Node *y){
+    
+    if(x->op != y->op)
+        return 0;
+    if(x->op == eIRImmediate){
+        return memcmp(&(x->value.immediate),
+            &(y->value.immediate),
+            sizeof(double)) == 0;
+    }
+    if(x->op == eIRArgument)
+        return x->value.argument == y->value.argument;
+    return x->a == y->a && x->b == y->b && x->c == y->c;
+}
+
+/* Returns the table entry for a node, which is either the entry that already
+ * has the same node or the empty entry to put it in. */
+static unsigned *dc_ir_find_entry(const struct DC_IR *ir,
+    const struct DC_IR_Node *node){
+    
+    const unsigned mask = ir->table_size - 1;
+    unsigned i = dc_ir_hash(node) & mask;
+    while(ir->table[i] != 0 &&
+        !dc_ir_same_node(ir->nodes + (ir->table[i] - 1), node)){
+        i = (i + 1) & mask;
+    }
+    return ir->table + i;
+}
+
+static void dc_ir_grow_table(struct DC_IR *ir){
+    unsigned i;
+    free(ir->table);
+    ir->table_size = (ir->table_size == 0) ?
+        (DC_IR_INITIAL_CAPACITY * 2) : (ir->table_size << 1);
+    ir->table = calloc(sizeof(unsigned), ir->table_size);
+    for(i = 0; i < ir->num_nodes; i++)
+        dc_ir_find_entry(ir, ir->nodes + i)[0] = i + 1;
+}
+
+/* Returns the index of a node which is the same as node, adding it if there
+ * is not one already. */
+static unsigned dc_ir_intern(struct DC_IR *ir, const struct DC_IR_Node *node){
+    unsigned *entry;
+    if((ir->num_nodes + 1) * 2 > ir->table_size)
+        dc_ir_grow_table(ir);
+    
+    entry = dc_ir_find_entry(ir, node);
+    if(DC_OPTIMIZE_CSE && entry[0] != 0)
+        return entry[0] - 1;
+    
+    if(ir->num_nodes == ir->capacity){
+        ir->capacity = (ir->capacity == 0) ?
+            DC_IR_INITIAL_CAPACITY : (ir->capacity << 1);
+        ir->nodes = realloc(ir->nodes,
+            sizeof(struct DC_IR_Node) * ir->capacity);
+    }
+    ir->nodes[ir->num_nodes] = *node;
+    entry[0] = ++ir->num_nodes;
+    return ir->num_nodes - 1;
+}
+
+unsigned DC_IR_AddImmediate(struct DC_IR *ir, double value){
+    struct DC_IR_Node node;
+    node.op = eIRImmediate;
+    node.a = node.b = node.c = 0;
+    node.value.immediate = value;
+    return dc_ir_intern(ir, &node);
+}
+
+unsigned DC_IR_AddArgument(struct DC_IR *ir, unsigned short arg_num){
+    struct DC_IR_Node node;
+    if(arg_num < DC_IR_MAX_BOUND_ARGS && ((ir->bound_args >> arg_num) & 1))
+        return DC_IR_AddImmediate(ir, ir->bound_values[arg_num]);
+    node.op = eIRArgument;
+    node.a = node.b = node.c = 0;
+    node.value.argument = arg_num;
+    return dc_ir_intern(ir, &node);
+}
+
+/* Calculates an operation on immediates. b is ignored for unary operations. */
+static double dc_ir_fold(enum DC_IR_Op op, double a, double b){
+    switch(op){
+        case eIRAdd: return a + b;
+        case eIRSub: return a - b;
+        case eIRMul: return a * b;
+        case eIRDiv: return a / b;
+        case eIRPow: return pow(a, b);
+        case eIRAtan2: return atan2(a, b);
+        /* The same as minss and maxss, which give b for NaN */
+        case eIRMin: return (a < b) ? a : b;
+        case eIRMax: return (a > b) ? a : b;
+        case eIRLess: return (a < b) ? 1.0 : 0.0;
+        case eIRLessEqual: return (a <= b) ? 1.0 : 0.0;
+        case eIREqual: return (a == b) ? 1.0 : 0.0;
+        case eIRNotEqual: return (a != b) ? 1.0 : 0.0;
+        case eIRSin: return sin(a);
+        case eIRCos: return cos(a);
+        case eIRSqrt: return sqrt(a);
+        case eIRTan: return tan(a);
+        case eIRExp: return exp(a);
+        case eIRLog: return log(a);
+        case eIRAbs: return fabs(a);
+        case eIRFloor: return floor(a);
+        case eIRImmediate: /* FALLTHROUGH */
+        case eIRArgument: /* FALLTHROUGH */
+        case eIRSelect:
+            break;
+    }
+    assert(0 && "Invalid op to fold");
+    return 0.0;
+}
+
+static int dc_ir_is_immediate(const struct DC_IR *ir, unsigned n){
+    return ir->nodes[n].op == eIRImmediate;
+}
+
+#define DC_IR_IMMEDIATE(IR, N) ((IR)->nodes[(N)].value.immediate)
+
+/* Returns if node n is an immediate with exactly the bits of value, so that
+ * 0.0 and -0.0 are told apart. */
+static int dc_ir_is_value(const struct DC_IR *ir, unsigned n, double value){
+    return dc_ir_is_immediate(ir, n) &&
+        memcmp(&DC_IR_IMMEDIATE(ir, n), &value, sizeof(double)) == 0;
+}
+
+/* Returns if node n negates another node, and sets out_operand to that node.
+ * x*-1 and -0.0-x are exactly -x, and 0.0-x is only different for zero. */
+static int dc_ir_get_negated(const struct DC_IR *ir,
+    unsigned n,
+    unsigned *out_operand){
+
+    const struct DC_IR_Node *const node = ir->nodes + n;
+    if(node->op == eIRMul && dc_ir_is_value(ir, node->b, -1.0)){
+        out_operand[0] = node->a;
+        return 1;
+    }
+    if(node->op == eIRSub && (dc_ir_is_value(ir, node->a, -0.0) ||
+        (ir->fast_math && dc_ir_is_value(ir, node->a, 0.0)))){
+        out_operand[0] = node->b;
+        return 1;
+    }
+    return 0;
+}
+
+/* Returns if node n is an operation on an immediate second operand, and sets
+ * out_operand and out_constant to its operands. */
+static int dc_ir_split_constant(const struct DC_IR *ir,
+    enum DC_IR_Op op,
+    unsigned n,
+    unsigned *out_operand,
+    double *out_constant){
+
+    const struct DC_IR_Node *const node = ir->nodes + n;
+    if(node->op == op && dc_ir_is_immediate(ir, node->b)){
+        out_operand[0] = node->a;
+        out_constant[0] = DC_IR_IMMEDIATE(ir, node->b);
+        return 1;
+    }
+    return 0;
+}
+
+/* Returns if node n is an operation on an immediate first operand, and sets
+ * out_constant and out_operand to its operands. */
+static int dc_ir_split_reverse_constant(const struct DC_IR *ir,
+    enum DC_IR_Op op,
+    unsigned n,
+    double *out_constant,
+    unsigned *out_operand){
+
+    const struct DC_IR_Node *const node = ir->nodes + n;
+    if(node->op == op && dc_ir_is_immediate(ir, node->a)){
+        out_constant[0] = DC_IR_IMMEDIATE(ir, node->a);
+        out_operand[0] = node->b;
+        return 1;
+    }
+    return 0;
+}
+
+/* Rewrites of a binary operation which can change how it rounds. Additions
+ * and multiplications are treated as associative, so that constants are moved
+ * outwards through chains of them and then folded together. The operands are
+ * already rewritten, so constants are never more than one level down.
+ *
+ * Returns non-zero and sets out_node if the operation was replaced. */
+static int dc_ir_reassociate(struct DC_IR *ir,
+    enum DC_IR_Op op,
+    unsigned a,
+    unsigned b,
+    unsigned *out_node){
+
+    unsigned x;
+    double c;
+    if(dc_ir_is_immediate(ir, b)){
+        const double imm = DC_IR_IMMEDIATE(ir, b);
+        switch(op){
+            case eIRAdd:
+                /* (x+c)+imm = x+(c+imm), and (c-x)+imm = (c+imm)-x */
+                if(dc_ir_split_constant(ir, eIRAdd, a, &x, &c)){
+                    out_node[0] = DC_IR_AddBinary(ir, eIRAdd,
+                        x, DC_IR_AddImmediate(ir, c + imm));
+                    return 1;
+                }
+                if(dc_ir_split_reverse_constant(ir, eIRSub, a, &c, &x)){
+                    out_node[0] = DC_IR_AddBinary(ir, eIRSub,
+                        DC_IR_AddImmediate(ir, c + imm), x);
+                    return 1;
+                }
+                break;
+            case eIRMul: /* FALLTHROUGH */
+            case eIRDiv:
+                /* (x*c) op imm = x*(c op imm) */
+                if(dc_ir_split_constant(ir, eIRMul, a, &x, &c)){
+                    out_node[0] = DC_IR_AddBinary(ir, eIRMul,
+                        x, DC_IR_AddImmediate(ir, dc_ir_fold(op, c, imm)));
+                    return 1;
+                }
+                /* (x/c)*imm = x*(imm/c), and (x/c)/imm = x/(c*imm) */
+                if(dc_ir_split_constant(ir, eIRDiv, a, &x, &c)){
+                    out_node[0] = (op == eIRMul) ?
+                        DC_IR_AddBinary(ir, eIRMul,
+                            x, DC_IR_AddImmediate(ir, imm / c)) :
+                        DC_IR_AddBinary(ir, eIRDiv,
+                            x, DC_IR_AddImmediate(ir, c * imm));
+                    return 1;
+                }
+                /* (c/x) op imm = (c op imm)/x */
+                if(dc_ir_split_reverse_constant(ir, eIRDiv, a, &c, &x)){
+                    out_node[0] = DC_IR_AddBinary(ir, eIRDiv,
+                        DC_IR_AddImmediate(ir, dc_ir_fold(op, c, imm)), x);
+                    return 1;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    else if(dc_ir_is_immediate(ir, a)){
+        /* Only subtraction and division keep an immediate first operand. */
+        const double imm = DC_IR_IMMEDIATE(ir, a);
+        if(op == eIRSub && dc_ir_split_constant(ir, eIRAdd, b, &x, &c)){
+            /* imm-(x+c) = (imm-c)-x */
+            out_node[0] = DC_IR_AddBinary(ir, eIRSub,
+                DC_IR_AddImmediate(ir, imm - c), x);
+            return 1;
+        }
+        if(op == eIRDiv && dc_ir_split_constant(ir, eIRMul, b, &x, &c)){
+            /* imm/(x*c) = (imm/c)/x */
+            out_node[0] = DC_IR_AddBinary(ir, eIRDiv,
+                DC_IR_AddImmediate(ir, imm / c), x);
+            return 1;
+        }
+    }
+    else{
+        /* Move a constant from either operand out of the operation, so that
+         * it can meet any other constants in the chain. */
+        const enum DC_IR_Op chain_op =
+            (op == eIRAdd || op == eIRSub) ? eIRAdd : eIRMul;
+        if(dc_ir_split_constant(ir, chain_op, a, &x, &c)){
+            /* (x+c)+b = (x+b)+c, (x+c)-b = (x-b)+c, and the same for * and / */
+            out_node[0] = DC_IR_AddBinary(ir, chain_op,
+                DC_IR_AddBinary(ir, op, x, b),
+                DC_IR_AddImmediate(ir, c));
+            return 1;
+        }
+        if(dc_ir_split_constant(ir, chain_op, b, &x, &c)){
+            /* a+(x+c) = (a+x)+c, a-(x+c) = (a-x)+(-c), and a/(x*c) = (a/x)/c */
+            const unsigned rest = DC_IR_AddBinary(ir, op, a, x);
+            switch(op){
+                case eIRSub:
+                    out_node[0] = DC_IR_AddBinary(ir, eIRAdd,
+                        rest, DC_IR_AddImmediate(ir, -c));
+                    break;
+                case eIRDiv:
+                    out_node[0] = DC_IR_AddBinary(ir, eIRDiv,
+                        rest, DC_IR_AddImmediate(ir, c));
+                    break;
+                default:
+                    out_node[0] = DC_IR_AddBinary(ir, op,
+                        rest, DC_IR_AddImmediate(ir, c));
+                    break;
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Rewrites a binary operation into a simpler form. Returns non-zero and sets
+ * out_node if the operation was replaced. Otherwise, op_ptr, a_ptr, and b_ptr
+ * are updated to the canonical form of the operation, which has any immediate
+ * operand of an addition or multiplication second, and subtracts no
+ * immediates.
+ *
+ * Unless the IR has fast_math set, only rewrites which give exactly the same
+ * results are done. */
+static int dc_ir_simplify(struct DC_IR *ir,
+    enum DC_IR_Op *op_ptr,
+    unsigned *a_ptr,
+    unsigned *b_ptr,
+    unsigned *out_node){
+
+    enum DC_IR_Op op = op_ptr[0];
+    unsigned a = a_ptr[0], b = b_ptr[0], negated;
+
+    /* x-imm is exactly x+(-imm) */
+    if(op == eIRSub && dc_ir_is_immediate(ir, b)){
+        op = eIRAdd;
+        b = DC_IR_AddImmediate(ir, -DC_IR_IMMEDIATE(ir, b));
+    }
+    if((op == eIRAdd || op == eIRMul) && dc_ir_is_immediate(ir, a)){
+        const unsigned swap = a;
+        a = b;
+        b = swap;
+    }
+    op_ptr[0] = op;
+    a_ptr[0] = a;
+    b_ptr[0] = b;
+
+#define DC_IR_SIMPLIFIED(NODE) do{ out_node[0] = (NODE); return 1; }while(0)
+
+    switch(op){
+        case eIRAdd:
+            /* x+(-0.0) is exactly x, and x+0.0 is only different for -0.0 */
+            if(dc_ir_is_value(ir, b, -0.0) ||
+                (ir->fast_math && dc_ir_is_value(ir, b, 0.0))){
+                DC_IR_SIMPLIFIED(a);
+            }
+            /* a+(-x) = a-x */
+            if(dc_ir_get_negated(ir, b, &negated))
+                DC_IR_SIMPLIFIED(DC_IR_AddBinary(ir, eIRSub, a, negated));
+            if(dc_ir_get_negated(ir, a, &negated))
+                DC_IR_SIMPLIFIED(DC_IR_AddBinary(ir, eIRSub, b, negated));
+            break;
+        case eIRSub:
+            /* a-(-x) = a+x */
+            if(dc_ir_get_negated(ir, b, &negated))
+                DC_IR_SIMPLIFIED(DC_IR_AddBinary(ir, eIRAdd, a, negated));
+            break;
+        case eIRMul:
+            if(dc_ir_is_value(ir, b, 1.0))
+                DC_IR_SIMPLIFIED(a);
+            /* x*0 is not zero for infinities and NaN */
+            if(ir->fast_math &&
+                dc_ir_is_immediate(ir, b) &&
+                DC_IR_IMMEDIATE(ir, b) == 0.0){
+                DC_IR_SIMPLIFIED(b);
+            }
+            break;
+        case eIRDiv:
+            if(dc_ir_is_value(ir, b, 1.0))
+                DC_IR_SIMPLIFIED(a);
+            if(ir->fast_math &&
+                dc_ir_is_immediate(ir, a) &&
+                DC_IR_IMMEDIATE(ir, a) == 0.0){
+                DC_IR_SIMPLIFIED(a);
+            }
+            break;
+        default:
+            break;
+    }
+
+#undef DC_IR_SIMPLIFIED
+
+    return ir->fast_math && dc_ir_reassociate(ir, op, a, b, out_node);
+}
+
+/* Returns if 1/value is exact in single precision, so that dividing by value
+ * is the same as multiplying by its reciprocal. This is true for powers of two
+ * which have a normal reciprocal. */
+static int dc_ir_has_exact_reciprocal(double value){
+    int exponent;
+    const double mantissa = frexp(value, &exponent);
+    return (mantissa == 0.5 || mantissa == -0.5) &&
+        exponent >= -125 &&
+        exponent <= 127;
+}
+
+/* Adds x^n as multiplications, by squaring x^(n/2). The squares are
+ * operations on two copies of one value, so they are lowered as a duplicate
+ * and keep the whole chain in registers. */
+static unsigned dc_ir_expand_power(struct DC_IR *ir, unsigned x, unsigned n){
+    unsigned half;
+    assert(n != 0);
+    if(n == 1)
+        return x;
+    half = dc_ir_expand_power(ir, x, n >> 1);
+    half = DC_IR_AddBinary(ir, eIRMul, half, half);
+    return (n & 1) ? DC_IR_AddBinary(ir, eIRMul, half, x) : half;
+}
+
+/* Returns if a power with exponent as its second operand is expanded into
+ * multiplications. */
+static int dc_ir_is_small_power(double exponent){
+    return exponent == floor(exponent) &&
+        exponent >= -DC_IR_MAX_POWER &&
+        exponent <= DC_IR_MAX_POWER;
+}
+
+unsigned DC_IR_AddBinary(struct DC_IR *ir,
+    enum DC_IR_Op op,
+    unsigned a,
+    unsigned b){
+
+    struct DC_IR_Node node;
+    assert(DC_IR_IS_BINARY(op));
+    assert(a < ir->num_nodes && b < ir->num_nodes);
+    if(DC_OPTIMIZE &&
+        ir->nodes[a].op == eIRImmediate &&
+        ir->nodes[b].op == eIRImmediate){
+
+        return DC_IR_AddImmediate(ir, dc_ir_fold(op,
+            ir->nodes[a].value.immediate,
+            ir->nodes[b].value.immediate));
+    }
+    /* Small powers are always expanded, even without DC_OPTIMIZE_STRENGTH,
+     * since the JIT's pow is only valid for a positive base. */
+    if(op == eIRPow && ir->nodes[b].op == eIRImmediate){
+        const double exponent = ir->nodes[b].value.immediate;
+        if(dc_ir_is_small_power(exponent)){
+            /* x^0 is one even for NaN, and x^-n is 1/x^n */
+            if(exponent == 0.0)
+                return DC_IR_AddImmediate(ir, 1.0);
+            if(exponent > 0.0)
+                return dc_ir_expand_power(ir, a, (unsigned)exponent);
+            return DC_IR_AddBinary(ir,
+                eIRDiv,
+                DC_IR_AddImmediate(ir, 1.0),
+                dc_ir_expand_power(ir, a, (unsigned)-exponent));
+        }
+        /* x^0.5 is not sqrt(x) for -0.0 and -infinity */
+        if(DC_OPTIMIZE_STRENGTH && ir->fast_math && exponent == 0.5)
+            return DC_IR_AddUnary(ir, eIRSqrt, a);
+    }
+    /* Only the arithmetic operators are rewritten. */
+    if(DC_OPTIMIZE_ALGEBRA && op <= eIRDiv){
+        unsigned simplified;
+        if(dc_ir_simplify(ir, &op, &a, &b, &simplified))
+            return simplified;
+    }
+    if(DC_OPTIMIZE_STRENGTH &&
+        op == eIRDiv &&
+        ir->nodes[b].op == eIRImmediate){
+        
+        const double divisor = ir->nodes[b].value.immediate;
+        if(dc_ir_has_exact_reciprocal(divisor) ||
+            (ir->fast_math && divisor != 0.0)){
+            return DC_IR_AddBinary(ir,
+                eIRMul,
+                a,
+                DC_IR_AddImmediate(ir, 1.0 / divisor));
+        }
+    }
+    node.op = op;
+    node.a = a;
+    node.b = b;
+    node.c = 0;
+    return dc_ir_intern(ir, &node);
+}
+
+unsigned DC_IR_AddUnary(struct DC_IR *ir, enum DC_IR_Op op, unsigned a){
+    struct DC_IR_Node node;
+    assert(op >= eIRSin && op <= eIRFloor);
+    assert(a < ir->num_nodes);
+    if(DC_OPTIMIZE_INTRINSIC && ir->nodes[a].op == eIRImmediate){
+        return DC_IR_AddImmediate(ir,
+            dc_ir_fold(op, ir->nodes[a].value.immediate, 0.0));
+    }
+    node.op = op;
+    node.a = a;
+    node.b = node.c = 0;
+    return dc_ir_intern(ir, &node);
+}
+
+unsigned DC_IR_AddSelect(struct DC_IR *ir,
+    unsigned condition,
+    unsigned b,
+    unsigned c){
+    
+    struct DC_IR_Node node;
+    assert(condition < ir->num_nodes);
+    assert(b < ir->num_nodes && c < ir->num_nodes);
+    if(DC_OPTIMIZE && ir->nodes[condition].op == eIRImmediate)
+        return (ir->nodes[condition].value.immediate != 0.0) ? b : c;
+    if(DC_OPTIMIZE_ALGEBRA && b == c)
+        return b;
+    node.op = eIRSelect;
+    node.a = condition;
+    node.b = b;
+    node.c = c;
+    return dc_ir_intern(ir, &node);
+}
+
+void DC_IR_Bind(struct DC_IR *ir,
+    const char *name,
+    unsigned length,
+    unsigned node){
+    
+    struct DC_IR_Binding *binding;
+    assert(node < ir->num_nodes);
+    if(ir->num_bindings == ir->bindings_capacity){
+        ir->bindings_capacity = (ir->bindings_capacity == 0) ?
+            DC_IR_INITIAL_CAPACITY : (ir->bindings_capacity << 1);
+        ir->bindings = realloc(ir->bindings,
+            sizeof(struct DC_IR_Binding) * ir->bindings_capacity);
+    }
+    binding = ir->bindings + ir->num_bindings++;
+    binding->name = name;
+    binding->length = length;
+    binding->node = node;
+}
+
+int DC_IR_FindBinding(const struct DC_IR *ir,
+    const char *name,
+    unsigned length,
+    unsigned *out_node){
+    
+    unsigned i = ir->num_bindings;
+    /* Search backwards so that later bindings hide earlier ones. */
+    while(i-- != 0){
+        const struct DC_IR_Binding *const binding = ir->bindings + i;
+        if(binding->length == length &&
+            memcmp(binding->name, name, length) == 0){
+            out_node[0] = binding->node;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Derivatives that are exactly zero are kept as DC_IR_ZERO rather than as a
+ * node, so that terms multiplied by them are left out. Multiplying by an
+ * immediate zero can not be removed when the other operand could be NaN or
+ * infinite. */
+#define DC_IR_ZERO (~0u)
+
+static unsigned dc_ir_zero_node(struct DC_IR *ir, unsigned d){
+    return (d == DC_IR_ZERO) ? DC_IR_AddImmediate(ir, 0.0) : d;
+}
+
+static unsigned dc_ir_d_add(struct DC_IR *ir, unsigned da, unsigned db){
+    if(da == DC_IR_ZERO)
+        return db;
+    if(db == DC_IR_ZERO)
+        return da;
+    return DC_IR_AddBinary(ir, eIRAdd, da, db);
+}
+
+/* Applies op to a derivative and another node, which is zero when the
+ * derivative is. This is only for multiplying and dividing. */
+static unsigned dc_ir_d_apply(struct DC_IR *ir,
+    enum DC_IR_Op op,
+    unsigned d,
+    unsigned x){
+    
+    assert(op == eIRMul || op == eIRDiv);
+    return (d == DC_IR_ZERO) ? DC_IR_ZERO : DC_IR_AddBinary(ir, op, d, x);
+}
+
+static unsigned dc_ir_d_negate(struct DC_IR *ir, unsigned d){
+    return dc_ir_d_apply(ir, eIRMul, d, DC_IR_AddImmediate(ir, -1.0));
+}
+
+static unsigned dc_ir_d_select(struct DC_IR *ir,
+    unsigned condition,
+    unsigned db,
+    unsigned dc){
+    
+    if(db == DC_IR_ZERO && dc == DC_IR_ZERO)
+        return DC_IR_ZERO;
+    return DC_IR_AddSelect(ir,
+        condition,
+        dc_ir_zero_node(ir, db),
+        dc_ir_zero_node(ir, dc));
+}
+
+/* Adds the derivative of node n, from the derivatives of its operands. The
+ * node is copied, since adding nodes can move the array. */
+static unsigned dc_ir_derivative(struct DC_IR *ir,
+    unsigned n,
+    const unsigned *derivatives,
+    unsigned short arg_num){
+    
+    const struct DC_IR_Node node = ir->nodes[n];
+    const unsigned da = DC_IR_IS_LEAF(node.op) ?
+        DC_IR_ZERO : derivatives[node.a];
+    const unsigned db = (DC_IR_IS_BINARY(node.op) || node.op == eIRSelect) ?
+        derivatives[node.b] : DC_IR_ZERO;
+    unsigned t;
+    switch(node.op){
+        case eIRImmediate:
+            return DC_IR_ZERO;
+        case eIRArgument:
+            return (node.value.argument == arg_num) ?
+                DC_IR_AddImmediate(ir, 1.0) : DC_IR_ZERO;
+        case eIRAdd:
+            return dc_ir_d_add(ir, da, db);
+        case eIRSub:
+            return dc_ir_d_add(ir, da, dc_ir_d_negate(ir, db));
+        case eIRMul:
+            return dc_ir_d_add(ir,
+                dc_ir_d_apply(ir, eIRMul, da, node.b),
+                dc_ir_d_apply(ir, eIRMul, db, node.a));
+        case eIRDiv:
+            /* (da - (a/b)*db) / b, which uses the quotient again. */
+            t = dc_ir_d_negate(ir, dc_ir_d_apply(ir, eIRMul, db, n));
+            return dc_ir_d_apply(ir, eIRDiv, dc_ir_d_add(ir, da, t), node.b);
+        case eIRPow:
+            /* A constant exponent uses b*a^(b-1), so that a can be negative
+             * and x^2 differentiates to 2*x. */
+            if(db == DC_IR_ZERO){
+                t = DC_IR_AddBinary(ir,
+                    eIRSub,
+                    node.b,
+                    DC_IR_AddImmediate(ir, 1.0));
+                t = DC_IR_AddBinary(ir,
+                    eIRMul,
+                    node.b,
+                    DC_IR_AddBinary(ir, eIRPow, node.a, t));
+                return dc_ir_d_apply(ir, eIRMul, da, t);
+            }
+            /* a^b * (db*log(a) + da*b/a) */
+            t = dc_ir_d_add(ir,
+                dc_ir_d_apply(ir,
+                    eIRMul,
+                    db,
+                    DC_IR_AddUnary(ir, eIRLog, node.a)),
+                dc_ir_d_apply(ir,
+                    eIRDiv,
+                    dc_ir_d_apply(ir, eIRMul, da, node.b),
+                    node.a));
+            return dc_ir_d_apply(ir, eIRMul, t, n);
+        case eIRAtan2:
+            /* atan2(y, x) is (x*dy - y*dx) / (x*x + y*y) */
+            t = dc_ir_d_add(ir,
+                dc_ir_d_apply(ir, eIRMul, da, node.b),
+                dc_ir_d_negate(ir, dc_ir_d_apply(ir, eIRMul, db, node.a)));
+            return dc_ir_d_apply(ir,
+                eIRDiv,
+                t,
+                DC_IR_AddBinary(ir,
+                    eIRAdd,
+                    DC_IR_AddBinary(ir, eIRMul, node.a, node.a),
+                    DC_IR_AddBinary(ir, eIRMul, node.b, node.b)));
+        /* These follow the operand that is chosen, which is b for ties. */
+        case eIRMin:
+            return dc_ir_d_select(ir,
+                DC_IR_AddBinary(ir, eIRLess, node.a, node.b),
+                da,
+                db);
+        case eIRMax:
+            return dc_ir_d_select(ir,
+                DC_IR_AddBinary(ir, eIRLess, node.b, node.a),
+                da,
+                db);
+        case eIRLess: /* FALLTHROUGH */
+        case eIRLessEqual: /* FALLTHROUGH */
+        case eIREqual: /* FALLTHROUGH */
+        case eIRNotEqual: /* FALLTHROUGH */
+        case eIRFloor:
+            return DC_IR_ZERO;
+        case eIRSin:
+            return dc_ir_d_apply(ir,
+                eIRMul,
+                da,
+                DC_IR_AddUnary(ir, eIRCos, node.a));
+        case eIRCos:
+            return dc_ir_d_negate(ir, dc_ir_d_apply(ir,
+                eIRMul,
+                da,
+                DC_IR_AddUnary(ir, eIRSin, node.a)));
+        case eIRSqrt:
+            return dc_ir_d_apply(ir,
+                eIRDiv,
+                da,
+                DC_IR_AddBinary(ir, eIRAdd, n, n));
+        case eIRTan:
+            /* 1 + tan^2 */
+            t = DC_IR_AddBinary(ir,
+                eIRAdd,
+                DC_IR_AddImmediate(ir, 1.0),
+                DC_IR_AddBinary(ir, eIRMul, n, n));
+            return dc_ir_d_apply(ir, eIRMul, da, t);
+        case eIRExp:
+            return dc_ir_d_apply(ir, eIRMul, da, n);
+        case eIRLog:
+            return dc_ir_d_apply(ir, eIRDiv, da, node.a);
+        case eIRAbs:
+            return dc_ir_d_select(ir,
+                DC_IR_AddBinary(ir,
+                    eIRLess,
+                    node.a,
+                    DC_IR_AddImmediate(ir, 0.0)),
+                dc_ir_d_negate(ir, da),
+                da);
+        case eIRSelect:
+            /* The condition is only compared to zero. */
+            return dc_ir_d_select(ir, node.a, db, derivatives[node.c]);
+    }
+    assert(0 && "Invalid op to differentiate");
+    return DC_IR_ZERO;
+}
+
+unsigned DC_IR_Differentiate(struct DC_IR *ir,
+    unsigned root,
+    unsigned short arg_num){
+    
+    unsigned *const derivatives = malloc(sizeof(unsigned) * (root + 1));
+    unsigned char *const used = calloc(root + 1, 1);
+    unsigned i, result;
+    assert(root < ir->num_nodes);
+    
+    /* Only the nodes that the root uses are differentiated. Operands come
+     * before their nodes, so one pass backwards finds all of them. */
+    used[root] = 1;
+    i = root + 1;
+    while(i-- != 0){
+        const struct DC_IR_Node *const node = ir->nodes + i;
+        if(!used[i] || DC_IR_IS_LEAF(node->op))
+            continue;
+        used[node->a] = 1;
+        if(DC_IR_IS_BINARY(node->op) || node->op == eIRSelect)
+            used[node->b] = 1;
+        if(node->op == eIRSelect)
+            used[node->c] = 1;
+    }
+    
+    for(i = 0; i <= root; i++){
+        derivatives[i] = used[i] ?
+            dc_ir_derivative(ir, i, derivatives, arg_num) : DC_IR_ZERO;
+    }
+    
+    result = dc_ir_zero_node(ir, derivatives[root]);
+    free(derivatives);
+    free(used);
+    return result;
+}
+
+/* Serialized nodes start with the number of nodes. Each node is then its op,
+ * followed by the double for immediates, the argument number for arguments, or
+ * the indices of the operands for operations. Everything is little endian.
+ * Only the nodes that the root uses are written, and the root is last. */
+#define DC_IR_SERIAL_OPERAND_SIZE 4
+#define DC_IR_SERIAL_MAX_NODE_SIZE (1 + (DC_IR_SERIAL_OPERAND_SIZE * 3))
+
+static int dc_ir_is_little_endian(void){
+    const unsigned one = 1;
+    return *((const unsigned char *)&one) == 1;
+}
+
+static unsigned char *dc_ir_write_int(unsigned char *data,
+    unsigned long value,
+    unsigned size){
+    
+    unsigned i;
+    for(i = 0; i < size; i++){
+        data[i] = (unsigned char)(value & 0xFF);
+        value >>= 8;
+    }
+    return data + size;
+}
+
+static unsigned long dc_ir_read_int(const unsigned char *data, unsigned size){
+    unsigned long value = 0;
+    while(size-- != 0)
+        value = (value << 8) | data[size];
+    return value;
+}
+
+/* Returns the number of operands that a node has. */
+static unsigned dc_ir_num_operands(enum DC_IR_Op op){
+    if(DC_IR_IS_LEAF(op))
+        return 0;
+    else if(DC_IR_IS_BINARY(op))
+        return 2;
+    else if(op == eIRSelect)
+        return 3;
+    else
+        return 1;
+}
+
+unsigned long DC_IR_Serialize(const struct DC_IR *ir,
+    unsigned root,
+    unsigned char **out_data){
+    
+    /* index holds the serialized index plus one of each node that is used. */
+    unsigned *const index = calloc(root + 1, sizeof(unsigned));
+    unsigned i, count = 0;
+    unsigned char *data, *at;
+    const int little_endian = dc_ir_is_little_endian();
+    
+    assert(root < ir->num_nodes);
+    index[root] = 1;
+    i = root + 1;
+    do{
+        const struct DC_IR_Node *const node = ir->nodes + --i;
+        if(index[i] != 0){
+            const unsigned num_operands = dc_ir_num_operands(node->op);
+            if(num_operands > 0)
+                index[node->a] = 1;
+            if(num_operands > 1)
+                index[node->b] = 1;
+            if(num_operands > 2)
+                index[node->c] = 1;
+        }
+    }while(i != 0);
+    
+    for(i = 0; i <= root; i++){
+        if(index[i] != 0)
+            index[i] = ++count;
+    }
+    
+    at = data = malloc(4 + (DC_IR_SERIAL_MAX_NODE_SIZE * count));
+    at = dc_ir_write_int(at, count, 4);
+    for(i = 0; i <= root; i++){
+        const struct DC_IR_Node *const node = ir->nodes + i;
+        const unsigned num_operands = dc_ir_num_operands(node->op);
+        if(index[i] == 0)
+            continue;
+        *(at++) = (unsigned char)node->op;
+        if(node->op == eIRImmediate){
+            const unsigned char *const bytes =
+                (const unsigned char *)&(node->value.immediate);
+            unsigned n;
+            for(n = 0; n < sizeof(double); n++)
+                at[n] = bytes[little_endian ? n : (sizeof(double) - 1 - n)];
+            at += sizeof(double);
+        }
+        else if(node->op == eIRArgument){
+            at = dc_ir_write_int(at, node->value.argument, 2);
+        }
+        if(num_operands > 0)
+            at = dc_ir_write_int(at, index[node->a] - 1, 4);
+        if(num_operands > 1)
+            at = dc_ir_write_int(at, index[node->b] - 1, 4);
+        if(num_operands > 2)
+            at = dc_ir_write_int(at, index[node->c] - 1, 4);
+    }
+    
+    free(index);
+    out_data[0] = data;
+    return (unsigned long)(at - data);
+}
+
+int DC_IR_Deserialize(struct DC_IR *ir,
+    const unsigned char *data,
+    unsigned long length,
+    unsigned num_args,
+    unsigned *out_root){
+    
+    const unsigned char *const end = data + length;
+    const int little_endian = dc_ir_is_little_endian();
+    unsigned long count, i;
+    unsigned *nodes = NULL;
+    
+    if(length < 4 || sizeof(double) != 8)
+        return 0;
+    count = dc_ir_read_int(data, 4);
+    data += 4;
+    /* Every node is at least three bytes. */
+    if(count == 0 || count > (length / 3))
+        return 0;
+    
+    /* The serialized indices are not the same as the IR's when nodes are
+     * already in it. */
+    if(ir != NULL)
+        nodes = malloc(sizeof(unsigned) * count);
+    
+    for(i = 0; i < count; i++){
+        struct DC_IR_Node node;
+        unsigned num_operands, n;
+        if(data == end || *data > eIRSelect)
+            break;
+        node.op = (enum DC_IR_Op)*(data++);
+        node.a = node.b = node.c = 0;
+        num_operands = dc_ir_num_operands(node.op);
+        
+        if(node.op == eIRImmediate){
+            unsigned char *const bytes =
+                (unsigned char *)&(node.value.immediate);
+            if(end - data < 8)
+                break;
+            for(n = 0; n < 8; n++)
+                bytes[little_endian ? n : (7 - n)] = data[n];
+            data += 8;
+        }
+        else if(node.op == eIRArgument){
+            if(end - data < 2)
+                break;
+            node.value.argument = (unsigned short)dc_ir_read_int(data, 2);
+            data += 2;
+            if(node.value.argument >= num_args)
+                break;
+        }
+        
+        if((unsigned long)(end - data) < num_operands * 4)
+            break;
+        /* Operands must come before the nodes that use them. */
+        for(n = 0; n < num_operands; n++){
+            const unsigned long operand = dc_ir_read_int(data, 4);
+            data += 4;
+            if(operand >= i)
+                break;
+            if(ir != NULL){
+                if(n == 0)
+                    node.a = nodes[operand];
+                else if(n == 1)
+                    node.b = nodes[operand];
+                else
+                    node.c = nodes[operand];
+            }
+        }
+        if(n != num_operands)
+            break;
+        
+        if(ir != NULL)
+            nodes[i] = dc_ir_intern(ir, &node);
+    }
+    
+    if(i == count && data == end){
+        if(ir != NULL)
+            out_root[0] = nodes[count - 1];
+        free(nodes);
+        return 1;
+    }
+    else{
+        free(nodes);
+        return 0;
+    }
+}
+
+/* State for lowering. need is the number of stack slots that each node takes
+ * to compute, which is used to order the operands of commutative operations
+ * so that the deeper one is computed first. Keeping the stack shallow keeps
+ * more values in registers in the JIT.
+ *
+ * uses is the number of times each node is an operand in the expression.
+ * Operations which are used more than once are stored in a temporary the
+ * first time they are calculated, and temps is then one more than the number
+ * of that temporary. */
+struct DC_IR_Lowering {
+    const struct DC_IR *ir;
+    unsigned *need, *uses, *temps;
+    unsigned short num_temps;
+    struct DC_X_Context *ctx;
+    struct DC_X_CalculationBuilder *bld;
+    struct DC_Bytecode *bc;
+};
+
+/* Returns if a node can be used directly as an operand, without pushing. */
+static int dc_ir_is_fetch(const struct DC_IR *ir, unsigned n){
+    return DC_OPTIMIZE_FETCH && DC_IR_IS_LEAF(ir->nodes[n].op);
+}
+
+static int dc_ir_is_commutative(enum DC_IR_Op op){
+    return op == eIRAdd ||
+        op == eIRMul ||
+        op == eIREqual ||
+        op == eIRNotEqual;
+}
+
+/* Returns if a binary node is calculated by duplicating one value, and sets
+ * out_op and out_operand to the operation to use on the two copies and the
+ * value to duplicate. This is x op x, and x*2 as x+x. */
+static int dc_ir_get_dup_operation(const struct DC_IR *ir,
+    const struct DC_IR_Node *node,
+    enum DC_IR_Op *out_op,
+    unsigned *out_operand){
+
+    if(!DC_OPTIMIZE_STRENGTH)
+        return 0;
+    if(node->a == node->b){
+        out_op[0] = node->op;
+        out_operand[0] = node->a;
+        return 1;
+    }
+    if(node->op == eIRMul && dc_ir_is_value(ir, node->b, 2.0)){
+        out_op[0] = eIRAdd;
+        out_operand[0] = node->a;
+        return 1;
+    }
+    return 0;
+}
+
+/* Returns the stack needed to compute the operands of a binary node, with a
+ * computed first and b used as an operand if possible. */
+static unsigned dc_ir_binary_need(const struct DC_IR_Lowering *lower,
+    unsigned a,
+    unsigned b){
+
+    const unsigned need_a = lower->need[a];
+    const unsigned need_b = dc_ir_is_fetch(lower->ir, b) ?
+        need_a : (lower->need[b] + 1);
+    return (need_a > need_b) ? need_a : need_b;
+}
+
+/* Returns if b should be computed before a. This is only done for commutative
+ * operations, and only when it uses less of the stack. */
+static int dc_ir_swap_operands(const struct DC_IR_Lowering *lower,
+    const struct DC_IR_Node *node){
+
+    return dc_ir_is_commutative(node->op) &&
+        dc_ir_binary_need(lower, node->b, node->a) <
+            dc_ir_binary_need(lower, node->a, node->b);
+}
+
+static void dc_ir_calculate_need(struct DC_IR_Lowering *lower,
+    unsigned root){
+
+    unsigned i, operand;
+    enum DC_IR_Op op;
+    for(i = 0; i <= root; i++){
+        const struct DC_IR_Node *const node = lower->ir->nodes + i;
+        if(DC_IR_IS_LEAF(node->op)){
+            lower->need[i] = 1;
+        }
+        else if(DC_IR_IS_BINARY(node->op) &&
+            dc_ir_get_dup_operation(lower->ir, node, &op, &operand)){
+            /* The copy needs one more value on top of the operand. */
+            lower->need[i] = (lower->need[operand] > 2) ?
+                lower->need[operand] : 2;
+        }
+        else if(DC_IR_IS_BINARY(node->op)){
+            const unsigned a_first =
+                dc_ir_binary_need(lower, node->a, node->b);
+            const unsigned b_first =
+                dc_ir_binary_need(lower, node->b, node->a);
+            lower->need[i] = (dc_ir_is_commutative(node->op) &&
+                b_first < a_first) ? b_first : a_first;
+        }
+        else if(node->op == eIRSelect){
+            /* b, c, and then the condition are pushed. */
+            unsigned need = lower->need[node->b];
+            if(lower->need[node->c] + 1 > need)
+                need = lower->need[node->c] + 1;
+            if(lower->need[node->a] + 2 > need)
+                need = lower->need[node->a] + 2;
+            lower->need[i] = need;
+        }
+        else{
+            lower->need[i] = lower->need[node->a];
+        }
+    }
+}
+
+/* Counts the uses of each node that is part of the expressions at roots, and
+ * returns how many temporaries the expressions will need. Each root is also a
+ * use, so nodes that more than one expression uses are shared. last is the
+ * highest root. */
+static unsigned dc_ir_count_uses(struct DC_IR_Lowering *lower,
+    const unsigned *roots,
+    unsigned num_roots,
+    unsigned last){
+    
+    unsigned i = last + 1, num_shared = 0;
+    memset(lower->uses, 0, sizeof(unsigned) * (last + 1));
+    while(num_roots-- != 0)
+        lower->uses[roots[num_roots]]++;
+    do{
+        const struct DC_IR_Node *const node = lower->ir->nodes + --i;
+        if(lower->uses[i] == 0 || DC_IR_IS_LEAF(node->op))
+            continue;
+        if(lower->uses[i] > 1)
+            num_shared++;
+        lower->uses[node->a]++;
+        /* x op x only calculates x once. */
+        if(DC_IR_IS_BINARY(node->op) &&
+            (node->a != node->b || !DC_OPTIMIZE_STRENGTH)){
+            lower->uses[node->b]++;
+        }
+        if(node->op == eIRSelect){
+            lower->uses[node->b]++;
+            lower->uses[node->c]++;
+        }
+    }while(i != 0);
+    return num_shared;
+}
+
+static void dc_ir_push_leaf(struct DC_IR_Lowering *lower, unsigned n){
+    const struct DC_IR_Node *const node = lower->ir->nodes + n;
+    if(node->op == eIRImmediate){
+        if(lower->bld != NULL)
+            DC_X_BuildPushImmediate(lower->ctx, lower->bld,
+                node->value.immediate);
+        if(lower->bc != NULL)
+            DC_BC_BuildPushImmediate(lower->bc, node->value.immediate);
+    }
+    else{
+        assert(node->op == eIRArgument);
+        if(lower->bld != NULL)
+            DC_X_BuildPushArg(lower->ctx, lower->bld, node->value.argument);
+        if(lower->bc != NULL)
+            DC_BC_BuildPushArg(lower->bc, node->value.argument);
+    }
+}
+
+static void dc_ir_lower_node(struct DC_IR_Lowering *lower, unsigned n);
+
+/* Writes a binary operation with the top of the stack as the first operand,
+ * and the node operand as the second. */
+static void dc_ir_lower_op(struct DC_IR_Lowering *lower,
+    enum DC_IR_Op op,
+    unsigned operand){
+
+    const struct DC_IR_Builders *const builders = DC_IR_GET_BUILDERS(op);
+    const struct DC_IR_Node *const node = lower->ir->nodes + operand;
+
+    if(dc_ir_is_fetch(lower->ir, operand)){
+        if(node->op == eIRArgument){
+            if(lower->bld != NULL)
+                builders->build_arg_op(lower->ctx, lower->bld,
+                    node->value.argument);
+            if(lower->bc != NULL)
+                builders->bytecode_arg_op(lower->bc, node->value.argument);
+        }
+        else{
+            if(lower->bld != NULL)
+                builders->build_imm_op(lower->ctx, lower->bld,
+                    node->value.immediate);
+            if(lower->bc != NULL)
+                builders->bytecode_imm_op(lower->bc, node->value.immediate);
+        }
+    }
+    else{
+        dc_ir_lower_node(lower, operand);
+        if(lower->bld != NULL)
+            builders->build_op(lower->ctx, lower->bld);
+        if(lower->bc != NULL)
+            builders->bytecode_op(lower->bc);
+    }
+}
+
+/* Writes the operations to calculate a node. */
+static void dc_ir_lower_operation(struct DC_IR_Lowering *lower, unsigned n){
+    const struct DC_IR_Node *const node = lower->ir->nodes + n;
+    enum DC_IR_Op op;
+    unsigned dup_operand;
+    if(node->op == eIRSelect){
+        /* The condition is on top of the values, so that the JIT can turn it
+         * into a mask in place. */
+        dc_ir_lower_node(lower, node->b);
+        dc_ir_lower_node(lower, node->c);
+        dc_ir_lower_node(lower, node->a);
+        if(lower->bld != NULL)
+            DC_X_BuildSelect(lower->ctx, lower->bld);
+        if(lower->bc != NULL)
+            DC_BC_BuildSelect(lower->bc);
+    }
+    else if(DC_IR_IS_BINARY(node->op)){
+        if(dc_ir_get_dup_operation(lower->ir, node, &op, &dup_operand)){
+            const struct DC_IR_Builders *const builders =
+                DC_IR_GET_BUILDERS(op);
+            dc_ir_lower_node(lower, dup_operand);
+            if(lower->bld != NULL){
+                DC_X_BuildDup(lower->ctx, lower->bld);
+                builders->build_op(lower->ctx, lower->bld);
+            }
+            if(lower->bc != NULL){
+                DC_BC_BuildDup(lower->bc);
+                builders->bytecode_op(lower->bc);
+            }
+        }
+        else if(dc_ir_swap_operands(lower, node)){
+            dc_ir_lower_node(lower, node->b);
+            dc_ir_lower_op(lower, node->op, node->a);
+        }
+        else{
+            dc_ir_lower_node(lower, node->a);
+            dc_ir_lower_op(lower, node->op, node->b);
+        }
+    }
+    else{
+        /* The argument form of a unary operation pushes its result. Anything
+         * else is pushed first and then operated on. */
+        const struct DC_IR_Builders *const builders =
+            DC_IR_GET_BUILDERS(node->op);
+        const struct DC_IR_Node *const operand = lower->ir->nodes + node->a;
+        if(DC_OPTIMIZE_FETCH && operand->op == eIRArgument){
+            if(lower->bld != NULL)
+                builders->build_arg_op(lower->ctx, lower->bld,
+                    operand->value.argument);
+            if(lower->bc != NULL)
+                builders->bytecode_arg_op(lower->bc, operand->value.argument);
+        }
+        else{
+            dc_ir_lower_node(lower, node->a);
+            if(lower->bld != NULL)
+                builders->build_op(lower->ctx, lower->bld);
+            if(lower->bc != NULL)
+                builders->bytecode_op(lower->bc);
+        }
+    }
+}
+
+/* Pushes the value of a node, either by calculating it or by pushing the
+ * temporary that it was already stored in. */
+static void dc_ir_lower_node(struct DC_IR_Lowering *lower, unsigned n){
+    if(DC_IR_IS_LEAF(lower->ir->nodes[n].op)){
+        dc_ir_push_leaf(lower, n);
+    }
+    else if(lower->temps[n] != 0){
+        const unsigned short temp = (unsigned short)(lower->temps[n] - 1);
+        if(lower->bld != NULL)
+            DC_X_BuildPushTemp(lower->ctx, lower->bld, temp);
+        if(lower->bc != NULL)
+            DC_BC_BuildPushTemp(lower->bc, temp);
+    }
+    else{
+        dc_ir_lower_operation(lower, n);
+        if(lower->uses[n] > 1){
+            const unsigned short temp = lower->num_temps++;
+            lower->temps[n] = temp + 1;
+            if(lower->bld != NULL)
+                DC_X_BuildStoreTemp(lower->ctx, lower->bld, temp);
+            if(lower->bc != NULL)
+                DC_BC_BuildStoreTemp(lower->bc, temp);
+        }
+    }
+}
+
+/* Writes the expressions at roots, storing all but the first as in
+ * DC_IR_LowerResults. Stores are only written to bld. */
+static void dc_ir_lower_roots(const struct DC_IR *ir,
+    const unsigned *roots,
+    unsigned num_roots,
+    unsigned short first_arg,
+    struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    struct DC_Bytecode *bc){
+
+    struct DC_IR_Lowering lower;
+    unsigned num_temps, last = 0, i;
+    assert(num_roots != 0);
+    assert(num_roots == 1 || bc == NULL);
+    for(i = 0; i < num_roots; i++){
+        assert(roots[i] < ir->num_nodes);
+        if(roots[i] > last)
+            last = roots[i];
+    }
+    lower.ir = ir;
+    lower.need = malloc(sizeof(unsigned) * (last + 1) * 3);
+    lower.uses = lower.need + last + 1;
+    lower.temps = lower.uses + last + 1;
+    lower.num_temps = 0;
+    lower.ctx = ctx;
+    lower.bld = bld;
+    lower.bc = bc;
+
+    dc_ir_calculate_need(&lower, last);
+    num_temps = dc_ir_count_uses(&lower, roots, num_roots, last);
+    assert(num_temps <= 0xFFFF);
+    memset(lower.temps, 0, sizeof(unsigned) * (last + 1));
+    if(num_temps != 0){
+        if(bld != NULL)
+            DC_X_BuildReserveTemps(ctx, bld, (unsigned short)num_temps);
+        if(bc != NULL)
+            DC_BC_BuildReserveTemps(bc, (unsigned short)num_temps);
+    }
+    
+    /* The stored results are written first, so that the result of the
+     * calculation is the only value left on the stack. */
+    for(i = 1; i < num_roots; i++){
+        dc_ir_lower_node(&lower, roots[i]);
+        if(bld != NULL){
+            DC_X_BuildStoreArg(ctx, bld, (unsigned short)(first_arg + i - 1));
+            DC_X_BuildPop(ctx, bld);
+        }
+    }
+    dc_ir_lower_node(&lower, roots[0]);
+    assert(lower.num_temps == num_temps);
+
+    free(lower.need);
+}
+
+void DC_IR_Lower(const struct DC_IR *ir,
+    unsigned root,
+    struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    struct DC_Bytecode *bc){
+    
+    dc_ir_lower_roots(ir, &root, 1, 0, ctx, bld, bc);
+}
+
+void DC_IR_LowerResults(const struct DC_IR *ir,
+    const unsigned *roots,
+    unsigned num_roots,
+    unsigned short first_arg,
+    struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld){
+    
+    dc_ir_lower_roots(ir, roots, num_roots, first_arg, ctx, bld, NULL);
+}
@@ -0,0 +1,248 @@
+/* Copyright (c) 2018, Transnat Games
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef LIBDCJIT_DC_IR_H
+#define LIBDCJIT_DC_IR_H
+#pragma once
+
+/* Expression DAG for calculations.
+ *
+ * The parser builds the whole expression as nodes here, and DC_IR_Lower then
+ * writes it out using the DC_X and DC_BC builders. This lets optimizations see
+ * the entire expression rather than only the operator being parsed.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct DC_X_Context;
+struct DC_X_CalculationBuilder;
+struct DC_Bytecode;
+
+#ifndef DC_OPTIMIZE
+#define DC_OPTIMIZE 1
+#endif
+
+/* Whether the argument and immediate forms of the operations are used. */
+#ifndef DC_OPTIMIZE_FETCH
+#define DC_OPTIMIZE_FETCH DC_OPTIMIZE
+#endif
+
+/* Whether builtins of constants are computed at compile time. */
+#ifndef DC_OPTIMIZE_INTRINSIC
+#define DC_OPTIMIZE_INTRINSIC DC_OPTIMIZE
+#endif
+
+/* Whether operations are rewritten into simpler forms, such as removing
+ * multiplications by one and gathering the constants of chains of additions.
+ * The rewrites that can change the rounding of results are only done when the
+ * IR has fast_math set. */
+#ifndef DC_OPTIMIZE_ALGEBRA
+#define DC_OPTIMIZE_ALGEBRA DC_OPTIMIZE
+#endif
+
+/* Whether operations are replaced with cheaper ones. Division by a constant
+ * becomes multiplication by its reciprocal when that is exact, or always when
+ * the IR has fast_math set. Operations on two copies of one value, such as
+ * x*x, and also x*2 as x+x, calculate the value once and then duplicate it.
+ * x^0.5 becomes sqrt(x) when the IR has fast_math set. Powers with small
+ * integer exponents always become chains of squaring, since that is what
+ * makes them valid for a negative base. */
+#ifndef DC_OPTIMIZE_STRENGTH
+#define DC_OPTIMIZE_STRENGTH DC_OPTIMIZE
+#endif
+
+/* The largest integer exponent that is calculated with multiplications. */
+#ifndef DC_IR_MAX_POWER
+#define DC_IR_MAX_POWER 64
+#endif
+
+/* Whether repeated subexpressions are only calculated once. */
+#ifndef DC_OPTIMIZE_CSE
+#define DC_OPTIMIZE_CSE DC_OPTIMIZE
+#endif
+
+enum DC_IR_Op {
+    eIRImmediate,
+    eIRArgument,
+    /* Binary operations */
+    eIRAdd,
+    eIRSub,
+    eIRMul,
+    eIRDiv,
+    eIRPow,
+    eIRAtan2,
+    eIRMin,
+    eIRMax,
+    eIRLess, /* Comparisons are 1.0 if true, and 0.0 if false */
+    eIRLessEqual,
+    eIREqual,
+    eIRNotEqual,
+    /* Unary operations */
+    eIRSin,
+    eIRCos,
+    eIRSqrt,
+    eIRTan,
+    eIRExp,
+    eIRLog,
+    eIRAbs,
+    eIRFloor,
+    /* a is the condition, b is the value when it is not zero, and c is the
+     * value when it is zero. */
+    eIRSelect
+};
+
+#define DC_IR_IS_LEAF(OP) ((OP) == eIRImmediate || (OP) == eIRArgument)
+#define DC_IR_IS_BINARY(OP) ((OP) >= eIRAdd && (OP) <= eIRNotEqual)
+
+/* Nodes refer to their operands by index. Operands are always created before
+ * the nodes that use them, so the nodes are in evaluation order. b is unused
+ * for unary operations, and c is only used by selects.
+ *
+ * Nodes are hash-consed, so adding a node that is the same as an existing one
+ * returns the existing node when DC_OPTIMIZE_CSE is set. Repeated
+ * subexpressions are then shared, and are only calculated once. */
+struct DC_IR_Node {
+    enum DC_IR_Op op;
+    unsigned a, b, c;
+    union {
+        double immediate;
+        unsigned short argument;
+    } value;
+};
+
+/* A name bound to a node with `let'. The name points into the source text, and
+ * is not NUL-terminated. */
+struct DC_IR_Binding {
+    const char *name;
+    unsigned length;
+    unsigned node;
+};
+
+/* table is an open addressed hash table of node indices plus one, so that
+ * zero marks an empty entry. table_size is always a power of two, and is kept
+ * at least twice the number of nodes.
+ *
+ * fast_math allows rewrites that assume addition and multiplication are
+ * associative, and that ignore the sign of zero and non-finite values. See
+ * DC_OPTION_FAST_MATH.
+ *
+ * bindings are the names bound so far, in the order they were bound.
+ *
+ * Arguments with their bit set in bound_args are added as immediates of their
+ * element of bound_values instead, which specializes the expression for those
+ * values. Only the first DC_IR_MAX_BOUND_ARGS arguments can be bound. */
+struct DC_IR {
+    struct DC_IR_Node *nodes;
+    unsigned num_nodes, capacity;
+    unsigned *table;
+    unsigned table_size;
+    unsigned fast_math;
+    struct DC_IR_Binding *bindings;
+    unsigned num_bindings, bindings_capacity;
+    unsigned long bound_args;
+    const double *bound_values;
+};
+
+#define DC_IR_MAX_BOUND_ARGS 32
+
+/* fast_math and bound_args start as zero, and along with bound_values can be
+ * set any time before nodes are added. */
+void DC_IR_Init(struct DC_IR *ir);
+
+void DC_IR_Destroy(struct DC_IR *ir);
+
+/* Removes all nodes and bindings, keeping the memory to build another
+ * expression. */
+void DC_IR_Clear(struct DC_IR *ir);
+
+/* These all return the index of the new node. Operations on immediates are
+ * folded into a new immediate when DC_OPTIMIZE is set. The node returned for
+ * an operation may be a simpler equivalent, see DC_OPTIMIZE_ALGEBRA. */
+unsigned DC_IR_AddImmediate(struct DC_IR *ir, double value);
+
+/* Adds an immediate instead if the argument is bound, see bound_args. */
+unsigned DC_IR_AddArgument(struct DC_IR *ir, unsigned short arg_num);
+
+unsigned DC_IR_AddBinary(struct DC_IR *ir,
+    enum DC_IR_Op op,
+    unsigned a,
+    unsigned b);
+
+unsigned DC_IR_AddUnary(struct DC_IR *ir, enum DC_IR_Op op, unsigned a);
+
+/* Adds a node which is b if condition is not zero (including NaN), or c if it
+ * is zero. */
+unsigned DC_IR_AddSelect(struct DC_IR *ir,
+    unsigned condition,
+    unsigned b,
+    unsigned c);
+
+/* Binds a name to a node. A name can be bound again, which hides the earlier
+ * binding. The name must stay valid until the IR is cleared. */
+void DC_IR_Bind(struct DC_IR *ir,
+    const char *name,
+    unsigned length,
+    unsigned node);
+
+/* Finds the node most recently bound to a name. Returns zero if the name is
+ * not bound. */
+int DC_IR_FindBinding(const struct DC_IR *ir,
+    const char *name,
+    unsigned length,
+    unsigned *out_node);
+
+/* Adds the derivative of the expression at root with respect to an argument,
+ * and returns its node. The derivative shares nodes with the expression, such
+ * as the quotient of a division or the result of sqrt. Parts of the expression
+ * that do not use the argument have a derivative of exactly zero, even where
+ * multiplying by zero would give NaN. Comparisons and floor have a derivative
+ * of zero, and min, max, abs, and selects use the derivative of the operand
+ * that they choose. */
+unsigned DC_IR_Differentiate(struct DC_IR *ir,
+    unsigned root,
+    unsigned short arg_num);
+
+/* Writes the nodes that the expression at root uses to a new buffer, and
+ * returns its length. The data is the same on every platform, and is used to
+ * save calculations to files. The buffer must be freed with free. */
+unsigned long DC_IR_Serialize(const struct DC_IR *ir,
+    unsigned root,
+    unsigned char **out_data);
+
+/* Adds the nodes from DC_IR_Serialize, and sets out_root to the expression.
+ * Returns zero if the data is not valid, including when it uses an argument
+ * that is not less than num_args. If ir is NULL, the data is only checked. */
+int DC_IR_Deserialize(struct DC_IR *ir,
+    const unsigned char *data,
+    unsigned long length,
+    unsigned num_args,
+    unsigned *out_root);
+
+/* Writes the expression at root to bld and bc, either of which can be NULL. */
+void DC_IR_Lower(const struct DC_IR *ir,
+    unsigned root,
+    struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    struct DC_Bytecode *bc);
+
+/* Writes a calculation with more than one result to bld. The calculation gives
+ * the expression at roots[0], and stores the expression at roots[i] to
+ * argument first_arg+i-1 with DC_X_BuildStoreArg. Nodes that the expressions
+ * share are only calculated once. */
+void DC_IR_LowerResults(const struct DC_IR *ir,
+    const unsigned *roots,
+    unsigned num_roots,
+    unsigned short first_arg,
+    struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif /* LIBDCJIT_DC_IR_H */
@@ -4,6 +4,7 @@
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
 
+#include "dc.h"
 #include "dc_jit.h"
 #include "dc_backend.h"
 
@@ -14,36 +15,222 @@
 
 #define NUM_PAGE_LISTS 2
 
+/* The number of idle pages a context keeps for reuse before returning pages
+ * to the OS. This can be changed per context with DC_OPTION_MAX_FREE_PAGES. */
+#ifndef DC_X_DEFAULT_MAX_FREE_PAGES
+#define DC_X_DEFAULT_MAX_FREE_PAGES 4
+#endif
+
+/* Whether sin/cos use the SSE polynomial by default, see DC_OPTION_FAST_TRIG */
+#ifndef DC_X_DEFAULT_FAST_TRIG
+#define DC_X_DEFAULT_FAST_TRIG 1
+#endif
+
+/* Calculations are packed into pages, with each one starting on this
+ * alignment so that the entry point begins a fresh fetch block. */
+#define DC_X_CODE_ALIGNMENT 16
+#define DC_X_ALIGN_CODE(AT)\
+    (((AT) + (DC_X_CODE_ALIGNMENT - 1)) & ~(DC_X_CODE_ALIGNMENT - 1))
+
+/* The encoders only use xmm0-xmm7, since those are all that x86 has and the
+ * amd64 encoders do not write REX prefixes. The bottom DC_X_RESIDENT_VALUES
+ * values on the stack always live in the register of the same number. Values
+ * above that are spilled to the native stack, and are reloaded into the
+ * remaining registers to be operated on.
+ *
+ * Three registers are left over since the polynomial sin/cos need two
+ * temporaries above their operand. */
+#define DC_X_NUM_REGISTERS 8
+#define DC_X_RESIDENT_VALUES (DC_X_NUM_REGISTERS - 3)
+
+/* Size of the native stack frame for a calculation that uses NUM spill slots.
+ * This keeps the stack aligned, and leaves 16 bytes between the spill slots
+ * and the original stack pointer, which is where the amd64 code keeps its
+ * scratch memory for immediates. */
+#define DC_X_FRAME_SIZE(NUM) ((((NUM) * 4 + 15) & ~15) + 16)
+#define DC_X_PACKED_FRAME_SIZE(NUM) ((NUM) * 16 + 16)
+#define DC_X_DOUBLE_FRAME_SIZE(NUM) ((((NUM) * 8 + 15) & ~15) + 16)
+
+/* Most bytes that DC_ASM_WriteNativeEntry will write. */
+#define DC_X_MAX_NATIVE_ENTRY_SIZE 64
+
+/* Most bytes that any other encoder will write. The polynomial sin/cos are the
+ * largest. */
+#define DC_X_MAX_WRITE_SIZE 128
+
+/* Number of lanes in the packed code used by DC_X_CalculateBatch. */
+#define DC_X_LANES 4
+
+/* DC_X_CalculateBatch gathers the arguments for each group of lanes into a
+ * buffer on the stack if there are at most this many arguments. This is also
+ * the most arguments that are converted on the stack when running a
+ * calculation with the other precision. */
+#define DC_X_STACK_ARGS 16
+
+/* size is the number of bytes mapped, which is the page size except for runs
+ * of pages holding a single calculation that is bigger than a page.
+ *
+ * sealed is set once the page's data can no longer be written, which is when
+ * the platform could not map it twice, see DC_JIT_MarkPageExecutable. */
 struct DC_X_PageList {
     struct DC_JIT_Page *page;
-    unsigned at, refs;
+    unsigned at, refs, size;
+    unsigned sealed;
     struct DC_X_PageList *next;
 };
 
+/* next_page is the page that new calculations are appended to. Once it is
+ * full or sealed it is moved to active_pages. Code is only ever written to
+ * memory that no calculation is running from, so pages are never protected
+ * again once they hold code. The refs of each page are the number of
+ * calculations that live on it.
+ *
+ * Pages with no calculations left are kept in free_pages (up to
+ * max_free_pages of them) to be reused before mapping any new pages. Runs of
+ * pages and sealed pages are never kept.
+ *
+ * can_round is set if the CPU has roundss (SSE4.1). */
 struct DC_X_Context{
     unsigned page_size;
+    unsigned num_free_pages, max_free_pages;
+    unsigned fast_trig, use_double, fast_math;
+    unsigned can_round;
     struct DC_X_PageList *next_page, *active_pages, *free_pages;
 };
 
+/* native_start is the offset of the entry point for DC_X_GetNativeFunction,
+ * which comes right before the scalar code at start. Double precision
+ * calculations have no native entry, and is_double is set for them.
+ *
+ * packed_start is the offset of the packed code in the page, or zero if the
+ * calculation has no packed code. The packed code always follows the scalar
+ * code, so zero is never a valid offset for it. */
 struct DC_X_Calculation{
     struct DC_X_PageList *page;
-    unsigned start;
+    unsigned native_start, start, packed_start, num_args;
+    unsigned is_double;
 };
 
+/* depth is the number of values on the calculation's stack, which is used to
+ * tell the encoders which registers to use. Keeping this here rather than in
+ * the encoders lets builders be used on separate threads.
+ *
+ * num_slots is the number of frame slots that the calculation has used, and
+ * num_args is one more than the highest argument it uses. The first num_temps
+ * frame slots hold temporaries, and spill slots follow them.
+ *
+ * The scalar code is written to code, which has room for capacity bytes. The
+ * packed code is built alongside it in packed, using the same registers.
+ * packed is NULL once an operation is found that has no packed form. Every
+ * write goes through DC_X_GET_BUILDER_AT or DC_X_GET_PACKED_AT, which grow
+ * the buffer first if the write might not fit.
+ *
+ * is_double and fast_trig are DC_OPTION_DOUBLE and DC_OPTION_FAST_TRIG, which
+ * are copied from the context when the builder is created and can be changed
+ * with DC_X_SetBuilderOption. Double precision builders never have packed
+ * code. */
 struct DC_X_CalculationBuilder{
-    unsigned at;
-    /* Data follows. */
+    unsigned at, depth, num_slots, num_temps, num_args;
+    unsigned is_double, fast_trig;
+    unsigned capacity, packed_at, packed_capacity;
+    unsigned char *code, *packed;
 };
 
-#define DC_X_GET_BUILDER_BYTES(BLD) ((unsigned char*)((BLD)+1))
-#define DC_X_GET_BUILDER_AT(BLD) (((unsigned char*)((BLD)+1)) + ((BLD)->at))
+/* Returns where to write the next encoding to a buffer with at bytes written,
+ * first growing the buffer if there are fewer than DC_X_MAX_WRITE_SIZE bytes
+ * left in it. */
+static unsigned char *dc_x_reserve_write(unsigned char **buffer,
+    unsigned *capacity,
+    unsigned at){
+    
+    if(at + DC_X_MAX_WRITE_SIZE > capacity[0]){
+        while(at + DC_X_MAX_WRITE_SIZE > capacity[0])
+            capacity[0] <<= 1;
+        buffer[0] = realloc(buffer[0], capacity[0]);
+    }
+    return buffer[0] + at;
+}
+
+#define DC_X_GET_BUILDER_AT(BLD)\
+    dc_x_reserve_write(&((BLD)->code), &((BLD)->capacity), (BLD)->at)
+#define DC_X_GET_PACKED_AT(BLD)\
+    dc_x_reserve_write(&((BLD)->packed), &((BLD)->packed_capacity),\
+        (BLD)->packed_at)
+
+/* Drops the packed code of a builder, once an operation is found that has no
+ * packed form. */
+static void dc_x_drop_packed(struct DC_X_CalculationBuilder *bld){
+    free(bld->packed);
+    bld->packed = NULL;
+}
 
 struct DC_X_Context *DC_X_CreateContext(void){
     struct DC_X_Context *const ctx = calloc(sizeof(struct DC_X_Context), 1);
     ctx->page_size = DC_JIT_PageSize();
+    ctx->max_free_pages = DC_X_DEFAULT_MAX_FREE_PAGES;
+    ctx->fast_trig = DC_X_DEFAULT_FAST_TRIG;
+    ctx->can_round = C_DEMANGLE_NAME(DC_ASM_CanRound)();
     return ctx;
 }
 
+/* Puts a page with no calculations left into the pool, or returns it to the OS
+ * if the pool is already full. */
+static void dc_x_release_page(struct DC_X_Context *ctx,
+    struct DC_X_PageList *page){
+    
+    assert(page->refs == 0);
+    if(page->size == ctx->page_size && !page->sealed &&
+        ctx->num_free_pages < ctx->max_free_pages){
+        page->next = ctx->free_pages;
+        ctx->free_pages = page;
+        ctx->num_free_pages++;
+    }
+    else{
+        DC_JIT_FreePage(page->page);
+        free(page);
+    }
+}
+
+int DC_X_SetOption(struct DC_X_Context *ctx, int option, unsigned value){
+    switch(option){
+        case DC_OPTION_MAX_FREE_PAGES:
+            ctx->max_free_pages = value;
+            /* Trim the pool down to the new limit right away. */
+            while(ctx->num_free_pages > value){
+                struct DC_X_PageList *const page = ctx->free_pages;
+                ctx->free_pages = page->next;
+                ctx->num_free_pages--;
+                DC_JIT_FreePage(page->page);
+                free(page);
+            }
+            return 1;
+        case DC_OPTION_FAST_TRIG:
+            ctx->fast_trig = value;
+            return 1;
+        case DC_OPTION_DOUBLE:
+            ctx->use_double = value;
+            return 1;
+        case DC_OPTION_FAST_MATH:
+            ctx->fast_math = value;
+            return 1;
+    }
+    return 0;
+}
+
+unsigned DC_X_GetOption(const struct DC_X_Context *ctx, int option){
+    switch(option){
+        case DC_OPTION_MAX_FREE_PAGES:
+            return ctx->max_free_pages;
+        case DC_OPTION_FAST_TRIG:
+            return ctx->fast_trig;
+        case DC_OPTION_DOUBLE:
+            return ctx->use_double;
+        case DC_OPTION_FAST_MATH:
+            return ctx->fast_math;
+    }
+    return 0;
+}
+
 void DC_X_FreeContext(struct DC_X_Context *ctx){
     struct DC_X_PageList *page_lists[NUM_PAGE_LISTS];
     unsigned i = 0;
@@ -75,123 +262,986 @@ struct DC_X_CalculationBuilder *DC_X_CreateCalculationBuilder(
     struct DC_X_Context *ctx){
     
     struct DC_X_CalculationBuilder *const builder =
-        malloc(sizeof(struct DC_X_CalculationBuilder) + ctx->page_size);
+        malloc(sizeof(struct DC_X_CalculationBuilder));
     builder->at = 0;
+    builder->depth = 0;
+    builder->num_slots = 0;
+    builder->num_temps = 0;
+    builder->num_args = 0;
+    builder->packed_at = 0;
+    builder->is_double = ctx->use_double;
+    builder->fast_trig = ctx->fast_trig;
+    builder->capacity = ctx->page_size;
+    builder->code = malloc(builder->capacity);
+    builder->packed_capacity = ctx->page_size;
+    builder->packed = builder->is_double ?
+        NULL : malloc(builder->packed_capacity);
     return builder;
 }
 
+int DC_X_SetBuilderOption(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    int option,
+    unsigned value){
+    
+    (void)ctx;
+    assert(bld->at == 0);
+    switch(option){
+        case DC_OPTION_FAST_TRIG:
+            bld->fast_trig = value;
+            return 1;
+        case DC_OPTION_DOUBLE:
+            bld->is_double = value;
+            if(value)
+                dc_x_drop_packed(bld);
+            else if(bld->packed == NULL)
+                bld->packed = malloc(bld->packed_capacity);
+            return 1;
+    }
+    return 0;
+}
+
+/* Returns the index to give the encoder for an operation on the top count
+ * values of the stack, first reloading any of those values which are spilled.
+ * Spilled operands are placed in the registers above the resident values. */
+static unsigned dc_x_load_operands(struct DC_X_CalculationBuilder *bld,
+    unsigned count){
+    
+    const unsigned depth = bld->depth;
+    unsigned index = depth, i;
+    if(index > DC_X_RESIDENT_VALUES + count)
+        index = DC_X_RESIDENT_VALUES + count;
+    
+    for(i = depth - count; i < depth; i++){
+        if(i >= DC_X_RESIDENT_VALUES){
+            const unsigned slot = bld->num_temps + i - DC_X_RESIDENT_VALUES,
+                reg = index - (depth - i);
+            if(bld->is_double){
+                bld->at += C_DEMANGLE_NAME(DC_ASM_WriteDoubleReload)(
+                    DC_X_GET_BUILDER_AT(bld), slot, reg);
+            }
+            else{
+                bld->at += C_DEMANGLE_NAME(DC_ASM_WriteReload)(
+                    DC_X_GET_BUILDER_AT(bld), slot, reg);
+            }
+            if(bld->packed != NULL){
+                bld->packed_at += C_DEMANGLE_NAME(DC_ASM_WritePackedReload)(
+                    DC_X_GET_PACKED_AT(bld), slot, reg);
+            }
+        }
+    }
+    return index;
+}
+
+/* Returns the index to give the encoder for a push. */
+static unsigned dc_x_push_index(const struct DC_X_CalculationBuilder *bld){
+    return (bld->depth > DC_X_RESIDENT_VALUES) ?
+        DC_X_RESIDENT_VALUES : bld->depth;
+}
+
+/* Spills the top of the stack if it is not a resident value. index is the
+ * encoder index that has the top value in XMM(index-1). */
+static void dc_x_store_result(struct DC_X_CalculationBuilder *bld,
+    unsigned index){
+    
+    if(bld->depth > DC_X_RESIDENT_VALUES){
+        const unsigned slot =
+            bld->num_temps + bld->depth - 1 - DC_X_RESIDENT_VALUES;
+        if(bld->is_double){
+            bld->at += C_DEMANGLE_NAME(DC_ASM_WriteDoubleSpill)(
+                DC_X_GET_BUILDER_AT(bld), slot, index);
+        }
+        else{
+            bld->at += C_DEMANGLE_NAME(DC_ASM_WriteSpill)(
+                DC_X_GET_BUILDER_AT(bld), slot, index);
+        }
+        if(bld->packed != NULL){
+            bld->packed_at += C_DEMANGLE_NAME(DC_ASM_WritePackedSpill)(
+                DC_X_GET_PACKED_AT(bld), slot, index);
+        }
+        if(slot >= bld->num_slots)
+            bld->num_slots = slot + 1;
+    }
+}
+
+/* Writes a packed argument push, and records the use of the argument. */
+static void dc_x_packed_push_arg(struct DC_X_CalculationBuilder *bld,
+    unsigned short arg,
+    unsigned index){
+    
+    if(arg >= bld->num_args)
+        bld->num_args = arg + 1;
+    if(bld->packed != NULL){
+        bld->packed_at += C_DEMANGLE_NAME(DC_ASM_WritePackedPushArg)(
+            DC_X_GET_PACKED_AT(bld), arg, index);
+    }
+}
+
+/* Writes a double precision argument push, and records the use of the
+ * argument. */
+static void dc_x_double_push_arg(struct DC_X_CalculationBuilder *bld,
+    unsigned short arg,
+    unsigned index){
+    
+    if(arg >= bld->num_args)
+        bld->num_args = arg + 1;
+    bld->at += C_DEMANGLE_NAME(DC_ASM_WriteDoublePushArg)(
+        DC_X_GET_BUILDER_AT(bld), arg, index);
+}
+
 void DC_X_BuildPushImmediate(struct DC_X_Context *ctx,
     struct DC_X_CalculationBuilder *bld,
-    float value){
+    double value){
+    const unsigned index = dc_x_push_index(bld);
     (void)ctx;
-    bld->at += C_DEMANGLE_NAME(DC_ASM_WriteImmediate)(
-        DC_X_GET_BUILDER_AT(bld), value);
+    if(bld->is_double){
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteDoubleImmediate)(
+            DC_X_GET_BUILDER_AT(bld), value, index);
+    }
+    else{
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteImmediate)(
+            DC_X_GET_BUILDER_AT(bld), (float)value, index);
+        if(bld->packed != NULL){
+            bld->packed_at += C_DEMANGLE_NAME(DC_ASM_WritePackedImmediate)(
+                DC_X_GET_PACKED_AT(bld), (float)value, index);
+        }
+    }
+    bld->depth++;
+    dc_x_store_result(bld, index + 1);
 }
 
 void DC_X_BuildPushArg(struct DC_X_Context *ctx,
     struct DC_X_CalculationBuilder *bld,
     unsigned short arg_num){
+    const unsigned index = dc_x_push_index(bld);
     (void)ctx;
-    bld->at += C_DEMANGLE_NAME(DC_ASM_WritePushArg)(
-        DC_X_GET_BUILDER_AT(bld), arg_num);
+    if(bld->is_double){
+        dc_x_double_push_arg(bld, arg_num, index);
+    }
+    else{
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WritePushArg)(
+            DC_X_GET_BUILDER_AT(bld), arg_num, index);
+        dc_x_packed_push_arg(bld, arg_num, index);
+    }
+    bld->depth++;
+    dc_x_store_result(bld, index + 1);
 }
 
-#define DC_X_OP(NAME)\
+/* Binary operations pop two values and push the result. The argument and
+ * immediate forms operate on the top of the stack in place. Their packed and
+ * double precision forms push the operand into the next register and use the
+ * stack form. */
+#define DC_X_BINARY_OP(NAME)\
 void DC_X_Build ## NAME(struct DC_X_Context *ctx,\
     struct DC_X_CalculationBuilder *bld){\
+    unsigned index;\
     (void)ctx;\
-    bld->at += C_DEMANGLE_NAME(DC_ASM_Write ## NAME)(DC_X_GET_BUILDER_AT(bld));\
+    assert(bld->depth >= 2);\
+    index = dc_x_load_operands(bld, 2);\
+    if(bld->is_double){\
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteDouble ## NAME)(\
+            DC_X_GET_BUILDER_AT(bld), index);\
+    }\
+    else{\
+        bld->at += C_DEMANGLE_NAME(DC_ASM_Write ## NAME)(\
+            DC_X_GET_BUILDER_AT(bld), index);\
+    }\
+    if(bld->packed != NULL){\
+        bld->packed_at += C_DEMANGLE_NAME(DC_ASM_WritePacked ## NAME)(\
+            DC_X_GET_PACKED_AT(bld), index);\
+    }\
+    bld->depth--;\
+    dc_x_store_result(bld, index - 1);\
 }\
 void DC_X_Build ## NAME ## Arg(struct DC_X_Context *ctx,\
     struct DC_X_CalculationBuilder *bld,\
     unsigned short arg){\
+    unsigned index;\
     (void)ctx;\
-    bld->at += C_DEMANGLE_NAME(DC_ASM_Write ## NAME ## Arg)(DC_X_GET_BUILDER_AT(bld), arg);\
+    assert(bld->depth >= 1);\
+    index = dc_x_load_operands(bld, 1);\
+    if(bld->is_double){\
+        dc_x_double_push_arg(bld, arg, index);\
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteDouble ## NAME)(\
+            DC_X_GET_BUILDER_AT(bld), index + 1);\
+    }\
+    else{\
+        bld->at += C_DEMANGLE_NAME(DC_ASM_Write ## NAME ## Arg)(\
+            DC_X_GET_BUILDER_AT(bld), arg, index);\
+        dc_x_packed_push_arg(bld, arg, index);\
+    }\
+    if(bld->packed != NULL){\
+        bld->packed_at += C_DEMANGLE_NAME(DC_ASM_WritePacked ## NAME)(\
+            DC_X_GET_PACKED_AT(bld), index + 1);\
+    }\
+    dc_x_store_result(bld, index);\
+}\
+void DC_X_Build ## NAME ## Imm(struct DC_X_Context *ctx,\
+    struct DC_X_CalculationBuilder *bld,\
+    double imm){\
+    unsigned index;\
+    (void)ctx;\
+    assert(bld->depth >= 1);\
+    index = dc_x_load_operands(bld, 1);\
+    if(bld->is_double){\
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteDoubleImmediate)(\
+            DC_X_GET_BUILDER_AT(bld), imm, index);\
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteDouble ## NAME)(\
+            DC_X_GET_BUILDER_AT(bld), index + 1);\
+    }\
+    else{\
+        bld->at += C_DEMANGLE_NAME(DC_ASM_Write ## NAME ## Imm)(\
+            DC_X_GET_BUILDER_AT(bld), (float)imm, index);\
+    }\
+    if(bld->packed != NULL){\
+        bld->packed_at += C_DEMANGLE_NAME(DC_ASM_WritePackedImmediate)(\
+            DC_X_GET_PACKED_AT(bld), (float)imm, index);\
+        bld->packed_at += C_DEMANGLE_NAME(DC_ASM_WritePacked ## NAME)(\
+            DC_X_GET_PACKED_AT(bld), index + 1);\
+    }\
+    dc_x_store_result(bld, index);\
 }
 
-DC_X_OP(Add)
-DC_X_OP(Sub)
-DC_X_OP(Mul)
-DC_X_OP(Div)
-DC_X_OP(Sin)
-DC_X_OP(Cos)
-DC_X_OP(Sqrt)
+DC_X_BINARY_OP(Add)
+DC_X_BINARY_OP(Sub)
+DC_X_BINARY_OP(Mul)
+DC_X_BINARY_OP(Div)
+
+/* The remaining operations are written by a writer function, which writes the
+ * stack form of the operation at index, and the macros below build the
+ * argument and immediate forms by pushing the operand into the next register.
+ *
+ * Operations calculated on the x87 unit have no packed form, like fsin/fcos,
+ * so calculations using them do not get packed code. */
+static void dc_x_write_x87(struct DC_X_CalculationBuilder *bld,
+    unsigned func,
+    unsigned index){
+    
+    if(bld->is_double){
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteDoubleX87)(
+            DC_X_GET_BUILDER_AT(bld), func, index);
+    }
+    else{
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteX87)(
+            DC_X_GET_BUILDER_AT(bld), func, index);
+    }
+    dc_x_drop_packed(bld);
+}
+
+/* Writes an argument push into XMM(index) for both the scalar and packed
+ * code. */
+static void dc_x_write_push_arg(struct DC_X_CalculationBuilder *bld,
+    unsigned short arg,
+    unsigned index){
+    
+    if(bld->is_double){
+        dc_x_double_push_arg(bld, arg, index);
+    }
+    else{
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WritePushArg)(
+            DC_X_GET_BUILDER_AT(bld), arg, index);
+        dc_x_packed_push_arg(bld, arg, index);
+    }
+}
+
+/* Writes an immediate push into XMM(index) for both the scalar and packed
+ * code. */
+static void dc_x_write_immediate(struct DC_X_CalculationBuilder *bld,
+    double imm,
+    unsigned index){
+    
+    if(bld->is_double){
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteDoubleImmediate)(
+            DC_X_GET_BUILDER_AT(bld), imm, index);
+    }
+    else{
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteImmediate)(
+            DC_X_GET_BUILDER_AT(bld), (float)imm, index);
+        if(bld->packed != NULL){
+            bld->packed_at += C_DEMANGLE_NAME(DC_ASM_WritePackedImmediate)(
+                DC_X_GET_PACKED_AT(bld), (float)imm, index);
+        }
+    }
+}
+
+static void dc_x_write_pow(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned index){
+    (void)ctx;
+    dc_x_write_x87(bld, DC_ASM_X87_POW, index);
+}
+
+static void dc_x_write_atan2(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned index){
+    (void)ctx;
+    dc_x_write_x87(bld, DC_ASM_X87_ATAN2, index);
+}
+
+/* minss/maxss and their packed and double forms. */
+#define DC_X_SSE_WRITER(NAME, WRITER)\
+static void WRITER(struct DC_X_Context *ctx,\
+    struct DC_X_CalculationBuilder *bld,\
+    unsigned index){\
+    (void)ctx;\
+    if(bld->is_double){\
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteDouble ## NAME)(\
+            DC_X_GET_BUILDER_AT(bld), index);\
+    }\
+    else{\
+        bld->at += C_DEMANGLE_NAME(DC_ASM_Write ## NAME)(\
+            DC_X_GET_BUILDER_AT(bld), index);\
+    }\
+    if(bld->packed != NULL){\
+        bld->packed_at += C_DEMANGLE_NAME(DC_ASM_WritePacked ## NAME)(\
+            DC_X_GET_PACKED_AT(bld), index);\
+    }\
+}
+
+DC_X_SSE_WRITER(Min, dc_x_write_min)
+DC_X_SSE_WRITER(Max, dc_x_write_max)
+
+static void dc_x_write_tan(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned index){
+    (void)ctx;
+    dc_x_write_x87(bld, DC_ASM_X87_TAN, index);
+}
+
+static void dc_x_write_exp(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned index){
+    (void)ctx;
+    dc_x_write_x87(bld, DC_ASM_X87_EXP, index);
+}
+
+static void dc_x_write_log(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned index){
+    (void)ctx;
+    dc_x_write_x87(bld, DC_ASM_X87_LOG, index);
+}
+
+/* roundss needs SSE4.1, so the x87 unit is used without it. */
+static void dc_x_write_floor(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned index){
+    
+    if(!ctx->can_round){
+        dc_x_write_x87(bld, DC_ASM_X87_FLOOR, index);
+        return;
+    }
+    
+    if(bld->is_double){
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteDoubleFloor)(
+            DC_X_GET_BUILDER_AT(bld), index);
+    }
+    else{
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteFloor)(
+            DC_X_GET_BUILDER_AT(bld), index);
+    }
+    if(bld->packed != NULL){
+        bld->packed_at += C_DEMANGLE_NAME(DC_ASM_WritePackedFloor)(
+            DC_X_GET_PACKED_AT(bld), index);
+    }
+}
+
+/* Clears the sign bit by pushing a mask into XMM(index) and using andps. The
+ * mask is little endian, and its first four bytes are the double's low bits. */
+static const unsigned char dc_x_abs_mask[8] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x7F
+};
+
+static void dc_x_write_abs(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned index){
+    (void)ctx;
+    if(bld->is_double){
+        double mask;
+        memcpy(&mask, dc_x_abs_mask, sizeof(double));
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteDoubleImmediate)(
+            DC_X_GET_BUILDER_AT(bld), mask, index);
+    }
+    else{
+        float mask;
+        memcpy(&mask, dc_x_abs_mask + 4, sizeof(float));
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteImmediate)(
+            DC_X_GET_BUILDER_AT(bld), mask, index);
+        if(bld->packed != NULL){
+            bld->packed_at += C_DEMANGLE_NAME(DC_ASM_WritePackedImmediate)(
+                DC_X_GET_PACKED_AT(bld), mask, index);
+        }
+    }
+    bld->at += C_DEMANGLE_NAME(DC_ASM_WriteAnd)(
+        DC_X_GET_BUILDER_AT(bld), index + 1);
+    if(bld->packed != NULL){
+        bld->packed_at += C_DEMANGLE_NAME(DC_ASM_WriteAnd)(
+            DC_X_GET_PACKED_AT(bld), index + 1);
+    }
+}
+
+/* Comparisons give 1.0 or 0.0. */
+static void dc_x_write_compare(struct DC_X_CalculationBuilder *bld,
+    unsigned predicate,
+    unsigned index){
+    
+    if(bld->is_double){
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteDoubleCompare)(
+            DC_X_GET_BUILDER_AT(bld), predicate, index);
+    }
+    else{
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteCompare)(
+            DC_X_GET_BUILDER_AT(bld), predicate, index);
+    }
+    if(bld->packed != NULL){
+        bld->packed_at += C_DEMANGLE_NAME(DC_ASM_WritePackedCompare)(
+            DC_X_GET_PACKED_AT(bld), predicate, index);
+    }
+}
+
+#define DC_X_COMPARE_WRITER(WRITER, PREDICATE)\
+static void WRITER(struct DC_X_Context *ctx,\
+    struct DC_X_CalculationBuilder *bld,\
+    unsigned index){\
+    (void)ctx;\
+    dc_x_write_compare(bld, (PREDICATE), index);\
+}
 
+DC_X_COMPARE_WRITER(dc_x_write_less, DC_ASM_CMP_LT)
+DC_X_COMPARE_WRITER(dc_x_write_less_equal, DC_ASM_CMP_LE)
+DC_X_COMPARE_WRITER(dc_x_write_equal, DC_ASM_CMP_EQ)
+DC_X_COMPARE_WRITER(dc_x_write_not_equal, DC_ASM_CMP_NEQ)
 
-#define DC_X_IMM_OP(NAME)\
+#define DC_X_WRITTEN_BINARY_OP(NAME, WRITER)\
+void DC_X_Build ## NAME(struct DC_X_Context *ctx,\
+    struct DC_X_CalculationBuilder *bld){\
+    unsigned index;\
+    assert(bld->depth >= 2);\
+    index = dc_x_load_operands(bld, 2);\
+    WRITER(ctx, bld, index);\
+    bld->depth--;\
+    dc_x_store_result(bld, index - 1);\
+}\
+void DC_X_Build ## NAME ## Arg(struct DC_X_Context *ctx,\
+    struct DC_X_CalculationBuilder *bld,\
+    unsigned short arg){\
+    unsigned index;\
+    assert(bld->depth >= 1);\
+    index = dc_x_load_operands(bld, 1);\
+    dc_x_write_push_arg(bld, arg, index);\
+    WRITER(ctx, bld, index + 1);\
+    dc_x_store_result(bld, index);\
+}\
 void DC_X_Build ## NAME ## Imm(struct DC_X_Context *ctx,\
     struct DC_X_CalculationBuilder *bld,\
-    float imm){\
+    double imm){\
+    unsigned index;\
+    assert(bld->depth >= 1);\
+    index = dc_x_load_operands(bld, 1);\
+    dc_x_write_immediate(bld, imm, index);\
+    WRITER(ctx, bld, index + 1);\
+    dc_x_store_result(bld, index);\
+}
+
+DC_X_WRITTEN_BINARY_OP(Pow, dc_x_write_pow)
+DC_X_WRITTEN_BINARY_OP(Atan2, dc_x_write_atan2)
+DC_X_WRITTEN_BINARY_OP(Min, dc_x_write_min)
+DC_X_WRITTEN_BINARY_OP(Max, dc_x_write_max)
+DC_X_WRITTEN_BINARY_OP(Less, dc_x_write_less)
+DC_X_WRITTEN_BINARY_OP(LessEqual, dc_x_write_less_equal)
+DC_X_WRITTEN_BINARY_OP(Equal, dc_x_write_equal)
+DC_X_WRITTEN_BINARY_OP(NotEqual, dc_x_write_not_equal)
+
+#define DC_X_WRITTEN_UNARY_OP(NAME, WRITER)\
+void DC_X_Build ## NAME(struct DC_X_Context *ctx,\
+    struct DC_X_CalculationBuilder *bld){\
+    unsigned index;\
+    assert(bld->depth >= 1);\
+    index = dc_x_load_operands(bld, 1);\
+    WRITER(ctx, bld, index);\
+    dc_x_store_result(bld, index);\
+}\
+void DC_X_Build ## NAME ## Arg(struct DC_X_Context *ctx,\
+    struct DC_X_CalculationBuilder *bld,\
+    unsigned short arg){\
+    const unsigned index = dc_x_push_index(bld);\
+    dc_x_write_push_arg(bld, arg, index);\
+    WRITER(ctx, bld, index + 1);\
+    bld->depth++;\
+    dc_x_store_result(bld, index + 1);\
+}
+
+DC_X_WRITTEN_UNARY_OP(Tan, dc_x_write_tan)
+DC_X_WRITTEN_UNARY_OP(Exp, dc_x_write_exp)
+DC_X_WRITTEN_UNARY_OP(Log, dc_x_write_log)
+DC_X_WRITTEN_UNARY_OP(Abs, dc_x_write_abs)
+DC_X_WRITTEN_UNARY_OP(Floor, dc_x_write_floor)
+
+/* Selects pop the condition and the value for when it is zero, and replace the
+ * value for when it is not zero with the result. */
+void DC_X_BuildSelect(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld){
+    unsigned index;
+    (void)ctx;
+    assert(bld->depth >= 3);
+    index = dc_x_load_operands(bld, 3);
+    if(bld->is_double){
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteDoubleSelect)(
+            DC_X_GET_BUILDER_AT(bld), index);
+    }
+    else{
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteSelect)(
+            DC_X_GET_BUILDER_AT(bld), index);
+    }
+    if(bld->packed != NULL){
+        bld->packed_at += C_DEMANGLE_NAME(DC_ASM_WritePackedSelect)(
+            DC_X_GET_PACKED_AT(bld), index);
+    }
+    bld->depth -= 2;
+    dc_x_store_result(bld, index - 2);
+}
+
+/* Unary operations replace the top of the stack. The argument form pushes the
+ * result of operating on the argument. */
+void DC_X_BuildSqrt(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld){
+    unsigned index;
+    (void)ctx;
+    assert(bld->depth >= 1);
+    index = dc_x_load_operands(bld, 1);
+    if(bld->is_double){
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteDoubleSqrt)(
+            DC_X_GET_BUILDER_AT(bld), index);
+    }
+    else{
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteSqrt)(
+            DC_X_GET_BUILDER_AT(bld), index);
+    }
+    if(bld->packed != NULL){
+        bld->packed_at += C_DEMANGLE_NAME(DC_ASM_WritePackedSqrt)(
+            DC_X_GET_PACKED_AT(bld), index);
+    }
+    dc_x_store_result(bld, index);
+}
+
+void DC_X_BuildSqrtArg(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned short arg){
+    const unsigned index = dc_x_push_index(bld);
+    (void)ctx;
+    if(bld->is_double){
+        dc_x_double_push_arg(bld, arg, index);
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteDoubleSqrt)(
+            DC_X_GET_BUILDER_AT(bld), index + 1);
+    }
+    else{
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteSqrtArg)(
+            DC_X_GET_BUILDER_AT(bld), arg, index);
+        dc_x_packed_push_arg(bld, arg, index);
+    }
+    if(bld->packed != NULL){
+        bld->packed_at += C_DEMANGLE_NAME(DC_ASM_WritePackedSqrt)(
+            DC_X_GET_PACKED_AT(bld), index + 1);
+    }
+    bld->depth++;
+    dc_x_store_result(bld, index + 1);
+}
+
+/* Like unary operations, but these use the SSE polynomial when the context
+ * builder has fast_trig set. There is no packed form of fsin/fcos, so calculations
+ * using them do not get packed code. Double precision calculations always use
+ * fsin/fcos. */
+#define DC_X_TRIG_OP(NAME)\
+void DC_X_Build ## NAME(struct DC_X_Context *ctx,\
+    struct DC_X_CalculationBuilder *bld){\
+    unsigned index;\
+    (void)ctx;\
+    assert(bld->depth >= 1);\
+    index = dc_x_load_operands(bld, 1);\
+    if(bld->is_double){\
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteDouble ## NAME)(\
+            DC_X_GET_BUILDER_AT(bld), index);\
+    }\
+    else if(bld->fast_trig){\
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WritePoly ## NAME)(\
+            DC_X_GET_BUILDER_AT(bld), index);\
+        if(bld->packed != NULL){\
+            bld->packed_at += C_DEMANGLE_NAME(DC_ASM_WritePackedPoly ## NAME)(\
+                DC_X_GET_PACKED_AT(bld), index);\
+        }\
+    }\
+    else{\
+        bld->at += C_DEMANGLE_NAME(DC_ASM_Write ## NAME)(\
+            DC_X_GET_BUILDER_AT(bld), index);\
+        dc_x_drop_packed(bld);\
+    }\
+    dc_x_store_result(bld, index);\
+}\
+void DC_X_Build ## NAME ## Arg(struct DC_X_Context *ctx,\
+    struct DC_X_CalculationBuilder *bld,\
+    unsigned short arg){\
+    const unsigned index = dc_x_push_index(bld);\
     (void)ctx;\
-    bld->at += C_DEMANGLE_NAME(DC_ASM_Write ## NAME ## Imm)(DC_X_GET_BUILDER_AT(bld), imm);\
+    if(bld->is_double){\
+        dc_x_double_push_arg(bld, arg, index);\
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteDouble ## NAME)(\
+            DC_X_GET_BUILDER_AT(bld), index + 1);\
+    }\
+    else if(bld->fast_trig){\
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WritePushArg)(\
+            DC_X_GET_BUILDER_AT(bld), arg, index);\
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WritePoly ## NAME)(\
+            DC_X_GET_BUILDER_AT(bld), index + 1);\
+        dc_x_packed_push_arg(bld, arg, index);\
+        if(bld->packed != NULL){\
+            bld->packed_at += C_DEMANGLE_NAME(DC_ASM_WritePackedPoly ## NAME)(\
+                DC_X_GET_PACKED_AT(bld), index + 1);\
+        }\
+    }\
+    else{\
+        bld->at += C_DEMANGLE_NAME(DC_ASM_Write ## NAME ## Arg)(\
+            DC_X_GET_BUILDER_AT(bld), arg, index);\
+        if(arg >= bld->num_args)\
+            bld->num_args = arg + 1;\
+        dc_x_drop_packed(bld);\
+    }\
+    bld->depth++;\
+    dc_x_store_result(bld, index + 1);\
 }
 
-DC_X_IMM_OP(Add)
-DC_X_IMM_OP(Sub)
-DC_X_IMM_OP(Mul)
-DC_X_IMM_OP(Div)
+DC_X_TRIG_OP(Sin)
+DC_X_TRIG_OP(Cos)
 
 void DC_X_BuildPop(struct DC_X_Context *ctx,
     struct DC_X_CalculationBuilder *bld){
     (void)ctx;
+    assert(bld->depth >= 1);
+    bld->depth--;
     bld->at += C_DEMANGLE_NAME(DC_ASM_WritePop)(DC_X_GET_BUILDER_AT(bld));
 }
 
-void DC_X_AbandonCalculation(struct DC_X_Context *ctx,
+void DC_X_BuildDup(struct DC_X_Context *ctx,
     struct DC_X_CalculationBuilder *bld){
+    unsigned index;
+    (void)ctx;
+    assert(bld->depth >= 1);
+    index = dc_x_load_operands(bld, 1);
+    bld->at += C_DEMANGLE_NAME(DC_ASM_WriteDup)(
+        DC_X_GET_BUILDER_AT(bld), index);
+    if(bld->packed != NULL){
+        bld->packed_at += C_DEMANGLE_NAME(DC_ASM_WriteDup)(
+            DC_X_GET_PACKED_AT(bld), index);
+    }
+    bld->depth++;
+    dc_x_store_result(bld, index + 1);
+}
+
+/* Temporaries use the spill encoders on the first num_temps frame slots. This
+ * must be called before anything could be spilled. */
+void DC_X_BuildReserveTemps(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned short num_temps){
+    (void)ctx;
+    assert(bld->num_slots == 0);
+    bld->num_temps = num_temps;
+    bld->num_slots = num_temps;
+}
+
+void DC_X_BuildStoreTemp(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned short temp){
+    unsigned index;
+    (void)ctx;
+    assert(bld->depth >= 1);
+    assert(temp < bld->num_temps);
+    index = dc_x_load_operands(bld, 1);
+    if(bld->is_double){
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteDoubleSpill)(
+            DC_X_GET_BUILDER_AT(bld), temp, index);
+    }
+    else{
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteSpill)(
+            DC_X_GET_BUILDER_AT(bld), temp, index);
+    }
+    if(bld->packed != NULL){
+        bld->packed_at += C_DEMANGLE_NAME(DC_ASM_WritePackedSpill)(
+            DC_X_GET_PACKED_AT(bld), temp, index);
+    }
+}
+
+void DC_X_BuildPushTemp(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned short temp){
+    const unsigned index = dc_x_push_index(bld);
+    (void)ctx;
+    assert(temp < bld->num_temps);
+    if(bld->is_double){
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteDoubleReload)(
+            DC_X_GET_BUILDER_AT(bld), temp, index);
+    }
+    else{
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteReload)(
+            DC_X_GET_BUILDER_AT(bld), temp, index);
+    }
+    if(bld->packed != NULL){
+        bld->packed_at += C_DEMANGLE_NAME(DC_ASM_WritePackedReload)(
+            DC_X_GET_PACKED_AT(bld), temp, index);
+    }
+    bld->depth++;
+    dc_x_store_result(bld, index + 1);
+}
+
+/* Batches do not keep their arguments, so there is no packed form. */
+void DC_X_BuildStoreArg(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld,
+    unsigned short arg_num){
+    unsigned index;
     (void)ctx;
+    assert(bld->depth >= 1);
+    index = dc_x_load_operands(bld, 1);
+    if(bld->is_double){
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteDoubleStoreArg)(
+            DC_X_GET_BUILDER_AT(bld), arg_num, index);
+    }
+    else{
+        bld->at += C_DEMANGLE_NAME(DC_ASM_WriteStoreArg)(
+            DC_X_GET_BUILDER_AT(bld), arg_num, index);
+    }
+    dc_x_drop_packed(bld);
+}
+
+/* Frees a builder and its buffers. */
+static void dc_x_free_builder(struct DC_X_CalculationBuilder *bld){
+    free(bld->code);
+    free(bld->packed);
     free(bld);
 }
 
+void DC_X_AbandonCalculation(struct DC_X_Context *ctx,
+    struct DC_X_CalculationBuilder *bld){
+    (void)ctx;
+    dc_x_free_builder(bld);
+}
+
+/* Maps size bytes of pages for code. Returns NULL if they could not be
+ * mapped. */
+static struct DC_X_PageList *dc_x_map_page(unsigned size){
+    struct DC_JIT_Page *const p = DC_JIT_AllocPage(size);
+    struct DC_X_PageList *page;
+    if(p == NULL)
+        return NULL;
+    page = malloc(sizeof(struct DC_X_PageList));
+    page->page = p;
+    page->at = 0;
+    page->refs = 0;
+    page->size = size;
+    page->sealed = 0;
+    page->next = NULL;
+    return page;
+}
+
+/* Finds room for size bytes of code in the context's open page, retiring it
+ * and opening a new page if the code will not fit. The returned page's `at' is
+ * the aligned offset to write the code at.
+ *
+ * Code that is bigger than a page gets a run of pages of its own, which goes
+ * straight to active_pages and leaves the open page as it is.
+ *
+ * Returns NULL if no pages could be mapped. */
+static struct DC_X_PageList *dc_x_reserve_code(struct DC_X_Context *ctx,
+    unsigned size){
+    
+    struct DC_X_PageList *page = ctx->next_page;
+    if(size > ctx->page_size){
+        const unsigned run_size =
+            ((size + ctx->page_size - 1) / ctx->page_size) * ctx->page_size;
+        if((page = dc_x_map_page(run_size)) != NULL){
+            page->next = ctx->active_pages;
+            ctx->active_pages = page;
+        }
+        return page;
+    }
+    
+    if(page != NULL){
+        const unsigned start = DC_X_ALIGN_CODE(page->at);
+        if(start + size <= ctx->page_size){
+            page->at = start;
+            return page;
+        }
+        
+        /* The page is full. If all of its calculations have already been
+         * freed it goes straight to the free list. */
+        ctx->next_page = NULL;
+        if(page->refs == 0){
+            dc_x_release_page(ctx, page);
+        }
+        else{
+            page->next = ctx->active_pages;
+            ctx->active_pages = page;
+        }
+    }
+    
+    /* Reuse a pooled page if there is one. */
+    if((page = ctx->free_pages) != NULL){
+        ctx->free_pages = page->next;
+        ctx->num_free_pages--;
+        page->at = 0;
+        page->next = NULL;
+    }
+    else if((page = dc_x_map_page(ctx->page_size)) == NULL){
+        return NULL;
+    }
+    ctx->next_page = page;
+    return page;
+}
+
+/* Writes the end of the stack frame (if there is one) and the return to the
+ * end of some code. The prologue is only known once the whole calculation is
+ * built, so it is written separately to be placed in front of the code when
+ * copying it to the page. Returns the size of the prologue. */
+static unsigned dc_x_finish_code(unsigned char *prologue,
+    unsigned char **code,
+    unsigned *capacity,
+    unsigned *at,
+    unsigned frame_size){
+    
+    unsigned prologue_size = 0;
+    if(frame_size != 0){
+        prologue_size = C_DEMANGLE_NAME(DC_ASM_WriteEnterFrame)(prologue,
+            frame_size);
+        at[0] += C_DEMANGLE_NAME(DC_ASM_WriteLeaveFrame)(
+            dc_x_reserve_write(code, capacity, at[0]),
+            frame_size);
+    }
+    at[0] += C_DEMANGLE_NAME(DC_ASM_WriteRet)(
+        dc_x_reserve_write(code, capacity, at[0]));
+    return prologue_size;
+}
+
 struct DC_X_Calculation *DC_X_FinalizeCalculation(struct DC_X_Context *ctx,
     struct DC_X_CalculationBuilder *bld){
     
-    struct DC_JIT_Page *const new_page = DC_JIT_AllocPage();
-    bld->at += C_DEMANGLE_NAME(DC_ASM_WriteRet)(DC_X_GET_BUILDER_AT(bld));
+    struct DC_X_PageList *page;
+    unsigned char *page_data;
+    unsigned char native_entry[DC_X_MAX_NATIVE_ENTRY_SIZE];
+    unsigned char prologue[16], packed_prologue[16];
+    unsigned native_entry_size = 0, prologue_size, packed_prologue_size = 0,
+        packed_offset = 0, frame_size = 0, size;
+    assert(bld->depth == 1);
+    
+    /* The native entry runs the code right after it, which is the scalar
+     * code including its prologue. */
+    if(!bld->is_double){
+        native_entry_size =
+            C_DEMANGLE_NAME(DC_ASM_WriteNativeEntry)(native_entry);
+        assert(native_entry_size <= DC_X_MAX_NATIVE_ENTRY_SIZE);
+    }
+    
+    if(bld->num_slots != 0){
+        frame_size = bld->is_double ?
+            DC_X_DOUBLE_FRAME_SIZE(bld->num_slots) :
+            DC_X_FRAME_SIZE(bld->num_slots);
+    }
+    prologue_size = dc_x_finish_code(prologue,
+        &(bld->code),
+        &(bld->capacity),
+        &(bld->at),
+        frame_size);
+    size = native_entry_size + prologue_size + bld->at;
+    
+    /* The packed code goes after the scalar code, on its own alignment. It is
+     * dropped if both will not fit in a single page. */
+    if(bld->packed != NULL){
+        packed_prologue_size = dc_x_finish_code(packed_prologue,
+            &(bld->packed),
+            &(bld->packed_capacity),
+            &(bld->packed_at),
+            (bld->num_slots != 0) ?
+                DC_X_PACKED_FRAME_SIZE(bld->num_slots) : 0);
+        packed_offset = DC_X_ALIGN_CODE(size);
+        if(packed_offset + packed_prologue_size + bld->packed_at >
+            ctx->page_size){
+            dc_x_drop_packed(bld);
+        }
+        else{
+            size = packed_offset + packed_prologue_size + bld->packed_at;
+        }
+    }
 
 #if 0
     { /* For debugging only. */
         FILE *const log = fopen("log.bin", "wb");
-        fwrite(DC_X_GET_BUILDER_BYTES(bld), 1, bld->at, log);
+        fwrite(bld->code, 1, bld->at, log);
         fclose(log);
     }
 #endif
     
-    memcpy(DC_JIT_GetPageData(new_page),
-        DC_X_GET_BUILDER_BYTES(bld),
-        ctx->page_size);
+    if((page = dc_x_reserve_code(ctx, size)) == NULL){
+        dc_x_free_builder(bld);
+        return NULL;
+    }
+    page_data = (unsigned char*)DC_JIT_GetPageData(page->page) + page->at;
     
-    DC_JIT_MarkPageExecutable(new_page);
+    memcpy(page_data, native_entry, native_entry_size);
+    memcpy(page_data + native_entry_size, prologue, prologue_size);
+    memcpy(page_data + native_entry_size + prologue_size, bld->code, bld->at);
+    
+    if(bld->packed != NULL){
+        const unsigned scalar_size =
+            native_entry_size + prologue_size + bld->at;
+        /* Pad with int3 */
+        memset(page_data + scalar_size, 0xCC, packed_offset - scalar_size);
+        memcpy(page_data + packed_offset,
+            packed_prologue,
+            packed_prologue_size);
+        memcpy(page_data + packed_offset + packed_prologue_size,
+            bld->packed,
+            bld->packed_at);
+    }
+    
+    /* A sealed page can't take any more code. */
+    if(!DC_JIT_MarkPageExecutable(page->page)){
+        page->sealed = 1;
+        if(ctx->next_page == page){
+            ctx->next_page = NULL;
+            page->next = ctx->active_pages;
+            ctx->active_pages = page;
+        }
+    }
     
-    free(bld);
     {
         struct DC_X_Calculation *const calc =
             malloc(sizeof(struct DC_X_Calculation));
-        struct DC_X_PageList *const pagelist =
-            malloc(sizeof(struct DC_X_PageList));
-        /* Stitch this new page into the start of the context's pagelist. */
-        pagelist->next = ctx->active_pages;
-        ctx->active_pages = pagelist;
-        pagelist->refs = 1;
-        pagelist->page = new_page;
         
-        calc->page = pagelist;
-        calc->start = 0;
+        calc->page = page;
+        calc->native_start = page->at;
+        calc->start = page->at + native_entry_size;
+        calc->packed_start =
+            (bld->packed != NULL) ? (page->at + packed_offset) : 0;
+        calc->num_args = bld->num_args;
+        calc->is_double = bld->is_double;
+        
+        page->refs++;
+        page->at += size;
         
+        dc_x_free_builder(bld);
         return calc;
     }
 }
 
 void DC_X_Free(struct DC_X_Context *ctx, struct DC_X_Calculation *calc){
     if((calc->page->refs -= 1) == 0){
-        if(ctx->active_pages == calc->page){
+        if(ctx->next_page == calc->page){
+            /* Nothing lives in the open page anymore, so just rewind it. */
+            calc->page->at = 0;
+        }
+        else if(ctx->active_pages == calc->page){
             ctx->active_pages = ctx->active_pages->next;
-            calc->page->next = ctx->free_pages;
-            ctx->free_pages = calc->page;
+            dc_x_release_page(ctx, calc->page);
         }
         else{
             struct DC_X_PageList *page = ctx->active_pages->next,
-                **prev = &(ctx->active_pages);
+                **prev = &(ctx->active_pages->next);
             
             while(page != calc->page){
                 prev = &(page->next);
@@ -199,17 +1249,114 @@ void DC_X_Free(struct DC_X_Context *ctx, struct DC_X_Calculation *calc){
             }
             
             prev[0] = page->next;
-            page->next = ctx->free_pages;
-            ctx->free_pages = page;
+            dc_x_release_page(ctx, page);
         }
     }
     
     free(calc);
 }
 
+/* Running a calculation with the other precision converts its arguments into
+ * a buffer, which is on the stack unless there are many arguments. */
 float DC_X_Calculate(const struct DC_X_Calculation *calc, const float *args){
-    const unsigned char *const code = DC_JIT_GetPageData(calc->page->page);
-    float r;
-    C_DEMANGLE_NAME(DC_ASM_Calculate)(code + calc->start, args, &r);
-    return r;
+    const unsigned char *const code = DC_JIT_GetPageCode(calc->page->page);
+    if(calc->is_double){
+        const unsigned num_args = calc->num_args;
+        double stack_args[DC_X_STACK_ARGS];
+        double *const double_args = (num_args <= DC_X_STACK_ARGS) ?
+            stack_args : malloc(sizeof(double) * num_args);
+        double r;
+        unsigned i;
+        for(i = 0; i < num_args; i++)
+            double_args[i] = args[i];
+        C_DEMANGLE_NAME(DC_ASM_CalculateDouble)(code + calc->start,
+            double_args,
+            &r);
+        if(double_args != stack_args)
+            free(double_args);
+        return (float)r;
+    }
+    else{
+        float r;
+        C_DEMANGLE_NAME(DC_ASM_Calculate)(code + calc->start, args, &r);
+        return r;
+    }
+}
+
+double DC_X_CalculateDouble(const struct DC_X_Calculation *calc,
+    const double *args){
+    const unsigned char *const code = DC_JIT_GetPageCode(calc->page->page);
+    if(calc->is_double){
+        double r;
+        C_DEMANGLE_NAME(DC_ASM_CalculateDouble)(code + calc->start, args, &r);
+        return r;
+    }
+    else{
+        const unsigned num_args = calc->num_args;
+        float stack_args[DC_X_STACK_ARGS];
+        float *const float_args = (num_args <= DC_X_STACK_ARGS) ?
+            stack_args : malloc(sizeof(float) * num_args);
+        float r;
+        unsigned i;
+        for(i = 0; i < num_args; i++)
+            float_args[i] = (float)args[i];
+        C_DEMANGLE_NAME(DC_ASM_Calculate)(code + calc->start, float_args, &r);
+        if(float_args != stack_args)
+            free(float_args);
+        return r;
+    }
+}
+
+DC_X_NativeFunction DC_X_GetNativeFunction(const struct DC_X_Calculation *calc){
+    const unsigned char *const code = (const unsigned char*)
+        DC_JIT_GetPageCode(calc->page->page) + calc->native_start;
+    DC_X_NativeFunction func;
+    if(calc->is_double)
+        return NULL;
+    /* ISO C does not allow casting between data and function pointers. */
+    memcpy(&func, &code, sizeof(func));
+    return func;
+}
+
+void DC_X_CalculateBatch(const struct DC_X_Calculation *calc,
+    unsigned n,
+    const float *args,
+    float *out){
+    
+    const unsigned char *const code = DC_JIT_GetPageCode(calc->page->page);
+    const unsigned num_args = calc->num_args;
+    float stack_block[DC_X_STACK_ARGS * DC_X_LANES];
+    float *const block = (num_args <= DC_X_STACK_ARGS) ?
+        stack_block : malloc(sizeof(float) * DC_X_LANES * num_args);
+    unsigned i = 0, a;
+    
+    if(calc->packed_start != 0){
+        const unsigned char *const packed = code + calc->packed_start;
+        for(; i + DC_X_LANES <= n; i += DC_X_LANES){
+            for(a = 0; a < num_args; a++){
+                memcpy(block + (a * DC_X_LANES),
+                    args + (a * n) + i,
+                    sizeof(float) * DC_X_LANES);
+            }
+            C_DEMANGLE_NAME(DC_ASM_CalculatePacked)(packed, block, out + i);
+        }
+    }
+    
+    /* Anything left over, or everything if there is no packed code, is run
+     * through the scalar code. */
+    for(; i < n; i++){
+        for(a = 0; a < num_args; a++)
+            block[a] = args[(a * n) + i];
+        if(calc->is_double){
+            out[i] = DC_X_Calculate(calc, block);
+        }
+        else{
+            C_DEMANGLE_NAME(DC_ASM_Calculate)(code + calc->start,
+                block,
+                out + i);
+        }
+    }
+    
+    if(block != stack_block)
+        free(block);
 }
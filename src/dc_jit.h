@@ -40,98 +40,333 @@ extern "C" {
     #define DCJIT_CDECL(X) _cdecl C_DEMANGLE_NAME(X)
 #endif
 
-/* Implemented by the platform memory backend. This is mmap on Unix. */
+/* Implemented by the platform memory backend. This is mmap on Unix.
+ *
+ * Code is written through the page's data and run from its code. Where the
+ * platform allows it these are two views of the same memory, so that code can
+ * be added to a page while other code on it is running. Otherwise they are the
+ * same, and a page is sealed once it is marked executable. */
 struct DC_JIT_Page;
 unsigned DC_JIT_PageSize();
 
-/* Allocs a page with write-only permissions. */
-struct DC_JIT_Page *DC_JIT_AllocPage();
+/* Allocs size bytes of pages, with the data writable. size must be a multiple
+ * of the page size. Returns NULL if the pages could not be mapped. */
+struct DC_JIT_Page *DC_JIT_AllocPage(unsigned size);
 void *DC_JIT_GetPageData(struct DC_JIT_Page *);
+const void *DC_JIT_GetPageCode(const struct DC_JIT_Page *);
 
-/* Marks a page as read/execute only. */
-void DC_JIT_MarkPageExecutable(struct DC_JIT_Page *);
-
-/* Clears a page, and marks as write-only again. */
-void DC_JIT_RenewPage(struct DC_JIT_Page *);
+/* Makes the code written to the data so far ready to run. Returns zero if the
+ * page is sealed by this, in which case its data can't be written again. */
+int DC_JIT_MarkPageExecutable(struct DC_JIT_Page *);
 
 void DC_JIT_FreePage(struct DC_JIT_Page *);
 
-/* Implemented by the JIT/ASM backend. */
+/* Implemented by the JIT/ASM backend.
+ *
+ * The encoders do not keep any state. The index argument is the current depth
+ * of the value stack, which is the register that the next push will write to.
+ * The caller is responsible for tracking how each operation changes it. */
 extern const unsigned DC_ASM_jmp_size;
 unsigned DCJIT_CDECL(DC_ASM_WriteJMP)(void *asm_dest, void *jmp_dest);
 
 extern const unsigned DC_ASM_immediate_size;
-unsigned DCJIT_CDECL(DC_ASM_WriteImmediate)(void *dest, float value);
+unsigned DCJIT_CDECL(DC_ASM_WriteImmediate)(void *dest,
+    float value,
+    unsigned index);
 
 extern const unsigned DC_ASM_push_arg_size;
 unsigned DCJIT_CDECL(DC_ASM_WritePushArg)(void *dest,
-    unsigned short arg_num);
+    unsigned short arg_num,
+    unsigned index);
+
+/* Stores XMM(index-1) to an argument, for calculations with more than one
+ * result. */
+extern const unsigned DC_ASM_store_arg_size;
+unsigned DCJIT_CDECL(DC_ASM_WriteStoreArg)(void *dest,
+    unsigned short arg_num,
+    unsigned index);
 
 extern const unsigned DC_ASM_pop_size;
 unsigned DCJIT_CDECL(DC_ASM_WritePop)(void *dest);
 
 extern const unsigned DC_ASM_add_size;
-unsigned DCJIT_CDECL(DC_ASM_WriteAdd)(void *dest);
+unsigned DCJIT_CDECL(DC_ASM_WriteAdd)(void *dest, unsigned index);
 
 extern const unsigned DC_ASM_sub_size;
-unsigned DCJIT_CDECL(DC_ASM_WriteSub)(void *dest);
+unsigned DCJIT_CDECL(DC_ASM_WriteSub)(void *dest, unsigned index);
 
 extern const unsigned DC_ASM_mul_size;
-unsigned DCJIT_CDECL(DC_ASM_WriteMul)(void *dest);
+unsigned DCJIT_CDECL(DC_ASM_WriteMul)(void *dest, unsigned index);
 
 extern const unsigned DC_ASM_div_size;
-unsigned DCJIT_CDECL(DC_ASM_WriteDiv)(void *dest);
+unsigned DCJIT_CDECL(DC_ASM_WriteDiv)(void *dest, unsigned index);
 
 extern const unsigned DC_ASM_sin_size;
-unsigned DCJIT_CDECL(DC_ASM_WriteSin)(void *dest);
+unsigned DCJIT_CDECL(DC_ASM_WriteSin)(void *dest, unsigned index);
 
 extern const unsigned DC_ASM_cos_size;
-unsigned DCJIT_CDECL(DC_ASM_WriteCos)(void *dest);
+unsigned DCJIT_CDECL(DC_ASM_WriteCos)(void *dest, unsigned index);
+
+/* minss/maxss of XMM(index-2) and XMM(index-1). These give XMM(index-1) if
+ * either is NaN or both are zero. */
+extern const unsigned DC_ASM_min_size;
+unsigned DCJIT_CDECL(DC_ASM_WriteMin)(void *dest, unsigned index);
+unsigned DCJIT_CDECL(DC_ASM_WriteMax)(void *dest, unsigned index);
+
+/* Operations calculated on the x87 unit, for DC_ASM_WriteX87. */
+#define DC_ASM_X87_POW 0 /* XMM(index-2)^XMM(index-1), for a positive base */
+#define DC_ASM_X87_ATAN2 1 /* atan2(XMM(index-2), XMM(index-1)) */
+#define DC_ASM_X87_TAN 2
+#define DC_ASM_X87_EXP 3
+#define DC_ASM_X87_LOG 4
+#define DC_ASM_X87_FLOOR 5 /* For when DC_ASM_CanRound is zero */
+
+/* Moves the operands of func onto the x87 stack through the scratch memory,
+ * the same as the x87 sin/cos, and puts the result in the register of the
+ * first operand. There is no packed form of these. */
+extern const unsigned DC_ASM_x87_size;
+unsigned DCJIT_CDECL(DC_ASM_WriteX87)(void *dest,
+    unsigned func,
+    unsigned index);
+
+/* Sin/cos using SSE range reduction and a polynomial instead of the x87 unit.
+ * These use XMM5-XMM7 as temporaries, so index must be at most 6, and values
+ * below XMM(index-1) must not be in those registers. */
+extern const unsigned DC_ASM_poly_sin_size;
+unsigned DCJIT_CDECL(DC_ASM_WritePolySin)(void *dest, unsigned index);
+
+extern const unsigned DC_ASM_poly_cos_size;
+unsigned DCJIT_CDECL(DC_ASM_WritePolyCos)(void *dest, unsigned index);
 
 extern const unsigned DC_ASM_sqrt_size;
-unsigned DCJIT_CDECL(DC_ASM_WriteSqrt)(void *dest);
+unsigned DCJIT_CDECL(DC_ASM_WriteSqrt)(void *dest, unsigned index);
 
 extern const unsigned DC_ASM_ret_size;
 unsigned DCJIT_CDECL(DC_ASM_WriteRet)(void *dest);
 
 extern const unsigned DC_ASM_add_arg_size;
-unsigned DCJIT_CDECL(DC_ASM_WriteAddArg)(void *dest, unsigned short arg);
+unsigned DCJIT_CDECL(DC_ASM_WriteAddArg)(void *dest,
+    unsigned short arg,
+    unsigned index);
 
 extern const unsigned DC_ASM_sub_arg_size;
-unsigned DCJIT_CDECL(DC_ASM_WriteSubArg)(void *dest, unsigned short arg);
+unsigned DCJIT_CDECL(DC_ASM_WriteSubArg)(void *dest,
+    unsigned short arg,
+    unsigned index);
 
 extern const unsigned DC_ASM_mul_arg_size;
-unsigned DCJIT_CDECL(DC_ASM_WriteMulArg)(void *dest, unsigned short arg);
+unsigned DCJIT_CDECL(DC_ASM_WriteMulArg)(void *dest,
+    unsigned short arg,
+    unsigned index);
 
 extern const unsigned DC_ASM_div_arg_size;
-unsigned DCJIT_CDECL(DC_ASM_WriteDivArg)(void *dest, unsigned short arg);
+unsigned DCJIT_CDECL(DC_ASM_WriteDivArg)(void *dest,
+    unsigned short arg,
+    unsigned index);
 
 extern const unsigned DC_ASM_sin_arg_size;
-unsigned DCJIT_CDECL(DC_ASM_WriteSinArg)(void *dest, unsigned short arg);
+unsigned DCJIT_CDECL(DC_ASM_WriteSinArg)(void *dest,
+    unsigned short arg,
+    unsigned index);
 
 extern const unsigned DC_ASM_cos_arg_size;
-unsigned DCJIT_CDECL(DC_ASM_WriteCosArg)(void *dest, unsigned short arg);
+unsigned DCJIT_CDECL(DC_ASM_WriteCosArg)(void *dest,
+    unsigned short arg,
+    unsigned index);
 
 extern const unsigned DC_ASM_sqrt_arg_size;
-unsigned DCJIT_CDECL(DC_ASM_WriteSqrtArg)(void *dest, unsigned short arg);
+unsigned DCJIT_CDECL(DC_ASM_WriteSqrtArg)(void *dest,
+    unsigned short arg,
+    unsigned index);
 
 extern const unsigned DC_ASM_add_imm_size;
-unsigned DCJIT_CDECL(DC_ASM_WriteAddImm)(void *dest, float imm);
+unsigned DCJIT_CDECL(DC_ASM_WriteAddImm)(void *dest,
+    float imm,
+    unsigned index);
 
 extern const unsigned DC_ASM_sub_imm_size;
-unsigned DCJIT_CDECL(DC_ASM_WriteSubImm)(void *dest, float imm);
+unsigned DCJIT_CDECL(DC_ASM_WriteSubImm)(void *dest,
+    float imm,
+    unsigned index);
 
 extern const unsigned DC_ASM_mul_imm_size;
-unsigned DCJIT_CDECL(DC_ASM_WriteMulImm)(void *dest, float imm);
+unsigned DCJIT_CDECL(DC_ASM_WriteMulImm)(void *dest,
+    float imm,
+    unsigned index);
 
 extern const unsigned DC_ASM_div_imm_size;
-unsigned DCJIT_CDECL(DC_ASM_WriteDivImm)(void *dest, float imm);
+unsigned DCJIT_CDECL(DC_ASM_WriteDivImm)(void *dest,
+    float imm,
+    unsigned index);
 
 extern const unsigned DC_ASM_ret_size;
 unsigned DCJIT_CDECL(DC_ASM_WriteRet)(void *dest);
 
+/* Spill slots are 4-byte slots on the native stack, numbered up from the stack
+ * pointer. WriteSpill stores XMM(index-1) to the slot, and WriteReload loads
+ * the slot into XMM(index). */
+extern const unsigned DC_ASM_spill_size;
+unsigned DCJIT_CDECL(DC_ASM_WriteSpill)(void *dest,
+    unsigned slot,
+    unsigned index);
+
+extern const unsigned DC_ASM_reload_size;
+unsigned DCJIT_CDECL(DC_ASM_WriteReload)(void *dest,
+    unsigned slot,
+    unsigned index);
+
+/* Copies XMM(index-1) into XMM(index). This copies the whole register, so it
+ * is also used by the packed and double precision code. */
+extern const unsigned DC_ASM_dup_size;
+unsigned DCJIT_CDECL(DC_ASM_WriteDup)(void *dest, unsigned index);
+
+/* andps of XMM(index-2) and XMM(index-1). This is used for abs with a mask
+ * of the sign bit, and is also used by the packed and double precision
+ * code. */
+extern const unsigned DC_ASM_and_size;
+unsigned DCJIT_CDECL(DC_ASM_WriteAnd)(void *dest, unsigned index);
+
+/* Rounds XMM(index-1) down with roundss/roundps/roundsd. These are SSE4.1,
+ * so they must only be used when DC_ASM_CanRound returns non-zero. */
+extern const unsigned DC_ASM_floor_size;
+unsigned DCJIT_CDECL(DC_ASM_WriteFloor)(void *dest, unsigned index);
+unsigned DCJIT_CDECL(DC_ASM_WritePackedFloor)(void *dest, unsigned index);
+unsigned DCJIT_CDECL(DC_ASM_WriteDoubleFloor)(void *dest, unsigned index);
+
+unsigned DCJIT_CDECL(DC_ASM_CanRound)(void);
+
+/* Predicates for DC_ASM_WriteCompare, which are the cmpss immediates. Greater
+ * than comparisons are written by swapping the operands. */
+#define DC_ASM_CMP_EQ 0
+#define DC_ASM_CMP_LT 1
+#define DC_ASM_CMP_LE 2
+#define DC_ASM_CMP_NEQ 4
+
+/* Compares XMM(index-2) with XMM(index-1), and puts 1.0 in XMM(index-2) if
+ * predicate holds or 0.0 if it does not. These use rcx on amd64. */
+extern const unsigned DC_ASM_compare_size;
+unsigned DCJIT_CDECL(DC_ASM_WriteCompare)(void *dest,
+    unsigned predicate,
+    unsigned index);
+unsigned DCJIT_CDECL(DC_ASM_WritePackedCompare)(void *dest,
+    unsigned predicate,
+    unsigned index);
+unsigned DCJIT_CDECL(DC_ASM_WriteDoubleCompare)(void *dest,
+    unsigned predicate,
+    unsigned index);
+
+/* Keeps XMM(index-3) if the condition in XMM(index-1) is not zero (or is
+ * NaN), and otherwise replaces it with XMM(index-2), without branching. These
+ * use rcx on amd64. */
+extern const unsigned DC_ASM_select_size;
+unsigned DCJIT_CDECL(DC_ASM_WriteSelect)(void *dest, unsigned index);
+unsigned DCJIT_CDECL(DC_ASM_WritePackedSelect)(void *dest, unsigned index);
+unsigned DCJIT_CDECL(DC_ASM_WriteDoubleSelect)(void *dest, unsigned index);
+
+/* Moves the stack pointer down/up by size bytes to hold the spill slots. */
+extern const unsigned DC_ASM_frame_size;
+unsigned DCJIT_CDECL(DC_ASM_WriteEnterFrame)(void *dest, unsigned size);
+unsigned DCJIT_CDECL(DC_ASM_WriteLeaveFrame)(void *dest, unsigned size);
+
+/* Writes an entry point that can be called as a DC_X_NativeFunction using the
+ * platform's C calling convention. It runs the code immediately following it.
+ * This writes at most 64 bytes. */
+unsigned DCJIT_CDECL(DC_ASM_WriteNativeEntry)(void *dest);
+
+/* Packed versions of the encoders, which operate on four lanes at once. The
+ * arguments for each lane are grouped together, so the arguments are four
+ * times as far apart. Operations without a packed encoder here are written
+ * as a push followed by the stack form of the operation. */
+extern const unsigned DC_ASM_packed_push_arg_size;
+unsigned DCJIT_CDECL(DC_ASM_WritePackedPushArg)(void *dest,
+    unsigned short arg_num,
+    unsigned index);
+
+extern const unsigned DC_ASM_packed_immediate_size;
+unsigned DCJIT_CDECL(DC_ASM_WritePackedImmediate)(void *dest,
+    float value,
+    unsigned index);
+
+extern const unsigned DC_ASM_packed_arithmetic_size;
+unsigned DCJIT_CDECL(DC_ASM_WritePackedAdd)(void *dest, unsigned index);
+unsigned DCJIT_CDECL(DC_ASM_WritePackedSub)(void *dest, unsigned index);
+unsigned DCJIT_CDECL(DC_ASM_WritePackedMul)(void *dest, unsigned index);
+unsigned DCJIT_CDECL(DC_ASM_WritePackedDiv)(void *dest, unsigned index);
+unsigned DCJIT_CDECL(DC_ASM_WritePackedMin)(void *dest, unsigned index);
+unsigned DCJIT_CDECL(DC_ASM_WritePackedMax)(void *dest, unsigned index);
+unsigned DCJIT_CDECL(DC_ASM_WritePackedSqrt)(void *dest, unsigned index);
+
+extern const unsigned DC_ASM_packed_poly_sin_size;
+unsigned DCJIT_CDECL(DC_ASM_WritePackedPolySin)(void *dest, unsigned index);
+
+extern const unsigned DC_ASM_packed_poly_cos_size;
+unsigned DCJIT_CDECL(DC_ASM_WritePackedPolyCos)(void *dest, unsigned index);
+
+/* Packed spill slots are 16 bytes each. */
+extern const unsigned DC_ASM_packed_spill_size;
+unsigned DCJIT_CDECL(DC_ASM_WritePackedSpill)(void *dest,
+    unsigned slot,
+    unsigned index);
+unsigned DCJIT_CDECL(DC_ASM_WritePackedReload)(void *dest,
+    unsigned slot,
+    unsigned index);
+
+/* Double precision versions of the encoders, which use 8 byte arguments and
+ * spill slots. As with the packed encoders, operations without a double
+ * encoder here are written as a push followed by the stack form. The x87
+ * sin/cos is always used, since the polynomial is only accurate enough for
+ * single precision. */
+extern const unsigned DC_ASM_double_push_arg_size;
+unsigned DCJIT_CDECL(DC_ASM_WriteDoublePushArg)(void *dest,
+    unsigned short arg_num,
+    unsigned index);
+
+extern const unsigned DC_ASM_double_store_arg_size;
+unsigned DCJIT_CDECL(DC_ASM_WriteDoubleStoreArg)(void *dest,
+    unsigned short arg_num,
+    unsigned index);
+
+extern const unsigned DC_ASM_double_immediate_size;
+unsigned DCJIT_CDECL(DC_ASM_WriteDoubleImmediate)(void *dest,
+    double value,
+    unsigned index);
+
+extern const unsigned DC_ASM_double_arithmetic_size;
+unsigned DCJIT_CDECL(DC_ASM_WriteDoubleAdd)(void *dest, unsigned index);
+unsigned DCJIT_CDECL(DC_ASM_WriteDoubleSub)(void *dest, unsigned index);
+unsigned DCJIT_CDECL(DC_ASM_WriteDoubleMul)(void *dest, unsigned index);
+unsigned DCJIT_CDECL(DC_ASM_WriteDoubleDiv)(void *dest, unsigned index);
+unsigned DCJIT_CDECL(DC_ASM_WriteDoubleMin)(void *dest, unsigned index);
+unsigned DCJIT_CDECL(DC_ASM_WriteDoubleMax)(void *dest, unsigned index);
+unsigned DCJIT_CDECL(DC_ASM_WriteDoubleSqrt)(void *dest, unsigned index);
+
+extern const unsigned DC_ASM_double_trig_size;
+unsigned DCJIT_CDECL(DC_ASM_WriteDoubleSin)(void *dest, unsigned index);
+unsigned DCJIT_CDECL(DC_ASM_WriteDoubleCos)(void *dest, unsigned index);
+
+unsigned DCJIT_CDECL(DC_ASM_WriteDoubleX87)(void *dest,
+    unsigned func,
+    unsigned index);
+
+extern const unsigned DC_ASM_double_spill_size;
+unsigned DCJIT_CDECL(DC_ASM_WriteDoubleSpill)(void *dest,
+    unsigned slot,
+    unsigned index);
+unsigned DCJIT_CDECL(DC_ASM_WriteDoubleReload)(void *dest,
+    unsigned slot,
+    unsigned index);
+
 void DCJIT_CDECL(DC_ASM_Calculate)(const void *addr, const float *args, float *result);
 
+/* Runs packed code, writing four results. */
+void DCJIT_CDECL(DC_ASM_CalculatePacked)(const void *addr,
+    const float *args,
+    float *results);
+
+void DCJIT_CDECL(DC_ASM_CalculateDouble)(const void *addr,
+    const double *args,
+    double *result);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -8,20 +8,22 @@
 ; to exist on amd64. This allows us to more easily move data to/from the SSE
 ; registers using the MOVD instructions.
 ;
-; We use the extended, XMM versions of mov instructions from and the cvt
-; instructions (double to/from float) from SSE2, and the MOV instructions that
-; can store/load from MMX registers for sin/cos and fld1.
-;
 ; See the file dc_jit_win64 for how we handle the 64-bit Windows calling
 ; convention, which uses different registers for parameter transfer than SysV.
 ;
 ; Unlike x86, we start with a `lea rax,[rsp-0x8]` (actually -16, but then we
 ; `call`) to leave rax as an address to place immediates in.
 ;
-; Any functions that need x87 (sin/cos) use different code gen if the CPU is
-; detected to be an AMD processor. This is because 32-bit fld/fstp and movss is
-; slightly slower than a cvtss2sd and 64-bit fld/fstp on AMD, but it's
-; definitely the opposite on an Intel CPU.
+; Functions that need x87 (sin/cos) move the value through [rax] to get it
+; between the XMM registers and the x87 stack, the same as on x86. The
+; polynomial sin/cos stay in the XMM registers, and use rcx to point to their
+; constants.
+;
+; The encoders keep no state of their own. Each one receives the current
+; depth of the calculation's value stack (the XMM register that the next push
+; would use) as its last integer argument, and the builder in dc_jit.c tracks
+; how each operation changes the depth. This lets different builders generate
+; code on different threads at the same time.
 
 section .text
 bits 64
@@ -32,6 +34,9 @@ global DC_ASM_WriteJMP
 global DC_ASM_push_arg_size
 global DC_ASM_WritePushArg
 
+global DC_ASM_store_arg_size
+global DC_ASM_WriteStoreArg
+
 global DC_ASM_immediate_size
 global DC_ASM_WriteImmediate
 
@@ -53,6 +58,39 @@ global DC_ASM_WriteSin
 global DC_ASM_cos_size
 global DC_ASM_WriteCos
 
+global DC_ASM_min_size
+global DC_ASM_WriteMin
+global DC_ASM_WriteMax
+
+global DC_ASM_and_size
+global DC_ASM_WriteAnd
+
+global DC_ASM_floor_size
+global DC_ASM_WriteFloor
+global DC_ASM_WritePackedFloor
+global DC_ASM_WriteDoubleFloor
+global DC_ASM_CanRound
+
+global DC_ASM_x87_size
+global DC_ASM_WriteX87
+global DC_ASM_WriteDoubleX87
+
+global DC_ASM_compare_size
+global DC_ASM_WriteCompare
+global DC_ASM_WritePackedCompare
+global DC_ASM_WriteDoubleCompare
+
+global DC_ASM_select_size
+global DC_ASM_WriteSelect
+global DC_ASM_WritePackedSelect
+global DC_ASM_WriteDoubleSelect
+
+global DC_ASM_poly_sin_size
+global DC_ASM_WritePolySin
+
+global DC_ASM_poly_cos_size
+global DC_ASM_WritePolyCos
+
 global DC_ASM_sqrt_size
 global DC_ASM_WriteSqrt
 
@@ -95,7 +133,75 @@ global DC_ASM_WritePop
 global DC_ASM_ret_size
 global DC_ASM_WriteRet
 
+global DC_ASM_spill_size
+global DC_ASM_WriteSpill
+
+global DC_ASM_reload_size
+global DC_ASM_WriteReload
+
+global DC_ASM_dup_size
+global DC_ASM_WriteDup
+
+global DC_ASM_frame_size
+global DC_ASM_WriteEnterFrame
+global DC_ASM_WriteLeaveFrame
+
+global DC_ASM_WriteNativeEntry
+
+global DC_ASM_packed_push_arg_size
+global DC_ASM_WritePackedPushArg
+
+global DC_ASM_packed_immediate_size
+global DC_ASM_WritePackedImmediate
+
+global DC_ASM_packed_arithmetic_size
+global DC_ASM_WritePackedAdd
+global DC_ASM_WritePackedSub
+global DC_ASM_WritePackedMul
+global DC_ASM_WritePackedDiv
+global DC_ASM_WritePackedMin
+global DC_ASM_WritePackedMax
+global DC_ASM_WritePackedSqrt
+
+global DC_ASM_packed_poly_sin_size
+global DC_ASM_WritePackedPolySin
+
+global DC_ASM_packed_poly_cos_size
+global DC_ASM_WritePackedPolyCos
+
+global DC_ASM_packed_spill_size
+global DC_ASM_WritePackedSpill
+global DC_ASM_WritePackedReload
+
+global DC_ASM_double_push_arg_size
+global DC_ASM_WriteDoublePushArg
+
+global DC_ASM_double_store_arg_size
+global DC_ASM_WriteDoubleStoreArg
+
+global DC_ASM_double_immediate_size
+global DC_ASM_WriteDoubleImmediate
+
+global DC_ASM_double_arithmetic_size
+global DC_ASM_WriteDoubleAdd
+global DC_ASM_WriteDoubleSub
+global DC_ASM_WriteDoubleMul
+global DC_ASM_WriteDoubleDiv
+global DC_ASM_WriteDoubleMin
+global DC_ASM_WriteDoubleMax
+global DC_ASM_WriteDoubleSqrt
+
+global DC_ASM_double_trig_size
+global DC_ASM_WriteDoubleSin
+global DC_ASM_WriteDoubleCos
+
+global DC_ASM_double_spill_size
+global DC_ASM_WriteDoubleSpill
+global DC_ASM_WriteDoubleReload
+
 global DC_ASM_Calculate
+global DC_ASM_CalculatePacked
+global DC_ASM_CalculateDouble
 
 DC_ASM_WriteJMP:
     ; There are no absolute 64-bit jmps, so we push the address then ret.
@@ -110,34 +216,58 @@ DC_ASM_WriteJMP:
     mov rax, 13
     ret
 
-; unsigned DC_ASM_WritePushArg(void *dest, unsigned short arg_num);
+; unsigned DC_ASM_WritePushArg(void *dest, unsigned short arg_num,
+;     unsigned index);
 DC_ASM_WritePushArg:
     ; Write:
     ; movss XMM, [rsi+N]
     ; Or:
     ; movss XMM, [rsi]
-    mov rax, QWORD dc_asm_index
-    mov r8d, [rax]
-    inc DWORD [rax]
-    lea rax, [(r8 * 8) + 0xF30F1006]
-    shl si, 2
+    lea eax, [(edx * 8) + 0xF30F1006]
+    ; FALLTHROUGH
+
+; eax has the opcode and a ModRM for [rsi], and si has the argument number.
+dc_asm_write_arg_operand:
+    movzx esi, si
+    shl esi, 2
     jz push_zero_arg
+    cmp esi, 0x80
+    jae push_far_arg
     
     add eax, 0x40
     bswap eax
     mov [rdi], eax
-    mov ax, si
-    mov [rdi+4], al
+    mov [rdi+4], sil
     mov rax, 5
     ret
 
+push_far_arg:
+    ; Use [rsi+disp32] instead
+    add eax, 0x80
+    bswap eax
+    mov [rdi], eax
+    mov [rdi+4], esi
+    mov rax, 8
+    ret
+
 push_zero_arg:
     bswap eax
     mov [rdi], eax
     mov rax, 4
     ret
 
-; unsigned DC_ASM_WriteImmediate(void *dest, float value);
+; unsigned DC_ASM_WriteStoreArg(void *dest, unsigned short arg_num,
+;     unsigned index);
+DC_ASM_WriteStoreArg:
+    ; Write:
+    ; movss [rsi+N], XMM
+    ; Or:
+    ; movss [rsi], XMM
+    ; Where XMM is XMM(index-1)
+    lea eax, [(edx * 8) + 0xF30F10FE]
+    jmp dc_asm_write_arg_operand
+
+; unsigned DC_ASM_WriteImmediate(void *dest, float value, unsigned index);
 DC_ASM_WriteImmediate:
     ; Write the immediate to [rax]:
     ; mov [rax], IMM
@@ -151,10 +281,7 @@ DC_ASM_WriteImmediate:
     ; eax will specify (number of instructions written) - 4 after the split.
 
     ; Get the XMM code
-    mov rax, QWORD dc_asm_index
-    mov ecx, [rax]
-    inc DWORD [rax]
-    lea edx, [(ecx * 8) + 0xF30F1000]
+    lea edx, [(esi * 8) + 0xF30F1000]
     bswap edx
     
     ; Get the immediate
@@ -175,22 +302,32 @@ write_imm:
     add rax, 4
     ret
 
-; unsigned DC_ASM_WriteAdd(void *dest);
+; unsigned DC_ASM_WriteAdd(void *dest, unsigned index);
 DC_ASM_WriteAdd:
     mov ecx, 0xF30F5800
     jmp dc_asm_write_arithmetic
     
-; unsigned DC_ASM_WriteSub(void *dest);
+; unsigned DC_ASM_WriteSub(void *dest, unsigned index);
 DC_ASM_WriteSub:
     mov ecx, 0xF30F5C00
     jmp dc_asm_write_arithmetic
 
-; unsigned DC_ASM_WriteDiv(void *dest);
+; unsigned DC_ASM_WriteDiv(void *dest, unsigned index);
 DC_ASM_WriteDiv:
     mov ecx, 0xF30F5E00
     jmp dc_asm_write_arithmetic
 
-; unsigned DC_ASM_WriteMul(void *dest);
+; unsigned DC_ASM_WriteMin(void *dest, unsigned index);
+DC_ASM_WriteMin:
+    mov ecx, 0xF30F5D00
+    jmp dc_asm_write_arithmetic
+
+; unsigned DC_ASM_WriteMax(void *dest, unsigned index);
+DC_ASM_WriteMax:
+    mov ecx, 0xF30F5F00
+    jmp dc_asm_write_arithmetic
+
+; unsigned DC_ASM_WriteMul(void *dest, unsigned index);
 ; Mul is last, since it's the most likely and we can avoid a jmp.
 DC_ASM_WriteMul:
 _DC_ASM_WriteMul:
@@ -198,172 +335,222 @@ _DC_ASM_WriteMul:
     ; jmp dc_asm_write_arithmetic
 
 dc_asm_write_arithmetic:
-    mov rax, QWORD dc_asm_index
-    dec DWORD [rax]
-    mov edx, [rax]
+    ; The operands are XMM(index-2) and XMM(index-1)
     mov rax, QWORD dc_asm_arithmetic_codes
-    mov r8d, edx
-    xor cl, [rax + r8 - 1]
+    mov edx, esi
+    xor cl, [rax + rdx - 2]
     bswap ecx
     mov [rdi], ecx
     mov eax, 4
     ret
 
+; unsigned DC_ASM_WriteSin(void *dest, unsigned index);
 DC_ASM_WriteSin:
     mov cx, 0xFED9
     jmp dc_asm_trig
 
+; unsigned DC_ASM_WriteCos(void *dest, unsigned index);
 DC_ASM_WriteCos:
     mov cx, 0xFFD9
-    jmp dc_asm_trig
-
-DC_ASM_WriteSqrt:
-    mov cx, 0xFAD9
+    ; jmp dc_asm_trig
 
 dc_asm_trig:
-    ; TODO: This code gen is based on a flawed test. It is actually very slow.
-    ; We should rejoin this with the amd/intel trig code.
-    
+    ; Operates on XMM(index-1)
+    lea r8d, [esi - 1]
+    ; FALLTHROUGH
+
+; This is used for the sin/cos calculations.
+; cx has the operation to use in the x87 registers.
+; r8d has the XMM register to operate on.
+dc_asm_trig_register:
     ; Write:
     ; movss [rax], XMM
-    ; fld [rax] (0x00D9)
-    mov rax, QWORD dc_asm_index
-    mov r8d, [rax]
-    dec r8
-    lea rdx, [(r8d * 8) + 0xF30F1100]
+    ; fld DWORD [rax]
+    ; fsin/fcos
+    ; fstp DWORD [rax]
+    ; movss XMM, [rax]
+    lea edx, [(r8d * 8) + 0xF30F1100]
     bswap edx
     mov [rdi], edx
     mov [rdi+4], WORD 0x00D9
     mov [rdi+6], cx
-    
+    mov [rdi+8], WORD 0x18D9
+    ; Turn the movss store into a load
+    bswap edx
+    mov dh, 0x10
+    bswap edx
+    mov [rdi+10], edx
+    mov rax, 14
+    ret
+
+; unsigned DC_ASM_WritePolySin(void *dest, unsigned index);
+DC_ASM_WritePolySin:
+    mov rdx, QWORD dc_asm_poly_sin
+    jmp dc_asm_write_poly_trig
+
+; unsigned DC_ASM_WritePolyCos(void *dest, unsigned index);
+DC_ASM_WritePolyCos:
+    mov rdx, QWORD dc_asm_poly_cos
+    ; FALLTHROUGH
+
+; rdx points to the template's descriptor, which holds the address and size
+; of its head and tail, and the address of its constants.
+dc_asm_write_poly_trig:
+    ; Write:
+    ; mov rcx, CONSTANTS
+    ; movaps xmm5, XMM (unless XMM is xmm5)
+    ; <head>
+    ; <tail>
+    ; movaps XMM, xmm5 (unless XMM is xmm5)
+    ; Where XMM is XMM(index-1)
+    mov r9, rdi
+    mov [rdi], WORD 0xB948
+    mov rax, [rdx+32]
+    mov [rdi+2], rax
+    add rdi, 10
+    lea r8d, [esi - 1]
+    cmp r8d, 5
+    je dc_asm_poly_trig_no_load
+    lea eax, [r8d + 0xE8]
+    mov [rdi], WORD 0x280F
+    mov [rdi+2], al
+    add rdi, 3
+dc_asm_poly_trig_no_load:
+    mov rsi, [rdx]
+    mov rcx, [rdx+8]
+    rep movsb
+    mov rsi, [rdx+16]
+    mov rcx, [rdx+24]
+    rep movsb
+    cmp r8d, 5
+    je dc_asm_poly_trig_no_store
+    lea eax, [(r8d * 8) + 0xC5]
+    mov [rdi], WORD 0x280F
+    mov [rdi+2], al
+    add rdi, 3
+dc_asm_poly_trig_no_store:
+    mov rax, rdi
+    sub rax, r9
+    ret
+
+; unsigned DC_ASM_WriteSqrt(void *dest, unsigned index);
+DC_ASM_WriteSqrt:
     ; Write:
-    ; movq2dq XMM, mm0
-    ; cvtsd2ss XMM, XMM
-    ; fdecstp
-    ; ffree st0
-    ; r8 still has the XMM register.
-    lea eax, [(r8 * 8) + 0xF30FD6C8]
-    mov [rdi+10], eax
-    ; Write the FPU stuff.
-    mov [rdi+14], DWORD 0xF6D9C0DD
-    ; Write the cvt
-    lea eax, [(r8 * 8) + 0xF20F5ACA]
-    mov [rdi+18], eax
-    mov rax, 22
-    ret
-
-; unsigned DC_ASM_WriteAddArg(void *dest, unsigned short arg);
+    ; sqrtss XMM, XMM
+    ; Where XMM is XMM(index-1), so the ModRM is 0xC0 + (9 * (index-1))
+    lea ecx, [(esi * 8) + esi + 0xF30F51B7]
+    bswap ecx
+    mov [rdi], ecx
+    mov eax, 4
+    ret
+
+; unsigned DC_ASM_WriteAddArg(void *dest, unsigned short arg, unsigned index);
 DC_ASM_WriteAddArg:
     mov ecx, 0xF30F5806
     jmp dc_asm_write_arg_arithmetic
 
-; unsigned DC_ASM_WriteSubArg(void *dest, unsigned short arg);
+; unsigned DC_ASM_WriteSubArg(void *dest, unsigned short arg, unsigned index);
 DC_ASM_WriteSubArg:
     mov ecx, 0xF30F5C06
     jmp dc_asm_write_arg_arithmetic
 
-; unsigned DC_ASM_WriteDivArg(void *dest, unsigned short arg);
+; unsigned DC_ASM_WriteDivArg(void *dest, unsigned short arg, unsigned index);
 DC_ASM_WriteDivArg:
     mov ecx, 0xF30F5E06
     jmp dc_asm_write_arg_arithmetic
 
-; unsigned DC_ASM_WriteMulArg(void *dest, unsigned short arg);
+; unsigned DC_ASM_WriteMulArg(void *dest, unsigned short arg, unsigned index);
 DC_ASM_WriteMulArg:
     mov ecx, 0xF30F5906
     ; jmp dc_asm_write_arg_arithmetic
 
 dc_asm_write_arg_arithmetic:
-    mov rax, QWORD dc_asm_index
-    mov edx, [rax]
-    lea eax, [(edx * 8) + ecx + 6]
-    
-    ; TODO: Something up with that calculation above?
-    or cx, ax
-    
-    shl si, 2
-    jz dc_asm_write_zero_arg_arithmetic
+    ; Operates on XMM(index-1)
+    lea eax, [(edx * 8) - 8]
+    or ecx, eax
+    ; FALLTHROUGH
+
+; ecx has the opcode and a ModRM for [rsi], and si has the argument number.
+dc_asm_write_arg_operand:
+    movzx esi, si
+    shl esi, 2
+    jz dc_asm_write_zero_arg_operand
+    cmp esi, 0x80
+    jae dc_asm_write_far_arg_operand
     add cl, 0x40
     bswap ecx
     mov [rdi], ecx
-    mov cx, si
-    mov [rdi+4], cl
+    mov [rdi+4], sil
     mov rax, 5
     ret
+
+dc_asm_write_far_arg_operand:
+    ; Use [rsi+disp32] instead
+    add cl, 0x80
+    bswap ecx
+    mov [rdi], ecx
+    mov [rdi+4], esi
+    mov rax, 8
+    ret
     
-dc_asm_write_zero_arg_arithmetic:
+dc_asm_write_zero_arg_operand:
     bswap ecx
     mov [rdi], ecx
     mov rax, 4
     ret
 
-; unsigned DC_ASM_WriteSinArg(void *dest, float immediate);
+; unsigned DC_ASM_WriteSinArg(void *dest, unsigned short arg, unsigned index);
 DC_ASM_WriteSinArg:
-    mov dx, 0xD9FE
+    mov cx, 0xFED9
     jmp dc_asm_write_trig_arg
 
-; unsigned DC_ASM_WriteCosImm(void *dest, float immediate);
+; unsigned DC_ASM_WriteCosArg(void *dest, unsigned short arg, unsigned index);
 DC_ASM_WriteCosArg:
-    mov dx, 0xD9FF
-    ; jmp dc_asm_write_trig_arg:
+    mov cx, 0xFFD9
+    ; jmp dc_asm_write_trig_arg
 
 dc_asm_write_trig_arg:
-    ; Check the CPU vendor string.
+    ; Push the argument into XMM(index), then operate on it.
+    push rcx
     push rdx
-    push rbx
-    xor eax, eax
-    cpuid
-    pop rbx
+    push rdi
+    call DC_ASM_WritePushArg
+    pop rdi
+    pop r8
+    pop rcx
+    push rax
+    add rdi, rax
+    call dc_asm_trig_register
     pop rdx
-    
-    ; Grab the current index into r8 right now.
-    mov rax, QWORD dc_asm_index
-    inc DWORD [rax]
-    mov r8d, [rax]
-    
-    ; ecx has the last 4 letters of the vendor string. Compare against the AMD
-    ; code.
-    mov rax, QWORD dc_asm_ID_AMD
-    cmp ecx, [rax]
-    jne dc_asm_amd_trig_arg
-    jmp dc_asm_intel_trig_arg
-
-DC_ASM_WriteSqrtArg:
-    ; Get the XMM number
-    mov rax, QWORD dc_asm_index
-    mov r8d, [rax]
-    mov rax, 4 ; rax will function as the write index later.
-    shl rsi, 2
-    jz dc_asm_write_sqrt_zero_arg
-    lea rdx, [(r8 * 8) + 0xF30F5146]
-    bswap edx
-    mov [rdi], edx
-    mov cx, si
-    mov [rdi+4], cl
-    inc rax
-    ret
-
-dc_asm_write_sqrt_zero_arg:
-    lea rcx, [(r8 * 8) + 0xF30F5106]
-    bswap ecx
-    mov [rdi], ecx
+    add rax, rdx
     ret
 
-DC_ASM_WriteSqrtImm:
-    mov ecx, 0xF30F5100
-    jmp dc_asm_write_arg_immediate
+; unsigned DC_ASM_WriteSqrtArg(void *dest, unsigned short arg, unsigned index);
+DC_ASM_WriteSqrtArg:
+    ; Write:
+    ; sqrtss XMM, [rsi+N]
+    ; Or:
+    ; sqrtss XMM, [rsi]
+    ; Where XMM is XMM(index)
+    lea ecx, [(edx * 8) + 0xF30F5106]
+    jmp dc_asm_write_arg_operand
 
+; unsigned DC_ASM_WriteAddImm(void *dest, float imm, unsigned index);
 DC_ASM_WriteAddImm:
     mov ecx, 0xF30F5800
     jmp dc_asm_write_arg_immediate
 
+; unsigned DC_ASM_WriteSubImm(void *dest, float imm, unsigned index);
 DC_ASM_WriteSubImm:
     mov ecx, 0xF30F5C00
     jmp dc_asm_write_arg_immediate
 
+; unsigned DC_ASM_WriteDivImm(void *dest, float imm, unsigned index);
 DC_ASM_WriteDivImm:
     mov ecx, 0xF30F5E00
     jmp dc_asm_write_arg_immediate
 
+; unsigned DC_ASM_WriteMulImm(void *dest, float imm, unsigned index);
 DC_ASM_WriteMulImm:
     mov ecx, 0xF30F5900
     ; jmp dc_asm_write_arg_immediate
@@ -380,174 +567,913 @@ dc_asm_write_arg_immediate:
     mov [rdi], WORD 0x00C7
     mov [rdi+2], edx
     
-    ; Get the XMM register.
-    mov rax, QWORD dc_asm_index
-    mov edx, [rax]
-    lea eax, [(edx*8)-8]
+    ; Get the XMM register, which is XMM(index-1)
+    lea eax, [(esi*8)-8]
     or cl, al
     bswap ecx
     mov [rdi+6], ecx
     mov rax, 10
     ret
 
+; unsigned DC_ASM_WritePop(void *dest);
 DC_ASM_WritePop:
-    mov rax, QWORD dc_asm_index
-    dec DWORD [rax]
+    ; Popping only changes the depth, which is tracked by the builder.
+    xor eax, eax
     ret
 
+; unsigned DC_ASM_WriteRet(void *dest);
 DC_ASM_WriteRet:
     mov [rdi], BYTE 0xC3
-    mov rax, QWORD dc_asm_index
-    dec DWORD [rax]
     mov rax, 1
     ret
 
-; void DC_ASM_Calculate(const void *addr, const float *args, float *result);
-DC_ASM_Calculate:
-    push rdx
-    lea rax,[rsp-24]
-    call rdi
-    pop rdx
-    movss [rdx], xmm0
+; unsigned DC_ASM_WriteDup(void *dest, unsigned index);
+DC_ASM_WriteDup:
+    ; Write:
+    ; movaps XMM(index), XMM(index-1)
+    ; The ModRM is 0xC0 + (8 * index) + (index-1)
+    lea ecx, [(esi * 8) + esi + 0xBF]
+    mov [rdi], WORD 0x280F
+    mov [rdi+2], cl
+    mov rax, 3
     ret
 
-;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
-; Intel trig functions
-;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
-; On Intel, using cvtss2sd/cvtsd2ss is about the slowest thing you can do, and
-; fld is about the same speed on 32-bit values as 64-bit values. Therefor, it's
-; best to just movss to the stack, then fld the DWORD.
+; unsigned DC_ASM_WriteSpill(void *dest, unsigned slot, unsigned index);
+DC_ASM_WriteSpill:
+    ; Write:
+    ; movss [rsp+N], XMM
+    ; Where XMM is XMM(index-1)
+    lea eax, [(edx * 8) + 0xF30F113C]
+    jmp dc_asm_write_stack_slot
 
-; This is used for the sin/cos calculations.
-; dx has the operation to use in the x87 registers.
-; rsi has the argument index
-dc_asm_intel_trig_arg:
-    shl rsi, 2
-    je dc_asm_intel_trig_zero_arg
-    mov cx, si
-    
-    mov [rdi], WORD 0x46D9
+; unsigned DC_ASM_WriteReload(void *dest, unsigned slot, unsigned index);
+DC_ASM_WriteReload:
+    ; Write:
+    ; movss XMM, [rsp+N]
+    ; Where XMM is XMM(index)
+    lea eax, [(edx * 8) + 0xF30F1044]
+    ; FALLTHROUGH
+
+; eax has the opcode and a ModRM for [rsp+disp8], which is followed by the SIB
+; byte 0x24 and the displacement.
+dc_asm_write_stack_slot:
+    shl esi, 2
+    ; FALLTHROUGH
+
+; The same, but esi already has the displacement.
+dc_asm_write_stack_offset:
+    cmp esi, 0x80
+    jae dc_asm_write_far_stack_slot
+    bswap eax
+    mov [rdi], eax
+    mov [rdi+4], BYTE 0x24
+    mov [rdi+5], sil
+    mov rax, 6
+    ret
+
+dc_asm_write_far_stack_slot:
+    ; Use [rsp+disp32] instead
+    add eax, 0x40
+    bswap eax
+    mov [rdi], eax
+    mov [rdi+4], BYTE 0x24
+    mov [rdi+5], esi
+    mov rax, 9
+    ret
+
+; unsigned DC_ASM_WriteEnterFrame(void *dest, unsigned size);
+DC_ASM_WriteEnterFrame:
+    ; Write:
+    ; sub rsp, N
+    mov cl, 0xEC
+    jmp dc_asm_write_frame
+
+; unsigned DC_ASM_WriteLeaveFrame(void *dest, unsigned size);
+DC_ASM_WriteLeaveFrame:
+    ; Write:
+    ; add rsp, N
+    mov cl, 0xC4
+    ; FALLTHROUGH
+
+dc_asm_write_frame:
+    mov [rdi], BYTE 0x48
     mov [rdi+2], cl
+    cmp esi, 0x80
+    jae dc_asm_write_far_frame
+    mov [rdi+1], BYTE 0x83
+    mov [rdi+3], sil
+    mov rax, 4
+    ret
+
+dc_asm_write_far_frame:
+    mov [rdi+1], BYTE 0x81
+    mov [rdi+3], esi
+    mov rax, 7
+    ret
+
+; unsigned DC_ASM_WriteNativeEntry(void *dest);
+DC_ASM_WriteNativeEntry:
+    ; Write:
+    ; mov rsi, rdi
+    ; lea rax, [rsp-16]
+    ; This puts the arguments and scratch memory where the generated code
+    ; expects them, and then falls through into it.
+    mov rax, QWORD 0xF024448D48FE8948
+    mov [rdi], rax
+    mov rax, 8
+    ret
+
+; The packed encoders write the same code as the scalar ones, but using the
+; *ps forms of the instructions so that each XMM register holds four lanes.
+; The arguments of the four lanes are grouped together, so argument N is at
+; [rsi+(16*N)].
+
+; unsigned DC_ASM_WritePackedPushArg(void *dest, unsigned short arg_num,
+;     unsigned index);
+DC_ASM_WritePackedPushArg:
+    ; Write:
+    ; movups XMM, [rsi+N]
+    ; Or:
+    ; movups XMM, [rsi]
+    ; Where XMM is XMM(index)
+    mov [rdi], WORD 0x100F
+    lea eax, [(edx * 8) + 6]
+    movzx esi, si
+    shl esi, 4
+    jz dc_asm_packed_push_zero_arg
+    cmp esi, 0x80
+    jae dc_asm_packed_push_far_arg
+    add al, 0x40
+    mov [rdi+2], al
+    mov [rdi+3], sil
+    mov rax, 4
+    ret
+
+dc_asm_packed_push_far_arg:
+    add al, 0x80
+    mov [rdi+2], al
+    mov [rdi+3], esi
+    mov rax, 7
+    ret
+
+dc_asm_packed_push_zero_arg:
+    mov [rdi+2], al
     mov rax, 3
-    jmp dc_asm_intel_trig
-    
-dc_asm_intel_trig_zero_arg:
-    mov [rdi], WORD 0x06D9
-    mov rax, 2
+    ret
+
+; unsigned DC_ASM_WritePackedImmediate(void *dest, float value,
+;     unsigned index);
+DC_ASM_WritePackedImmediate:
+    ; Write the same code as DC_ASM_WriteImmediate, then:
+    ; shufps XMM, XMM, 0
+    ; Where XMM is XMM(index)
+    push rdi
+    push rsi
+    call DC_ASM_WriteImmediate
+    pop rsi
+    pop rdi
+    lea ecx, [(esi * 8) + esi + 0xC0]
+    mov [rdi+rax], WORD 0xC60F
+    mov [rdi+rax+2], cl
+    mov [rdi+rax+3], BYTE 0
+    add rax, 4
+    ret
+
+; unsigned DC_ASM_WritePackedAdd(void *dest, unsigned index);
+DC_ASM_WritePackedAdd:
+    mov cl, 0x58
+    jmp dc_asm_write_packed_arithmetic
+
+; unsigned DC_ASM_WritePackedSub(void *dest, unsigned index);
+DC_ASM_WritePackedSub:
+    mov cl, 0x5C
+    jmp dc_asm_write_packed_arithmetic
+
+; unsigned DC_ASM_WritePackedDiv(void *dest, unsigned index);
+DC_ASM_WritePackedDiv:
+    mov cl, 0x5E
+    jmp dc_asm_write_packed_arithmetic
+
+; unsigned DC_ASM_WritePackedMin(void *dest, unsigned index);
+DC_ASM_WritePackedMin:
+    mov cl, 0x5D
+    jmp dc_asm_write_packed_arithmetic
+
+; unsigned DC_ASM_WritePackedMax(void *dest, unsigned index);
+DC_ASM_WritePackedMax:
+    mov cl, 0x5F
+    jmp dc_asm_write_packed_arithmetic
+
+; unsigned DC_ASM_WriteAnd(void *dest, unsigned index);
+DC_ASM_WriteAnd:
+    ; Write:
+    ; andps XMM(index-2), XMM(index-1)
+    mov cl, 0x54
+    jmp dc_asm_write_packed_arithmetic
+
+; unsigned DC_ASM_WritePackedMul(void *dest, unsigned index);
+DC_ASM_WritePackedMul:
+    mov cl, 0x59
     ; FALLTHROUGH
 
-; This is used for the sin/cos calculations.
-; dx has the operation to use in the x87 registers.
-; rax has our current write offset.
-dc_asm_intel_trig:
-    ; fsin/fcos
-    mov [rdi+rax], dx
-    
-    ; Write fstp DWORD [rax]
-    mov [rdi+rax+2], WORD 0x18D9
-    
-    lea rdx, [(r8 * 8) + 0xF30F1000]
-    mov [rdi+rax+4], edx
-
-;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
-; AMD trig functions
-;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
-; It's slightly faster on AMD to use cvtss2sd and then write 64-bit doubles to
-; the stack, then read those into the x87 registers than to write 32-bit floats
-; to the stack then read those in to the x87 registers.
-; This is COMPLETELY different on Intel, where fld is about the same speed for
-; 32 and 64 bit values. The cvt is pretty slow on both, but the 32-bit fld is
-; surprisingly slow on AMD, which is what changes the balance.
+dc_asm_write_packed_arithmetic:
+    ; The operands are XMM(index-2) and XMM(index-1)
+    mov rax, QWORD dc_asm_arithmetic_codes
+    mov edx, esi
+    movzx edx, BYTE [rax + rdx - 2]
+    mov [rdi], BYTE 0x0F
+    mov [rdi+1], cl
+    mov [rdi+2], dl
+    mov rax, 3
+    ret
 
-; This is used for the sin/cos calculations.
-; dx has the operation to use in the x87 registers.
-; rsi has the argument index
-dc_asm_amd_trig_arg:
-    xor rax, rax
-    
-    ; Convert the float arg to a double in XMM+1
-    ; Write that to [rax]
-    
-    shl esi, 2
-    je dc_asm_amd_trig_zero_arg
-    
-    mov cx, si
-    ; cvtss2sd XMM+1, [rsi+arg]
-    lea rsi, [(r8 * 8) + 0xF30F5A4E]
-    bswap esi
-    mov [rdi+rax], esi
-    mov [rdi+rax+4], cl
-    add rax, 5
-    jmp dc_asm_amd_trig_arg_rejoin
-
-dc_asm_amd_trig_zero_arg:
-    ; cvtss2sd XMM+1, [rsi]
-    lea rsi, [(r8 * 8) + 0xF30F5A0E]
-    bswap esi
-    mov [rdi+rax], esi
-    add rax, 4
+; unsigned DC_ASM_WritePackedSqrt(void *dest, unsigned index);
+DC_ASM_WritePackedSqrt:
+    ; Write:
+    ; sqrtps XMM, XMM
+    ; Where XMM is XMM(index-1)
+    lea ecx, [(esi * 8) + esi + 0xB7]
+    mov [rdi], WORD 0x510F
+    mov [rdi+2], cl
+    mov rax, 3
+    ret
+
+; unsigned DC_ASM_WritePackedPolySin(void *dest, unsigned index);
+DC_ASM_WritePackedPolySin:
+    mov rdx, QWORD dc_asm_packed_poly_sin
+    jmp dc_asm_write_poly_trig
+
+; unsigned DC_ASM_WritePackedPolyCos(void *dest, unsigned index);
+DC_ASM_WritePackedPolyCos:
+    mov rdx, QWORD dc_asm_packed_poly_cos
+    jmp dc_asm_write_poly_trig
+
+; unsigned DC_ASM_WritePackedSpill(void *dest, unsigned slot, unsigned index);
+DC_ASM_WritePackedSpill:
+    ; Write:
+    ; movups [rsp+N], XMM
+    ; Where XMM is XMM(index-1)
+    lea eax, [(edx * 8) + 0x3C]
+    mov cl, 0x11
+    jmp dc_asm_write_packed_stack_slot
+
+; unsigned DC_ASM_WritePackedReload(void *dest, unsigned slot, unsigned index);
+DC_ASM_WritePackedReload:
+    ; Write:
+    ; movups XMM, [rsp+N]
+    ; Where XMM is XMM(index)
+    lea eax, [(edx * 8) + 0x44]
+    mov cl, 0x10
+    ; FALLTHROUGH
+
+; al has the ModRM for [rsp+disp8] and cl has the opcode.
+dc_asm_write_packed_stack_slot:
+    mov [rdi], BYTE 0x0F
+    mov [rdi+1], cl
+    mov [rdi+3], BYTE 0x24
+    shl esi, 4
+    cmp esi, 0x80
+    jae dc_asm_write_far_packed_stack_slot
+    mov [rdi+2], al
+    mov [rdi+4], sil
+    mov rax, 5
+    ret
+
+dc_asm_write_far_packed_stack_slot:
+    add al, 0x40
+    mov [rdi+2], al
+    mov [rdi+4], esi
+    mov rax, 8
+    ret
+
+; The double encoders write the same code as the scalar ones, but using the
+; *sd forms of the instructions. Arguments and spill slots are 8 bytes each.
+
+; unsigned DC_ASM_WriteDoublePushArg(void *dest, unsigned short arg_num,
+;     unsigned index);
+DC_ASM_WriteDoublePushArg:
+    ; Write:
+    ; movsd XMM, [rsi+N]
+    ; Or:
+    ; movsd XMM, [rsi]
+    ; Where XMM is XMM(index)
+    mov [rdi], WORD 0x0FF2
+    mov [rdi+2], BYTE 0x10
+    lea eax, [(edx * 8) + 6]
+    ; FALLTHROUGH
+
+; The opcode is written, al has the ModRM for [rsi], and si has the argument
+; number.
+dc_asm_write_double_arg_operand:
+    movzx esi, si
+    shl esi, 3
+    jz dc_asm_double_push_zero_arg
+    cmp esi, 0x80
+    jae dc_asm_double_push_far_arg
+    add al, 0x40
+    mov [rdi+3], al
+    mov [rdi+4], sil
+    mov rax, 5
+    ret
+
+dc_asm_double_push_far_arg:
+    add al, 0x80
+    mov [rdi+3], al
+    mov [rdi+4], esi
+    mov rax, 8
+    ret
+
+dc_asm_double_push_zero_arg:
+    mov [rdi+3], al
+    mov rax, 4
+    ret
+
+; unsigned DC_ASM_WriteDoubleStoreArg(void *dest, unsigned short arg_num,
+;     unsigned index);
+DC_ASM_WriteDoubleStoreArg:
+    ; Write:
+    ; movsd [rsi+N], XMM
+    ; Or:
+    ; movsd [rsi], XMM
+    ; Where XMM is XMM(index-1)
+    mov [rdi], WORD 0x0FF2
+    mov [rdi+2], BYTE 0x11
+    lea eax, [(edx * 8) - 2]
+    jmp dc_asm_write_double_arg_operand
+
+; unsigned DC_ASM_WriteDoubleImmediate(void *dest, double value,
+;     unsigned index);
+DC_ASM_WriteDoubleImmediate:
+    ; Write:
+    ; mov rcx, IMM
+    ; movq XMM, rcx
+    ; Or:
+    ; xorps XMM, XMM
+    ; Where XMM is XMM(index)
+    movq rax, xmm0
+    test rax, rax
+    jz dc_asm_double_immediate_zero
+    mov [rdi], WORD 0xB948
+    mov [rdi+2], rax
+    mov [rdi+10], DWORD 0x6E0F4866
+    lea eax, [(esi * 8) + 0xC1]
+    mov [rdi+14], al
+    mov rax, 15
+    ret
+
+dc_asm_double_immediate_zero:
+    lea eax, [(esi * 8) + esi + 0xC0]
+    mov [rdi], WORD 0x570F
+    mov [rdi+2], al
+    mov rax, 3
+    ret
+
+; unsigned DC_ASM_WriteDoubleAdd(void *dest, unsigned index);
+DC_ASM_WriteDoubleAdd:
+    mov ecx, 0xF20F5800
+    jmp dc_asm_write_arithmetic
+
+; unsigned DC_ASM_WriteDoubleSub(void *dest, unsigned index);
+DC_ASM_WriteDoubleSub:
+    mov ecx, 0xF20F5C00
+    jmp dc_asm_write_arithmetic
+
+; unsigned DC_ASM_WriteDoubleDiv(void *dest, unsigned index);
+DC_ASM_WriteDoubleDiv:
+    mov ecx, 0xF20F5E00
+    jmp dc_asm_write_arithmetic
+
+; unsigned DC_ASM_WriteDoubleMul(void *dest, unsigned index);
+DC_ASM_WriteDoubleMul:
+    mov ecx, 0xF20F5900
+    jmp dc_asm_write_arithmetic
+
+; unsigned DC_ASM_WriteDoubleMin(void *dest, unsigned index);
+DC_ASM_WriteDoubleMin:
+    mov ecx, 0xF20F5D00
+    jmp dc_asm_write_arithmetic
+
+; unsigned DC_ASM_WriteDoubleMax(void *dest, unsigned index);
+DC_ASM_WriteDoubleMax:
+    mov ecx, 0xF20F5F00
+    jmp dc_asm_write_arithmetic
+
+; unsigned DC_ASM_WriteFloor(void *dest, unsigned index);
+DC_ASM_WriteFloor:
+    mov cl, 0x0A
+    jmp dc_asm_write_round
+
+; unsigned DC_ASM_WritePackedFloor(void *dest, unsigned index);
+DC_ASM_WritePackedFloor:
+    mov cl, 0x08
+    jmp dc_asm_write_round
+
+; unsigned DC_ASM_WriteDoubleFloor(void *dest, unsigned index);
+DC_ASM_WriteDoubleFloor:
+    mov cl, 0x0B
+    ; FALLTHROUGH
+
+dc_asm_write_round:
+    ; Write:
+    ; roundss/roundps/roundsd XMM, XMM, 9
+    ; Where XMM is XMM(index-1). 9 rounds down without raising the inexact
+    ; exception.
+    mov [rdi], DWORD 0x003A0F66
+    mov [rdi+3], cl
+    lea edx, [(esi * 8) + esi + 0x09B7]
+    mov [rdi+4], dx
+    mov rax, 6
+    ret
+
+; unsigned DC_ASM_CanRound(void);
+DC_ASM_CanRound:
+    ; Check for SSE4.1, which has roundss
+    push rbx
+    mov eax, 1
+    cpuid
+    mov eax, ecx
+    shr eax, 19
+    and eax, 1
+    pop rbx
+    ret
+
+; unsigned DC_ASM_WriteX87(void *dest, unsigned func, unsigned index);
+DC_ASM_WriteX87:
+    mov ecx, 0xF3D9
+    jmp dc_asm_x87
+
+; unsigned DC_ASM_WriteDoubleX87(void *dest, unsigned func, unsigned index);
+DC_ASM_WriteDoubleX87:
+    mov ecx, 0xF2DD
+    ; FALLTHROUGH
+
+; cl has the x87 load/store opcode, and ch has the SSE move prefix.
+dc_asm_x87:
+    ; Write:
+    ; movss [rax], XMM(index-N)
+    ; fld DWORD [rax]
+    ; (the same for each of the N operands, up to XMM(index-1))
+    ; <the x87 code for func>
+    ; fstp DWORD [rax]
+    ; movss XMM(index-N), [rax]
+    ; Using movsd and QWORD for double precision.
+    mov rax, QWORD dc_asm_x87_funcs
+    mov esi, esi
+    mov r8, [rax + rsi * 8]
+    movzx r9d, BYTE [r8]
+    sub edx, r9d
+    shl edx, 27
+    movzx r10d, ch
+    or r10d, 0x00110F00
+    or r10d, edx
+    mov r11d, r10d
+    mov rax, rdi
+
+dc_asm_x87_load:
+    mov [rdi], r10d
+    mov [rdi+4], cl
+    mov [rdi+5], BYTE 0x00
+    add rdi, 6
+    add r10d, 0x08000000
+    dec r9d
+    jnz dc_asm_x87_load
     
-dc_asm_amd_trig_arg_rejoin:
-    ; movsd [rax], XMM+1
-    lea rcx, [(r8 * 8) + 0xF20F1108]
+    mov edx, ecx
+    movzx ecx, BYTE [r8+1]
+    lea rsi, [r8+2]
+    rep movsb
+    mov [rdi], dl
+    mov [rdi+1], BYTE 0x18
+    ; Turn the first store into a load of the result
+    xor r11d, 0x00010000
+    mov [rdi+2], r11d
+    sub rdi, rax
+    lea rax, [rdi+6]
+    ret
+
+; unsigned DC_ASM_WriteCompare(void *dest, unsigned predicate, unsigned index);
+DC_ASM_WriteCompare:
+    mov ecx, 0x10F3
+    jmp dc_asm_write_compare
+
+; unsigned DC_ASM_WritePackedCompare(void *dest,
+;     unsigned predicate,
+;     unsigned index);
+DC_ASM_WritePackedCompare:
+    mov ecx, 0x1000
+    jmp dc_asm_write_compare
+
+; unsigned DC_ASM_WriteDoubleCompare(void *dest,
+;     unsigned predicate,
+;     unsigned index);
+DC_ASM_WriteDoubleCompare:
+    mov ecx, 0x20F2
+    ; FALLTHROUGH
+
+; cl has the SSE prefix, or zero for the packed form, and ch has the offset of
+; 1.0 for the precision in dc_asm_select_constants.
+dc_asm_write_compare:
+    ; Write:
+    ; cmpss XMM(index-2), XMM(index-1), predicate
+    ; mov rcx, dc_asm_select_constants
+    ; andps XMM(index-2), [rcx+offset]
+    ; Using cmpps or cmpsd for the other forms. The comparison gives a mask of
+    ; all ones or all zeros, so the and gives 1.0 or 0.0.
+    mov rax, rdi
+    test cl, cl
+    jz dc_asm_compare_no_prefix
+    mov [rdi], cl
+    inc rdi
+dc_asm_compare_no_prefix:
+    lea r8d, [(edx * 8) + edx + 0xAF]
+    shl r8d, 16
+    or r8d, 0xC20F
+    mov [rdi], r8d
+    mov [rdi+3], sil
+    mov [rdi+4], WORD 0xB948
+    mov r9, QWORD dc_asm_select_constants
+    mov [rdi+6], r9
+    lea r8d, [(edx * 8) + 0x31]
+    shl r8d, 16
+    or r8d, 0x540F
+    mov [rdi+14], r8d
+    mov [rdi+17], ch
+    sub rdi, rax
+    lea rax, [rdi+18]
+    ret
+
+; unsigned DC_ASM_WriteSelect(void *dest, unsigned index);
+DC_ASM_WriteSelect:
+    mov cl, 0xF3
+    jmp dc_asm_write_select
+
+; unsigned DC_ASM_WritePackedSelect(void *dest, unsigned index);
+DC_ASM_WritePackedSelect:
+    xor ecx, ecx
+    jmp dc_asm_write_select
+
+; unsigned DC_ASM_WriteDoubleSelect(void *dest, unsigned index);
+DC_ASM_WriteDoubleSelect:
+    mov cl, 0xF2
+    ; FALLTHROUGH
+
+; cl has the SSE prefix, or zero for the packed form.
+dc_asm_write_select:
+    ; Write:
+    ; mov rcx, dc_asm_select_constants
+    ; cmpneqss XMM(index-1), [rcx]
+    ; andps XMM(index-3), XMM(index-1)
+    ; andnps XMM(index-1), XMM(index-2)
+    ; orps XMM(index-3), XMM(index-1)
+    ; XMM(index-1) is the condition, which becomes a mask that keeps
+    ; XMM(index-3) when it is not zero (including NaN), and XMM(index-2)
+    ; otherwise.
+    mov rax, rdi
+    mov [rdi], WORD 0xB948
+    mov r9, QWORD dc_asm_select_constants
+    mov [rdi+2], r9
+    add rdi, 10
+    test cl, cl
+    jz dc_asm_select_no_prefix
+    mov [rdi], cl
+    inc rdi
+dc_asm_select_no_prefix:
+    lea r8d, [(esi * 8) - 7]
+    shl r8d, 16
+    or r8d, 0xC20F
+    mov [rdi], r8d
+    mov [rdi+3], BYTE 4
+    lea r8d, [(esi * 8) + esi + 0xA7]
+    mov [rdi+4], WORD 0x540F
+    mov [rdi+6], r8b
+    mov [rdi+10], WORD 0x560F
+    mov [rdi+12], r8b
+    lea r8d, [(esi * 8) + esi + 0xB6]
+    mov [rdi+7], WORD 0x550F
+    mov [rdi+9], r8b
+    sub rdi, rax
+    lea rax, [rdi+13]
+    ret
+
+; unsigned DC_ASM_WriteDoubleSqrt(void *dest, unsigned index);
+DC_ASM_WriteDoubleSqrt:
+    ; Write:
+    ; sqrtsd XMM, XMM
+    ; Where XMM is XMM(index-1)
+    lea ecx, [(esi * 8) + esi + 0xF20F51B7]
     bswap ecx
-    mov [rdi+rax], ecx
-    add rax, 4
+    mov [rdi], ecx
+    mov eax, 4
+    ret
+
+; unsigned DC_ASM_WriteDoubleSin(void *dest, unsigned index);
+DC_ASM_WriteDoubleSin:
+    mov cx, 0xFED9
+    jmp dc_asm_double_trig
+
+; unsigned DC_ASM_WriteDoubleCos(void *dest, unsigned index);
+DC_ASM_WriteDoubleCos:
+    mov cx, 0xFFD9
     ; FALLTHROUGH
 
-; This is used for the sin/cos calculations.
-; dx has the operation to use in the x87 registers.
-; rax has our current write offset.
-dc_asm_amd_trig:
+dc_asm_double_trig:
+    ; Write:
+    ; movsd [rax], XMM
     ; fld QWORD [rax]
-    mov [rdi+rax], WORD 0x00DD
-    
     ; fsin/fcos
-    mov [rdi+rax+2], dx
-    
     ; fstp QWORD [rax]
-    mov [rdi+rax+4], WORD 0x18DD
-    
-    ; cvtsd2ss XMM, [rax]
-    lea rax, [(r8 * 8) + 0xF20F5A00]
-    bswap eax
-    mov [rdi+rax+6], eax
-    add rax, 10
+    ; movsd XMM, [rax]
+    ; Where XMM is XMM(index-1)
+    lea edx, [(esi * 8) - 8]
+    or edx, 0xF20F1100
+    bswap edx
+    mov [rdi], edx
+    mov [rdi+4], WORD 0x00DD
+    mov [rdi+6], cx
+    mov [rdi+8], WORD 0x18DD
+    ; Turn the movsd store into a load
+    bswap edx
+    mov dh, 0x10
+    bswap edx
+    mov [rdi+10], edx
+    mov rax, 14
+    ret
+
+; unsigned DC_ASM_WriteDoubleSpill(void *dest, unsigned slot, unsigned index);
+DC_ASM_WriteDoubleSpill:
+    ; Write:
+    ; movsd [rsp+N], XMM
+    ; Where XMM is XMM(index-1)
+    lea eax, [(edx * 8) + 0xF20F113C]
+    shl esi, 3
+    jmp dc_asm_write_stack_offset
+
+; unsigned DC_ASM_WriteDoubleReload(void *dest, unsigned slot, unsigned index);
+DC_ASM_WriteDoubleReload:
+    ; Write:
+    ; movsd XMM, [rsp+N]
+    ; Where XMM is XMM(index)
+    lea eax, [(edx * 8) + 0xF20F1044]
+    shl esi, 3
+    jmp dc_asm_write_stack_offset
+
+; void DC_ASM_CalculateDouble(const void *addr, const double *args,
+;     double *result);
+DC_ASM_CalculateDouble:
+    push rdx
+    lea rax,[rsp-24]
+    call rdi
+    pop rdx
+    movsd [rdx], xmm0
+    ret
+
+; void DC_ASM_CalculatePacked(const void *addr, const float *args,
+;     float *results);
+DC_ASM_CalculatePacked:
+    push rdx
+    lea rax,[rsp-24]
+    call rdi
+    pop rdx
+    movups [rdx], xmm0
+    ret
+
+; void DC_ASM_Calculate(const void *addr, const float *args, float *result);
+DC_ASM_Calculate:
+    push rdx
+    lea rax,[rsp-24]
+    call rdi
+    pop rdx
+    movss [rdx], xmm0
     ret
 
 section .bss
     DC_ASM_pop_size: ; FALLTHROUGH
     dc_zero_memory: resd 1
-    dc_asm_index: resd 1
 
-section .data
-    
-    dc_asm_ID_AMD: db "cAMD"
+section .data align=16
+
+    ; Templates for the polynomial sin/cos. The argument is in xmm5, xmm6 and
+    ; xmm7 are temporaries, and rcx points to the constants.
+    ;
+    ; With k = round(x / pi), sin(x) = (-1)^k * sin(x - k*pi). The sign is
+    ; applied to both x and k first, and then k*pi is subtracted in two parts
+    ; so the reduced argument stays accurate for larger k.
+    ; For cos, k = round(x / pi + 0.5) and (k - 0.5)*pi is subtracted instead.
+dc_asm_poly_sin_head:
+    movaps xmm6, xmm5
+    mulss xmm6, [rcx]
+    addss xmm6, [rcx+4]
+    ; Adding 1.5 * 2^23 leaves k in the low bits, so this gets the sign.
+    movaps xmm7, xmm6
+    pslld xmm7, 31
+    subss xmm6, [rcx+4]
+dc_asm_poly_sin_head_size equ $ - dc_asm_poly_sin_head
+
+dc_asm_poly_cos_head:
+    movaps xmm6, xmm5
+    mulss xmm6, [rcx]
+    addss xmm6, [rcx+32]
+    addss xmm6, [rcx+4]
+    movaps xmm7, xmm6
+    pslld xmm7, 31
+    subss xmm6, [rcx+4]
+    subss xmm6, [rcx+32]
+dc_asm_poly_cos_head_size equ $ - dc_asm_poly_cos_head
+
+dc_asm_poly_trig_tail:
+    xorps xmm5, xmm7
+    xorps xmm6, xmm7
+    movaps xmm7, xmm6
+    mulss xmm7, [rcx+8]
+    subss xmm5, xmm7
+    mulss xmm6, [rcx+12]
+    subss xmm5, xmm6
+    ; xmm5 is now in [-pi/2, pi/2]
+    movaps xmm6, xmm5
+    mulss xmm6, xmm6
+    movaps xmm7, xmm6
+    mulss xmm7, [rcx+16]
+    addss xmm7, [rcx+20]
+    mulss xmm7, xmm6
+    addss xmm7, [rcx+24]
+    mulss xmm7, xmm6
+    addss xmm7, [rcx+28]
+    mulss xmm7, xmm6
+    mulss xmm7, xmm5
+    addss xmm5, xmm7
+dc_asm_poly_trig_tail_size equ $ - dc_asm_poly_trig_tail
+
+    ; The same templates with the *ps instructions, using the constants in
+    ; dc_asm_packed_poly_trig_constants which are repeated for each lane.
+dc_asm_packed_poly_sin_head:
+    movaps xmm6, xmm5
+    mulps xmm6, [rcx]
+    addps xmm6, [rcx+16]
+    movaps xmm7, xmm6
+    pslld xmm7, 31
+    subps xmm6, [rcx+16]
+dc_asm_packed_poly_sin_head_size equ $ - dc_asm_packed_poly_sin_head
+
+dc_asm_packed_poly_cos_head:
+    movaps xmm6, xmm5
+    mulps xmm6, [rcx]
+    addps xmm6, [rcx+128]
+    addps xmm6, [rcx+16]
+    movaps xmm7, xmm6
+    pslld xmm7, 31
+    subps xmm6, [rcx+16]
+    subps xmm6, [rcx+128]
+dc_asm_packed_poly_cos_head_size equ $ - dc_asm_packed_poly_cos_head
+
+dc_asm_packed_poly_trig_tail:
+    xorps xmm5, xmm7
+    xorps xmm6, xmm7
+    movaps xmm7, xmm6
+    mulps xmm7, [rcx+32]
+    subps xmm5, xmm7
+    mulps xmm6, [rcx+48]
+    subps xmm5, xmm6
+    movaps xmm6, xmm5
+    mulps xmm6, xmm6
+    movaps xmm7, xmm6
+    mulps xmm7, [rcx+64]
+    addps xmm7, [rcx+80]
+    mulps xmm7, xmm6
+    addps xmm7, [rcx+96]
+    mulps xmm7, xmm6
+    addps xmm7, [rcx+112]
+    mulps xmm7, xmm6
+    mulps xmm7, xmm5
+    addps xmm5, xmm7
+dc_asm_packed_poly_trig_tail_size equ $ - dc_asm_packed_poly_trig_tail
+
+    align 4
+dc_asm_poly_trig_constants:
+    dd 0.318309886 ; 1 / pi
+    dd 12582912.0 ; 1.5 * 2^23
+    dd 3.140625 ; pi, high part with few enough bits that k * it is exact
+    dd 9.67653589793e-4 ; pi, low part
+    ; Minimax coefficients for sin(x) = x + x^3 * P(x^2) on [-pi/2, pi/2]
+    dd 2.600054813e-6
+    dd -1.980661473e-4
+    dd 8.333017118e-3
+    dd -1.666665673e-1
+    dd 0.5
+
+    ; Packed constants must be aligned for the *ps memory operands.
+    align 16
+dc_asm_packed_poly_trig_constants:
+    times 4 dd 0.318309886
+    times 4 dd 12582912.0
+    times 4 dd 3.140625
+    times 4 dd 9.67653589793e-4
+    times 4 dd 2.600054813e-6
+    times 4 dd -1.980661473e-4
+    times 4 dd 8.333017118e-3
+    times 4 dd -1.666665673e-1
+    times 4 dd 0.5
+
+    ; Comparisons and selects compare against the zeros, and a true comparison
+    ; gives the 1.0 for its precision.
+dc_asm_select_constants:
+    times 4 dd 0
+    times 4 dd 1.0
+    times 2 dq 1.0
+
+    ; Descriptors for dc_asm_write_poly_trig. Each one has the head, the size
+    ; of the head, the tail, the size of the tail, and the constants.
+    align 8
+dc_asm_poly_sin:
+    dq dc_asm_poly_sin_head, dc_asm_poly_sin_head_size
+    dq dc_asm_poly_trig_tail, dc_asm_poly_trig_tail_size
+    dq dc_asm_poly_trig_constants
+dc_asm_poly_cos:
+    dq dc_asm_poly_cos_head, dc_asm_poly_cos_head_size
+    dq dc_asm_poly_trig_tail, dc_asm_poly_trig_tail_size
+    dq dc_asm_poly_trig_constants
+dc_asm_packed_poly_sin:
+    dq dc_asm_packed_poly_sin_head, dc_asm_packed_poly_sin_head_size
+    dq dc_asm_packed_poly_trig_tail, dc_asm_packed_poly_trig_tail_size
+    dq dc_asm_packed_poly_trig_constants
+dc_asm_packed_poly_cos:
+    dq dc_asm_packed_poly_cos_head, dc_asm_packed_poly_cos_head_size
+    dq dc_asm_packed_poly_trig_tail, dc_asm_packed_poly_trig_tail_size
+    dq dc_asm_packed_poly_trig_constants
     
     dc_asm_arithmetic_codes: db 0xC1,0xCA,0xD3,0xDC,0xE5,0xEE,0xF7
+    
+    ; The x87 code for DC_ASM_WriteX87, indexed by DC_ASM_X87_*. Each starts
+    ; with the number of operands and the length of the code.
+dc_asm_x87_funcs:
+    dq dc_asm_x87_pow, dc_asm_x87_atan2, dc_asm_x87_tan, dc_asm_x87_exp
+    dq dc_asm_x87_log, dc_asm_x87_floor
+    
+    ; 2^st0, with st0 split into an integer for fscale and a fraction for f2xm1:
+    ; fld st0 / frndint / fsub st1, st0 / fxch / f2xm1 / fld1 / faddp / fscale
+    ; fstp st1
+%define DC_ASM_X87_EXP2 0xD9,0xC0,0xD9,0xFC,0xDC,0xE9,0xD9,0xC9,0xD9,0xF0,0xD9,0xE8,0xDE,0xC1,0xD9,0xFD,0xDD,0xD9
+    ; fxch / fyl2x / 2^st0
+dc_asm_x87_pow: db 2, 22, 0xD9,0xC9,0xD9,0xF1,DC_ASM_X87_EXP2
+    ; fpatan
+dc_asm_x87_atan2: db 2, 2, 0xD9,0xF3
+    ; fptan / fstp st0
+dc_asm_x87_tan: db 1, 4, 0xD9,0xF2,0xDD,0xD8
+    ; fldl2e / fmulp / 2^st0
+dc_asm_x87_exp: db 1, 22, 0xD9,0xEA,0xDE,0xC9,DC_ASM_X87_EXP2
+    ; fldln2 / fxch / fyl2x
+dc_asm_x87_log: db 1, 6, 0xD9,0xED,0xD9,0xC9,0xD9,0xF1
+    ; fnstcw [rax] / movzx ecx, WORD [rax] / and ch, 0xF3 / or ch, 0x04
+    ; mov [rax+4], ecx / fldcw [rax+4] / frndint / fldcw [rax]
+    ; This rounds down, then restores the rounding mode.
+dc_asm_x87_floor: db 1, 21, 0xD9,0x38,0x0F,0xB7,0x08,0x80,0xE5,0xF3,0x80,0xCD,0x04,0x89,0x48,0x04,0xD9,0x68,0x04,0xD9,0xFC,0xD9,0x28
+    DC_ASM_poly_sin_size:
+        dd 16 + dc_asm_poly_sin_head_size + dc_asm_poly_trig_tail_size
+    DC_ASM_poly_cos_size:
+        dd 16 + dc_asm_poly_cos_head_size + dc_asm_poly_trig_tail_size
+    DC_ASM_packed_poly_sin_size:
+        dd 16 + dc_asm_packed_poly_sin_head_size + dc_asm_packed_poly_trig_tail_size
+    DC_ASM_packed_poly_cos_size:
+        dd 16 + dc_asm_packed_poly_cos_head_size + dc_asm_packed_poly_trig_tail_size
+    DC_ASM_packed_immediate_size: dd 14
+    DC_ASM_packed_spill_size: dd 8
+    DC_ASM_packed_push_arg_size: dd 7
+    DC_ASM_dup_size: ; FALLTHROUGH
+    DC_ASM_and_size: ; FALLTHROUGH
+    DC_ASM_packed_arithmetic_size: dd 3
+    DC_ASM_double_store_arg_size: ; FALLTHROUGH
+    DC_ASM_double_push_arg_size: dd 8
+    DC_ASM_double_immediate_size: dd 15
+    DC_ASM_double_arithmetic_size: dd 4
+    DC_ASM_double_trig_size: dd 14
+    DC_ASM_x87_size: dd 40
+    DC_ASM_floor_size: dd 6
+    DC_ASM_compare_size: dd 19
+    DC_ASM_select_size: dd 24
+    DC_ASM_double_spill_size: dd 9
     DC_ASM_ret_size: dd 1
+    DC_ASM_spill_size: ; FALLTHROUGH
+    DC_ASM_reload_size: dd 9
+    DC_ASM_frame_size: dd 7
     DC_ASM_sin_size: ; FALLTHROUGH
-    DC_ASM_cos_size: ; FALLTHROUGH
-    DC_ASM_sqrt_size: dd 15
+    DC_ASM_cos_size: dd 14
     DC_ASM_add_arg_size: ; FALLTHROUGH
     DC_ASM_sub_arg_size: ; FALLTHROUGH
     DC_ASM_div_arg_size: ; FALLTHROUGH
     DC_ASM_mul_arg_size: ; FALLTHROUGH
     DC_ASM_sqrt_arg_size: ; FALLTHROUGH
-    DC_ASM_push_arg_size: dd 5
+    DC_ASM_store_arg_size: ; FALLTHROUGH
+    DC_ASM_push_arg_size: dd 8
     DC_ASM_sin_arg_size: ; FALLTHROUGH
-    DC_ASM_cos_arg_size: ; FALLTHROUGH
-    DC_ASM_sin_imm_size: ; FALLTHROUGH
-    DC_ASM_cos_imm_size: dd 43
+    DC_ASM_cos_arg_size: dd 22
     DC_ASM_add_imm_size: ; FALLTHROUGH
     DC_ASM_sub_imm_size: ; FALLTHROUGH
     DC_ASM_div_imm_size: ; FALLTHROUGH
     DC_ASM_mul_imm_size: ; FALLTHROUGH
-    DC_ASM_sqrt_imm_size: ; FALLTHROUGH
     DC_ASM_immediate_size: dd 10
     DC_ASM_jmp_size: dd 13
     DC_ASM_add_size: ; FALLTHROUGH
+    DC_ASM_min_size: ; FALLTHROUGH
     DC_ASM_sub_size: ; FALLTHROUGH
     DC_ASM_mul_size: ; FALLTHROUGH
+    DC_ASM_sqrt_size: ; FALLTHROUGH
     DC_ASM_div_size: dd 4
-
@@ -19,19 +19,39 @@
 // This is quite similar to how mmap with a -1 FD and MAP_ANONYMOUS works, but
 // having read the source for Haiku's implementation, it's quite a bit simpler.
 // It also gives us an opportunity to show our love for Haiku.
+//
+// The code is a clone of the data area that can be executed but not written,
+// so that code can be added while other code in the area is running. If the
+// clone can't be made then the code is the data area itself, which is sealed
+// once it is made executable.
 struct DC_JIT_Page{
-    DC_JIT_Page()
+    DC_JIT_Page(unsigned size)
       : m_id(B_ERROR)
-      , m_data(NULL){
+      , m_code_id(B_ERROR)
+      , m_data(NULL)
+      , m_code(NULL){
         m_id = create_area("DCJIT generated code",
             &m_data,
             B_ANY_ADDRESS,
-            B_PAGE_SIZE,
+            size,
             B_NO_LOCK,
-            B_WRITE_AREA);
+            B_READ_AREA|B_WRITE_AREA);
+        if(ok()){
+            m_code_id = clone_area("DCJIT generated code",
+                &m_code,
+                B_ANY_ADDRESS,
+                B_READ_AREA|B_EXECUTE_AREA,
+                m_id);
+            if(m_code_id < B_OK){
+                m_code_id = m_id;
+                m_code = m_data;
+            }
+        }
     }
     
     ~DC_JIT_Page(){
+        if(m_code_id != m_id)
+            delete_area(m_code_id);
         if(ok())
             delete_area(m_id);
     }
@@ -40,29 +60,28 @@ struct DC_JIT_Page{
         return m_id != B_ERROR && m_id != B_BAD_VALUE && m_id != B_NO_MEMORY;
     }
     
-    inline void makeExecutable(){
+    inline bool makeExecutable(){
+        if(m_code_id != m_id)
+            return true;
         set_area_protection(m_id, B_READ_AREA|B_EXECUTE_AREA);
-    }
-    
-    inline void renew(){
-        set_area_protection(m_id, B_WRITE_AREA);
+        return false;
     }
     
     inline void *data() { return m_data; }
+    inline const void *code() const { return m_code; }
     
 private:
     
-    area_id m_id;
-    void *m_data;
+    area_id m_id, m_code_id;
+    void *m_data, *m_code;
 };
 
 unsigned DC_JIT_PageSize(){
     return B_PAGE_SIZE;
 }
 
-/* Allocs a page with write-only permissions. */
-DC_JIT_Page *DC_JIT_AllocPage(){
-    DC_JIT_Page *const page = new DC_JIT_Page();
+DC_JIT_Page *DC_JIT_AllocPage(unsigned size){
+    DC_JIT_Page *const page = new DC_JIT_Page(size);
     if(page == NULL || page->ok()){
         return page;
     }
@@ -76,14 +95,12 @@ void *DC_JIT_GetPageData(DC_JIT_Page *p){
     return p->data();
 }
 
-/* Marks a page as read/execute only. */
-void DC_JIT_MarkPageExecutable(DC_JIT_Page *p){
-    p->makeExecutable();
+const void *DC_JIT_GetPageCode(const DC_JIT_Page *p){
+    return p->code();
 }
 
-/* Clears a page, and marks as write-only again. */
-void DC_JIT_RenewPage(DC_JIT_Page *p){
-    p->renew();
+int DC_JIT_MarkPageExecutable(DC_JIT_Page *p){
+    return p->makeExecutable();
 }
 
 void DC_JIT_FreePage(DC_JIT_Page *p){
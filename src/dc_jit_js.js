@@ -7,7 +7,7 @@
 var DC_JS_strings = [];
 var DC_JS_functions = [];
 
-var DC_JS_function_prefix = "s=[];var u=0.0;";
+var DC_JS_function_prefix = "s=[];var t=[];var u=0.0;";
 var DC_JS_function_suffix = "return s[0];";
 
 function DC_JS_FindFirstFreeSlot(array){
@@ -45,6 +45,22 @@ function DC_JS_BuildPop(string_num){
     DC_JS_strings[string_num] += "u=s.pop();";
 }
 
+function DC_JS_BuildDup(string_num){
+    DC_JS_strings[string_num] += "s.push(s[s.length-1]);";
+}
+
+function DC_JS_BuildStoreTemp(string_num, temp){
+    DC_JS_strings[string_num] += "t["+temp+"]=s[s.length-1];";
+}
+
+function DC_JS_BuildStoreArg(string_num, arg_num){
+    DC_JS_strings[string_num] += "a["+arg_num+"]=s[s.length-1];";
+}
+
+function DC_JS_BuildPushTemp(string_num, temp){
+    DC_JS_BuildPushImm(string_num, 0, "t["+temp+"]");
+}
+
 function DC_JS_BuildMathBuiltinImm(string_num, name, immediate){
     DC_JS_strings[string_num] += "s.push(Math."+name+"("+immediate+"));";
 }
@@ -57,6 +73,40 @@ function DC_JS_BuildMathBuiltin(string_num, name){
     DC_JS_BuildMathBuiltinImm(string_num, name, "s.pop()");
 }
 
+function DC_JS_BuildMathBuiltin2Imm(string_num, name, immediate){
+    DC_JS_strings[string_num] += "s.push(Math."+name+"(s.pop(),"+immediate+"));";
+}
+
+function DC_JS_BuildMathBuiltin2Arg(string_num, name, arg_num){
+    DC_JS_BuildMathBuiltin2Imm(string_num, name, "a["+arg_num+"]");
+}
+
+function DC_JS_BuildMathBuiltin2(string_num, name){
+    DC_JS_BuildPop(string_num);
+    DC_JS_BuildMathBuiltin2Imm(string_num, name, "u");
+}
+
+// Comparisons give numbers rather than booleans.
+function DC_JS_BuildCompareImm(string_num, operator, immediate){
+    DC_JS_strings[string_num] += "s.push(+(s.pop()"+operator+""+immediate+"));";
+}
+
+function DC_JS_BuildCompareArg(string_num, operator, arg_num){
+    DC_JS_BuildCompareImm(string_num, operator, "a["+arg_num+"]");
+}
+
+function DC_JS_BuildCompare(string_num, operator){
+    DC_JS_BuildPop(string_num);
+    DC_JS_BuildCompareImm(string_num, operator, "u");
+}
+
+// NaN is not zero, so it selects the first value.
+function DC_JS_BuildSelect(string_num){
+    DC_JS_BuildPop(string_num);
+    DC_JS_strings[string_num] +=
+        "if(u==0)s[s.length-2]=s[s.length-1];s.pop();";
+}
+
 function DC_JS_AbandonCalculation(string_num){
     DC_JS_strings[string_num] = null;
 }
@@ -90,6 +140,10 @@ function DC_JS_AppendArg(a){
     DC_JS_args.push(a);
 }
 
+function DC_JS_GetArg(i){
+    return DC_JS_args[i];
+}
+
 function DC_JS_Calculate(function_num){
     return DC_JS_functions[function_num](DC_JS_args);
 }
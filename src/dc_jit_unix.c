@@ -10,8 +10,16 @@
 #define _BSD_SOURCE
 #define _DEFAULT_SOURCE
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 static unsigned page_size(){
 #ifdef _SC_PAGESIZE
@@ -37,29 +45,92 @@ unsigned DC_JIT_PageSize(){
     return size;
 }
 
-/* Allocs a page with write-only permissions. */
-struct DC_JIT_Page *DC_JIT_AllocPage(){
-    const unsigned page_size = DC_JIT_PageSize();
-    return mmap(NULL, page_size, PROT_WRITE, MAP_PRIVATE|DC_MAP_ANON, -1, 0);
+/* Pages are mapped twice from a shared memory object, once writable as data
+ * and once executable as code. If that is not possible then code is the same
+ * as data, and the pages are sealed once they are marked executable. The size
+ * is kept for munmap and mprotect. */
+struct DC_JIT_Page{
+    void *data, *code;
+    unsigned size;
+};
+
+/* Opens an anonymous shared memory object of size bytes, or returns -1. Linux
+ * has memfd_create, which works even where /dev/shm is mounted noexec. The
+ * name of a named object is unlinked right away, so nothing is left behind. */
+static int dc_jit_open_memory(unsigned size){
+    int fd;
+#if defined SYS_memfd_create
+    /* 1 is MFD_CLOEXEC */
+    fd = (int)syscall(SYS_memfd_create, "dcjit", 1u);
+#elif defined SHM_ANON
+    fd = shm_open(SHM_ANON, O_RDWR, 0600);
+#else
+    static unsigned counter = 0;
+    char name[0x40];
+    sprintf(name, "/dcjit-%ld-%u", (long)getpid(), counter++);
+    if((fd = shm_open(name, O_RDWR|O_CREAT|O_EXCL, 0600)) != -1)
+        shm_unlink(name);
+#endif
+    if(fd != -1 && ftruncate(fd, size) != 0){
+        close(fd);
+        fd = -1;
+    }
+    return fd;
 }
 
-void *DC_JIT_GetPageData(struct DC_JIT_Page *p){
+/* Maps the data and code views of a shared memory object. Returns zero and
+ * leaves nothing mapped if either view could not be mapped. */
+static int dc_jit_map_views(struct DC_JIT_Page *p){
+    const int fd = dc_jit_open_memory(p->size);
+    if(fd == -1)
+        return 0;
+    p->data = mmap(NULL, p->size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    p->code = MAP_FAILED;
+    if(p->data != MAP_FAILED){
+        p->code = mmap(NULL, p->size, PROT_READ|PROT_EXEC, MAP_SHARED, fd, 0);
+        if(p->code == MAP_FAILED)
+            munmap(p->data, p->size);
+    }
+    close(fd);
+    return p->code != MAP_FAILED;
+}
+
+struct DC_JIT_Page *DC_JIT_AllocPage(unsigned size){
+    struct DC_JIT_Page *const p = malloc(sizeof(struct DC_JIT_Page));
+    if(p == NULL)
+        return NULL;
+    p->size = size;
+    if(!dc_jit_map_views(p)){
+        p->data = mmap(NULL, size, PROT_WRITE, MAP_PRIVATE|DC_MAP_ANON, -1, 0);
+        if(p->data == MAP_FAILED){
+            free(p);
+            return NULL;
+        }
+        p->code = p->data;
+    }
     return p;
 }
 
-/* Marks a page as read/execute only. */
-void DC_JIT_MarkPageExecutable(struct DC_JIT_Page *p){
-    const unsigned page_size = DC_JIT_PageSize();
-    mprotect(p, page_size, PROT_READ|PROT_EXEC);
+void *DC_JIT_GetPageData(struct DC_JIT_Page *p){
+    return p->data;
+}
+
+const void *DC_JIT_GetPageCode(const struct DC_JIT_Page *p){
+    return p->code;
 }
 
-/* Clears a page, and marks as write-only again. */
-void DC_JIT_RenewPage(struct DC_JIT_Page *p){
-    const unsigned page_size = DC_JIT_PageSize();
-    mprotect(p, page_size, PROT_WRITE);
+/* x86 keeps the instruction cache coherent with writes through the other view,
+ * so only pages with a single view need anything done. */
+int DC_JIT_MarkPageExecutable(struct DC_JIT_Page *p){
+    if(p->code != p->data)
+        return 1;
+    mprotect(p->data, p->size, PROT_READ|PROT_EXEC);
+    return 0;
 }
 
 void DC_JIT_FreePage(struct DC_JIT_Page *p){
-    const unsigned page_size = DC_JIT_PageSize();
-    munmap(p, page_size);
+    if(p->code != p->data)
+        munmap(p->code, p->size);
+    munmap(p->data, p->size);
+    free(p);
 }
@@ -19,31 +19,90 @@ unsigned DC_JIT_PageSize(){
     return page_size;
 }
 
-/* Allocs a page with write-only permissions. */
-struct DC_JIT_Page *DC_JIT_AllocPage(){
-    return VirtualAlloc(NULL, DC_JIT_PageSize(), MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+/* Pages are two views of a section, one writable as data and one executable
+ * as code. If the section could not be mapped then code is the same as data,
+ * which is made executable and sealed by DC_JIT_MarkPageExecutable. The size
+ * is kept for VirtualProtect. */
+struct DC_JIT_Page{
+    void *data, *code;
+    SIZE_T size;
+};
+
+/* Maps the data and code views of a new section. Returns zero and leaves
+ * nothing mapped if either view could not be mapped. */
+static int dc_jit_map_views(struct DC_JIT_Page *p){
+    const HANDLE section = CreateFileMapping(INVALID_HANDLE_VALUE,
+        NULL,
+        PAGE_EXECUTE_READWRITE,
+        0,
+        (DWORD)p->size,
+        NULL);
+    if(section == NULL)
+        return 0;
+    p->code = NULL;
+    p->data = MapViewOfFile(section, FILE_MAP_WRITE, 0, 0, p->size);
+    if(p->data != NULL){
+        p->code = MapViewOfFile(section,
+            FILE_MAP_READ | FILE_MAP_EXECUTE,
+            0,
+            0,
+            p->size);
+        if(p->code == NULL)
+            UnmapViewOfFile(p->data);
+    }
+    /* The views keep the section alive. */
+    CloseHandle(section);
+    return p->code != NULL;
 }
 
-void *DC_JIT_GetPageData(struct DC_JIT_Page *p){
+struct DC_JIT_Page *DC_JIT_AllocPage(unsigned size){
+    struct DC_JIT_Page *const p = HeapAlloc(GetProcessHeap(),
+        0,
+        sizeof(struct DC_JIT_Page));
+    if(p == NULL)
+        return NULL;
+    p->size = size;
+    if(!dc_jit_map_views(p)){
+        p->data = VirtualAlloc(NULL,
+            size,
+            MEM_RESERVE | MEM_COMMIT,
+            PAGE_READWRITE);
+        if(p->data == NULL){
+            HeapFree(GetProcessHeap(), 0, p);
+            return NULL;
+        }
+        p->code = p->data;
+    }
     return p;
 }
 
-/* Marks a page as read/execute only. */
-void DC_JIT_MarkPageExecutable(struct DC_JIT_Page *p){
-    DWORD unused, page_size = DC_JIT_PageSize();
-    if(VirtualProtect(p, page_size, PAGE_EXECUTE_READ, &unused) != 0){
-        const DWORD err = GetLastError();
-        (void)err;
-    }
-    FlushInstructionCache(GetCurrentProcess(), p, page_size);
+void *DC_JIT_GetPageData(struct DC_JIT_Page *p){
+    return p->data;
 }
 
-/* Clears a page, and marks as write-only again. */
-void DC_JIT_RenewPage(struct DC_JIT_Page *p){
-    DWORD unused;
-    VirtualProtect(p, DC_JIT_PageSize(), PAGE_READWRITE, &unused);
+const void *DC_JIT_GetPageCode(const struct DC_JIT_Page *p){
+    return p->code;
+}
+
+int DC_JIT_MarkPageExecutable(struct DC_JIT_Page *p){
+    if(p->code == p->data){
+        DWORD unused;
+        if(VirtualProtect(p->data, p->size, PAGE_EXECUTE_READ, &unused) != 0){
+            const DWORD err = GetLastError();
+            (void)err;
+        }
+    }
+    FlushInstructionCache(GetCurrentProcess(), p->code, p->size);
+    return p->code != p->data;
 }
 
 void DC_JIT_FreePage(struct DC_JIT_Page *p){
-    VirtualFree(p, 0, MEM_RELEASE);
+    if(p->code != p->data){
+        UnmapViewOfFile(p->code);
+        UnmapViewOfFile(p->data);
+    }
+    else{
+        VirtualFree(p->data, 0, MEM_RELEASE);
+    }
+    HeapFree(GetProcessHeap(), 0, p);
 }
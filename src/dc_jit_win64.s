@@ -40,14 +40,39 @@ DC_ASM_FunctionWin64(%1):
     DC_ASM_SingleIntArgBody %1
 %endmacro
 
-%macro DC_ASM_SingleIntSingleFloatArgFunc 1
+; The encoders take the stack depth as the last integer argument.
+%macro DC_ASM_IndexArgFunc 1
 DC_ASM_FunctionWrapper %1
 DC_ASM_FunctionWin64(%1):
+    sub rsp, 8
+    push rsi
+    push rdi
+    mov rdi, rcx
+    mov esi, edx
+    call %1
+    pop rdi
+    pop rsi
+    add rsp, 8
+    ret
+%endmacro
+
+%macro DC_ASM_FloatIndexArgFunc 1
+DC_ASM_FunctionWrapper %1
+DC_ASM_FunctionWin64(%1):
+    sub rsp, 8
+    push rsi
+    push rdi
     movaps xmm0, xmm1
-    DC_ASM_SingleIntArgBody %1
+    mov rdi, rcx
+    mov esi, r8d
+    call %1
+    pop rdi
+    pop rsi
+    add rsp, 8
+    ret
 %endmacro
 
-%macro DC_ASM_SingleIntSingleShortArgFunc 1
+%macro DC_ASM_ShortIndexArgFunc 1
 DC_ASM_FunctionWrapper %1
 DC_ASM_FunctionWin64(%1):
     sub rsp, 8
@@ -55,6 +80,7 @@ DC_ASM_FunctionWin64(%1):
     push rsi
     mov rdi, rcx
     movzx rsi, dx
+    mov edx, r8d
     call %1
     pop rsi
     pop rdi
@@ -62,6 +88,22 @@ DC_ASM_FunctionWin64(%1):
     ret
 %endmacro
 
+%macro DC_ASM_IntIndexArgFunc 1
+DC_ASM_FunctionWrapper %1
+DC_ASM_FunctionWin64(%1):
+    sub rsp, 8
+    push rsi
+    push rdi
+    mov rdi, rcx
+    mov esi, edx
+    mov edx, r8d
+    call %1
+    pop rdi
+    pop rsi
+    add rsp, 8
+    ret
+%endmacro
+
 %macro DC_ASM_SingleIntSinglePointerArgFunc 1
 DC_ASM_FunctionWrapper %1
 DC_ASM_FunctionWin64(%1):
@@ -77,48 +119,150 @@ DC_ASM_FunctionWin64(%1):
     ret
 %endmacro
 
-DC_ASM_SingleIntSingleFloatArgFunc DC_ASM_WriteImmediate
+DC_ASM_FloatIndexArgFunc DC_ASM_WriteImmediate
 DC_ASM_SingleIntSinglePointerArgFunc DC_ASM_WriteJMP
-DC_ASM_SingleIntSingleShortArgFunc DC_ASM_WritePushArg
+DC_ASM_ShortIndexArgFunc DC_ASM_WritePushArg
+DC_ASM_ShortIndexArgFunc DC_ASM_WriteStoreArg
 
 DC_ASM_SingleIntArgFunc DC_ASM_WritePop
 DC_ASM_SingleIntArgFunc DC_ASM_WriteRet
 
-DC_ASM_SingleIntArgFunc DC_ASM_WriteAdd
-DC_ASM_SingleIntArgFunc DC_ASM_WriteSub
-DC_ASM_SingleIntArgFunc DC_ASM_WriteMul
-DC_ASM_SingleIntArgFunc DC_ASM_WriteDiv
+DC_ASM_IndexArgFunc DC_ASM_WriteAdd
+DC_ASM_IndexArgFunc DC_ASM_WriteSub
+DC_ASM_IndexArgFunc DC_ASM_WriteMul
+DC_ASM_IndexArgFunc DC_ASM_WriteDiv
+DC_ASM_IndexArgFunc DC_ASM_WriteMin
+DC_ASM_IndexArgFunc DC_ASM_WriteMax
+DC_ASM_IndexArgFunc DC_ASM_WriteAnd
 
-DC_ASM_SingleIntArgFunc DC_ASM_WriteSin
-DC_ASM_SingleIntArgFunc DC_ASM_WriteCos
-DC_ASM_SingleIntArgFunc DC_ASM_WriteSqrt
+DC_ASM_IndexArgFunc DC_ASM_WriteSin
+DC_ASM_IndexArgFunc DC_ASM_WriteCos
+DC_ASM_IndexArgFunc DC_ASM_WriteSqrt
+DC_ASM_IndexArgFunc DC_ASM_WritePolySin
+DC_ASM_IndexArgFunc DC_ASM_WritePolyCos
+DC_ASM_IndexArgFunc DC_ASM_WriteFloor
+DC_ASM_IntIndexArgFunc DC_ASM_WriteX87
+DC_ASM_SingleIntArgFunc DC_ASM_CanRound
+DC_ASM_IntIndexArgFunc DC_ASM_WriteCompare
+DC_ASM_IndexArgFunc DC_ASM_WriteSelect
 
-DC_ASM_SingleIntSingleShortArgFunc DC_ASM_WriteAddArg
-DC_ASM_SingleIntSingleShortArgFunc DC_ASM_WriteSubArg
-DC_ASM_SingleIntSingleShortArgFunc DC_ASM_WriteMulArg
-DC_ASM_SingleIntSingleShortArgFunc DC_ASM_WriteDivArg
+DC_ASM_ShortIndexArgFunc DC_ASM_WriteAddArg
+DC_ASM_ShortIndexArgFunc DC_ASM_WriteSubArg
+DC_ASM_ShortIndexArgFunc DC_ASM_WriteMulArg
+DC_ASM_ShortIndexArgFunc DC_ASM_WriteDivArg
 
-DC_ASM_SingleIntSingleShortArgFunc DC_ASM_WriteSinArg
-DC_ASM_SingleIntSingleShortArgFunc DC_ASM_WriteCosArg
-DC_ASM_SingleIntSingleShortArgFunc DC_ASM_WriteSqrtArg
+DC_ASM_ShortIndexArgFunc DC_ASM_WriteSinArg
+DC_ASM_ShortIndexArgFunc DC_ASM_WriteCosArg
+DC_ASM_ShortIndexArgFunc DC_ASM_WriteSqrtArg
 
-DC_ASM_SingleIntSingleFloatArgFunc DC_ASM_WriteAddImm
-DC_ASM_SingleIntSingleFloatArgFunc DC_ASM_WriteSubImm
-DC_ASM_SingleIntSingleFloatArgFunc DC_ASM_WriteMulImm
-DC_ASM_SingleIntSingleFloatArgFunc DC_ASM_WriteDivImm
+DC_ASM_FloatIndexArgFunc DC_ASM_WriteAddImm
+DC_ASM_FloatIndexArgFunc DC_ASM_WriteSubImm
+DC_ASM_FloatIndexArgFunc DC_ASM_WriteMulImm
+DC_ASM_FloatIndexArgFunc DC_ASM_WriteDivImm
 
-extern DC_ASM_Calculate
-global DC_ASM_Calculate_Win64
-DC_ASM_Calculate_Win64:
-    sub rsp, 8
-    push rsi
-    push rdi
+DC_ASM_IntIndexArgFunc DC_ASM_WriteSpill
+DC_ASM_IntIndexArgFunc DC_ASM_WriteReload
+DC_ASM_IndexArgFunc DC_ASM_WriteDup
+
+DC_ASM_ShortIndexArgFunc DC_ASM_WritePackedPushArg
+DC_ASM_FloatIndexArgFunc DC_ASM_WritePackedImmediate
+DC_ASM_IndexArgFunc DC_ASM_WritePackedAdd
+DC_ASM_IndexArgFunc DC_ASM_WritePackedSub
+DC_ASM_IndexArgFunc DC_ASM_WritePackedMul
+DC_ASM_IndexArgFunc DC_ASM_WritePackedDiv
+DC_ASM_IndexArgFunc DC_ASM_WritePackedMin
+DC_ASM_IndexArgFunc DC_ASM_WritePackedMax
+DC_ASM_IndexArgFunc DC_ASM_WritePackedSqrt
+DC_ASM_IndexArgFunc DC_ASM_WritePackedFloor
+DC_ASM_IntIndexArgFunc DC_ASM_WritePackedCompare
+DC_ASM_IndexArgFunc DC_ASM_WritePackedSelect
+DC_ASM_IndexArgFunc DC_ASM_WritePackedPolySin
+DC_ASM_IndexArgFunc DC_ASM_WritePackedPolyCos
+DC_ASM_IntIndexArgFunc DC_ASM_WritePackedSpill
+DC_ASM_IntIndexArgFunc DC_ASM_WritePackedReload
+
+DC_ASM_ShortIndexArgFunc DC_ASM_WriteDoublePushArg
+DC_ASM_ShortIndexArgFunc DC_ASM_WriteDoubleStoreArg
+DC_ASM_FloatIndexArgFunc DC_ASM_WriteDoubleImmediate
+DC_ASM_IndexArgFunc DC_ASM_WriteDoubleAdd
+DC_ASM_IndexArgFunc DC_ASM_WriteDoubleSub
+DC_ASM_IndexArgFunc DC_ASM_WriteDoubleMul
+DC_ASM_IndexArgFunc DC_ASM_WriteDoubleDiv
+DC_ASM_IndexArgFunc DC_ASM_WriteDoubleMin
+DC_ASM_IndexArgFunc DC_ASM_WriteDoubleMax
+DC_ASM_IndexArgFunc DC_ASM_WriteDoubleFloor
+DC_ASM_IndexArgFunc DC_ASM_WriteDoubleSqrt
+DC_ASM_IndexArgFunc DC_ASM_WriteDoubleSin
+DC_ASM_IndexArgFunc DC_ASM_WriteDoubleCos
+DC_ASM_IntIndexArgFunc DC_ASM_WriteDoubleX87
+DC_ASM_IntIndexArgFunc DC_ASM_WriteDoubleCompare
+DC_ASM_IndexArgFunc DC_ASM_WriteDoubleSelect
+DC_ASM_IntIndexArgFunc DC_ASM_WriteDoubleSpill
+DC_ASM_IntIndexArgFunc DC_ASM_WriteDoubleReload
+
+; The frame size is passed the same way as a stack depth.
+DC_ASM_IndexArgFunc DC_ASM_WriteEnterFrame
+DC_ASM_IndexArgFunc DC_ASM_WriteLeaveFrame
+
+; xmm6 and xmm7 are nonvolatile in Win64, but the generated code uses them as
+; temporaries for the polynomial sin/cos.
+%macro DC_ASM_CalculateFunc 1
+DC_ASM_FunctionWrapper %1
+DC_ASM_FunctionWin64(%1):
+    sub rsp, 56
+    mov [rsp], rsi
+    mov [rsp+8], rdi
+    movaps [rsp+16], xmm6
+    movaps [rsp+32], xmm7
     mov rdi, rcx
     mov rsi, rdx
     mov rdx, r8
-    call DC_ASM_Calculate
-    pop rdi
-    pop rsi
-    add rsp, 8
+    call %1
+    mov rsi, [rsp]
+    mov rdi, [rsp+8]
+    movaps xmm6, [rsp+16]
+    movaps xmm7, [rsp+32]
+    add rsp, 56
     ret
+%endmacro
+
+DC_ASM_CalculateFunc DC_ASM_Calculate
+DC_ASM_CalculateFunc DC_ASM_CalculatePacked
+DC_ASM_CalculateFunc DC_ASM_CalculateDouble
 
+; The native entry point has to follow Win64 itself, so this is a separate
+; encoder rather than a wrapper.
+; unsigned DC_ASM_WriteNativeEntry_Win64(void *dest);
+global DC_ASM_WriteNativeEntry_Win64
+DC_ASM_WriteNativeEntry_Win64:
+    mov [rsp+8], rsi
+    mov [rsp+16], rdi
+    mov rdi, rcx
+    mov rsi, QWORD dc_asm_native_entry
+    mov ecx, dc_asm_native_entry_size
+    mov eax, ecx
+    rep movsb
+    mov rsi, [rsp+8]
+    mov rdi, [rsp+16]
+    ret
+
+section .data
+
+    ; Template for DC_ASM_WriteNativeEntry_Win64. The call is relative, so this
+    ; calls the code immediately following wherever the template is copied.
+    ; This keeps the same scratch memory layout as DC_ASM_Calculate.
+dc_asm_native_entry:
+    sub rsp, 56
+    mov [rsp], rsi
+    movaps [rsp+16], xmm6
+    movaps [rsp+32], xmm7
+    mov rsi, rcx
+    lea rax, [rsp-24]
+    call dc_asm_native_entry_end
+    mov rsi, [rsp]
+    movaps xmm6, [rsp+16]
+    movaps xmm7, [rsp+32]
+    add rsp, 56
+    ret
+dc_asm_native_entry_end:
+dc_asm_native_entry_size equ $ - dc_asm_native_entry
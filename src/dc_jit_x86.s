@@ -3,6 +3,12 @@
 ; This Source Code Form is subject to the terms of the Mozilla Public
 ; License, v. 2.0. If a copy of the MPL was not distributed with this
 ; file, You can obtain one at http://mozilla.org/MPL/2.0/.
+;
+; The encoders keep no state of their own. Each one receives the current
+; depth of the calculation's value stack (the XMM register that the next push
+; would use) as its last argument, and the builder in dc_jit.c tracks how each
+; operation changes the depth. This lets different builders generate code on
+; different threads at the same time.
 
 section .text
 bits 32
@@ -14,6 +20,10 @@ global DC_ASM_push_arg_size
 global DC_ASM_WritePushArg
 global _DC_ASM_WritePushArg
 
+global DC_ASM_store_arg_size
+global DC_ASM_WriteStoreArg
+global _DC_ASM_WriteStoreArg
+
 global DC_ASM_immediate_size
 global DC_ASM_WriteImmediate
 global _DC_ASM_WriteImmediate
@@ -42,6 +52,56 @@ global DC_ASM_cos_size
 global DC_ASM_WriteCos
 global _DC_ASM_WriteCos
 
+global DC_ASM_min_size
+global DC_ASM_WriteMin
+global _DC_ASM_WriteMin
+global DC_ASM_WriteMax
+global _DC_ASM_WriteMax
+
+global DC_ASM_and_size
+global DC_ASM_WriteAnd
+global _DC_ASM_WriteAnd
+
+global DC_ASM_floor_size
+global DC_ASM_WriteFloor
+global _DC_ASM_WriteFloor
+global DC_ASM_WritePackedFloor
+global _DC_ASM_WritePackedFloor
+global DC_ASM_WriteDoubleFloor
+global _DC_ASM_WriteDoubleFloor
+global DC_ASM_CanRound
+global _DC_ASM_CanRound
+
+global DC_ASM_x87_size
+global DC_ASM_WriteX87
+global _DC_ASM_WriteX87
+global DC_ASM_WriteDoubleX87
+global _DC_ASM_WriteDoubleX87
+
+global DC_ASM_compare_size
+global DC_ASM_WriteCompare
+global _DC_ASM_WriteCompare
+global DC_ASM_WritePackedCompare
+global _DC_ASM_WritePackedCompare
+global DC_ASM_WriteDoubleCompare
+global _DC_ASM_WriteDoubleCompare
+
+global DC_ASM_select_size
+global DC_ASM_WriteSelect
+global _DC_ASM_WriteSelect
+global DC_ASM_WritePackedSelect
+global _DC_ASM_WritePackedSelect
+global DC_ASM_WriteDoubleSelect
+global _DC_ASM_WriteDoubleSelect
+
+global DC_ASM_poly_sin_size
+global DC_ASM_WritePolySin
+global _DC_ASM_WritePolySin
+
+global DC_ASM_poly_cos_size
+global DC_ASM_WritePolyCos
+global _DC_ASM_WritePolyCos
+
 global DC_ASM_sqrt_size
 global DC_ASM_WriteSqrt
 global _DC_ASM_WriteSqrt
@@ -98,8 +158,111 @@ global DC_ASM_ret_size
 global DC_ASM_WriteRet
 global _DC_ASM_WriteRet
 
+global DC_ASM_spill_size
+global DC_ASM_WriteSpill
+global _DC_ASM_WriteSpill
+
+global DC_ASM_reload_size
+global DC_ASM_WriteReload
+global _DC_ASM_WriteReload
+
+global DC_ASM_dup_size
+global DC_ASM_WriteDup
+global _DC_ASM_WriteDup
+
+global DC_ASM_frame_size
+global DC_ASM_WriteEnterFrame
+global _DC_ASM_WriteEnterFrame
+global DC_ASM_WriteLeaveFrame
+global _DC_ASM_WriteLeaveFrame
+
+global DC_ASM_WriteNativeEntry
+global _DC_ASM_WriteNativeEntry
+
+global DC_ASM_packed_push_arg_size
+global DC_ASM_WritePackedPushArg
+global _DC_ASM_WritePackedPushArg
+
+global DC_ASM_packed_immediate_size
+global DC_ASM_WritePackedImmediate
+global _DC_ASM_WritePackedImmediate
+
+global DC_ASM_packed_arithmetic_size
+global DC_ASM_WritePackedAdd
+global _DC_ASM_WritePackedAdd
+global DC_ASM_WritePackedSub
+global _DC_ASM_WritePackedSub
+global DC_ASM_WritePackedMul
+global _DC_ASM_WritePackedMul
+global DC_ASM_WritePackedDiv
+global _DC_ASM_WritePackedDiv
+global DC_ASM_WritePackedMin
+global _DC_ASM_WritePackedMin
+global DC_ASM_WritePackedMax
+global _DC_ASM_WritePackedMax
+global DC_ASM_WritePackedSqrt
+global _DC_ASM_WritePackedSqrt
+
+global DC_ASM_packed_poly_sin_size
+global DC_ASM_WritePackedPolySin
+global _DC_ASM_WritePackedPolySin
+
+global DC_ASM_packed_poly_cos_size
+global DC_ASM_WritePackedPolyCos
+global _DC_ASM_WritePackedPolyCos
+
+global DC_ASM_packed_spill_size
+global DC_ASM_WritePackedSpill
+global _DC_ASM_WritePackedSpill
+global DC_ASM_WritePackedReload
+global _DC_ASM_WritePackedReload
+
+global DC_ASM_double_push_arg_size
+global DC_ASM_WriteDoublePushArg
+global _DC_ASM_WriteDoublePushArg
+
+global DC_ASM_double_store_arg_size
+global DC_ASM_WriteDoubleStoreArg
+global _DC_ASM_WriteDoubleStoreArg
+
+global DC_ASM_double_immediate_size
+global DC_ASM_WriteDoubleImmediate
+global _DC_ASM_WriteDoubleImmediate
+
+global DC_ASM_double_arithmetic_size
+global DC_ASM_WriteDoubleAdd
+global _DC_ASM_WriteDoubleAdd
+global DC_ASM_WriteDoubleSub
+global _DC_ASM_WriteDoubleSub
+global DC_ASM_WriteDoubleMul
+global _DC_ASM_WriteDoubleMul
+global DC_ASM_WriteDoubleDiv
+global _DC_ASM_WriteDoubleDiv
+global DC_ASM_WriteDoubleMin
+global _DC_ASM_WriteDoubleMin
+global DC_ASM_WriteDoubleMax
+global _DC_ASM_WriteDoubleMax
+global DC_ASM_WriteDoubleSqrt
+global _DC_ASM_WriteDoubleSqrt
+
+global DC_ASM_double_trig_size
+global DC_ASM_WriteDoubleSin
+global _DC_ASM_WriteDoubleSin
+global DC_ASM_WriteDoubleCos
+global _DC_ASM_WriteDoubleCos
+
+global DC_ASM_double_spill_size
+global DC_ASM_WriteDoubleSpill
+global _DC_ASM_WriteDoubleSpill
+global DC_ASM_WriteDoubleReload
+global _DC_ASM_WriteDoubleReload
+
 global DC_ASM_Calculate
 global _DC_ASM_Calculate
+global DC_ASM_CalculatePacked
+global _DC_ASM_CalculatePacked
+global DC_ASM_CalculateDouble
+global _DC_ASM_CalculateDouble
 
 ; void DC_ASM_WriteJMP(void *asm_dest, void *jmp_dest);
 DC_ASM_WriteJMP:
@@ -112,49 +275,66 @@ _DC_ASM_WriteJMP:
     mov eax, 6
     ret
 
-; void DC_ASM_WritePushArg(void *dest, unsigned short arg_num);
-
+; unsigned DC_ASM_WritePushArg(void *dest, unsigned short arg_num,
+;     unsigned index);
 DC_ASM_WritePushArg:
 _DC_ASM_WritePushArg:
-    mov eax, [esp+4] ; get the dest
-; Write the 0xF3 0x0F 0x10 prefix that all push ops use.
-    mov [eax+0], BYTE 0xF3
-    mov [eax+1], BYTE 0x0F
+    ; Write:
+    ; movss XMM, [edx+N]
+    ; Or:
+    ; movss XMM, [edx]
+    ; Where XMM is XMM(index)
+    mov eax, [esp+4]
+    movzx ecx, WORD [esp+8]
+    mov edx, [esp+12]
+    mov [eax], WORD 0x0FF3
     mov [eax+2], BYTE 0x10
-    
-; Get the current stack depth
-    mov edx, dc_asm_index
-    mov ecx, [edx]
-    inc DWORD [edx]
-
-; TODO: Check if we have overflowed into the CPU stack.
-
-; Translate the stack depth into the XMM register encoding
-    rol cx, 3
-
-; Add 2 to ecx. This forms the opcode movss, xmm, [edx+IMM] or movss xmm, [edx]
-    or cl, 2
+    lea edx, [(edx * 8) + 2]
+    ; FALLTHROUGH
 
-; Get the arg number
-    xor edx, edx
-    or dx, [esp+8]
+; The opcode is written, dl has the ModRM for [edx], and ecx has the argument
+; number.
+dc_asm_write_arg_operand:
+    shl ecx, 2
     jz push_zero
-    
-; TODO: Check for larger arg numbers
-    
-; Change arg number into an offset
-    shl edx, 2
-    
-    or ecx, 0x40
-    mov [eax+3], cl
-    mov [eax+4], dl
+    cmp ecx, 0x80
+    jae push_far
+    add dl, 0x40
+    mov [eax+3], dl
+    mov [eax+4], cl
     mov eax, 5
     ret
+
+push_far:
+    ; Use [edx+disp32] instead
+    add dl, 0x80
+    mov [eax+3], dl
+    mov [eax+4], ecx
+    mov eax, 8
+    ret
+
 push_zero:
-    mov [eax+3], ecx
+    mov [eax+3], dl
     mov eax, 4
     ret
 
+; unsigned DCJIT_CDECL DC_ASM_WriteStoreArg(void *dest, unsigned short arg_num,
+;     unsigned index);
+DC_ASM_WriteStoreArg:
+_DC_ASM_WriteStoreArg:
+    ; Write:
+    ; movss [edx+N], XMM
+    ; Or:
+    ; movss [edx], XMM
+    ; Where XMM is XMM(index-1)
+    mov eax, [esp+4]
+    movzx ecx, WORD [esp+8]
+    mov edx, [esp+12]
+    mov [eax], WORD 0x0FF3
+    mov [eax+2], BYTE 0x11
+    lea edx, [(edx * 8) - 6]
+    jmp dc_asm_write_arg_operand
+
 dc_asm_immediate_zero:
     ; Write:
     ; xor eax, eax
@@ -184,15 +364,13 @@ dc_asm_immediate_one:
     mov eax, 12
     ret
 
-; unsigned DC_ASM_WriteImmediate(void *dest, float value);
+; unsigned DC_ASM_WriteImmediate(void *dest, float value, unsigned index);
 DC_ASM_WriteImmediate:
 _DC_ASM_WriteImmediate:
     mov eax, [esp+4] ; Get the dest
     
     ; Get the current stack depth
-    mov edx, dc_asm_index
-    mov ecx, [edx]
-    inc DWORD [edx]
+    mov ecx, [esp+12]
     
     mov edx, [esp+8] ; Get the immediate.
     
@@ -221,39 +399,53 @@ _DC_ASM_WriteImmediate:
     mov eax, 14
     ret
 
-; unsigned DCJIT_CDECL DC_ASM_WriteSqrt(void *dest);
+; unsigned DCJIT_CDECL DC_ASM_WriteSqrt(void *dest, unsigned index);
 ; Since this does not change the stack pointer, it can't be folded with the
 ; other arithmetic ops
 DC_ASM_WriteSqrt:
 _DC_ASM_WriteSqrt:
-    mov ecx, 0xF30F5101
-    mov eax, [dc_asm_index]
-    xor cl, [dc_asm_arithmetic_codes + eax - 1]
+    ; Write:
+    ; sqrtss XMM, XMM
+    ; Where XMM is XMM(index-1), so the ModRM is 0xC0 + (9 * (index-1))
+    mov eax, [esp+8]
+    lea ecx, [(eax * 8) + eax + 0xF30F51B7]
     bswap ecx
     mov edx, [esp+4]
     mov [edx], ecx
     mov eax, 4
     ret
 
-; unsigned DCJIT_CDECL DC_ASM_WriteAdd(void *dest);
+; unsigned DCJIT_CDECL DC_ASM_WriteAdd(void *dest, unsigned index);
 DC_ASM_WriteAdd:
 _DC_ASM_WriteAdd:
     mov ecx, 0xF30F5800
     jmp dc_asm_write_arithmetic
     
-; unsigned DCJIT_CDECL DC_ASM_WriteSub(void *dest);
+; unsigned DCJIT_CDECL DC_ASM_WriteSub(void *dest, unsigned index);
 DC_ASM_WriteSub:
 _DC_ASM_WriteSub:
     mov ecx, 0xF30F5C00
     jmp dc_asm_write_arithmetic
 
-; unsigned DCJIT_CDECL DC_ASM_WriteDiv(void *dest);
+; unsigned DCJIT_CDECL DC_ASM_WriteDiv(void *dest, unsigned index);
 DC_ASM_WriteDiv:
 _DC_ASM_WriteDiv:
     mov ecx, 0xF30F5E00
     jmp dc_asm_write_arithmetic
 
-; unsigned DCJIT_CDECL DC_ASM_WriteMul(void *dest);
+; unsigned DCJIT_CDECL DC_ASM_WriteMin(void *dest, unsigned index);
+DC_ASM_WriteMin:
+_DC_ASM_WriteMin:
+    mov ecx, 0xF30F5D00
+    jmp dc_asm_write_arithmetic
+
+; unsigned DCJIT_CDECL DC_ASM_WriteMax(void *dest, unsigned index);
+DC_ASM_WriteMax:
+_DC_ASM_WriteMax:
+    mov ecx, 0xF30F5F00
+    jmp dc_asm_write_arithmetic
+
+; unsigned DCJIT_CDECL DC_ASM_WriteMul(void *dest, unsigned index);
 ; Mul is last, since it's the most likely and we can avoid a jmp.
 DC_ASM_WriteMul:
 _DC_ASM_WriteMul:
@@ -261,63 +453,44 @@ _DC_ASM_WriteMul:
     ; jmp dc_asm_write_arithmetic
 
 dc_asm_write_arithmetic:
-    mov eax, [dc_asm_index]
-    dec eax
-    xor cl, [dc_asm_arithmetic_codes + eax - 1]
-    mov [dc_asm_index], eax
+    ; The operands are XMM(index-2) and XMM(index-1)
+    mov eax, [esp+8]
+    xor cl, [dc_asm_arithmetic_codes + eax - 2]
     bswap ecx
     mov edx, [esp+4]
     mov [edx], ecx
     mov eax, 4
     ret
 
-; unsigned DC_ASM_WritePop(void *dest, unsigned short arg_num);
+; unsigned DC_ASM_WritePop(void *dest);
 DC_ASM_WritePop:
 _DC_ASM_WritePop:
-; TODO: Check if we have overflowed into the CPU stack.
-    mov eax, [dc_asm_index]
-    dec eax
-    mov [dc_asm_index], eax
+    ; Popping only changes the depth, which is tracked by the builder.
     xor eax, eax
     ret
     
-DC_ASM_WriteCosArg:
-_DC_ASM_WriteCosArg:
-    call _DC_ASM_WritePushArg
-    ; FALLTHROUGH
-; unsigned DCJIT_CDECL DC_ASM_WriteCos(void *dest);
+; unsigned DCJIT_CDECL DC_ASM_WriteCos(void *dest, unsigned index);
 DC_ASM_WriteCos:
 _DC_ASM_WriteCos:
-    push 0xFF
+    mov edx, 0xFF
     jmp dc_asm_trig_func
 
-DC_ASM_WriteSinArg:
-_DC_ASM_WriteSinArg:
-    call _DC_ASM_WritePushArg
-    ; FALLTHROUGH
-; unsigned DCJIT_CDECL DC_ASM_WriteSin(void *dest);
+; unsigned DCJIT_CDECL DC_ASM_WriteSin(void *dest, unsigned index);
 DC_ASM_WriteSin:
 _DC_ASM_WriteSin:
-    push 0xFE
+    mov edx, 0xFE
     ; dc_asm_trig_func
 
 dc_asm_trig_func:
-    ; Check for SSE2, and use double-precision trig functions if the better
-    ; conversions functions are available.
-    push ebx
-    xor eax, eax
-    inc eax
-    cpuid
-    pop ebx
-    mov eax, [esp+8]
-    mov ecx, [dc_asm_index]
+    ; Operates on XMM(index-1)
+    mov eax, [esp+4]
+    mov ecx, [esp+8]
     dec ecx
-    bt edx, 26
-    jnc dc_asm_x87_trig
-    jmp dc_asm_x87_trig
-dc_asm_sse2_trig:
-    ret
-    
+    ; FALLTHROUGH
+
+; eax has the destination
+; ecx has the XMM register to operate on
+; edx has the sin/cos byte
 dc_asm_x87_trig:
     ; It's slightly more efficient to move the value of esp into eax, since we
     ; dereference the value so much.
@@ -332,7 +505,6 @@ dc_asm_x87_trig:
     lea ecx, [(ecx * 8) + 0xF30F1100]
     bswap ecx
     mov [eax+4], ecx ; movss [eax], XMM
-    pop edx ; Get the sin/cos byte
     shl edx, 24
     or edx, 0x00D900D9
     mov [eax+8], edx ; fld (DWORD) [eax], f(cos|sin)
@@ -344,34 +516,108 @@ dc_asm_x87_trig:
     mov eax, 18
     ret
 
+; unsigned DCJIT_CDECL DC_ASM_WritePolySin(void *dest, unsigned index);
+DC_ASM_WritePolySin:
+_DC_ASM_WritePolySin:
+    mov edx, dc_asm_poly_sin
+    jmp dc_asm_write_poly_trig
+
+; unsigned DCJIT_CDECL DC_ASM_WritePolyCos(void *dest, unsigned index);
+DC_ASM_WritePolyCos:
+_DC_ASM_WritePolyCos:
+    mov edx, dc_asm_poly_cos
+    ; FALLTHROUGH
+
+; edx points to the template's descriptor, which holds the address and size
+; of its head and tail, and the address of its constants.
+dc_asm_write_poly_trig:
+    ; Write:
+    ; mov ecx, CONSTANTS
+    ; movaps xmm5, XMM (unless XMM is xmm5)
+    ; <head>
+    ; <tail>
+    ; movaps XMM, xmm5 (unless XMM is xmm5)
+    ; Where XMM is XMM(index-1)
+    push esi
+    push edi
+    mov edi, [esp+12]
+    mov eax, [esp+16]
+    dec eax
+    push eax
+    mov [edi], BYTE 0xB9
+    mov ecx, [edx+16]
+    mov [edi+1], ecx
+    add edi, 5
+    cmp eax, 5
+    je dc_asm_poly_trig_no_load
+    add eax, 0xE8
+    mov [edi], WORD 0x280F
+    mov [edi+2], al
+    add edi, 3
+dc_asm_poly_trig_no_load:
+    mov esi, [edx]
+    mov ecx, [edx+4]
+    rep movsb
+    mov esi, [edx+8]
+    mov ecx, [edx+12]
+    rep movsb
+    pop eax
+    cmp eax, 5
+    je dc_asm_poly_trig_no_store
+    lea eax, [(eax * 8) + 0xC5]
+    mov [edi], WORD 0x280F
+    mov [edi+2], al
+    add edi, 3
+dc_asm_poly_trig_no_store:
+    mov eax, edi
+    sub eax, [esp+12]
+    pop edi
+    pop esi
+    ret
+
+; unsigned DCJIT_CDECL DC_ASM_WriteCosArg(void *dest, unsigned short arg,
+;     unsigned index);
+DC_ASM_WriteCosArg:
+_DC_ASM_WriteCosArg:
+    mov edx, 0xFF
+    jmp dc_asm_write_trig_arg
+
+; unsigned DCJIT_CDECL DC_ASM_WriteSinArg(void *dest, unsigned short arg,
+;     unsigned index);
+DC_ASM_WriteSinArg:
+_DC_ASM_WriteSinArg:
+    mov edx, 0xFE
+    ; jmp dc_asm_write_trig_arg
+
+dc_asm_write_trig_arg:
+    ; Push the argument into XMM(index), then operate on it.
+    push edx
+    ; Each push moves the next argument to [esp+16]
+    push DWORD [esp+16] ; index
+    push DWORD [esp+16] ; arg
+    push DWORD [esp+16] ; dest
+    call _DC_ASM_WritePushArg
+    pop ecx ; dest
+    mov [esp], eax ; Keep the length of the push where the arg was
+    add eax, ecx
+    mov ecx, [esp+4] ; index
+    mov edx, [esp+8] ; sin/cos byte
+    call dc_asm_x87_trig
+    pop edx
+    add esp, 8
+    add eax, edx
+    ret
+
+; unsigned DCJIT_CDECL DC_ASM_WriteSqrtArg(void *dest, unsigned short arg,
+;     unsigned index);
 DC_ASM_WriteSqrtArg:
 _DC_ASM_WriteSqrtArg:
-    mov eax, dc_asm_index
-    mov ecx, [eax]
-    inc DWORD [eax]
+    ; Writes to XMM(index)
+    mov ecx, [esp+12]
     ; Get the XMM register
-    mov edx, [ecx+dc_asm_unary_codes]
-    
-    ; Get the destination
-    mov eax, [esp+4]
-    ; Get the arg number
-    mov ecx, [esp+8]
-    cmp ecx, 0
-    jnz dc_sqrt_nonzero_argument_index
+    movzx edx, BYTE [ecx+dc_asm_unary_codes]
     or edx, 0xF30F5100
-    bswap edx
-    mov [eax], edx
-    mov eax, 4
-    ret
-
-dc_sqrt_nonzero_argument_index:
-    or edx, 0xF30F5140
-    bswap edx
-    mov [eax], edx
-    rol cx, 2
-    mov [eax+4], cx
-    mov eax, 5
-    ret
+    jmp dc_asm_write_arg_operand
 
 DC_ASM_WriteAddArg:
 _DC_ASM_WriteAddArg:
@@ -395,22 +641,27 @@ _DC_ASM_WriteMulArg:
     ; jmp dc_asm_write_arg_arithmetic
 
 dc_asm_write_arg_arithmetic:
-    ; Get the current stack
-    mov eax, dc_asm_index
-    mov eax, [eax]
-    ; Get the XMM register
+    ; Get the current stack depth
+    mov eax, [esp+12]
+    ; Get the XMM register, which is XMM(index-1)
     mov cl, [eax+dc_asm_unary_codes-1]
     movzx edx, cx
     or edx, 0xF30F0000
-    
+    ; FALLTHROUGH
+
+; edx has the opcode and a ModRM for [edx], which is changed to use the
+; argument's offset.
+dc_asm_write_arg_operand:
     ; Get the destination
     mov eax, [esp+4]
     
     ; Get the arg number
-    mov ecx, [esp+8]
+    movzx ecx, WORD [esp+8]
     
-    shl cl, 2
-    jz dc_asm_write_zero_arg_arithmetic
+    shl ecx, 2
+    jz dc_asm_write_zero_arg_operand
+    cmp ecx, 0x80
+    jae dc_asm_write_far_arg_operand
     
     or dl, 0x40
     bswap edx
@@ -418,31 +669,45 @@ dc_asm_write_arg_arithmetic:
     mov [eax+4], cl
     mov eax, 5
     ret
-dc_asm_write_zero_arg_arithmetic:
+
+dc_asm_write_far_arg_operand:
+    ; Use [edx+disp32] instead
+    or dl, 0x80
+    bswap edx
+    mov [eax], edx
+    mov [eax+4], ecx
+    mov eax, 8
+    ret
+
+dc_asm_write_zero_arg_operand:
     bswap edx
     mov [eax], edx
     mov eax, 4
     ret
 
-; unsigned DCJIT_CDECL DC_ASM_WriteAddImm(void *dest, unsigned short arg);
+; unsigned DCJIT_CDECL DC_ASM_WriteAddImm(void *dest, float imm,
+;     unsigned index);
 DC_ASM_WriteAddImm:
 _DC_ASM_WriteAddImm:
     mov ecx, 0xF30F5800
     jmp dc_asm_write_imm_arithmetic
 
-; unsigned DCJIT_CDECL DC_ASM_WriteSubImm(void *dest, unsigned short arg);
+; unsigned DCJIT_CDECL DC_ASM_WriteSubImm(void *dest, float imm,
+;     unsigned index);
 DC_ASM_WriteSubImm:
 _DC_ASM_WriteSubImm:
     mov ecx, 0xF30F5C00
     jmp dc_asm_write_imm_arithmetic
 
-; unsigned DCJIT_CDECL DC_ASM_WriteDivImm(void *dest, unsigned short arg);
+; unsigned DCJIT_CDECL DC_ASM_WriteDivImm(void *dest, float imm,
+;     unsigned index);
 DC_ASM_WriteDivImm:
 _DC_ASM_WriteDivImm:
     mov ecx, 0xF30F5E00
     jmp dc_asm_write_imm_arithmetic
 
-; unsigned DCJIT_CDECL DC_ASM_WriteMulImm(void *dest, unsigned short arg);
+; unsigned DCJIT_CDECL DC_ASM_WriteMulImm(void *dest, float imm,
+;     unsigned index);
 DC_ASM_WriteMulImm:
 _DC_ASM_WriteMulImm:
     mov ecx, 0xF30F5900
@@ -461,8 +726,8 @@ dc_asm_write_imm_arithmetic:
     mov [eax], BYTE 0x68
     mov [eax+1], edx
     
-    ; Get the current stack
-    movzx edx, BYTE [dc_asm_index]
+    ; Get the current stack depth, to operate on XMM(index-1)
+    mov edx, [esp+12]
     lea edx, [((edx-1) * 8) + 4]
     mov cl, dl
     ; Get the XMM register
@@ -475,13 +740,774 @@ dc_asm_write_imm_arithmetic:
 ; unsigned DCJIT_CDECL DC_ASM_WriteRet(void *dest);
 DC_ASM_WriteRet:
 _DC_ASM_WriteRet:
-    dec DWORD [dc_asm_index]
     mov eax, [esp+4]
     mov [eax], BYTE 0xC3
     xor eax, eax
     inc eax
     ret
 
+; unsigned DCJIT_CDECL DC_ASM_WriteDup(void *dest, unsigned index);
+DC_ASM_WriteDup:
+_DC_ASM_WriteDup:
+    ; Write:
+    ; movaps XMM(index), XMM(index-1)
+    ; The ModRM is 0xC0 + (8 * index) + (index-1)
+    mov eax, [esp+4]
+    mov ecx, [esp+8]
+    lea ecx, [(ecx * 8) + ecx + 0xBF]
+    mov [eax], WORD 0x280F
+    mov [eax+2], cl
+    mov eax, 3
+    ret
+
+; unsigned DCJIT_CDECL DC_ASM_WriteSpill(void *dest, unsigned slot,
+;     unsigned index);
+DC_ASM_WriteSpill:
+_DC_ASM_WriteSpill:
+    ; Write:
+    ; movss [esp+N], XMM
+    ; Where XMM is XMM(index-1)
+    mov ecx, [esp+12]
+    lea eax, [(ecx * 8) + 0xF30F113C]
+    jmp dc_asm_write_stack_slot
+
+; unsigned DCJIT_CDECL DC_ASM_WriteReload(void *dest, unsigned slot,
+;     unsigned index);
+DC_ASM_WriteReload:
+_DC_ASM_WriteReload:
+    ; Write:
+    ; movss XMM, [esp+N]
+    ; Where XMM is XMM(index)
+    mov ecx, [esp+12]
+    lea eax, [(ecx * 8) + 0xF30F1044]
+    ; FALLTHROUGH
+
+; eax has the opcode and a ModRM for [esp+disp8], which is followed by the SIB
+; byte 0x24 and the displacement.
+dc_asm_write_stack_slot:
+    mov ecx, [esp+4]
+    mov edx, [esp+8]
+    shl edx, 2
+    ; FALLTHROUGH
+
+; The same, but ecx already has the destination and edx has the displacement.
+dc_asm_write_stack_offset:
+    cmp edx, 0x80
+    jae dc_asm_write_far_stack_slot
+    bswap eax
+    mov [ecx], eax
+    mov [ecx+4], BYTE 0x24
+    mov [ecx+5], dl
+    mov eax, 6
+    ret
+
+dc_asm_write_far_stack_slot:
+    ; Use [esp+disp32] instead
+    add eax, 0x40
+    bswap eax
+    mov [ecx], eax
+    mov [ecx+4], BYTE 0x24
+    mov [ecx+5], edx
+    mov eax, 9
+    ret
+
+; unsigned DCJIT_CDECL DC_ASM_WriteEnterFrame(void *dest, unsigned size);
+DC_ASM_WriteEnterFrame:
+_DC_ASM_WriteEnterFrame:
+    ; Write:
+    ; sub esp, N
+    mov dl, 0xEC
+    jmp dc_asm_write_frame
+
+; unsigned DCJIT_CDECL DC_ASM_WriteLeaveFrame(void *dest, unsigned size);
+DC_ASM_WriteLeaveFrame:
+_DC_ASM_WriteLeaveFrame:
+    ; Write:
+    ; add esp, N
+    mov dl, 0xC4
+    ; FALLTHROUGH
+
+dc_asm_write_frame:
+    mov eax, [esp+4]
+    mov ecx, [esp+8]
+    mov [eax+1], dl
+    cmp ecx, 0x80
+    jae dc_asm_write_far_frame
+    mov [eax], BYTE 0x83
+    mov [eax+2], cl
+    mov eax, 3
+    ret
+
+dc_asm_write_far_frame:
+    mov [eax], BYTE 0x81
+    mov [eax+2], ecx
+    mov eax, 6
+    ret
+
+; unsigned DCJIT_CDECL DC_ASM_WriteNativeEntry(void *dest);
+DC_ASM_WriteNativeEntry:
+_DC_ASM_WriteNativeEntry:
+    push esi
+    push edi
+    mov edi, [esp+12]
+    mov esi, dc_asm_native_entry
+    mov ecx, dc_asm_native_entry_size
+    mov eax, ecx
+    rep movsb
+    pop edi
+    pop esi
+    ret
+
+; The packed encoders write the same code as the scalar ones, but using the
+; *ps forms of the instructions so that each XMM register holds four lanes.
+; The arguments of the four lanes are grouped together, so argument N is at
+; [edx+(16*N)].
+
+; unsigned DCJIT_CDECL DC_ASM_WritePackedPushArg(void *dest,
+;     unsigned short arg_num, unsigned index);
+DC_ASM_WritePackedPushArg:
+_DC_ASM_WritePackedPushArg:
+    ; Write:
+    ; movups XMM, [edx+N]
+    ; Or:
+    ; movups XMM, [edx]
+    ; Where XMM is XMM(index)
+    mov eax, [esp+4]
+    movzx ecx, WORD [esp+8]
+    mov edx, [esp+12]
+    mov [eax], WORD 0x100F
+    lea edx, [(edx * 8) + 2]
+    shl ecx, 4
+    jz dc_asm_packed_push_zero_arg
+    cmp ecx, 0x80
+    jae dc_asm_packed_push_far_arg
+    add dl, 0x40
+    mov [eax+2], dl
+    mov [eax+3], cl
+    mov eax, 4
+    ret
+
+dc_asm_packed_push_far_arg:
+    add dl, 0x80
+    mov [eax+2], dl
+    mov [eax+3], ecx
+    mov eax, 7
+    ret
+
+dc_asm_packed_push_zero_arg:
+    mov [eax+2], dl
+    mov eax, 3
+    ret
+
+; unsigned DCJIT_CDECL DC_ASM_WritePackedImmediate(void *dest, float value,
+;     unsigned index);
+DC_ASM_WritePackedImmediate:
+_DC_ASM_WritePackedImmediate:
+    ; Write the same code as DC_ASM_WriteImmediate, then:
+    ; shufps XMM, XMM, 0
+    ; Where XMM is XMM(index)
+    push DWORD [esp+12]
+    push DWORD [esp+12]
+    push DWORD [esp+12]
+    call _DC_ASM_WriteImmediate
+    add esp, 12
+    mov edx, [esp+4]
+    mov ecx, [esp+12]
+    add edx, eax
+    lea ecx, [(ecx * 8) + ecx + 0xC0]
+    mov [edx], WORD 0xC60F
+    mov [edx+2], cl
+    mov [edx+3], BYTE 0
+    add eax, 4
+    ret
+
+; unsigned DCJIT_CDECL DC_ASM_WritePackedAdd(void *dest, unsigned index);
+DC_ASM_WritePackedAdd:
+_DC_ASM_WritePackedAdd:
+    mov cl, 0x58
+    jmp dc_asm_write_packed_arithmetic
+
+; unsigned DCJIT_CDECL DC_ASM_WritePackedSub(void *dest, unsigned index);
+DC_ASM_WritePackedSub:
+_DC_ASM_WritePackedSub:
+    mov cl, 0x5C
+    jmp dc_asm_write_packed_arithmetic
+
+; unsigned DCJIT_CDECL DC_ASM_WritePackedDiv(void *dest, unsigned index);
+DC_ASM_WritePackedDiv:
+_DC_ASM_WritePackedDiv:
+    mov cl, 0x5E
+    jmp dc_asm_write_packed_arithmetic
+
+; unsigned DCJIT_CDECL DC_ASM_WritePackedMin(void *dest, unsigned index);
+DC_ASM_WritePackedMin:
+_DC_ASM_WritePackedMin:
+    mov cl, 0x5D
+    jmp dc_asm_write_packed_arithmetic
+
+; unsigned DCJIT_CDECL DC_ASM_WritePackedMax(void *dest, unsigned index);
+DC_ASM_WritePackedMax:
+_DC_ASM_WritePackedMax:
+    mov cl, 0x5F
+    jmp dc_asm_write_packed_arithmetic
+
+; unsigned DCJIT_CDECL DC_ASM_WriteAnd(void *dest, unsigned index);
+DC_ASM_WriteAnd:
+_DC_ASM_WriteAnd:
+    ; Write:
+    ; andps XMM(index-2), XMM(index-1)
+    mov cl, 0x54
+    jmp dc_asm_write_packed_arithmetic
+
+; unsigned DCJIT_CDECL DC_ASM_WritePackedMul(void *dest, unsigned index);
+DC_ASM_WritePackedMul:
+_DC_ASM_WritePackedMul:
+    mov cl, 0x59
+    ; FALLTHROUGH
+
+dc_asm_write_packed_arithmetic:
+    ; The operands are XMM(index-2) and XMM(index-1)
+    mov eax, [esp+4]
+    mov edx, [esp+8]
+    movzx edx, BYTE [dc_asm_arithmetic_codes + edx - 2]
+    mov [eax], BYTE 0x0F
+    mov [eax+1], cl
+    mov [eax+2], dl
+    mov eax, 3
+    ret
+
+; unsigned DCJIT_CDECL DC_ASM_WritePackedSqrt(void *dest, unsigned index);
+DC_ASM_WritePackedSqrt:
+_DC_ASM_WritePackedSqrt:
+    ; Write:
+    ; sqrtps XMM, XMM
+    ; Where XMM is XMM(index-1)
+    mov eax, [esp+4]
+    mov ecx, [esp+8]
+    lea ecx, [(ecx * 8) + ecx + 0xB7]
+    mov [eax], WORD 0x510F
+    mov [eax+2], cl
+    mov eax, 3
+    ret
+
+; unsigned DCJIT_CDECL DC_ASM_WritePackedPolySin(void *dest, unsigned index);
+DC_ASM_WritePackedPolySin:
+_DC_ASM_WritePackedPolySin:
+    mov edx, dc_asm_packed_poly_sin
+    jmp dc_asm_write_poly_trig
+
+; unsigned DCJIT_CDECL DC_ASM_WritePackedPolyCos(void *dest, unsigned index);
+DC_ASM_WritePackedPolyCos:
+_DC_ASM_WritePackedPolyCos:
+    mov edx, dc_asm_packed_poly_cos
+    jmp dc_asm_write_poly_trig
+
+; unsigned DCJIT_CDECL DC_ASM_WritePackedSpill(void *dest, unsigned slot,
+;     unsigned index);
+DC_ASM_WritePackedSpill:
+_DC_ASM_WritePackedSpill:
+    ; Write:
+    ; movups [esp+N], XMM
+    ; Where XMM is XMM(index-1)
+    mov ecx, [esp+12]
+    lea eax, [(ecx * 8) + 0x3C]
+    mov dl, 0x11
+    jmp dc_asm_write_packed_stack_slot
+
+; unsigned DCJIT_CDECL DC_ASM_WritePackedReload(void *dest, unsigned slot,
+;     unsigned index);
+DC_ASM_WritePackedReload:
+_DC_ASM_WritePackedReload:
+    ; Write:
+    ; movups XMM, [esp+N]
+    ; Where XMM is XMM(index)
+    mov ecx, [esp+12]
+    lea eax, [(ecx * 8) + 0x44]
+    mov dl, 0x10
+    ; FALLTHROUGH
+
+; al has the ModRM for [esp+disp8] and dl has the opcode.
+dc_asm_write_packed_stack_slot:
+    mov ecx, [esp+4]
+    mov [ecx], BYTE 0x0F
+    mov [ecx+1], dl
+    mov [ecx+3], BYTE 0x24
+    mov edx, [esp+8]
+    shl edx, 4
+    cmp edx, 0x80
+    jae dc_asm_write_far_packed_stack_slot
+    mov [ecx+2], al
+    mov [ecx+4], dl
+    mov eax, 5
+    ret
+
+dc_asm_write_far_packed_stack_slot:
+    add al, 0x40
+    mov [ecx+2], al
+    mov [ecx+4], edx
+    mov eax, 8
+    ret
+
+; The double encoders write the same code as the scalar ones, but using the
+; *sd forms of the instructions. Arguments and spill slots are 8 bytes each.
+
+; unsigned DCJIT_CDECL DC_ASM_WriteDoublePushArg(void *dest,
+;     unsigned short arg_num, unsigned index);
+DC_ASM_WriteDoublePushArg:
+_DC_ASM_WriteDoublePushArg:
+    ; Write:
+    ; movsd XMM, [edx+N]
+    ; Or:
+    ; movsd XMM, [edx]
+    ; Where XMM is XMM(index)
+    mov eax, [esp+4]
+    movzx ecx, WORD [esp+8]
+    mov edx, [esp+12]
+    mov [eax], WORD 0x0FF2
+    mov [eax+2], BYTE 0x10
+    lea edx, [(edx * 8) + 2]
+    ; FALLTHROUGH
+
+; The opcode is written, dl has the ModRM for [edx], and ecx has the argument
+; number.
+dc_asm_write_double_arg_operand:
+    shl ecx, 3
+    jz dc_asm_double_push_zero_arg
+    cmp ecx, 0x80
+    jae dc_asm_double_push_far_arg
+    add dl, 0x40
+    mov [eax+3], dl
+    mov [eax+4], cl
+    mov eax, 5
+    ret
+
+dc_asm_double_push_far_arg:
+    add dl, 0x80
+    mov [eax+3], dl
+    mov [eax+4], ecx
+    mov eax, 8
+    ret
+
+dc_asm_double_push_zero_arg:
+    mov [eax+3], dl
+    mov eax, 4
+    ret
+
+; unsigned DCJIT_CDECL DC_ASM_WriteDoubleStoreArg(void *dest,
+;     unsigned short arg_num, unsigned index);
+DC_ASM_WriteDoubleStoreArg:
+_DC_ASM_WriteDoubleStoreArg:
+    ; Write:
+    ; movsd [edx+N], XMM
+    ; Or:
+    ; movsd [edx], XMM
+    ; Where XMM is XMM(index-1)
+    mov eax, [esp+4]
+    movzx ecx, WORD [esp+8]
+    mov edx, [esp+12]
+    mov [eax], WORD 0x0FF2
+    mov [eax+2], BYTE 0x11
+    lea edx, [(edx * 8) - 6]
+    jmp dc_asm_write_double_arg_operand
+
+; unsigned DCJIT_CDECL DC_ASM_WriteDoubleImmediate(void *dest, double value,
+;     unsigned index);
+DC_ASM_WriteDoubleImmediate:
+_DC_ASM_WriteDoubleImmediate:
+    ; Write:
+    ; mov DWORD [esp-8], LOW
+    ; mov DWORD [esp-4], HIGH
+    ; movsd XMM, [esp-8]
+    ; Or:
+    ; xorps XMM, XMM
+    ; Where XMM is XMM(index)
+    mov eax, [esp+4]
+    mov ecx, [esp+16]
+    mov edx, [esp+8]
+    or edx, [esp+12]
+    jz dc_asm_double_immediate_zero
+    mov edx, [esp+8]
+    mov [eax], DWORD 0xF82444C7
+    mov [eax+4], edx
+    mov edx, [esp+12]
+    mov [eax+8], DWORD 0xFC2444C7
+    mov [eax+12], edx
+    lea ecx, [(ecx * 8) + 0xF20F1044]
+    bswap ecx
+    mov [eax+16], ecx
+    mov [eax+20], WORD 0xF824
+    mov eax, 22
+    ret
+
+dc_asm_double_immediate_zero:
+    lea ecx, [(ecx * 8) + ecx + 0xC0]
+    mov [eax], WORD 0x570F
+    mov [eax+2], cl
+    mov eax, 3
+    ret
+
+; unsigned DCJIT_CDECL DC_ASM_WriteDoubleAdd(void *dest, unsigned index);
+DC_ASM_WriteDoubleAdd:
+_DC_ASM_WriteDoubleAdd:
+    mov ecx, 0xF20F5800
+    jmp dc_asm_write_arithmetic
+
+; unsigned DCJIT_CDECL DC_ASM_WriteDoubleSub(void *dest, unsigned index);
+DC_ASM_WriteDoubleSub:
+_DC_ASM_WriteDoubleSub:
+    mov ecx, 0xF20F5C00
+    jmp dc_asm_write_arithmetic
+
+; unsigned DCJIT_CDECL DC_ASM_WriteDoubleDiv(void *dest, unsigned index);
+DC_ASM_WriteDoubleDiv:
+_DC_ASM_WriteDoubleDiv:
+    mov ecx, 0xF20F5E00
+    jmp dc_asm_write_arithmetic
+
+; unsigned DCJIT_CDECL DC_ASM_WriteDoubleMul(void *dest, unsigned index);
+DC_ASM_WriteDoubleMul:
+_DC_ASM_WriteDoubleMul:
+    mov ecx, 0xF20F5900
+    jmp dc_asm_write_arithmetic
+
+; unsigned DCJIT_CDECL DC_ASM_WriteDoubleMin(void *dest, unsigned index);
+DC_ASM_WriteDoubleMin:
+_DC_ASM_WriteDoubleMin:
+    mov ecx, 0xF20F5D00
+    jmp dc_asm_write_arithmetic
+
+; unsigned DCJIT_CDECL DC_ASM_WriteDoubleMax(void *dest, unsigned index);
+DC_ASM_WriteDoubleMax:
+_DC_ASM_WriteDoubleMax:
+    mov ecx, 0xF20F5F00
+    jmp dc_asm_write_arithmetic
+
+; unsigned DCJIT_CDECL DC_ASM_WriteFloor(void *dest, unsigned index);
+DC_ASM_WriteFloor:
+_DC_ASM_WriteFloor:
+    mov cl, 0x0A
+    jmp dc_asm_write_round
+
+; unsigned DCJIT_CDECL DC_ASM_WritePackedFloor(void *dest, unsigned index);
+DC_ASM_WritePackedFloor:
+_DC_ASM_WritePackedFloor:
+    mov cl, 0x08
+    jmp dc_asm_write_round
+
+; unsigned DCJIT_CDECL DC_ASM_WriteDoubleFloor(void *dest, unsigned index);
+DC_ASM_WriteDoubleFloor:
+_DC_ASM_WriteDoubleFloor:
+    mov cl, 0x0B
+    ; FALLTHROUGH
+
+dc_asm_write_round:
+    ; Write:
+    ; roundss/roundps/roundsd XMM, XMM, 9
+    ; Where XMM is XMM(index-1). 9 rounds down without raising the inexact
+    ; exception.
+    mov eax, [esp+4]
+    mov edx, [esp+8]
+    mov [eax], DWORD 0x003A0F66
+    mov [eax+3], cl
+    lea edx, [(edx * 8) + edx + 0x09B7]
+    mov [eax+4], dx
+    mov eax, 6
+    ret
+
+; unsigned DCJIT_CDECL DC_ASM_CanRound(void);
+DC_ASM_CanRound:
+_DC_ASM_CanRound:
+    ; Check for SSE4.1, which has roundss
+    push ebx
+    mov eax, 1
+    cpuid
+    mov eax, ecx
+    shr eax, 19
+    and eax, 1
+    pop ebx
+    ret
+
+; unsigned DCJIT_CDECL DC_ASM_WriteX87(void *dest, unsigned func,
+;     unsigned index);
+DC_ASM_WriteX87:
+_DC_ASM_WriteX87:
+    mov ecx, 0xF3D9
+    jmp dc_asm_x87
+
+; unsigned DCJIT_CDECL DC_ASM_WriteDoubleX87(void *dest, unsigned func,
+;     unsigned index);
+DC_ASM_WriteDoubleX87:
+_DC_ASM_WriteDoubleX87:
+    mov ecx, 0xF2DD
+    ; FALLTHROUGH
+
+; cl has the x87 load/store opcode, and ch has the SSE move prefix.
+dc_asm_x87:
+    ; Write:
+    ; lea eax, [esp-8]
+    ; movss [eax], XMM(index-N)
+    ; fld DWORD [eax]
+    ; (the same for each of the N operands, up to XMM(index-1))
+    ; <the x87 code for func>
+    ; fstp DWORD [eax]
+    ; movss XMM(index-N), [eax]
+    ; Using movsd and QWORD for double precision. Both precisions use 8 bytes
+    ; of scratch space, since the floor code keeps the control word after
+    ; the value.
+    push ebx
+    push esi
+    push edi
+    mov edi, [esp+16]
+    mov eax, [esp+20]
+    mov esi, [dc_asm_x87_funcs + eax * 4]
+    mov edx, [esp+24]
+    movzx eax, BYTE [esi]
+    sub edx, eax
+    shl edx, 27
+    movzx ebx, ch
+    or ebx, 0x00110F00
+    or ebx, edx
+    mov edx, ebx
+    mov [edi], DWORD 0xF824448D ; lea eax, [esp-8]
+    add edi, 4
+
+dc_asm_x87_load:
+    mov [edi], ebx
+    mov [edi+4], cl
+    mov [edi+5], BYTE 0x00
+    add edi, 6
+    add ebx, 0x08000000
+    dec eax
+    jnz dc_asm_x87_load
+    
+    mov ebx, ecx
+    movzx ecx, BYTE [esi+1]
+    add esi, 2
+    rep movsb
+    mov [edi], bl
+    mov [edi+1], BYTE 0x18
+    ; Turn the first store into a load of the result
+    xor edx, 0x00010000
+    mov [edi+2], edx
+    lea eax, [edi+6]
+    sub eax, [esp+16]
+    pop edi
+    pop esi
+    pop ebx
+    ret
+
+; unsigned DCJIT_CDECL DC_ASM_WriteCompare(void *dest, unsigned predicate,
+;     unsigned index);
+DC_ASM_WriteCompare:
+_DC_ASM_WriteCompare:
+    mov ecx, dc_asm_select_constants + 16
+    mov dl, 0xF3
+    jmp dc_asm_write_compare
+
+; unsigned DCJIT_CDECL DC_ASM_WritePackedCompare(void *dest,
+;     unsigned predicate,
+;     unsigned index);
+DC_ASM_WritePackedCompare:
+_DC_ASM_WritePackedCompare:
+    mov ecx, dc_asm_select_constants + 16
+    xor edx, edx
+    jmp dc_asm_write_compare
+
+; unsigned DCJIT_CDECL DC_ASM_WriteDoubleCompare(void *dest,
+;     unsigned predicate,
+;     unsigned index);
+DC_ASM_WriteDoubleCompare:
+_DC_ASM_WriteDoubleCompare:
+    mov ecx, dc_asm_select_constants + 32
+    mov dl, 0xF2
+    ; FALLTHROUGH
+
+; dl has the SSE prefix, or zero for the packed form, and ecx has the address
+; of 1.0 for the precision.
+dc_asm_write_compare:
+    ; Write:
+    ; cmpss XMM(index-2), XMM(index-1), predicate
+    ; andps XMM(index-2), [ONE]
+    ; Using cmpps or cmpsd for the other forms. The comparison gives a mask of
+    ; all ones or all zeros, so the and gives 1.0 or 0.0.
+    push edi
+    mov edi, [esp+8]
+    mov eax, [esp+16]
+    test dl, dl
+    jz dc_asm_compare_no_prefix
+    mov [edi], dl
+    inc edi
+dc_asm_compare_no_prefix:
+    lea edx, [(eax * 8) + eax + 0xAF]
+    shl edx, 16
+    or edx, 0xC20F
+    mov [edi], edx
+    mov edx, [esp+12]
+    mov [edi+3], dl
+    lea edx, [(eax * 8) - 11]
+    shl edx, 16
+    or edx, 0x540F
+    mov [edi+4], edx
+    mov [edi+7], ecx
+    lea eax, [edi+11]
+    sub eax, [esp+8]
+    pop edi
+    ret
+
+; unsigned DCJIT_CDECL DC_ASM_WriteSelect(void *dest, unsigned index);
+DC_ASM_WriteSelect:
+_DC_ASM_WriteSelect:
+    mov dl, 0xF3
+    jmp dc_asm_write_select
+
+; unsigned DCJIT_CDECL DC_ASM_WritePackedSelect(void *dest, unsigned index);
+DC_ASM_WritePackedSelect:
+_DC_ASM_WritePackedSelect:
+    xor edx, edx
+    jmp dc_asm_write_select
+
+; unsigned DCJIT_CDECL DC_ASM_WriteDoubleSelect(void *dest, unsigned index);
+DC_ASM_WriteDoubleSelect:
+_DC_ASM_WriteDoubleSelect:
+    mov dl, 0xF2
+    ; FALLTHROUGH
+
+; dl has the SSE prefix, or zero for the packed form.
+dc_asm_write_select:
+    ; Write:
+    ; cmpneqss XMM(index-1), [ZERO]
+    ; andps XMM(index-3), XMM(index-1)
+    ; andnps XMM(index-1), XMM(index-2)
+    ; orps XMM(index-3), XMM(index-1)
+    ; XMM(index-1) is the condition, which becomes a mask that keeps
+    ; XMM(index-3) when it is not zero (including NaN), and XMM(index-2)
+    ; otherwise.
+    mov ecx, [esp+4]
+    mov eax, [esp+8]
+    test dl, dl
+    jz dc_asm_select_no_prefix
+    mov [ecx], dl
+    inc ecx
+dc_asm_select_no_prefix:
+    lea edx, [(eax * 8) - 3]
+    shl edx, 16
+    or edx, 0xC20F
+    mov [ecx], edx
+    mov [ecx+3], DWORD dc_asm_select_constants
+    mov [ecx+7], BYTE 4
+    lea edx, [(eax * 8) + eax + 0xA7]
+    mov [ecx+8], WORD 0x540F
+    mov [ecx+10], dl
+    mov [ecx+14], WORD 0x560F
+    mov [ecx+16], dl
+    lea edx, [(eax * 8) + eax + 0xB6]
+    mov [ecx+11], WORD 0x550F
+    mov [ecx+13], dl
+    lea eax, [ecx+17]
+    sub eax, [esp+4]
+    ret
+
+; unsigned DCJIT_CDECL DC_ASM_WriteDoubleSqrt(void *dest, unsigned index);
+DC_ASM_WriteDoubleSqrt:
+_DC_ASM_WriteDoubleSqrt:
+    ; Write:
+    ; sqrtsd XMM, XMM
+    ; Where XMM is XMM(index-1)
+    mov eax, [esp+8]
+    lea ecx, [(eax * 8) + eax + 0xF20F51B7]
+    bswap ecx
+    mov edx, [esp+4]
+    mov [edx], ecx
+    mov eax, 4
+    ret
+
+; unsigned DCJIT_CDECL DC_ASM_WriteDoubleCos(void *dest, unsigned index);
+DC_ASM_WriteDoubleCos:
+_DC_ASM_WriteDoubleCos:
+    mov edx, 0xFF
+    jmp dc_asm_double_trig
+
+; unsigned DCJIT_CDECL DC_ASM_WriteDoubleSin(void *dest, unsigned index);
+DC_ASM_WriteDoubleSin:
+_DC_ASM_WriteDoubleSin:
+    mov edx, 0xFE
+    ; FALLTHROUGH
+
+dc_asm_double_trig:
+    ; Write:
+    ; lea eax, [esp-8]
+    ; movsd [eax], XMM
+    ; fld QWORD [eax]
+    ; fsin/fcos
+    ; fstp QWORD [eax]
+    ; movsd XMM, [eax]
+    ; Where XMM is XMM(index-1)
+    mov eax, [esp+4]
+    mov ecx, [esp+8]
+    dec ecx
+    mov [eax], DWORD 0xF824448D ; lea eax, [esp-8]
+    lea ecx, [(ecx * 8) + 0xF20F1100]
+    bswap ecx
+    mov [eax+4], ecx ; movsd [eax], XMM
+    shl edx, 24
+    or edx, 0x00D900DD
+    mov [eax+8], edx ; fld QWORD [eax], f(cos|sin)
+    mov [eax+12], WORD 0x18DD
+    bswap ecx
+    mov ch, 0x10
+    bswap ecx
+    mov [eax+14], ecx
+    mov eax, 18
+    ret
+
+; unsigned DCJIT_CDECL DC_ASM_WriteDoubleSpill(void *dest, unsigned slot,
+;     unsigned index);
+DC_ASM_WriteDoubleSpill:
+_DC_ASM_WriteDoubleSpill:
+    ; Write:
+    ; movsd [esp+N], XMM
+    ; Where XMM is XMM(index-1)
+    mov ecx, [esp+12]
+    lea eax, [(ecx * 8) + 0xF20F113C]
+    jmp dc_asm_write_double_stack_slot
+
+; unsigned DCJIT_CDECL DC_ASM_WriteDoubleReload(void *dest, unsigned slot,
+;     unsigned index);
+DC_ASM_WriteDoubleReload:
+_DC_ASM_WriteDoubleReload:
+    ; Write:
+    ; movsd XMM, [esp+N]
+    ; Where XMM is XMM(index)
+    mov ecx, [esp+12]
+    lea eax, [(ecx * 8) + 0xF20F1044]
+    ; FALLTHROUGH
+
+dc_asm_write_double_stack_slot:
+    mov ecx, [esp+4]
+    mov edx, [esp+8]
+    shl edx, 3
+    jmp dc_asm_write_stack_offset
+
+; void DCJIT_CDECL DC_ASM_CalculateDouble(void *addr, const double *args,
+;     double *result);
+DC_ASM_CalculateDouble:
+_DC_ASM_CalculateDouble:
+    mov edx, [esp+8]
+    call [esp+4]
+    mov eax, [esp+12]
+    movsd [eax], xmm0
+    ret
+
+; void DCJIT_CDECL DC_ASM_CalculatePacked(void *addr, const float *args,
+;     float *results);
+DC_ASM_CalculatePacked:
+_DC_ASM_CalculatePacked:
+    mov edx, [esp+8]
+    call [esp+4]
+    mov eax, [esp+12]
+    movups [eax], xmm0
+    ret
+
 ; float DC_ASM_Calculate(void *addr, const float *args, float *result);
 DC_ASM_Calculate:
 _DC_ASM_Calculate:
@@ -492,34 +1518,250 @@ _DC_ASM_Calculate:
     ret
 
 section .bss
-    dc_asm_index: resd 1
     DC_ASM_pop_size: resd 1
 
-section .data
+section .data align=16
+
+    ; Templates for the polynomial sin/cos. The argument is in xmm5, xmm6 and
+    ; xmm7 are temporaries, and ecx points to the constants.
+    ;
+    ; With k = round(x / pi), sin(x) = (-1)^k * sin(x - k*pi). The sign is
+    ; applied to both x and k first, and then k*pi is subtracted in two parts
+    ; so the reduced argument stays accurate for larger k.
+    ; For cos, k = round(x / pi + 0.5) and (k - 0.5)*pi is subtracted instead.
+dc_asm_poly_sin_head:
+    movaps xmm6, xmm5
+    mulss xmm6, [ecx]
+    addss xmm6, [ecx+4]
+    ; Adding 1.5 * 2^23 leaves k in the low bits, so this gets the sign.
+    movaps xmm7, xmm6
+    pslld xmm7, 31
+    subss xmm6, [ecx+4]
+dc_asm_poly_sin_head_size equ $ - dc_asm_poly_sin_head
+
+dc_asm_poly_cos_head:
+    movaps xmm6, xmm5
+    mulss xmm6, [ecx]
+    addss xmm6, [ecx+32]
+    addss xmm6, [ecx+4]
+    movaps xmm7, xmm6
+    pslld xmm7, 31
+    subss xmm6, [ecx+4]
+    subss xmm6, [ecx+32]
+dc_asm_poly_cos_head_size equ $ - dc_asm_poly_cos_head
+
+dc_asm_poly_trig_tail:
+    xorps xmm5, xmm7
+    xorps xmm6, xmm7
+    movaps xmm7, xmm6
+    mulss xmm7, [ecx+8]
+    subss xmm5, xmm7
+    mulss xmm6, [ecx+12]
+    subss xmm5, xmm6
+    ; xmm5 is now in [-pi/2, pi/2]
+    movaps xmm6, xmm5
+    mulss xmm6, xmm6
+    movaps xmm7, xmm6
+    mulss xmm7, [ecx+16]
+    addss xmm7, [ecx+20]
+    mulss xmm7, xmm6
+    addss xmm7, [ecx+24]
+    mulss xmm7, xmm6
+    addss xmm7, [ecx+28]
+    mulss xmm7, xmm6
+    mulss xmm7, xmm5
+    addss xmm5, xmm7
+dc_asm_poly_trig_tail_size equ $ - dc_asm_poly_trig_tail
+
+    ; Template for DC_ASM_WriteNativeEntry. The call is relative, so this
+    ; calls the code immediately following wherever the template is copied.
+    ; cdecl returns floats on the x87 stack.
+dc_asm_native_entry:
+    mov edx, [esp+4]
+    call dc_asm_native_entry_end
+    push eax
+    movss [esp], xmm0
+    fld DWORD [esp]
+    pop eax
+    ret
+dc_asm_native_entry_end:
+dc_asm_native_entry_size equ $ - dc_asm_native_entry
+
+    ; The same templates with the *ps instructions, using the constants in
+    ; dc_asm_packed_poly_trig_constants which are repeated for each lane.
+dc_asm_packed_poly_sin_head:
+    movaps xmm6, xmm5
+    mulps xmm6, [ecx]
+    addps xmm6, [ecx+16]
+    movaps xmm7, xmm6
+    pslld xmm7, 31
+    subps xmm6, [ecx+16]
+dc_asm_packed_poly_sin_head_size equ $ - dc_asm_packed_poly_sin_head
+
+dc_asm_packed_poly_cos_head:
+    movaps xmm6, xmm5
+    mulps xmm6, [ecx]
+    addps xmm6, [ecx+128]
+    addps xmm6, [ecx+16]
+    movaps xmm7, xmm6
+    pslld xmm7, 31
+    subps xmm6, [ecx+16]
+    subps xmm6, [ecx+128]
+dc_asm_packed_poly_cos_head_size equ $ - dc_asm_packed_poly_cos_head
+
+dc_asm_packed_poly_trig_tail:
+    xorps xmm5, xmm7
+    xorps xmm6, xmm7
+    movaps xmm7, xmm6
+    mulps xmm7, [ecx+32]
+    subps xmm5, xmm7
+    mulps xmm6, [ecx+48]
+    subps xmm5, xmm6
+    movaps xmm6, xmm5
+    mulps xmm6, xmm6
+    movaps xmm7, xmm6
+    mulps xmm7, [ecx+64]
+    addps xmm7, [ecx+80]
+    mulps xmm7, xmm6
+    addps xmm7, [ecx+96]
+    mulps xmm7, xmm6
+    addps xmm7, [ecx+112]
+    mulps xmm7, xmm6
+    mulps xmm7, xmm5
+    addps xmm5, xmm7
+dc_asm_packed_poly_trig_tail_size equ $ - dc_asm_packed_poly_trig_tail
+
+    align 4
+dc_asm_poly_trig_constants:
+    dd 0.318309886 ; 1 / pi
+    dd 12582912.0 ; 1.5 * 2^23
+    dd 3.140625 ; pi, high part with few enough bits that k * it is exact
+    dd 9.67653589793e-4 ; pi, low part
+    ; Minimax coefficients for sin(x) = x + x^3 * P(x^2) on [-pi/2, pi/2]
+    dd 2.600054813e-6
+    dd -1.980661473e-4
+    dd 8.333017118e-3
+    dd -1.666665673e-1
+    dd 0.5
+
+    ; Packed constants must be aligned for the *ps memory operands.
+    align 16
+dc_asm_packed_poly_trig_constants:
+    times 4 dd 0.318309886
+    times 4 dd 12582912.0
+    times 4 dd 3.140625
+    times 4 dd 9.67653589793e-4
+    times 4 dd 2.600054813e-6
+    times 4 dd -1.980661473e-4
+    times 4 dd 8.333017118e-3
+    times 4 dd -1.666665673e-1
+    times 4 dd 0.5
+
+    ; Comparisons and selects compare against the zeros, and a true comparison
+    ; gives the 1.0 for its precision.
+dc_asm_select_constants:
+    times 4 dd 0
+    times 4 dd 1.0
+    times 2 dq 1.0
+
+    ; Descriptors for dc_asm_write_poly_trig. Each one has the head, the size
+    ; of the head, the tail, the size of the tail, and the constants.
+    align 4
+dc_asm_poly_sin:
+    dd dc_asm_poly_sin_head, dc_asm_poly_sin_head_size
+    dd dc_asm_poly_trig_tail, dc_asm_poly_trig_tail_size
+    dd dc_asm_poly_trig_constants
+dc_asm_poly_cos:
+    dd dc_asm_poly_cos_head, dc_asm_poly_cos_head_size
+    dd dc_asm_poly_trig_tail, dc_asm_poly_trig_tail_size
+    dd dc_asm_poly_trig_constants
+dc_asm_packed_poly_sin:
+    dd dc_asm_packed_poly_sin_head, dc_asm_packed_poly_sin_head_size
+    dd dc_asm_packed_poly_trig_tail, dc_asm_packed_poly_trig_tail_size
+    dd dc_asm_packed_poly_trig_constants
+dc_asm_packed_poly_cos:
+    dd dc_asm_packed_poly_cos_head, dc_asm_packed_poly_cos_head_size
+    dd dc_asm_packed_poly_trig_tail, dc_asm_packed_poly_trig_tail_size
+    dd dc_asm_packed_poly_trig_constants
     
     ; These indicate (XMM(N), XMM(N-1). Subtract 0xC8 to just get XMM(N)
     dc_asm_arithmetic_codes: db 0xC1,0xCA,0xD3,0xDC,0xE5,0xEE,0xF7
+    
+    ; The x87 code for DC_ASM_WriteX87, indexed by DC_ASM_X87_*. Each starts
+    ; with the number of operands and the length of the code. This is the same
+    ; as on amd64, since [eax] and [rax] have the same encoding.
+dc_asm_x87_funcs:
+    dd dc_asm_x87_pow, dc_asm_x87_atan2, dc_asm_x87_tan, dc_asm_x87_exp
+    dd dc_asm_x87_log, dc_asm_x87_floor
+    
+    ; 2^st0, with st0 split into an integer for fscale and a fraction for f2xm1:
+    ; fld st0 / frndint / fsub st1, st0 / fxch / f2xm1 / fld1 / faddp / fscale
+    ; fstp st1
+%define DC_ASM_X87_EXP2 0xD9,0xC0,0xD9,0xFC,0xDC,0xE9,0xD9,0xC9,0xD9,0xF0,0xD9,0xE8,0xDE,0xC1,0xD9,0xFD,0xDD,0xD9
+    ; fxch / fyl2x / 2^st0
+dc_asm_x87_pow: db 2, 22, 0xD9,0xC9,0xD9,0xF1,DC_ASM_X87_EXP2
+    ; fpatan
+dc_asm_x87_atan2: db 2, 2, 0xD9,0xF3
+    ; fptan / fstp st0
+dc_asm_x87_tan: db 1, 4, 0xD9,0xF2,0xDD,0xD8
+    ; fldl2e / fmulp / 2^st0
+dc_asm_x87_exp: db 1, 22, 0xD9,0xEA,0xDE,0xC9,DC_ASM_X87_EXP2
+    ; fldln2 / fxch / fyl2x
+dc_asm_x87_log: db 1, 6, 0xD9,0xED,0xD9,0xC9,0xD9,0xF1
+    ; fnstcw [eax] / movzx ecx, WORD [eax] / and ch, 0xF3 / or ch, 0x04
+    ; mov [eax+4], ecx / fldcw [eax+4] / frndint / fldcw [eax]
+    ; This rounds down, then restores the rounding mode.
+dc_asm_x87_floor: db 1, 21, 0xD9,0x38,0x0F,0xB7,0x08,0x80,0xE5,0xF3,0x80,0xCD,0x04,0x89,0x48,0x04,0xD9,0x68,0x04,0xD9,0xFC,0xD9,0x28
     dc_asm_unary_codes: db 0x02, 0x0A, 0x12, 0x1A, 0x22, 0x2A, 0x32, 0x3A
+    DC_ASM_poly_sin_size:
+        dd 11 + dc_asm_poly_sin_head_size + dc_asm_poly_trig_tail_size
+    DC_ASM_poly_cos_size:
+        dd 11 + dc_asm_poly_cos_head_size + dc_asm_poly_trig_tail_size
+    DC_ASM_packed_poly_sin_size:
+        dd 11 + dc_asm_packed_poly_sin_head_size + dc_asm_packed_poly_trig_tail_size
+    DC_ASM_packed_poly_cos_size:
+        dd 11 + dc_asm_packed_poly_cos_head_size + dc_asm_packed_poly_trig_tail_size
+    DC_ASM_packed_immediate_size: dd 18
+    DC_ASM_packed_spill_size: dd 8
+    DC_ASM_packed_push_arg_size: dd 7
+    DC_ASM_dup_size: ; FALLTHROUGH
+    DC_ASM_and_size: ; FALLTHROUGH
+    DC_ASM_packed_arithmetic_size: dd 3
+    DC_ASM_double_store_arg_size: ; FALLTHROUGH
+    DC_ASM_double_push_arg_size: dd 8
+    DC_ASM_double_immediate_size: dd 22
+    DC_ASM_double_arithmetic_size: dd 4
+    DC_ASM_double_trig_size: dd 18
+    DC_ASM_x87_size: dd 44
+    DC_ASM_floor_size: dd 6
+    DC_ASM_compare_size: dd 12
+    DC_ASM_select_size: dd 18
+    DC_ASM_double_spill_size: dd 9
 
     DC_ASM_cos_arg_size: ; FALLTHROUGH
-    DC_ASM_sin_arg_size: dd 30
+    DC_ASM_sin_arg_size: dd 32
     DC_ASM_add_imm_size: ; FALLTHROUGH
     DC_ASM_sub_imm_size: ; FALLTHROUGH
     DC_ASM_div_imm_size: ; FALLTHROUGH
     DC_ASM_mul_imm_size: ; FALLTHROUGH
     DC_ASM_cos_size: ; FALLTHROUGH
     DC_ASM_sin_size: dd 24
-    DC_ASM_sqrt_arg_size: ; FALLTHROUGH
     DC_ASM_jmp_size: dd 6
+    DC_ASM_sqrt_arg_size: ; FALLTHROUGH
     DC_ASM_add_arg_size: ; FALLTHROUGH
     DC_ASM_sub_arg_size: ; FALLTHROUGH
     DC_ASM_mul_arg_size: ; FALLTHROUGH
     DC_ASM_div_arg_size: ; FALLTHROUGH
-    DC_ASM_push_arg_size: dd 5
+    DC_ASM_store_arg_size: ; FALLTHROUGH
+    DC_ASM_push_arg_size: dd 8
     DC_ASM_immediate_size: dd 14
     DC_ASM_sub_size: ; FALLTHROUGH
     DC_ASM_mul_size: ; FALLTHROUGH
     DC_ASM_div_size: ; FALLTHROUGH
     DC_ASM_sqrt_size: ; FALLTHROUGH
+    DC_ASM_min_size: ; FALLTHROUGH
     DC_ASM_add_size: dd 4
     DC_ASM_ret_size: dd 1
+    DC_ASM_spill_size: ; FALLTHROUGH
+    DC_ASM_reload_size: dd 9
+    DC_ASM_frame_size: dd 6
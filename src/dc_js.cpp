@@ -7,14 +7,18 @@
 
 #include <emscripten.h>
 
+// num_stored is one more than the highest argument that is stored, see
+// DC_X_BuildStoreArg. The stored arguments are copied back after running.
 struct DC_X_Calculation{
     unsigned js_function_number;
     unsigned num_args;
+    unsigned num_stored;
 };
 
 struct DC_X_CalculationBuilder{
     unsigned js_string_number;
     unsigned num_args;
+    unsigned num_stored;
 };
 
 DC_X_Context *DC_X_CreateContext(void){
@@ -23,14 +27,25 @@ DC_X_Context *DC_X_CreateContext(void){
 
 void DC_X_FreeContext(DC_X_Context *){}
 
+int DC_X_SetOption(DC_X_Context *, int, unsigned){
+    return 0;
+}
+
+unsigned DC_X_GetOption(const DC_X_Context *, int){
+    return 0;
+}
+
 DC_X_CalculationBuilder *DC_X_CreateCalculationBuilder(DC_X_Context *){
     const unsigned string_num = EM_ASM_INT("DC_JS_CreateCalculationBuilder()", 0);
-    return new DC_X_CalculationBuilder{string_num, 0};
+    return new DC_X_CalculationBuilder{string_num, 0, 0};
 }
 
-void DC_X_BuildPushImmediate(DC_X_Context *, DC_X_CalculationBuilder *bld, float value){
-    const double d = static_cast<double>(value);
-    EM_ASM("DC_JS_BuildPushImmediate($0, $1)", bld->js_string_number, d);
+int DC_X_SetBuilderOption(DC_X_Context *, DC_X_CalculationBuilder *, int, unsigned){
+    return 0;
+}
+
+void DC_X_BuildPushImmediate(DC_X_Context *, DC_X_CalculationBuilder *bld, double value){
+    EM_ASM("DC_JS_BuildPushImmediate($0, $1)", bld->js_string_number, value);
 }
 
 void DC_X_BuildPushArg(DC_X_Context *, DC_X_CalculationBuilder *bld, unsigned short arg_num){
@@ -56,10 +71,66 @@ void DC_X_BuildDiv(DC_X_Context *, DC_X_CalculationBuilder *bld){
     EM_ASM("DC_JS_BuildOperator($0, '/')", bld->js_string_number);
 }
 
+void DC_X_BuildPow(DC_X_Context *, DC_X_CalculationBuilder *bld){
+    EM_ASM("DC_JS_BuildOperator($0, '**')", bld->js_string_number);
+}
+
+void DC_X_BuildLess(DC_X_Context *, DC_X_CalculationBuilder *bld){
+    EM_ASM("DC_JS_BuildCompare($0, '<')", bld->js_string_number);
+}
+
+void DC_X_BuildLessEqual(DC_X_Context *, DC_X_CalculationBuilder *bld){
+    EM_ASM("DC_JS_BuildCompare($0, '<=')", bld->js_string_number);
+}
+
+void DC_X_BuildEqual(DC_X_Context *, DC_X_CalculationBuilder *bld){
+    EM_ASM("DC_JS_BuildCompare($0, '==')", bld->js_string_number);
+}
+
+void DC_X_BuildNotEqual(DC_X_Context *, DC_X_CalculationBuilder *bld){
+    EM_ASM("DC_JS_BuildCompare($0, '!=')", bld->js_string_number);
+}
+
+void DC_X_BuildSelect(DC_X_Context *, DC_X_CalculationBuilder *bld){
+    EM_ASM("DC_JS_BuildSelect($0)", bld->js_string_number);
+}
+
 void DC_X_BuildPop(DC_X_Context *, DC_X_CalculationBuilder *bld){
     EM_ASM("DC_JS_BuildPop($0)", bld->js_string_number);
 }
 
+void DC_X_BuildDup(DC_X_Context *, DC_X_CalculationBuilder *bld){
+    EM_ASM("DC_JS_BuildDup($0)", bld->js_string_number);
+}
+
+// Temporaries are kept in their own array, so nothing needs to be reserved.
+void DC_X_BuildReserveTemps(DC_X_Context *,
+    DC_X_CalculationBuilder *,
+    unsigned short){}
+
+void DC_X_BuildStoreTemp(DC_X_Context *,
+    DC_X_CalculationBuilder *bld,
+    unsigned short temp){
+    const int i = static_cast<int>(temp);
+    EM_ASM("DC_JS_BuildStoreTemp($0, $1)", bld->js_string_number, i);
+}
+
+void DC_X_BuildPushTemp(DC_X_Context *,
+    DC_X_CalculationBuilder *bld,
+    unsigned short temp){
+    const int i = static_cast<int>(temp);
+    EM_ASM("DC_JS_BuildPushTemp($0, $1)", bld->js_string_number, i);
+}
+
+void DC_X_BuildStoreArg(DC_X_Context *,
+    DC_X_CalculationBuilder *bld,
+    unsigned short arg_num){
+    const int i = static_cast<int>(arg_num);
+    if(arg_num >= bld->num_stored)
+        bld->num_stored = arg_num + 1;
+    EM_ASM("DC_JS_BuildStoreArg($0, $1)", bld->js_string_number, i);
+}
+
 void DC_X_BuildSin(DC_X_Context *, DC_X_CalculationBuilder *bld){
     EM_ASM("DC_JS_BuildMathBuiltin($0, 'sin')", bld->js_string_number);
 }
@@ -72,6 +143,38 @@ void DC_X_BuildSqrt(DC_X_Context *, DC_X_CalculationBuilder *bld){
     EM_ASM("DC_JS_BuildMathBuiltin($0, 'sqrt')", bld->js_string_number);
 }
 
+void DC_X_BuildAtan2(DC_X_Context *, DC_X_CalculationBuilder *bld){
+    EM_ASM("DC_JS_BuildMathBuiltin2($0, 'atan2')", bld->js_string_number);
+}
+
+void DC_X_BuildMin(DC_X_Context *, DC_X_CalculationBuilder *bld){
+    EM_ASM("DC_JS_BuildMathBuiltin2($0, 'min')", bld->js_string_number);
+}
+
+void DC_X_BuildMax(DC_X_Context *, DC_X_CalculationBuilder *bld){
+    EM_ASM("DC_JS_BuildMathBuiltin2($0, 'max')", bld->js_string_number);
+}
+
+void DC_X_BuildTan(DC_X_Context *, DC_X_CalculationBuilder *bld){
+    EM_ASM("DC_JS_BuildMathBuiltin($0, 'tan')", bld->js_string_number);
+}
+
+void DC_X_BuildExp(DC_X_Context *, DC_X_CalculationBuilder *bld){
+    EM_ASM("DC_JS_BuildMathBuiltin($0, 'exp')", bld->js_string_number);
+}
+
+void DC_X_BuildLog(DC_X_Context *, DC_X_CalculationBuilder *bld){
+    EM_ASM("DC_JS_BuildMathBuiltin($0, 'log')", bld->js_string_number);
+}
+
+void DC_X_BuildAbs(DC_X_Context *, DC_X_CalculationBuilder *bld){
+    EM_ASM("DC_JS_BuildMathBuiltin($0, 'abs')", bld->js_string_number);
+}
+
+void DC_X_BuildFloor(DC_X_Context *, DC_X_CalculationBuilder *bld){
+    EM_ASM("DC_JS_BuildMathBuiltin($0, 'floor')", bld->js_string_number);
+}
+
 void DC_X_AbandonCalculation(DC_X_Context *, DC_X_CalculationBuilder *bld){
     EM_ASM("DC_JS_AbandonCalculation($0)", bld->js_string_number);
 }
@@ -104,6 +207,41 @@ void DC_X_BuildDivArg(DC_X_Context *, DC_X_CalculationBuilder *bld, unsigned sho
     EM_ASM("DC_JS_BuildOperatorArg($0, '/', $1)", bld->js_string_number, i);
 }
 
+void DC_X_BuildPowArg(DC_X_Context *, DC_X_CalculationBuilder *bld, unsigned short arg_num){
+    const int i = static_cast<int>(arg_num);
+    if(arg_num > bld->num_args)
+        bld->num_args = arg_num;
+    EM_ASM("DC_JS_BuildOperatorArg($0, '**', $1)", bld->js_string_number, i);
+}
+
+void DC_X_BuildLessArg(DC_X_Context *, DC_X_CalculationBuilder *bld, unsigned short arg_num){
+    const int i = static_cast<int>(arg_num);
+    if(arg_num > bld->num_args)
+        bld->num_args = arg_num;
+    EM_ASM("DC_JS_BuildCompareArg($0, '<', $1)", bld->js_string_number, i);
+}
+
+void DC_X_BuildLessEqualArg(DC_X_Context *, DC_X_CalculationBuilder *bld, unsigned short arg_num){
+    const int i = static_cast<int>(arg_num);
+    if(arg_num > bld->num_args)
+        bld->num_args = arg_num;
+    EM_ASM("DC_JS_BuildCompareArg($0, '<=', $1)", bld->js_string_number, i);
+}
+
+void DC_X_BuildEqualArg(DC_X_Context *, DC_X_CalculationBuilder *bld, unsigned short arg_num){
+    const int i = static_cast<int>(arg_num);
+    if(arg_num > bld->num_args)
+        bld->num_args = arg_num;
+    EM_ASM("DC_JS_BuildCompareArg($0, '==', $1)", bld->js_string_number, i);
+}
+
+void DC_X_BuildNotEqualArg(DC_X_Context *, DC_X_CalculationBuilder *bld, unsigned short arg_num){
+    const int i = static_cast<int>(arg_num);
+    if(arg_num > bld->num_args)
+        bld->num_args = arg_num;
+    EM_ASM("DC_JS_BuildCompareArg($0, '!=', $1)", bld->js_string_number, i);
+}
+
 void DC_X_BuildSinArg(DC_X_Context *, DC_X_CalculationBuilder *bld, unsigned short arg_num){
     const int i = static_cast<int>(arg_num);
     if(arg_num > bld->num_args)
@@ -125,32 +263,117 @@ void DC_X_BuildSqrtArg(DC_X_Context *, DC_X_CalculationBuilder *bld, unsigned sh
     EM_ASM("DC_JS_BuildMathBuiltinArg($0, 'sqrt', $1)", bld->js_string_number, i);
 }
 
-void DC_X_BuildAddImm(DC_X_Context *, DC_X_CalculationBuilder *bld, float value){
-    const double d = static_cast<double>(value);
-    EM_ASM("DC_JS_BuildOperatorImm($0, '+', $1)", bld->js_string_number, d);
+void DC_X_BuildAtan2Arg(DC_X_Context *, DC_X_CalculationBuilder *bld, unsigned short arg_num){
+    const int i = static_cast<int>(arg_num);
+    if(arg_num > bld->num_args)
+        bld->num_args = arg_num;
+    EM_ASM("DC_JS_BuildMathBuiltin2Arg($0, 'atan2', $1)", bld->js_string_number, i);
+}
+
+void DC_X_BuildMinArg(DC_X_Context *, DC_X_CalculationBuilder *bld, unsigned short arg_num){
+    const int i = static_cast<int>(arg_num);
+    if(arg_num > bld->num_args)
+        bld->num_args = arg_num;
+    EM_ASM("DC_JS_BuildMathBuiltin2Arg($0, 'min', $1)", bld->js_string_number, i);
+}
+
+void DC_X_BuildMaxArg(DC_X_Context *, DC_X_CalculationBuilder *bld, unsigned short arg_num){
+    const int i = static_cast<int>(arg_num);
+    if(arg_num > bld->num_args)
+        bld->num_args = arg_num;
+    EM_ASM("DC_JS_BuildMathBuiltin2Arg($0, 'max', $1)", bld->js_string_number, i);
+}
+
+void DC_X_BuildTanArg(DC_X_Context *, DC_X_CalculationBuilder *bld, unsigned short arg_num){
+    const int i = static_cast<int>(arg_num);
+    if(arg_num > bld->num_args)
+        bld->num_args = arg_num;
+    EM_ASM("DC_JS_BuildMathBuiltinArg($0, 'tan', $1)", bld->js_string_number, i);
+}
+
+void DC_X_BuildExpArg(DC_X_Context *, DC_X_CalculationBuilder *bld, unsigned short arg_num){
+    const int i = static_cast<int>(arg_num);
+    if(arg_num > bld->num_args)
+        bld->num_args = arg_num;
+    EM_ASM("DC_JS_BuildMathBuiltinArg($0, 'exp', $1)", bld->js_string_number, i);
+}
+
+void DC_X_BuildLogArg(DC_X_Context *, DC_X_CalculationBuilder *bld, unsigned short arg_num){
+    const int i = static_cast<int>(arg_num);
+    if(arg_num > bld->num_args)
+        bld->num_args = arg_num;
+    EM_ASM("DC_JS_BuildMathBuiltinArg($0, 'log', $1)", bld->js_string_number, i);
+}
+
+void DC_X_BuildAbsArg(DC_X_Context *, DC_X_CalculationBuilder *bld, unsigned short arg_num){
+    const int i = static_cast<int>(arg_num);
+    if(arg_num > bld->num_args)
+        bld->num_args = arg_num;
+    EM_ASM("DC_JS_BuildMathBuiltinArg($0, 'abs', $1)", bld->js_string_number, i);
+}
+
+void DC_X_BuildFloorArg(DC_X_Context *, DC_X_CalculationBuilder *bld, unsigned short arg_num){
+    const int i = static_cast<int>(arg_num);
+    if(arg_num > bld->num_args)
+        bld->num_args = arg_num;
+    EM_ASM("DC_JS_BuildMathBuiltinArg($0, 'floor', $1)", bld->js_string_number, i);
+}
+
+void DC_X_BuildAddImm(DC_X_Context *, DC_X_CalculationBuilder *bld, double value){
+    EM_ASM("DC_JS_BuildOperatorImm($0, '+', $1)", bld->js_string_number, value);
 }
 
 
-void DC_X_BuildSubImm(DC_X_Context *, DC_X_CalculationBuilder *bld, float value){
-    const double d = static_cast<double>(value);
-    EM_ASM("DC_JS_BuildOperatorImm($0, '-', $1)", bld->js_string_number, d);
+void DC_X_BuildSubImm(DC_X_Context *, DC_X_CalculationBuilder *bld, double value){
+    EM_ASM("DC_JS_BuildOperatorImm($0, '-', $1)", bld->js_string_number, value);
+}
+
+void DC_X_BuildMulImm(DC_X_Context *, DC_X_CalculationBuilder *bld, double value){
+    EM_ASM("DC_JS_BuildOperatorImm($0, '*', $1)", bld->js_string_number, value);
+}
+
+void DC_X_BuildDivImm(DC_X_Context *, DC_X_CalculationBuilder *bld, double value){
+    EM_ASM("DC_JS_BuildOperatorImm($0, '/', $1)", bld->js_string_number, value);
+}
+
+void DC_X_BuildPowImm(DC_X_Context *, DC_X_CalculationBuilder *bld, double value){
+    EM_ASM("DC_JS_BuildOperatorImm($0, '**', $1)", bld->js_string_number, value);
+}
+
+void DC_X_BuildAtan2Imm(DC_X_Context *, DC_X_CalculationBuilder *bld, double value){
+    EM_ASM("DC_JS_BuildMathBuiltin2Imm($0, 'atan2', $1)", bld->js_string_number, value);
 }
 
-void DC_X_BuildMulImm(DC_X_Context *, DC_X_CalculationBuilder *bld, float value){
-    const double d = static_cast<double>(value);
-    EM_ASM("DC_JS_BuildOperatorImm($0, '*', $1)", bld->js_string_number, d);
+void DC_X_BuildMinImm(DC_X_Context *, DC_X_CalculationBuilder *bld, double value){
+    EM_ASM("DC_JS_BuildMathBuiltin2Imm($0, 'min', $1)", bld->js_string_number, value);
 }
 
-void DC_X_BuildDivImm(DC_X_Context *, DC_X_CalculationBuilder *bld, float value){
-    const double d = static_cast<double>(value);
-    EM_ASM("DC_JS_BuildOperatorImm($0, '/', $1)", bld->js_string_number, d);
+void DC_X_BuildMaxImm(DC_X_Context *, DC_X_CalculationBuilder *bld, double value){
+    EM_ASM("DC_JS_BuildMathBuiltin2Imm($0, 'max', $1)", bld->js_string_number, value);
+}
+
+void DC_X_BuildLessImm(DC_X_Context *, DC_X_CalculationBuilder *bld, double value){
+    EM_ASM("DC_JS_BuildCompareImm($0, '<', $1)", bld->js_string_number, value);
+}
+
+void DC_X_BuildLessEqualImm(DC_X_Context *, DC_X_CalculationBuilder *bld, double value){
+    EM_ASM("DC_JS_BuildCompareImm($0, '<=', $1)", bld->js_string_number, value);
+}
+
+void DC_X_BuildEqualImm(DC_X_Context *, DC_X_CalculationBuilder *bld, double value){
+    EM_ASM("DC_JS_BuildCompareImm($0, '==', $1)", bld->js_string_number, value);
+}
+
+void DC_X_BuildNotEqualImm(DC_X_Context *, DC_X_CalculationBuilder *bld, double value){
+    EM_ASM("DC_JS_BuildCompareImm($0, '!=', $1)", bld->js_string_number, value);
 }
 
 DC_X_Calculation *DC_X_FinalizeCalculation(DC_X_Context *, DC_X_CalculationBuilder *bld){
     const unsigned js_function_number = EM_ASM_INT("DC_JS_FinalizeCalculation($0)", bld->js_string_number);
     const unsigned num_args = bld->num_args;
+    const unsigned num_stored = bld->num_stored;
     delete bld;
-    return new DC_X_Calculation{js_function_number, num_args};
+    return new DC_X_Calculation{js_function_number, num_args, num_stored};
 }
 
 void DC_X_Free(DC_X_Context *, DC_X_Calculation *calc){
@@ -161,5 +384,36 @@ float DC_X_Calculate(const struct DC_X_Calculation *calc, const float *args){
     EM_ASM("DC_JS_InitArgs()", 0);
     for(unsigned i = 0; i < calc->num_args; i++)
         EM_ASM("DC_JS_AppendArg($0)", static_cast<double>(args[i]));
-    return EM_ASM_DOUBLE("DC_JS_Calculate($0)", static_cast<int>(calc->js_function_number));
+    const float r = EM_ASM_DOUBLE("DC_JS_Calculate($0)", static_cast<int>(calc->js_function_number));
+    for(unsigned i = calc->num_args; i < calc->num_stored; i++)
+        const_cast<float*>(args)[i] = EM_ASM_DOUBLE("DC_JS_GetArg($0)", static_cast<int>(i));
+    return r;
+}
+
+// JavaScript numbers are doubles, so every calculation already runs in double
+// precision.
+double DC_X_CalculateDouble(const struct DC_X_Calculation *calc, const double *args){
+    EM_ASM("DC_JS_InitArgs()", 0);
+    for(unsigned i = 0; i < calc->num_args; i++)
+        EM_ASM("DC_JS_AppendArg($0)", args[i]);
+    const double r = EM_ASM_DOUBLE("DC_JS_Calculate($0)", static_cast<int>(calc->js_function_number));
+    for(unsigned i = calc->num_args; i < calc->num_stored; i++)
+        const_cast<double*>(args)[i] = EM_ASM_DOUBLE("DC_JS_GetArg($0)", static_cast<int>(i));
+    return r;
+}
+
+DC_X_NativeFunction DC_X_GetNativeFunction(const struct DC_X_Calculation *){
+    return NULL;
+}
+
+void DC_X_CalculateBatch(const struct DC_X_Calculation *calc,
+    unsigned n,
+    const float *args,
+    float *out){
+    for(unsigned i = 0; i < n; i++){
+        EM_ASM("DC_JS_InitArgs()", 0);
+        for(unsigned a = 0; a < calc->num_args; a++)
+            EM_ASM("DC_JS_AppendArg($0)", static_cast<double>(args[(a * n) + i]));
+        out[i] = EM_ASM_DOUBLE("DC_JS_Calculate($0)", static_cast<int>(calc->js_function_number));
+    }
 }
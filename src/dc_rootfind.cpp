@@ -0,0 +1,296 @@
+// Copyright (c) 2018, Transnat Games
+//
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at http://mozilla.org/MPL/2.0/.
+
+#include "dc.h"
+#include "dc_bytecode.hpp"
+#include "dc_interpreter.hpp"
+
+#include <vector>
+#include <limits>
+#include <math.h>
+
+// Root finding API.
+//
+// The bytecode is run by the interpreter on dual numbers, which carry the
+// derivative by the argument being solved for along with each value. This
+// gives Newton's method the exact derivative from the same pass that
+// calculates the value.
+
+namespace DC {
+namespace RootFind {
+
+// The most iterations to find a root in. Bisecting alone would narrow any
+// bracket to the tolerance well within this for most uses.
+static const unsigned max_iterations = 100;
+
+struct Dual {
+    double value, derivative;
+    
+    Dual()
+      : value(0.0)
+      , derivative(0.0){}
+    
+    // Constants have no derivative. This also converts the 1 and 0 from
+    // comparisons.
+    Dual(double v)
+      : value(v)
+      , derivative(0.0){}
+    
+    Dual(double v, double d)
+      : value(v)
+      , derivative(d){}
+    
+    inline Dual &operator+=(const Dual &other){
+        value += other.value;
+        derivative += other.derivative;
+        return *this;
+    }
+    
+    inline Dual &operator-=(const Dual &other){
+        value -= other.value;
+        derivative -= other.derivative;
+        return *this;
+    }
+    
+    inline Dual &operator*=(const Dual &other){
+        derivative = (derivative * other.value) + (value * other.derivative);
+        value *= other.value;
+        return *this;
+    }
+    
+    inline Dual &operator/=(const Dual &other){
+        value /= other.value;
+        derivative = (derivative - (value * other.derivative)) / other.value;
+        return *this;
+    }
+};
+
+// Comparisons only use the values.
+inline bool operator<(const Dual &a, const Dual &b){ return a.value < b.value; }
+inline bool operator>(const Dual &a, const Dual &b){ return a.value > b.value; }
+inline bool operator<=(const Dual &a, const Dual &b){ return a.value <= b.value; }
+inline bool operator==(const Dual &a, const Dual &b){ return a.value == b.value; }
+inline bool operator!=(const Dual &a, const Dual &b){ return a.value != b.value; }
+
+// These are found by argument-dependent lookup from the interpreter.
+inline Dual sin(const Dual &a){
+    return Dual(::sin(a.value), ::cos(a.value) * a.derivative);
+}
+
+inline Dual cos(const Dual &a){
+    return Dual(::cos(a.value), -::sin(a.value) * a.derivative);
+}
+
+inline Dual sqrt(const Dual &a){
+    const double root = ::sqrt(a.value);
+    return Dual(root, a.derivative / (2.0 * root));
+}
+
+inline Dual tan(const Dual &a){
+    const double t = ::tan(a.value);
+    return Dual(t, (1.0 + (t * t)) * a.derivative);
+}
+
+inline Dual exp(const Dual &a){
+    const double e = ::exp(a.value);
+    return Dual(e, e * a.derivative);
+}
+
+inline Dual log(const Dual &a){
+    return Dual(::log(a.value), a.derivative / a.value);
+}
+
+inline Dual fabs(const Dual &a){
+    return (a.value < 0.0) ? Dual(-a.value, -a.derivative) : a;
+}
+
+inline Dual floor(const Dual &a){
+    return Dual(::floor(a.value));
+}
+
+// The log term is left out for constant exponents, so that negative bases
+// still have a derivative.
+inline Dual pow(const Dual &a, const Dual &b){
+    const double p = ::pow(a.value, b.value);
+    double derivative = 0.0;
+    if(a.derivative != 0.0)
+        derivative = b.value * ::pow(a.value, b.value - 1.0) * a.derivative;
+    if(b.derivative != 0.0)
+        derivative += p * ::log(a.value) * b.derivative;
+    return Dual(p, derivative);
+}
+
+inline Dual atan2(const Dual &y, const Dual &x){
+    const double d = (x.value * x.value) + (y.value * y.value);
+    return Dual(::atan2(y.value, x.value),
+        ((x.value * y.derivative) - (y.value * x.derivative)) / d);
+}
+
+// Returns the number of arguments that bytecode reads or stores.
+static unsigned NumArgs(const Bytecode::Bytecode &bc){
+    Bytecode::Bytecode::iterator iter = bc.begin(), end = bc.end();
+    unsigned num_args = 0;
+    while(iter != end){
+        switch(iter.opType()){
+            case Bytecode::eArgument: // FALLTHROUGH
+            case Bytecode::eStoreArg:
+                {
+                    const unsigned arg_num = iter.readArgument();
+                    if(arg_num >= num_args)
+                        num_args = arg_num + 1;
+                }
+                continue;
+            case Bytecode::eImmediate:
+                iter.readImmediate();
+                continue;
+            case Bytecode::eStoreTemp: // FALLTHROUGH
+            case Bytecode::ePushTemp:
+                iter.readTemp();
+                continue;
+            case Bytecode::eUnary:
+                iter.readUnaryOp();
+                continue;
+            case Bytecode::eBinary:
+                iter.readBinaryOp();
+                continue;
+            case Bytecode::eSelect:
+                iter.readSelect();
+                continue;
+        }
+        assert(NULL == "Invalid op type.");
+        break;
+    }
+    return num_args;
+}
+
+// The bytecode as a function of one of its arguments. The other arguments are
+// set before solving, and the stack is kept between calls.
+class Function {
+    const Bytecode::Bytecode &m_bc;
+    const unsigned m_arg_num;
+    std::vector<Dual> m_args, m_stack;
+    
+public:
+    
+    Function(const Bytecode::Bytecode &bc, unsigned arg_num)
+      : m_bc(bc)
+      , m_arg_num(arg_num){
+        const unsigned num_args = NumArgs(bc);
+        m_args.resize((num_args > arg_num) ? num_args : (arg_num + 1));
+        m_stack.resize(bc.stackSize());
+    }
+    
+    inline unsigned numArgs() const {
+        return static_cast<unsigned>(m_args.size());
+    }
+    
+    inline void setArgument(unsigned arg_num, double value){
+        m_args[arg_num] = Dual(value);
+    }
+    
+    inline Dual operator()(double x){
+        m_args[m_arg_num] = Dual(x, 1.0);
+        return Bytecode::Run(m_bc, &(m_args[0]), 1, &(m_stack[0]));
+    }
+};
+
+// Newton's method, kept inside a bracket that shrinks on every step. Steps
+// that would leave the bracket or that do not shrink quickly enough bisect
+// instead, so this always converges once the root is bracketed.
+static bool Solve(Function &f,
+    double low,
+    double high,
+    double tolerance,
+    double &out_root){
+    
+    const Dual f_low = f(low), f_high = f(high);
+    if(f_low.value == 0.0){
+        out_root = low;
+        return true;
+    }
+    if(f_high.value == 0.0){
+        out_root = high;
+        return true;
+    }
+    // The ends must have different signs. This is also false for NaN.
+    if(!(f_low.value * f_high.value < 0.0))
+        return false;
+    
+    // below is the end of the bracket where the function is negative.
+    double below = (f_low.value < 0.0) ? low : high;
+    double above = (f_low.value < 0.0) ? high : low;
+    double x = 0.5 * (low + high);
+    double step = ::fabs(high - low), last_step = step;
+    Dual fx = f(x);
+    for(unsigned i = 0; i < max_iterations; i++){
+        if(fx.value == 0.0){
+            out_root = x;
+            return true;
+        }
+        
+        // These comparisons are false for NaN, which bisects.
+        const bool use_newton =
+            (((x - above) * fx.derivative) - fx.value) *
+                (((x - below) * fx.derivative) - fx.value) <= 0.0 &&
+            ::fabs(2.0 * fx.value) <= ::fabs(last_step * fx.derivative);
+        last_step = step;
+        if(use_newton){
+            const double previous = x;
+            step = fx.value / fx.derivative;
+            x -= step;
+            if(x == previous){
+                out_root = x;
+                return true;
+            }
+        }
+        else{
+            step = 0.5 * (above - below);
+            x = below + step;
+            if(x == below){
+                out_root = x;
+                return true;
+            }
+        }
+        if(::fabs(step) <= tolerance){
+            out_root = x;
+            return true;
+        }
+        
+        fx = f(x);
+        if(fx.value < 0.0)
+            below = x;
+        else
+            above = x;
+    }
+    return false;
+}
+
+} // namespace RootFind
+} // namespace DC
+
+int DC_API_CALL DC_FindRoot(const struct DC_Bytecode *bc,
+    unsigned arg_num,
+    const float *args,
+    float low,
+    float high,
+    float tolerance,
+    float *out_root){
+    
+    double root;
+    out_root[0] = std::numeric_limits<float>::quiet_NaN();
+    if(bc == NULL)
+        return 0;
+    
+    DC::RootFind::Function f(*(const DC::Bytecode::Bytecode*)bc, arg_num);
+    for(unsigned a = 0; a < f.numArgs(); a++){
+        if(a != arg_num)
+            f.setArgument(a, args[a]);
+    }
+    if(!DC::RootFind::Solve(f, low, high, tolerance, root))
+        return 0;
+    out_root[0] = static_cast<float>(root);
+    return 1;
+}
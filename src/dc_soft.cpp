@@ -4,22 +4,31 @@
 // License, v. 2.0. If a copy of the MPL was not distributed with this
 // file, You can obtain one at http://mozilla.org/MPL/2.0/.
 
-#include "dc_bytecode.hpp"
+#include "dc.h"
+#include "dc_interpreter.hpp"
 #include "dc_backend.h"
 
-#include <vector>
-#include <math.h>
 #include <assert.h>
 
 // Software backend
 // The build instructions assembly bytecode.
-// Running interprets the bytecode format defined in dc_bytecode.hpp
-
-struct DC_X_Context {};
+// Running interprets the bytecode format defined in dc_bytecode.hpp, using the
+// interpreter in dc_interpreter.hpp
+
+struct DC_X_Context {
+    DC_X_Context()
+      : use_double(false)
+      , fast_math(false){}
+    bool use_double;
+    bool fast_math;
+};
 
 // Inheriting like this allows us to implement the Finalize method as passthrough.
+// use_double is copied from the context when the builder is created, and
+// selects the type that the stack is kept in. It can be changed for a single
+// builder with DC_X_SetBuilderOption.
 struct DC_X_Calculation : public DC::Bytecode::Bytecode {
-
+    bool use_double;
 };
 
 struct DC_X_CalculationBuilder : public DC_X_Calculation {
@@ -34,12 +43,47 @@ void DC_X_FreeContext(struct DC_X_Context *ctx){
     delete ctx;
 }
 
+int DC_X_SetOption(DC_X_Context *ctx, int option, unsigned value){
+    switch(option){
+        case DC_OPTION_DOUBLE:
+            ctx->use_double = (value != 0);
+            return 1;
+        case DC_OPTION_FAST_MATH:
+            ctx->fast_math = (value != 0);
+            return 1;
+    }
+    return 0;
+}
+
+unsigned DC_X_GetOption(const DC_X_Context *ctx, int option){
+    switch(option){
+        case DC_OPTION_DOUBLE:
+            return ctx->use_double;
+        case DC_OPTION_FAST_MATH:
+            return ctx->fast_math;
+    }
+    return 0;
+}
+
 DC_X_CalculationBuilder *DC_X_CreateCalculationBuilder(DC_X_Context *ctx){
+    DC_X_CalculationBuilder *const bld = new DC_X_CalculationBuilder;
+    bld->use_double = ctx->use_double;
+    return bld;
+}
+
+int DC_X_SetBuilderOption(DC_X_Context *ctx,
+    DC_X_CalculationBuilder *bld,
+    int option,
+    unsigned value){
     (void)ctx;
-    return new DC_X_CalculationBuilder;
+    if(option == DC_OPTION_DOUBLE){
+        bld->use_double = (value != 0);
+        return 1;
+    }
+    return 0;
 }
 
-void DC_X_BuildPushImmediate(DC_X_Context *ctx, DC_X_CalculationBuilder *bld, float value){
+void DC_X_BuildPushImmediate(DC_X_Context *ctx, DC_X_CalculationBuilder *bld, double value){
     (void)ctx;
     bld->writeImmediate(value);
 }
@@ -71,24 +115,75 @@ void DC_X_Build ## NAME ## Arg(DC_X_Context *ctx, \
     bld->writeBinaryArgument<DC::Bytecode::e ## NAME>(arg_num); \
 } \
 void DC_X_Build ## NAME ## Imm(DC_X_Context *ctx, \
-    DC_X_CalculationBuilder *bld, float value){\
+    DC_X_CalculationBuilder *bld, double value){\
     (void)ctx; \
     bld->writeBinaryImmediate<DC::Bytecode::e ## NAME>(value); \
 }
 
+void DC_X_BuildSelect(DC_X_Context *ctx, DC_X_CalculationBuilder *bld){
+    (void)ctx;
+    bld->writeSelect();
+}
+
 void DC_X_BuildPop(DC_X_Context *ctx, DC_X_CalculationBuilder *bld){\
     (void)ctx;
     bld->writeUnary<DC::Bytecode::ePop>();
 }
 
+void DC_X_BuildDup(DC_X_Context *ctx, DC_X_CalculationBuilder *bld){
+    (void)ctx;
+    bld->writeUnary<DC::Bytecode::eDup>();
+}
+
+void DC_X_BuildReserveTemps(DC_X_Context *ctx,
+    DC_X_CalculationBuilder *bld,
+    unsigned short num_temps){
+    (void)ctx;
+    bld->reserveTemps(num_temps);
+}
+
+void DC_X_BuildStoreTemp(DC_X_Context *ctx,
+    DC_X_CalculationBuilder *bld,
+    unsigned short temp){
+    (void)ctx;
+    bld->writeStoreTemp(temp);
+}
+
+void DC_X_BuildPushTemp(DC_X_Context *ctx,
+    DC_X_CalculationBuilder *bld,
+    unsigned short temp){
+    (void)ctx;
+    bld->writePushTemp(temp);
+}
+
+void DC_X_BuildStoreArg(DC_X_Context *ctx,
+    DC_X_CalculationBuilder *bld,
+    unsigned short arg_num){
+    (void)ctx;
+    bld->writeStoreArg(arg_num);
+}
+
 DC_SOFT_UNOP(Sin)
 DC_SOFT_UNOP(Cos)
 DC_SOFT_UNOP(Sqrt)
+DC_SOFT_UNOP(Tan)
+DC_SOFT_UNOP(Exp)
+DC_SOFT_UNOP(Log)
+DC_SOFT_UNOP(Abs)
+DC_SOFT_UNOP(Floor)
 
 DC_SOFT_BINOP(Add)
 DC_SOFT_BINOP(Sub)
 DC_SOFT_BINOP(Mul)
 DC_SOFT_BINOP(Div)
+DC_SOFT_BINOP(Pow)
+DC_SOFT_BINOP(Atan2)
+DC_SOFT_BINOP(Min)
+DC_SOFT_BINOP(Max)
+DC_SOFT_BINOP(Less)
+DC_SOFT_BINOP(LessEqual)
+DC_SOFT_BINOP(Equal)
+DC_SOFT_BINOP(NotEqual)
 
 void DC_X_AbandonCalculation(DC_X_Context *ctx, DC_X_CalculationBuilder *bld){
     (void)ctx;
@@ -97,6 +192,8 @@ void DC_X_AbandonCalculation(DC_X_Context *ctx, DC_X_CalculationBuilder *bld){
 
 DC_X_Calculation *DC_X_FinalizeCalculation(DC_X_Context *ctx, DC_X_CalculationBuilder *bld){
     (void)ctx;
+    // The interpreter relies on this, rather than checking the stack itself.
+    assert(bld->depth() == 1);
     return bld;
 }
 
@@ -106,73 +203,32 @@ void DC_X_Free(DC_X_Context *ctx, DC_X_Calculation *calc){
 }
 
 float DC_X_Calculate(const struct DC_X_Calculation *calc, const float *args){
-    DC::Bytecode::Bytecode::iterator iter = calc->begin(), end = calc->end();
-    std::vector<float> stack;
-    stack.reserve(16); // Pretty reasonable guess
-    while(iter != end){
-        switch(iter.opType()){
-            case DC::Bytecode::eImmediate:
-                // Push an immediate onto the stack
-                stack.push_back(iter.readImmediate());
-                continue;
-            case DC::Bytecode::eArgument:
-                // Push an argument onto the stack
-                {
-                    const unsigned short arg_num = iter.readArgument();
-                    const float value = args[arg_num];
-                    stack.push_back(value);
-                }
-                continue;
-            case DC::Bytecode::eUnary:
-                // Get the value to operate on.
-                // All unary ops work on the top value of the stack.
-                {
-                    assert(!stack.empty());
-                    const float value = stack.back();
-                    switch(iter.readUnaryOp()){
-                        case DC::Bytecode::eSin:
-                            stack.back() = sin(value);
-                            continue;
-                        case DC::Bytecode::eCos:
-                            stack.back() = cos(value);
-                            continue;
-                        case DC::Bytecode::eSqrt:
-                            stack.back() = sqrt(value);
-                            continue;
-                        case DC::Bytecode::ePop:
-                            stack.pop_back();
-                            continue;
-                    }
-                }
-                assert(NULL == "Invalid unary op.");
-                continue;
-            case DC::Bytecode::eBinary:
-                assert(stack.size() >= 2);
-                {
-                    const float value = stack.back();
-                    stack.pop_back();
-                    switch(iter.readBinaryOp()){
-                        case DC::Bytecode::eAdd:
-                            stack.back() += value;
-                            continue;
-                        case DC::Bytecode::eSub:
-                            stack.back() -= value;
-                            continue;
-                        case DC::Bytecode::eMul:
-                            stack.back() *= value;
-                            continue;
-                        case DC::Bytecode::eDiv:
-                            stack.back() /= value;
-                            continue;
-                    }
-                }
-                assert(NULL == "Invalid binary op.");
-                continue;
-        }
-        assert(NULL == "Invalid op type.");
-        continue;
-    }
+    if(calc->use_double)
+        return static_cast<float>(DC::Bytecode::RunLocal<double>(*calc, args));
+    else
+        return DC::Bytecode::RunLocal<float>(*calc, args);
+}
+
+double DC_X_CalculateDouble(const struct DC_X_Calculation *calc,
+    const double *args){
+    if(calc->use_double)
+        return DC::Bytecode::RunLocal<double>(*calc, args);
+    else
+        return DC::Bytecode::RunLocal<float>(*calc, args);
+}
+
+DC_X_NativeFunction DC_X_GetNativeFunction(const struct DC_X_Calculation *calc){
+    (void)calc;
+    return NULL;
+}
+
+void DC_X_CalculateBatch(const struct DC_X_Calculation *calc,
+    unsigned n,
+    const float *args,
+    float *out){
     
-    assert(stack.size() == 1);
-    return stack.back();
+    if(calc->use_double)
+        DC::Bytecode::RunBatch<double>(*calc, n, args, out);
+    else
+        DC::Bytecode::RunBatch<float>(*calc, n, args, out);
 }
@@ -9,13 +9,19 @@ CCFLAGS=-Wall -Wextra -pedantic -Werror $(SYSFLAGS)
 CFLAGS=$(CCFLAGS) -ansi -Wenum-compare -Wshadow
 CXXFLAGS=$(CCFLAGS) -std=c++14 -fno-rtti -fno-exceptions
 
-dc_core.bc: dc_core.c dc.h dc_backend.h
+dc_core.bc: dc_core.c dc.h dc_backend.h dc_ir.h dc_cache.h
 	$(CC) $(CFLAGS) -c dc_core.c -o dc_core.bc
 
+dc_ir.bc: dc_ir.c dc_ir.h dc_backend.h dc_bc.h
+	$(CC) $(CFLAGS) -c dc_ir.c -o dc_ir.bc
+
+dc_cache.bc: dc_cache.c dc_cache.h
+	$(CC) $(CFLAGS) -c dc_cache.c -o dc_cache.bc
+
 # Emscripten components
 dc_js.bc: dc_js.cpp dc_backend.h
 	$(CXX) $(CXXFLAGS) -c dc_js.cpp -o dc_js.bc
 
-OBJECTS=dc_core.bc dc_js.bc
+OBJECTS=dc_core.bc dc_ir.bc dc_cache.bc dc_js.bc
 dcjit.js: $(OBJECTS)
 	$(CXX) $(LINKFLAGS) -shared $(OBJECTS) --pre-js dc_jit_js.js -o dcjit.js
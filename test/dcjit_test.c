@@ -1,8 +1,14 @@
 #include "dcjit_test.h"
 #include "dc.h"
 
+#include <math.h>
+
 static const float dc_epsilon = 0.00001f;
 
+/* Batches are compared against the same calculation run on one set at a time,
+ * which should give the same result up to rounding. */
+static const float dc_batch_epsilon = 0.000001f;
+
 #define COMMA ,
 
 /* Expects a calculation to succeed. */
@@ -65,6 +71,60 @@ static int fail_calculation(const char *source,
     }
 }
 
+/* A calculation of x and y, and its result for the arguments of a test. */
+struct dc_test_case {
+    const char *source;
+    float expected;
+};
+
+/* Expects calculations of x and y to give the expected results for args, in
+ * both precisions and with and without DC_OPTION_FAST_MATH. Each calculation
+ * is also run as a batch over the five sets in batch_args, which must match
+ * running it on each set alone. */
+static int check_calculations(unsigned num_cases,
+    const struct dc_test_case *cases,
+    const float *args,
+    const float *batch_args){
+    
+    const char *const argnames[] = {"x", "y"};
+    float out[5], set[2];
+    const char *err;
+    unsigned use_double, fast, i, n;
+    struct DC_Calculation *calc;
+    struct DC_Context *const ctx = DC_CreateContext();
+    
+    for(use_double = 0; use_double < 2; use_double++){
+        DC_SetOption(ctx, DC_OPTION_DOUBLE, use_double);
+        for(fast = 0; fast < 2; fast++){
+            DC_SetOption(ctx, DC_OPTION_FAST_MATH, fast);
+            for(n = 0; n < num_cases; n++){
+                calc = DC_CompileCalculation(ctx,
+                    cases[n].source,
+                    2,
+                    argnames,
+                    &err);
+                YYY_ASSERT_TRUE(calc != NULL);
+                YYY_ASSERT_FLOAT_EQ(DC_Calculate(calc, args),
+                    cases[n].expected,
+                    dc_epsilon);
+                
+                DC_CalculateBatch(calc, 5, batch_args, out);
+                for(i = 0; i < 5; i++){
+                    set[0] = batch_args[i];
+                    set[1] = batch_args[i + 5];
+                    YYY_ASSERT_FLOAT_EQ(out[i],
+                        DC_Calculate(calc, set),
+                        dc_batch_epsilon);
+                }
+                DC_Free(ctx, calc);
+            }
+        }
+    }
+    
+    DC_FreeContext(ctx);
+    return 1;
+}
+
 #define RUN_CALCULATION_ARGS(SOURCE, ARGNAMES, ARGS, VALUE) do{\
         const char *const argnames[] = ARGNAMES;\
         const float args[] = ARGS;\
@@ -140,6 +200,1276 @@ static int one_arg_test(void){
     return 1;
 }
 
+/* Tests that many calculations in one context, which share pages, all keep
+ * their own results as other calculations are freed and compiled. */
+static int shared_page_test(void){
+#define DC_SHARED_PAGE_TEST_COUNT 300
+    struct DC_Calculation *calcs[DC_SHARED_PAGE_TEST_COUNT];
+    const char *const argnames[] = {"x"};
+    const float arg = 2.0f;
+    const char *err;
+    char source[0x40];
+    unsigned i;
+    struct DC_Context *const ctx = DC_CreateContext();
+    
+    for(i = 0; i < DC_SHARED_PAGE_TEST_COUNT; i++){
+        sprintf(source, "x * %u + 1", i);
+        calcs[i] = DC_CompileCalculation(ctx, source, 1, argnames, &err);
+        YYY_ASSERT_TRUE(calcs[i] != NULL);
+    }
+    
+    /* Free every other calculation, then recompile into the holes. */
+    for(i = 0; i < DC_SHARED_PAGE_TEST_COUNT; i += 2)
+        DC_Free(ctx, calcs[i]);
+    for(i = 0; i < DC_SHARED_PAGE_TEST_COUNT; i += 2){
+        sprintf(source, "x * %u + 1", i);
+        calcs[i] = DC_CompileCalculation(ctx, source, 1, argnames, &err);
+        YYY_ASSERT_TRUE(calcs[i] != NULL);
+    }
+    
+    for(i = 0; i < DC_SHARED_PAGE_TEST_COUNT; i++){
+        YYY_ASSERT_FLOAT_EQ(DC_Calculate(calcs[i], &arg),
+            (float)(i * 2 + 1), dc_epsilon);
+        DC_Free(ctx, calcs[i]);
+    }
+    
+    DC_FreeContext(ctx);
+    return 1;
+#undef DC_SHARED_PAGE_TEST_COUNT
+}
+
+/* Tests that calculations still work when pages are recycled through a small
+ * page pool, and when the pool is disabled. */
+static int page_pool_test(void){
+#define DC_PAGE_POOL_TEST_COUNT 300
+    struct DC_Calculation *calcs[DC_PAGE_POOL_TEST_COUNT];
+    const char *const argnames[] = {"x"};
+    const float arg = 3.0f;
+    const char *err;
+    char source[0x40];
+    unsigned i, pool_size;
+    struct DC_Context *const ctx = DC_CreateContext();
+    
+    for(pool_size = 0; pool_size < 2; pool_size++){
+        /* The interpreter has no pages to pool, so this may be unsupported. */
+        DC_SetOption(ctx, DC_OPTION_MAX_FREE_PAGES, pool_size);
+        
+        for(i = 0; i < DC_PAGE_POOL_TEST_COUNT; i++){
+            sprintf(source, "x - %u", i);
+            calcs[i] = DC_CompileCalculation(ctx, source, 1, argnames, &err);
+            YYY_ASSERT_TRUE(calcs[i] != NULL);
+        }
+        for(i = 0; i < DC_PAGE_POOL_TEST_COUNT; i++){
+            YYY_ASSERT_FLOAT_EQ(DC_Calculate(calcs[i], &arg),
+                3.0f - (float)i, dc_epsilon);
+            DC_Free(ctx, calcs[i]);
+        }
+    }
+    
+    DC_FreeContext(ctx);
+    return 1;
+#undef DC_PAGE_POOL_TEST_COUNT
+}
+
+/* Tests a calculation whose code is bigger than a page, compiled between two
+ * small calculations that share a page. */
+static int large_calculation_test(void){
+#define DC_LARGE_CALCULATION_TEST_TERMS 200
+    struct DC_Calculation *calcs[3];
+    const char *const argnames[] = {"x"};
+    const float arg = 0.5f;
+    const char *err;
+    char source[DC_LARGE_CALCULATION_TEST_TERMS * 16 + 1];
+    double expected = 0.0;
+    unsigned i, at = 0;
+    struct DC_Context *const ctx = DC_CreateContext();
+    
+    for(i = 1; i <= DC_LARGE_CALCULATION_TEST_TERMS; i++){
+        at += sprintf(source + at, "%ssin(x*%u)", (i == 1) ? "" : "+", i);
+        expected += sin(0.5 * i);
+    }
+    
+    calcs[0] = DC_CompileCalculation(ctx, "x + 1", 1, argnames, &err);
+    YYY_ASSERT_TRUE(calcs[0] != NULL);
+    calcs[1] = DC_CompileCalculation(ctx, source, 1, argnames, &err);
+    YYY_ASSERT_TRUE(calcs[1] != NULL);
+    calcs[2] = DC_CompileCalculation(ctx, "x + 2", 1, argnames, &err);
+    YYY_ASSERT_TRUE(calcs[2] != NULL);
+    
+    YYY_ASSERT_FLOAT_EQ(DC_Calculate(calcs[0], &arg), 1.5f, dc_epsilon);
+    YYY_ASSERT_FLOAT_EQ(DC_Calculate(calcs[1], &arg), (float)expected, 0.001f);
+    YYY_ASSERT_FLOAT_EQ(DC_Calculate(calcs[2], &arg), 2.5f, dc_epsilon);
+    
+    for(i = 0; i < 3; i++)
+        DC_Free(ctx, calcs[i]);
+    DC_FreeContext(ctx);
+    return 1;
+#undef DC_LARGE_CALCULATION_TEST_TERMS
+}
+
+/* Tests an expression whose stack is deeper than the number of registers, so
+ * that the JIT has to spill values to the native stack. */
+static int deep_stack_test(void){
+#define DC_DEEP_STACK_TEST_DEPTH 40
+    const char *const argnames[] = {"x", "y"};
+    const float args[] = {2.0f, 3.0f};
+    const char *err;
+    char source[DC_DEEP_STACK_TEST_DEPTH * 8 + 1];
+    struct DC_Calculation *calc;
+    unsigned i, at = 0;
+    struct DC_Context *const ctx = DC_CreateContext();
+    
+    /* x*y+(x*y+(x*y+...)) keeps one more value on the stack for each term. */
+    for(i = 1; i < DC_DEEP_STACK_TEST_DEPTH; i++)
+        at += sprintf(source + at, "x*y+(");
+    at += sprintf(source + at, "x*y");
+    for(i = 1; i < DC_DEEP_STACK_TEST_DEPTH; i++)
+        source[at++] = ')';
+    source[at] = '\0';
+    
+    calc = DC_CompileCalculation(ctx, source, 2, argnames, &err);
+    YYY_ASSERT_TRUE(calc != NULL);
+    YYY_ASSERT_FLOAT_EQ(DC_Calculate(calc, args),
+        6.0f * DC_DEEP_STACK_TEST_DEPTH, dc_epsilon);
+    
+    DC_Free(ctx, calc);
+    DC_FreeContext(ctx);
+    return 1;
+#undef DC_DEEP_STACK_TEST_DEPTH
+}
+
+/* Uses arguments that are too far into the arguments for a one byte offset,
+ * both on their own and as the operands of other operations. Argument N is
+ * named with the letters for N / 26 and N % 26, so "cm" is argument 64. */
+static int many_args_test(void){
+#define DC_MANY_ARGS_TEST_COUNT 70
+    const char *const sources[] = {
+        "cm",
+        "ab + bo",
+        "ab - by",
+        "ab * ci",
+        "ab / cr",
+        "sqrt(bt)",
+        "sin(bh)",
+        "cos(bg)"
+    };
+    const unsigned num_sources = sizeof(sources) / sizeof(sources[0]);
+    char names[DC_MANY_ARGS_TEST_COUNT][3];
+    const char *argnames[DC_MANY_ARGS_TEST_COUNT];
+    float args[DC_MANY_ARGS_TEST_COUNT];
+    float expected[sizeof(sources) / sizeof(sources[0])];
+    const char *err;
+    unsigned use_double, i;
+    struct DC_Calculation *calc;
+    struct DC_Context *const ctx = DC_CreateContext();
+    
+    for(i = 0; i < DC_MANY_ARGS_TEST_COUNT; i++){
+        names[i][0] = (char)('a' + (i / 26));
+        names[i][1] = (char)('a' + (i % 26));
+        names[i][2] = '\0';
+        argnames[i] = names[i];
+        args[i] = 1.0f + ((float)i * 0.25f);
+    }
+    expected[0] = args[64];
+    expected[1] = args[1] + args[40];
+    expected[2] = args[1] - args[50];
+    expected[3] = args[1] * args[60];
+    expected[4] = args[1] / args[69];
+    expected[5] = (float)sqrt(args[45]);
+    expected[6] = (float)sin(args[33]);
+    expected[7] = (float)cos(args[32]);
+    
+    for(use_double = 0; use_double < 2; use_double++){
+        DC_SetOption(ctx, DC_OPTION_DOUBLE, use_double);
+        for(i = 0; i < num_sources; i++){
+            calc = DC_CompileCalculation(ctx,
+                sources[i],
+                DC_MANY_ARGS_TEST_COUNT,
+                argnames,
+                &err);
+            YYY_ASSERT_TRUE(calc != NULL);
+            YYY_ASSERT_FLOAT_EQ(DC_Calculate(calc, args),
+                expected[i],
+                dc_epsilon);
+            DC_Free(ctx, calc);
+        }
+    }
+    
+    DC_FreeContext(ctx);
+    return 1;
+#undef DC_MANY_ARGS_TEST_COUNT
+}
+
+/* Checks sin and cos against libm, with and without DC_OPTION_FAST_TRIG. */
+static int trig_test(void){
+    const char *const argnames[] = {"x"};
+    const char *err;
+    struct DC_Calculation *sin_calc, *cos_calc;
+    unsigned fast;
+    int i;
+    struct DC_Context *const ctx = DC_CreateContext();
+    
+    for(fast = 0; fast < 2; fast++){
+        DC_SetOption(ctx, DC_OPTION_FAST_TRIG, fast);
+        sin_calc = DC_CompileCalculation(ctx, "sin(x)", 1, argnames, &err);
+        YYY_ASSERT_TRUE(sin_calc != NULL);
+        cos_calc = DC_CompileCalculation(ctx, "cos(x)", 1, argnames, &err);
+        YYY_ASSERT_TRUE(cos_calc != NULL);
+        
+        for(i = -1000; i <= 1000; i++){
+            const float x = (float)i * 0.0731f;
+            YYY_ASSERT_FLOAT_EQ(DC_Calculate(sin_calc, &x),
+                (float)sin(x), 0.000001f);
+            YYY_ASSERT_FLOAT_EQ(DC_Calculate(cos_calc, &x),
+                (float)cos(x), 0.000001f);
+        }
+        
+        DC_Free(ctx, sin_calc);
+        DC_Free(ctx, cos_calc);
+    }
+    
+    /* Sweep the default fast path out to 1e5, checking the error bounds that
+     * DC_OPTION_FAST_TRIG documents against libm in double precision. */
+    DC_SetOption(ctx, DC_OPTION_FAST_TRIG, 1);
+    sin_calc = DC_CompileCalculation(ctx, "sin(x)", 1, argnames, &err);
+    YYY_ASSERT_TRUE(sin_calc != NULL);
+    cos_calc = DC_CompileCalculation(ctx, "cos(x)", 1, argnames, &err);
+    YYY_ASSERT_TRUE(cos_calc != NULL);
+    
+    for(i = -200000; i <= 200000; i++){
+        const float x = (float)((double)i * 0.5);
+        const double limit = (fabs(x) <= 10000.0) ? 2e-7 : 1.5e-6;
+        YYY_ASSERT_TRUE(fabs(DC_Calculate(sin_calc, &x) - sin(x)) < limit);
+        YYY_ASSERT_TRUE(fabs(DC_Calculate(cos_calc, &x) - cos(x)) < limit);
+    }
+    
+    for(i = -20000; i <= 20000; i++){
+        const float x = (float)((double)i * 0.0731);
+        YYY_ASSERT_TRUE(fabs(DC_Calculate(sin_calc, &x) - sin(x)) < 2e-7);
+        YYY_ASSERT_TRUE(fabs(DC_Calculate(cos_calc, &x) - cos(x)) < 2e-7);
+    }
+    
+    DC_Free(ctx, sin_calc);
+    DC_Free(ctx, cos_calc);
+    
+    DC_FreeContext(ctx);
+    return 1;
+}
+
+/* Checks that DC_CalculateBatch matches DC_Calculate, including for sets left
+ * over after the packed groups and for calculations with no packed code. */
+static int batch_test(void){
+    const char *const argnames[] = {"x", "y"};
+    const char *const source =
+        "sqrt(x*x+y*y)*2+sin(y)/3+(x*(y+(x*(y+(x*(y+(x*(y+cos(x)))))))))";
+    const char *err;
+    struct DC_Calculation *calc;
+    unsigned fast, i;
+    float args[22], out[11], set[2];
+    struct DC_Context *const ctx = DC_CreateContext();
+    
+    for(i = 0; i < 11; i++){
+        args[i] = (float)i * 0.25f;
+        args[i + 11] = 2.0f - ((float)i * 0.5f);
+    }
+    
+    for(fast = 0; fast < 2; fast++){
+        DC_SetOption(ctx, DC_OPTION_FAST_TRIG, fast);
+        calc = DC_CompileCalculation(ctx, source, 2, argnames, &err);
+        YYY_ASSERT_TRUE(calc != NULL);
+        
+        DC_CalculateBatch(calc, 11, args, out);
+        for(i = 0; i < 11; i++){
+            set[0] = args[i];
+            set[1] = args[i + 11];
+            YYY_ASSERT_FLOAT_EQ(out[i],
+                DC_Calculate(calc, set),
+                dc_batch_epsilon);
+        }
+        
+        DC_Free(ctx, calc);
+    }
+    
+    DC_FreeContext(ctx);
+    return 1;
+}
+
+/* Checks that native functions match DC_Calculate. The interpreter does not
+ * have native functions, so this passes if there are none. */
+static int native_function_test(void){
+    const char *const argnames[] = {"x", "y"};
+    const char *const sources[] = {
+        "x",
+        "x*y+2",
+        "sin(x)*cos(y)",
+        "x*(y+(x*(y+(x*(y+(x*(y+sqrt(x))))))))"
+    };
+    const float args[] = { 1.5f, -0.25f };
+    const char *err;
+    unsigned i;
+    struct DC_Context *const ctx = DC_CreateContext();
+    
+    for(i = 0; i < sizeof(sources) / sizeof(*sources); i++){
+        DC_NativeFunction func;
+        struct DC_Calculation *const calc =
+            DC_CompileCalculation(ctx, sources[i], 2, argnames, &err);
+        YYY_ASSERT_TRUE(calc != NULL);
+        
+        func = DC_GetNativeFunction(calc);
+        if(func != NULL){
+            YYY_ASSERT_FLOAT_EQ(func(args), DC_Calculate(calc, args), 0.0f);
+        }
+        
+        DC_Free(ctx, calc);
+    }
+    
+    DC_FreeContext(ctx);
+    return 1;
+}
+
+/* Checks that operands keep their order when the second operand of a
+ * non-commutative operation is more complex than the first. */
+static int operand_order_test(void){
+    const char *const argnames[] = {"x", "y", "z"};
+    const float args[] = { 2.0f, 3.0f, 0.5f };
+    const char *err;
+    struct DC_Calculation *calc;
+    struct DC_Context *const ctx = DC_CreateContext();
+    
+    calc = DC_CompileCalculation(ctx, "x-y*z", 3, argnames, &err);
+    YYY_ASSERT_TRUE(calc != NULL);
+    YYY_ASSERT_FLOAT_EQ(DC_Calculate(calc, args), 0.5f, 0.00001f);
+    DC_Free(ctx, calc);
+    
+    calc = DC_CompileCalculation(ctx, "1/(x+y)-z/(x-(y-z))", 3, argnames, &err);
+    YYY_ASSERT_TRUE(calc != NULL);
+    YYY_ASSERT_FLOAT_EQ(DC_Calculate(calc, args), 1.2f, 0.00001f);
+    DC_Free(ctx, calc);
+    
+    DC_FreeContext(ctx);
+    return 1;
+}
+
+/* Checks repeated subexpressions, including ones used while values are
+ * spilled, in both precisions and in batches. */
+static int cse_test(void){
+    const char *const argnames[] = {"x", "y"};
+    const char *const source =
+        "sqrt(x*x+y*y)*2+sqrt(x*x+y*y)/(1+sqrt(x*x+y*y))";
+    const char *const deep_source =
+        "x*y+(y+(x*(y+(x*(y+(x*(y+x*y)))))))*(x*y+sin(x*y))";
+    const float args[] = { 1.5f, -0.25f };
+    float batch_args[10], out[5], set[2];
+    const char *err;
+    double len, xy, expected, deep_expected;
+    unsigned use_double, i;
+    struct DC_Calculation *calc;
+    struct DC_Context *const ctx = DC_CreateContext();
+    
+    len = sqrt(1.5 * 1.5 + 0.25 * 0.25);
+    expected = len * 2.0 + len / (1.0 + len);
+    xy = 1.5 * -0.25;
+    deep_expected = xy +
+        (-0.25 + (1.5 * (-0.25 + (1.5 * (-0.25 + (1.5 * (-0.25 + xy))))))) *
+        (xy + sin(xy));
+    
+    for(i = 0; i < 5; i++){
+        batch_args[i] = (float)i * 0.5f;
+        batch_args[i + 5] = 1.0f - (float)i;
+    }
+    
+    for(use_double = 0; use_double < 2; use_double++){
+        DC_SetOption(ctx, DC_OPTION_DOUBLE, use_double);
+    
+        calc = DC_CompileCalculation(ctx, source, 2, argnames, &err);
+        YYY_ASSERT_TRUE(calc != NULL);
+        YYY_ASSERT_FLOAT_EQ(DC_Calculate(calc, args),
+            (float)expected,
+            0.00001f);
+        DC_Free(ctx, calc);
+    
+        calc = DC_CompileCalculation(ctx, deep_source, 2, argnames, &err);
+        YYY_ASSERT_TRUE(calc != NULL);
+        YYY_ASSERT_FLOAT_EQ(DC_Calculate(calc, args),
+            (float)deep_expected,
+            0.00001f);
+    
+        DC_CalculateBatch(calc, 5, batch_args, out);
+        for(i = 0; i < 5; i++){
+            set[0] = batch_args[i];
+            set[1] = batch_args[i + 5];
+            YYY_ASSERT_FLOAT_EQ(out[i],
+                DC_Calculate(calc, set),
+                dc_batch_epsilon);
+        }
+        DC_Free(ctx, calc);
+    }
+    
+    DC_FreeContext(ctx);
+    return 1;
+}
+
+/* Checks expressions that are simplified and reassociated, both with and
+ * without DC_OPTION_FAST_MATH. */
+static int fast_math_test(void){
+#define DC_FAST_MATH_TEST_COUNT 8
+    const char *const argnames[] = {"x", "y"};
+    const char *const sources[DC_FAST_MATH_TEST_COUNT] = {
+        "x+1+2",
+        "2*x*3",
+        "x-(-2)-(0-y)",
+        "(x+1)+(y+2)-3",
+        "x*1/1+0*y",
+        "1-(x+2)*-1",
+        "12/(x*4)+(0-y)",
+        "(x-0)*(y*2)/4*x"
+    };
+    const float args[] = { 1.5f, -0.25f };
+    const float expected[DC_FAST_MATH_TEST_COUNT] = {
+        4.5f,
+        9.0f,
+        3.25f,
+        1.25f,
+        1.5f,
+        4.5f,
+        2.25f,
+        -0.28125f
+    };
+    const char *err;
+    unsigned fast, i;
+    struct DC_Calculation *calc;
+    struct DC_Context *const ctx = DC_CreateContext();
+    
+    for(fast = 0; fast < 2; fast++){
+        DC_SetOption(ctx, DC_OPTION_FAST_MATH, fast);
+        for(i = 0; i < DC_FAST_MATH_TEST_COUNT; i++){
+            calc = DC_CompileCalculation(ctx, sources[i], 2, argnames, &err);
+            YYY_ASSERT_TRUE(calc != NULL);
+            YYY_ASSERT_FLOAT_EQ(DC_Calculate(calc, args),
+                expected[i],
+                dc_epsilon);
+            DC_Free(ctx, calc);
+        }
+    }
+    
+    DC_FreeContext(ctx);
+    return 1;
+#undef DC_FAST_MATH_TEST_COUNT
+}
+
+/* Checks divisions by constants, squares, and doubling, including squares of
+ * values that are spilled, in both precisions and in batches. */
+static int strength_test(void){
+#define DC_STRENGTH_TEST_COUNT 6
+    const struct dc_test_case cases[DC_STRENGTH_TEST_COUNT] = {
+        { "x/4+y/0.125", -1.625f },
+        { "x/3-y/-0.1", -2.0f },
+        { "x*2+(x+y)*(x+y)", 4.5625f },
+        { "x*x*x-y*y", 3.3125f },
+        { "x+(y+(x+(y+(x+(y+(x*2+(y-x)*(y-x)))))))", 9.8125f },
+        { "sqrt(x*x+y*y+1.6875)/8", 0.25f }
+    };
+    const float args[] = { 1.5f, -0.25f };
+    float batch_args[10];
+    unsigned i;
+    
+    for(i = 0; i < 5; i++){
+        batch_args[i] = (float)i * 0.5f;
+        batch_args[i + 5] = 1.0f - (float)i;
+    }
+    
+    YYY_ASSERT_TRUE(check_calculations(DC_STRENGTH_TEST_COUNT,
+        cases,
+        args,
+        batch_args));
+    return 1;
+#undef DC_STRENGTH_TEST_COUNT
+}
+
+static int pow_test(void){
+#define DC_POW_TEST_COUNT 11
+    const char *const argnames[] = {"x", "y"};
+    const struct dc_test_case cases[DC_POW_TEST_COUNT] = {
+        { "x^2", 2.25f },
+        { "x^3-y^2", 3.3125f },
+        { "x^-2", 0.4444444f },
+        { "2^3*x", 12.0f },
+        { "x^y", 0.9036020f },
+        { "(x+2.5)^0.5", 2.0f },
+        { "x^(1+y)", 1.3554030f },
+        { "2^x^2", 4.7568285f },
+        { "y^-1+y^2", -3.9375f },
+        { "y^3+y^4", -0.01171875f },
+        { "(y-2)^-3", -0.0877915f }
+    };
+    const float args[] = { 1.5f, -0.25f };
+    float batch_args[10], set[2];
+    const char *err;
+    unsigned i, n;
+    struct DC_Calculation *calc, *tiered;
+    struct DC_Context *ctx;
+    
+    /* General exponents are only valid for positive bases. */
+    for(i = 0; i < 5; i++){
+        batch_args[i] = (float)(i + 1) * 0.5f;
+        batch_args[i + 5] = 1.0f - (float)i;
+    }
+    
+    YYY_ASSERT_TRUE(check_calculations(DC_POW_TEST_COUNT,
+        cases,
+        args,
+        batch_args));
+    
+    /* Integer exponents are valid for negative bases, and the interpreter
+     * gives the same results as the compiled code for them. */
+    ctx = DC_CreateContext();
+    for(n = DC_POW_TEST_COUNT - 3; n < DC_POW_TEST_COUNT; n++){
+        DC_SetOption(ctx, DC_OPTION_TIER_THRESHOLD, 0);
+        calc = DC_CompileCalculation(ctx, cases[n].source, 2, argnames, &err);
+        YYY_ASSERT_TRUE(calc != NULL);
+        DC_SetOption(ctx, DC_OPTION_TIER_THRESHOLD, 1000);
+        tiered =
+            DC_CompileCalculation(ctx, cases[n].source, 2, argnames, &err);
+        YYY_ASSERT_TRUE(tiered != NULL);
+        for(i = 0; i < 5; i++){
+            float value;
+            set[0] = batch_args[i];
+            set[1] = -batch_args[i];
+            value = DC_Calculate(calc, set);
+            /* NaN would pass the comparison. */
+            YYY_ASSERT_TRUE(value == value);
+            YYY_ASSERT_FLOAT_EQ(DC_Calculate(tiered, set), value, dc_epsilon);
+        }
+        DC_Free(ctx, calc);
+        DC_Free(ctx, tiered);
+    }
+    DC_FreeContext(ctx);
+    return 1;
+#undef DC_POW_TEST_COUNT
+}
+
+static int builtin_test(void){
+#define DC_BUILTIN_TEST_COUNT 8
+    const char *const argnames[] = {"x", "y"};
+    const struct dc_test_case cases[DC_BUILTIN_TEST_COUNT] = {
+        { "exp(y)*2", 1.5576016f },
+        { "log(x+1)", 0.9162907f },
+        { "tan(y)", -0.2553419f },
+        { "atan2(y, x)", -0.1651487f },
+        { "abs(y)+abs(x)", 1.75f },
+        { "floor(y)+floor(x*3)", 3.0f },
+        { "min(x, y)*2", -0.5f },
+        { "max(x, y*2)-max(y, -1)", 1.75f }
+    };
+    const float args[] = { 1.5f, -0.25f };
+    float batch_args[10];
+    unsigned i;
+    
+    for(i = 0; i < 5; i++){
+        batch_args[i] = (float)(i + 1) * 0.5f;
+        batch_args[i + 5] = 1.0f - (float)i;
+    }
+    
+    YYY_ASSERT_TRUE(check_calculations(DC_BUILTIN_TEST_COUNT,
+        cases,
+        args,
+        batch_args));
+    
+    /* Builtins must have exactly as many arguments as they take. */
+    YYY_ASSERT_TRUE(fail_calculation("atan2(x)", 2, argnames, args));
+    YYY_ASSERT_TRUE(fail_calculation("min(x, y, x)", 2, argnames, args));
+    YYY_ASSERT_TRUE(fail_calculation("abs(x, y)", 2, argnames, args));
+    return 1;
+#undef DC_BUILTIN_TEST_COUNT
+}
+
+/* Comparisons give 1.0 or 0.0, and selects choose between two values. The
+ * batch results are checked against single calculations, since each lane of a
+ * batch can take a different side of a select. */
+static int select_test(void){
+#define DC_SELECT_TEST_COUNT 8
+    const char *const argnames[] = {"x", "y"};
+    const struct dc_test_case cases[DC_SELECT_TEST_COUNT] = {
+        { "x < y", 0.0f },
+        { "(x >= y) + (x == x)*2 + (x != x)*4", 3.0f },
+        { "x <= y ? x : y", -0.25f },
+        { "x > y ? x*2 : y*3", 3.0f },
+        { "y ? x : 10", 1.5f },
+        { "y-y ? x : 10", 10.0f },
+        { "x < 1 ? x < 0.5 ? 1 : 2 : 3", 3.0f },
+        { "(x+y > 1) * (x - 2) + 1", 0.5f }
+    };
+    const float args[] = { 1.5f, -0.25f };
+    float batch_args[10];
+    unsigned i;
+    
+    for(i = 0; i < 5; i++){
+        batch_args[i] = (float)i * 0.5f;
+        batch_args[i + 5] = 1.0f - (float)i * 0.25f;
+    }
+    
+    YYY_ASSERT_TRUE(check_calculations(DC_SELECT_TEST_COUNT,
+        cases,
+        args,
+        batch_args));
+    
+    YYY_ASSERT_TRUE(fail_calculation("x ? y", 2, argnames, args));
+    YYY_ASSERT_TRUE(fail_calculation("x < ", 2, argnames, args));
+    YYY_ASSERT_TRUE(fail_calculation("x ? : y", 2, argnames, args));
+    return 1;
+#undef DC_SELECT_TEST_COUNT
+}
+
+/* Checks that let bindings can be used any number of times, that they can
+ * use earlier bindings, and that they hide arguments with the same name. */
+static int let_test(void){
+#define DC_LET_TEST_COUNT 5
+    const char *const argnames[] = {"x", "y"};
+    const char *const sources[DC_LET_TEST_COUNT] = {
+        "let d = sqrt(x*x+y*y); 2*(1 - d)/d",
+        "let a = x+1; let b = a*a; b+a",
+        "let x = y*2; x+x",
+        "let s = sin(x);\n  let c = cos(x);\n  s*s + c*c",
+        "let big = x > y; big ? big*x : y"
+    };
+    const float args[] = { 3.0f, 4.0f };
+    const float expected[DC_LET_TEST_COUNT] = {
+        -1.6f,
+        20.0f,
+        16.0f,
+        1.0f,
+        4.0f
+    };
+    const char *err;
+    unsigned use_double, n;
+    struct DC_Calculation *calc;
+    struct DC_Context *const ctx = DC_CreateContext();
+    
+    for(use_double = 0; use_double < 2; use_double++){
+        DC_SetOption(ctx, DC_OPTION_DOUBLE, use_double);
+        for(n = 0; n < DC_LET_TEST_COUNT; n++){
+            calc = DC_CompileCalculation(ctx,
+                sources[n],
+                2,
+                argnames,
+                &err);
+            YYY_ASSERT_TRUE(calc != NULL);
+            YYY_ASSERT_FLOAT_EQ(DC_Calculate(calc, args),
+                expected[n],
+                dc_epsilon);
+            DC_Free(ctx, calc);
+        }
+    }
+    
+    DC_FreeContext(ctx);
+    
+    YYY_ASSERT_TRUE(fail_calculation("let = x; x", 2, argnames, args));
+    YYY_ASSERT_TRUE(fail_calculation("let a x; a", 2, argnames, args));
+    YYY_ASSERT_TRUE(fail_calculation("let a = x a", 2, argnames, args));
+    YYY_ASSERT_TRUE(fail_calculation("let a = a; a", 2, argnames, args));
+    YYY_ASSERT_TRUE(fail_calculation("let a = x; b", 2, argnames, args));
+    return 1;
+#undef DC_LET_TEST_COUNT
+}
+
+/* Checks that schemas find the same arguments as arrays of names, including
+ * when there are many arguments and when names are repeated. */
+static int schema_test(void){
+#define DC_SCHEMA_TEST_ARGS 256
+    char name_data[DC_SCHEMA_TEST_ARGS][3];
+    const char *names[DC_SCHEMA_TEST_ARGS];
+    float args[DC_SCHEMA_TEST_ARGS];
+    const char *const repeated_names[] = {"x", "y", "x"};
+    const float repeated_args[] = { 1.0f, 2.0f, 3.0f };
+    const char *const sources[] = { "ab*2 + pp - ba", "zz", "x ? y : 4" };
+    const struct DC_ArgSchema *schemas[3];
+    struct DC_Calculation *calcs[3];
+    const char *errs[3];
+    struct DC_Calculation *calc;
+    struct DC_ArgSchema *schema, *repeated;
+    const char *err;
+    unsigned i;
+    struct DC_Context *const ctx = DC_CreateContext();
+    
+    for(i = 0; i < DC_SCHEMA_TEST_ARGS; i++){
+        name_data[i][0] = (char)('a' + (i >> 4));
+        name_data[i][1] = (char)('a' + (i & 15));
+        name_data[i][2] = '\0';
+        names[i] = name_data[i];
+        args[i] = (float)i;
+    }
+    
+    schema = DC_CreateArgSchema(DC_SCHEMA_TEST_ARGS, names);
+    YYY_ASSERT_INT_EQ(DC_GetArgSchemaSize(schema), DC_SCHEMA_TEST_ARGS);
+    
+    /* The names are copied into the schema. */
+    name_data[1][1] = 'z';
+    DC_CompileWithSchema(ctx, sources[0], schema, &err, &calc, NULL);
+    YYY_ASSERT_TRUE(calc != NULL);
+    YYY_ASSERT_FLOAT_EQ(DC_Calculate(calc, args), 241.0f, dc_epsilon);
+    DC_Free(ctx, calc);
+    name_data[1][1] = 'b';
+    
+    DC_CompileWithSchema(ctx, "$255 + ab", schema, &err, &calc, NULL);
+    YYY_ASSERT_TRUE(calc != NULL);
+    YYY_ASSERT_FLOAT_EQ(DC_Calculate(calc, args), 256.0f, dc_epsilon);
+    DC_Free(ctx, calc);
+    
+    repeated = DC_CreateArgSchema(3, repeated_names);
+    DC_CompileWithSchema(ctx, "x*10 + y", repeated, &err, &calc, NULL);
+    YYY_ASSERT_TRUE(calc != NULL);
+    YYY_ASSERT_FLOAT_EQ(DC_Calculate(calc, repeated_args),
+        12.0f,
+        dc_epsilon);
+    DC_Free(ctx, calc);
+    
+    schemas[0] = schema;
+    schemas[1] = schema;
+    schemas[2] = repeated;
+    YYY_ASSERT_INT_EQ(DC_CompileCalculationsWithSchemas(ctx,
+        DC_COMPILE_KEEP_GOING,
+        3,
+        sources,
+        schemas,
+        calcs,
+        errs), 2);
+    YYY_ASSERT_TRUE(calcs[0] != NULL);
+    YYY_ASSERT_TRUE(calcs[1] == NULL);
+    YYY_ASSERT_TRUE(errs[1] != NULL);
+    YYY_ASSERT_TRUE(calcs[2] != NULL);
+    YYY_ASSERT_FLOAT_EQ(DC_Calculate(calcs[0], args), 241.0f, dc_epsilon);
+    YYY_ASSERT_FLOAT_EQ(DC_Calculate(calcs[2], repeated_args),
+        2.0f,
+        dc_epsilon);
+    DC_Free(ctx, calcs[0]);
+    DC_Free(ctx, calcs[2]);
+    DC_FreeError(errs[1]);
+    
+    DC_FreeArgSchema(schema);
+    DC_FreeArgSchema(repeated);
+    DC_FreeContext(ctx);
+    return 1;
+#undef DC_SCHEMA_TEST_ARGS
+}
+
+/* Checks that identical compiles share one calculation with DC_OPTION_CACHE,
+ * and that the calculation lasts until every compile has been freed. */
+static int cache_test(void){
+    const char *const argnames[] = {"x", "y"};
+    const char *const other_argnames[] = {"y", "x"};
+    const char *const sources[] = { "x - y", "x*y", " x\t-  y " };
+    const unsigned num_args[] = { 2, 2, 2 };
+    const char *const *const arg_names_array[] = {
+        argnames,
+        argnames,
+        argnames
+    };
+    const float args[] = { 3.0f, 2.0f };
+    struct DC_Calculation *calc, *same, *other, *calcs[3];
+    const char *errs[3];
+    const char *err;
+    unsigned long hits, misses;
+    unsigned num_calculations;
+    struct DC_Context *const ctx = DC_CreateContext();
+    
+    YYY_ASSERT_TRUE(DC_SetOption(ctx, DC_OPTION_CACHE, 1));
+    
+    calc = DC_CompileCalculation(ctx, "x - y", 2, argnames, &err);
+    same = DC_CompileCalculation(ctx, "  x-   y", 2, argnames, &err);
+    YYY_ASSERT_TRUE(calc != NULL);
+    YYY_ASSERT_TRUE(calc == same);
+    
+    /* Different names or options give a different calculation. */
+    other = DC_CompileCalculation(ctx, "x - y", 2, other_argnames, &err);
+    YYY_ASSERT_TRUE(other != NULL);
+    YYY_ASSERT_TRUE(other != calc);
+    YYY_ASSERT_FLOAT_EQ(DC_Calculate(other, args), -1.0f, dc_epsilon);
+    DC_Free(ctx, other);
+    DC_SetOption(ctx, DC_OPTION_FAST_MATH, 1);
+    other = DC_CompileCalculation(ctx, "x - y", 2, argnames, &err);
+    YYY_ASSERT_TRUE(other != NULL);
+    YYY_ASSERT_TRUE(other != calc);
+    DC_Free(ctx, other);
+    DC_SetOption(ctx, DC_OPTION_FAST_MATH, 0);
+    
+    DC_GetCacheStatistics(ctx, &hits, &misses, &num_calculations);
+    YYY_ASSERT_INT_EQ(hits, 1);
+    YYY_ASSERT_INT_EQ(misses, 3);
+    YYY_ASSERT_INT_EQ(num_calculations, 3);
+    
+    YYY_ASSERT_INT_EQ(DC_CompileCalculations(ctx,
+        0,
+        3,
+        sources,
+        (unsigned*)num_args,
+        arg_names_array,
+        calcs,
+        errs), 0);
+    YYY_ASSERT_TRUE(calcs[0] == calc);
+    YYY_ASSERT_TRUE(calcs[1] != calc);
+    YYY_ASSERT_TRUE(calcs[2] == calc);
+    DC_Free(ctx, calcs[0]);
+    DC_Free(ctx, calcs[1]);
+    DC_Free(ctx, calcs[2]);
+    
+    /* The calculation is kept until the last reference is freed. */
+    DC_Free(ctx, same);
+    YYY_ASSERT_FLOAT_EQ(DC_Calculate(calc, args), 1.0f, dc_epsilon);
+    DC_GetCacheStatistics(ctx, &hits, &misses, &num_calculations);
+    YYY_ASSERT_INT_EQ(hits, 3);
+    YYY_ASSERT_INT_EQ(num_calculations, 4);
+    DC_Free(ctx, calc);
+    
+    /* The parsed calculation is kept after it is freed, and is used again. */
+    calc = DC_CompileCalculation(ctx, "x - y", 2, argnames, &err);
+    YYY_ASSERT_TRUE(calc != NULL);
+    YYY_ASSERT_FLOAT_EQ(DC_Calculate(calc, args), 1.0f, dc_epsilon);
+    DC_Free(ctx, calc);
+    DC_GetCacheStatistics(ctx, &hits, &misses, &num_calculations);
+    YYY_ASSERT_INT_EQ(hits, 4);
+    YYY_ASSERT_INT_EQ(num_calculations, 4);
+    
+    /* Only the most recently freed calculations are kept. */
+    YYY_ASSERT_TRUE(DC_SetOption(ctx, DC_OPTION_MAX_FREE_CACHED, 1));
+    DC_GetCacheStatistics(ctx, &hits, &misses, &num_calculations);
+    YYY_ASSERT_INT_EQ(num_calculations, 1);
+    calc = DC_CompileCalculation(ctx, "x - y", 2, argnames, &err);
+    DC_GetCacheStatistics(ctx, &hits, &misses, &num_calculations);
+    YYY_ASSERT_INT_EQ(hits, 5);
+    other = DC_CompileCalculation(ctx, "x*y", 2, argnames, &err);
+    DC_Free(ctx, other);
+    DC_GetCacheStatistics(ctx, &hits, &misses, &num_calculations);
+    YYY_ASSERT_INT_EQ(misses, 5);
+    YYY_ASSERT_INT_EQ(num_calculations, 2);
+    
+    /* Clearing keeps the calculations that are in use. */
+    DC_ClearCache(ctx);
+    DC_GetCacheStatistics(ctx, &hits, &misses, &num_calculations);
+    YYY_ASSERT_INT_EQ(num_calculations, 1);
+    same = DC_CompileCalculation(ctx, "x - y", 2, argnames, &err);
+    YYY_ASSERT_TRUE(calc == same);
+    DC_Free(ctx, same);
+    DC_SetOption(ctx, DC_OPTION_MAX_FREE_CACHED, 0);
+    DC_Free(ctx, calc);
+    DC_GetCacheStatistics(ctx, &hits, &misses, &num_calculations);
+    YYY_ASSERT_INT_EQ(num_calculations, 0);
+    
+    /* Without the cache, every compile is separate. */
+    DC_SetOption(ctx, DC_OPTION_CACHE, 0);
+    calc = DC_CompileCalculation(ctx, "x - y", 2, argnames, &err);
+    same = DC_CompileCalculation(ctx, "x - y", 2, argnames, &err);
+    YYY_ASSERT_TRUE(calc != same);
+    DC_Free(ctx, calc);
+    DC_Free(ctx, same);
+    
+    DC_FreeContext(ctx);
+    return 1;
+}
+
+/* Checks that a saved cache can be loaded into another context, and that its
+ * calculations give the same results without being parsed again. */
+static int save_cache_test(void){
+    const char *const argnames[] = {"x", "y"};
+    const char *const path = "dcjit_test_cache.bin";
+    const char *const sources[] = {
+        "let d = x - y; d*d + sin(x)",
+        "x < y ? x : y",
+        "(x+y)/(x+y+1)"
+    };
+    const unsigned num_sources = sizeof(sources) / sizeof(sources[0]);
+    const float args[] = { 3.0f, 2.0f };
+    float expected[sizeof(sources) / sizeof(sources[0])];
+    struct DC_Calculation *calc;
+    const char *err;
+    unsigned long hits, misses;
+    unsigned i, num_calculations;
+    FILE *file;
+    struct DC_Context *ctx = DC_CreateContext();
+    
+    DC_SetOption(ctx, DC_OPTION_CACHE, 1);
+    for(i = 0; i < num_sources; i++){
+        calc = DC_CompileCalculation(ctx, sources[i], 2, argnames, &err);
+        YYY_ASSERT_TRUE(calc != NULL);
+        expected[i] = DC_Calculate(calc, args);
+        DC_Free(ctx, calc);
+    }
+    YYY_ASSERT_TRUE(DC_SaveCache(ctx, path));
+    DC_FreeContext(ctx);
+    
+    ctx = DC_CreateContext();
+    DC_SetOption(ctx, DC_OPTION_CACHE, 1);
+    YYY_ASSERT_INT_EQ(DC_LoadCache(ctx, path), num_sources);
+    /* Loading again skips the calculations that are already in the cache. */
+    YYY_ASSERT_INT_EQ(DC_LoadCache(ctx, path), 0);
+    for(i = 0; i < num_sources; i++){
+        calc = DC_CompileCalculation(ctx, sources[i], 2, argnames, &err);
+        YYY_ASSERT_TRUE(calc != NULL);
+        YYY_ASSERT_FLOAT_EQ(DC_Calculate(calc, args), expected[i], dc_epsilon);
+        DC_Free(ctx, calc);
+    }
+    DC_GetCacheStatistics(ctx, &hits, &misses, &num_calculations);
+    YYY_ASSERT_INT_EQ(hits, num_sources);
+    YYY_ASSERT_INT_EQ(misses, 0);
+    YYY_ASSERT_INT_EQ(num_calculations, num_sources);
+    
+    /* Loaded calculations are kept after they are freed until the cache is
+     * cleared. */
+    DC_SetOption(ctx, DC_OPTION_MAX_FREE_CACHED, 0);
+    DC_GetCacheStatistics(ctx, &hits, &misses, &num_calculations);
+    YYY_ASSERT_INT_EQ(num_calculations, num_sources);
+    DC_ClearCache(ctx);
+    DC_GetCacheStatistics(ctx, &hits, &misses, &num_calculations);
+    YYY_ASSERT_INT_EQ(num_calculations, 0);
+    YYY_ASSERT_INT_EQ(DC_LoadCache(ctx, path), num_sources);
+    DC_FreeContext(ctx);
+    
+    /* Files that were not made by DC_SaveCache are not loaded. */
+    ctx = DC_CreateContext();
+    file = fopen(path, "wb");
+    YYY_ASSERT_TRUE(file != NULL);
+    fputs("not a cache", file);
+    fclose(file);
+    YYY_ASSERT_INT_EQ(DC_LoadCache(ctx, path), 0);
+    remove(path);
+    YYY_ASSERT_INT_EQ(DC_LoadCache(ctx, path), 0);
+    DC_GetCacheStatistics(ctx, &hits, &misses, &num_calculations);
+    YYY_ASSERT_INT_EQ(num_calculations, 0);
+    DC_FreeContext(ctx);
+    return 1;
+}
+
+/* Checks that specialized calculations give the same results as the original
+ * calculation, and ignore the arguments that are bound. */
+static int specialize_test(void){
+    const char *const argnames[] = {"g", "x", "drag"};
+    const char *const source = "x*g + sqrt(drag*drag + g)*x - drag";
+    const double values[] = { 9.81, 0.0, 0.25 };
+    const float args[] = { 9.81f, 2.0f, 0.25f };
+    const float other_args[] = { -1.0f, 2.0f, 100.0f };
+    struct DC_Calculation *calc, *specialized;
+    const char *err;
+    struct DC_Context *const ctx = DC_CreateContext();
+    
+    calc = DC_CompileCalculation(ctx, source, 3, argnames, &err);
+    YYY_ASSERT_TRUE(calc != NULL);
+    specialized = DC_Specialize(ctx, source, 3, argnames, 5, values, &err);
+    YYY_ASSERT_TRUE(specialized != NULL);
+    YYY_ASSERT_TRUE(err == NULL);
+    YYY_ASSERT_FLOAT_EQ(DC_Calculate(specialized, args),
+        DC_Calculate(calc, args),
+        dc_epsilon);
+    YYY_ASSERT_FLOAT_EQ(DC_Calculate(specialized, other_args),
+        DC_Calculate(calc, args),
+        dc_epsilon);
+    DC_Free(ctx, specialized);
+    
+    /* Binding every argument makes a constant. */
+    specialized = DC_Specialize(ctx, "x*2 + $2", 3, argnames, 7, values, &err);
+    YYY_ASSERT_TRUE(specialized != NULL);
+    YYY_ASSERT_FLOAT_EQ(DC_Calculate(specialized, args), 0.25f, dc_epsilon);
+    DC_Free(ctx, specialized);
+    
+    specialized = DC_Specialize(ctx, "x*", 3, argnames, 1, values, &err);
+    YYY_ASSERT_TRUE(specialized == NULL);
+    YYY_ASSERT_TRUE(err != NULL);
+    DC_FreeError(err);
+    
+    DC_Free(ctx, calc);
+    DC_FreeContext(ctx);
+    return 1;
+}
+
+/* Checks that tiered calculations give the same results before and after they
+ * are promoted, and that they keep the options they were compiled with. */
+static int tier_test(void){
+    const char *const argnames[] = {"x", "y"};
+    const char *const source = "x*y + sin(x) - (x < y ? y : 2)";
+    const float args[] = { 1.5f, 2.0f };
+    const float batch_args[] = { 1.5f, -3.0f, 2.0f, 0.5f };
+    const double double_args[] = { 1000000.0, 0.0 };
+    float expected, out[2];
+    struct DC_Calculation *calc, *tiered, *unused;
+    const char *err;
+    unsigned i;
+    struct DC_Context *const ctx = DC_CreateContext();
+    
+    calc = DC_CompileCalculation(ctx, source, 2, argnames, &err);
+    YYY_ASSERT_TRUE(calc != NULL);
+    expected = DC_Calculate(calc, args);
+    
+    YYY_ASSERT_TRUE(DC_SetOption(ctx, DC_OPTION_TIER_THRESHOLD, 4));
+    tiered = DC_CompileCalculation(ctx, source, 2, argnames, &err);
+    unused = DC_CompileCalculation(ctx, "x - y", 2, argnames, &err);
+    YYY_ASSERT_TRUE(tiered != NULL);
+    YYY_ASSERT_TRUE(unused != NULL);
+    for(i = 0; i < 2; i++)
+        YYY_ASSERT_FLOAT_EQ(DC_Calculate(tiered, args), expected, dc_epsilon);
+    YYY_ASSERT_INT_EQ(DC_PromoteCalculations(ctx), 0);
+    
+    /* Each set of a batch counts as a call, and the call that reaches the
+     * threshold promotes the calculation. */
+    DC_CalculateBatch(tiered, 2, batch_args, out);
+    YYY_ASSERT_FLOAT_EQ(out[0], expected, dc_epsilon);
+    YYY_ASSERT_INT_EQ(DC_PromoteCalculations(ctx), 0);
+    YYY_ASSERT_FLOAT_EQ(DC_Calculate(tiered, args), expected, dc_epsilon);
+    DC_CalculateBatch(tiered, 2, batch_args, out);
+    YYY_ASSERT_FLOAT_EQ(out[0], expected, dc_epsilon);
+    
+    /* Lowering the threshold leaves calculations for DC_PromoteCalculations
+     * until they are called again. */
+    YYY_ASSERT_FLOAT_EQ(DC_Calculate(unused, args), -0.5f, dc_epsilon);
+    DC_SetOption(ctx, DC_OPTION_TIER_THRESHOLD, 1);
+    YYY_ASSERT_INT_EQ(DC_PromoteCalculations(ctx), 1);
+    YYY_ASSERT_FLOAT_EQ(DC_Calculate(unused, args), -0.5f, dc_epsilon);
+    DC_Free(ctx, tiered);
+    DC_Free(ctx, unused);
+    
+    /* The precision is kept even if the option changes before promotion. */
+    DC_SetOption(ctx, DC_OPTION_TIER_THRESHOLD, 1);
+    DC_SetOption(ctx, DC_OPTION_DOUBLE, 1);
+    tiered = DC_CompileCalculation(ctx, "x+0.000001", 2, argnames, &err);
+    YYY_ASSERT_TRUE(tiered != NULL);
+    DC_SetOption(ctx, DC_OPTION_DOUBLE, 0);
+    YYY_ASSERT_TRUE(
+        DC_CalculateDouble(tiered, double_args) == 1000000.0 + 0.000001);
+    unused = DC_CompileCalculation(ctx, "x - y", 2, argnames, &err);
+    YYY_ASSERT_INT_EQ(DC_PromoteCalculations(ctx), 0);
+    YYY_ASSERT_TRUE(
+        DC_CalculateDouble(tiered, double_args) == 1000000.0 + 0.000001);
+    DC_Free(ctx, tiered);
+    DC_Free(ctx, unused);
+    
+    DC_Free(ctx, calc);
+    DC_FreeContext(ctx);
+    return 1;
+}
+
+/* Checks that calculations compiled from bytecode give the same results as
+ * ones compiled from the source, including with repeated subexpressions that
+ * the bytecode keeps in temporaries. */
+static int from_bytecode_test(void){
+    const char *const argnames[] = {"x", "y"};
+    const char *const source =
+        "let d = x*x + y*y; sqrt(d) + (x < y ? d : atan2(y, x)) - 2";
+    const float args[] = { 1.5f, 2.0f };
+    const float other_args[] = { 3.0f, -0.5f };
+    struct DC_Calculation *calc, *from_bc;
+    struct DC_Bytecode *bc;
+    const char *err;
+    struct DC_Context *const ctx = DC_CreateContext();
+    
+    DC_Compile(ctx, source, 2, argnames, &err, &calc, &bc);
+    YYY_ASSERT_TRUE(calc != NULL);
+    YYY_ASSERT_TRUE(bc != NULL);
+    from_bc = DC_CompileFromBytecode(ctx, bc, 2);
+    YYY_ASSERT_TRUE(from_bc != NULL);
+    YYY_ASSERT_FLOAT_EQ(DC_Calculate(from_bc, args),
+        DC_Calculate(calc, args),
+        dc_epsilon);
+    YYY_ASSERT_FLOAT_EQ(DC_Calculate(from_bc, other_args),
+        DC_Calculate(calc, other_args),
+        dc_epsilon);
+    DC_Free(ctx, from_bc);
+    
+    /* The bytecode uses the second argument. */
+    YYY_ASSERT_TRUE(DC_CompileFromBytecode(ctx, bc, 1) == NULL);
+    
+    DC_FreeBytecode(bc);
+    DC_Free(ctx, calc);
+    DC_FreeContext(ctx);
+    return 1;
+}
+
+/* Checks gradients against derivatives worked out by hand, including for an
+ * argument that is not used. */
+static int gradient_test(void){
+    const char *const argnames[] = {"x", "y", "z", "w"};
+    const float args[] = { 1.5f, 2.0f, 0.5f, 100.0f };
+    const double x = 1.5, y = 2.0, z = 0.5;
+    float out[5];
+    struct DC_Gradient *grad;
+    const char *err;
+    struct DC_Context *const ctx = DC_CreateContext();
+    
+    grad = DC_CompileGradient(ctx,
+        "x*y + sin(x)*cos(z) - sqrt(y)/x",
+        4,
+        argnames,
+        &err);
+    YYY_ASSERT_TRUE(grad != NULL);
+    YYY_ASSERT_TRUE(err == NULL);
+    DC_CalculateGradient(grad, args, out);
+    YYY_ASSERT_FLOAT_EQ(out[0],
+        x*y + sin(x)*cos(z) - sqrt(y)/x,
+        dc_epsilon);
+    YYY_ASSERT_FLOAT_EQ(out[1],
+        y + cos(x)*cos(z) + sqrt(y)/(x*x),
+        dc_epsilon);
+    YYY_ASSERT_FLOAT_EQ(out[2], x - 1.0/(2.0*sqrt(y)*x), dc_epsilon);
+    YYY_ASSERT_FLOAT_EQ(out[3], -sin(x)*sin(z), dc_epsilon);
+    YYY_ASSERT_FLOAT_EQ(out[4], 0.0f, 0.0f);
+    DC_FreeGradient(ctx, grad);
+    
+    /* Conditionals follow the value that they choose. */
+    grad = DC_CompileGradient(ctx, "x < y ? x^3 : y^x", 4, argnames, &err);
+    YYY_ASSERT_TRUE(grad != NULL);
+    DC_CalculateGradient(grad, args, out);
+    YYY_ASSERT_FLOAT_EQ(out[0], x*x*x, dc_epsilon);
+    YYY_ASSERT_FLOAT_EQ(out[1], 3.0*x*x, dc_epsilon);
+    YYY_ASSERT_FLOAT_EQ(out[2], 0.0f, 0.0f);
+    DC_FreeGradient(ctx, grad);
+    
+    grad = DC_CompileGradient(ctx, "x*", 4, argnames, &err);
+    YYY_ASSERT_TRUE(grad == NULL);
+    YYY_ASSERT_TRUE(err != NULL);
+    DC_FreeError(err);
+    
+    DC_FreeContext(ctx);
+    return 1;
+}
+
+/* Checks a gradient whose value and derivatives share a subexpression, which
+ * the single calculation for the gradient only calculates once. There are more
+ * arguments than the gradient keeps on the stack while it runs, and it is run
+ * at both precisions. */
+static int gradient_shared_test(void){
+    const char *const argnames[] = {
+        "a", "b", "c", "d", "e", "f", "g", "h", "i",
+        "j", "k", "l", "m", "n", "o", "p", "q", "r"
+    };
+    float args[18], out[19];
+    double double_args[18], double_out[19];
+    struct DC_Gradient *grad;
+    const char *err;
+    struct DC_Context *const ctx = DC_CreateContext();
+    unsigned i, use_double;
+    
+    for(i = 0; i < 18; i++)
+        double_args[i] = args[i] = 1.0f;
+    double_args[0] = args[0] = 3.0f;
+    double_args[1] = args[1] = 2.0f;
+    double_args[2] = args[2] = 4.0f;
+    double_args[17] = args[17] = 4.0f;
+    
+    /* Gradients are not tiered. */
+    DC_SetOption(ctx, DC_OPTION_TIER_THRESHOLD, 1000);
+    for(use_double = 0; use_double < 2; use_double++){
+        DC_SetOption(ctx, DC_OPTION_DOUBLE, use_double);
+        grad = DC_CompileGradient(ctx,
+            "let s = sqrt(a*a + r*r); s*b + s/c",
+            18,
+            argnames,
+            &err);
+        YYY_ASSERT_TRUE(grad != NULL);
+        YYY_ASSERT_TRUE(err == NULL);
+        DC_CalculateGradient(grad, args, out);
+        DC_CalculateGradientDouble(grad, double_args, double_out);
+        
+        YYY_ASSERT_FLOAT_EQ(out[0], 11.25f, dc_epsilon);
+        YYY_ASSERT_FLOAT_EQ(out[1], 1.35f, dc_epsilon);
+        YYY_ASSERT_FLOAT_EQ(out[2], 5.0f, dc_epsilon);
+        YYY_ASSERT_FLOAT_EQ(out[3], -0.3125f, dc_epsilon);
+        YYY_ASSERT_FLOAT_EQ(out[18], 1.8f, dc_epsilon);
+        for(i = 4; i < 18; i++)
+            YYY_ASSERT_FLOAT_EQ(out[i], 0.0f, 0.0f);
+        for(i = 0; i < 19; i++)
+            YYY_ASSERT_FLOAT_EQ(double_out[i], out[i], dc_epsilon);
+        DC_FreeGradient(ctx, grad);
+    }
+    
+    DC_FreeContext(ctx);
+    return 1;
+}
+
+/* Checks roots against known values, including for arguments with no root in
+ * the bracket. */
+static int find_root_test(void){
+    const char *const argnames[] = {"t", "a"};
+    const float args[] = { 0.0f, 2.0f };
+    const float set_args[] = {
+        0.0f, 1.0f,
+        0.0f, 9.0f,
+        0.0f, -1.0f
+    };
+    float root;
+    struct DC_Bytecode *bc;
+    const char *err;
+    struct DC_Context *const ctx = DC_CreateContext();
+    
+    bc = DC_CompileBytecode(ctx, "t*t - a", 2, argnames, &err);
+    YYY_ASSERT_TRUE(bc != NULL);
+    YYY_ASSERT_TRUE(DC_FindRoot(bc, 0, args, 0.0f, 4.0f, 1e-6f, &root));
+    YYY_ASSERT_FLOAT_EQ(root, sqrt(2.0), dc_epsilon);
+    
+    /* There is no sign change between 2 and 4. */
+    YYY_ASSERT_FALSE(DC_FindRoot(bc, 0, args, 2.0f, 4.0f, 1e-6f, &root));
+    YYY_ASSERT_TRUE(root != root);
+    
+    YYY_ASSERT_TRUE(DC_FindRoot(bc, 0, set_args, 0.0f, 4.0f, 1e-6f, &root));
+    YYY_ASSERT_FLOAT_EQ(root, 1.0f, dc_epsilon);
+    YYY_ASSERT_TRUE(
+        DC_FindRoot(bc, 0, set_args + 2, 0.0f, 4.0f, 1e-6f, &root));
+    YYY_ASSERT_FLOAT_EQ(root, 3.0f, dc_epsilon);
+    YYY_ASSERT_FALSE(
+        DC_FindRoot(bc, 0, set_args + 4, 0.0f, 4.0f, 1e-6f, &root));
+    YYY_ASSERT_TRUE(root != root);
+    DC_FreeBytecode(bc);
+    
+    /* The derivative goes through cos and a temporary. */
+    bc = DC_CompileBytecode(ctx,
+        "let u = t*a; cos(u) - u*u",
+        2,
+        argnames,
+        &err);
+    YYY_ASSERT_TRUE(bc != NULL);
+    YYY_ASSERT_TRUE(DC_FindRoot(bc, 0, args, 0.0f, 1.0f, 1e-6f, &root));
+    YYY_ASSERT_FLOAT_EQ(cos(root * 2.0f), 4.0f * root * root, dc_epsilon);
+    DC_FreeBytecode(bc);
+    
+    DC_FreeContext(ctx);
+    return 1;
+}
+
+/* Checks that double precision calculations keep precision that floats lose,
+ * and that both precisions can be run with either calculate function. */
+static int double_test(void){
+    const char *const argnames[] = {"x", "y"};
+    const char *const deep_source =
+        "sqrt(x)*(y+(x*(y+(x*(y+(x*(y+sin(y))))))))";
+    const double args[] = { 1000000.0, 0.5 }, deep_args[] = { 1.5, -0.25 };
+    const float float_args[] = { 1.5f, -0.25f };
+    const char *err;
+    double expected;
+    struct DC_Calculation *calc;
+    struct DC_Context *const ctx = DC_CreateContext();
+    
+    DC_SetOption(ctx, DC_OPTION_DOUBLE, 1);
+    
+    calc = DC_CompileCalculation(ctx, "(x+0.000001)*y", 2, argnames, &err);
+    YYY_ASSERT_TRUE(calc != NULL);
+    expected = (1000000.0 + 0.000001) * 0.5;
+    YYY_ASSERT_TRUE(fabs(DC_CalculateDouble(calc, args) - expected) < 1e-9);
+    DC_Free(ctx, calc);
+    
+    /* This spills, and uses the argument forms of the operations. */
+    calc = DC_CompileCalculation(ctx, deep_source, 2, argnames, &err);
+    YYY_ASSERT_TRUE(calc != NULL);
+    expected = sqrt(1.5) * (-0.25 + (1.5 * (-0.25 + (1.5 *
+        (-0.25 + (1.5 * (-0.25 + sin(-0.25))))))));
+    YYY_ASSERT_TRUE(fabs(DC_CalculateDouble(calc, deep_args) - expected) < 1e-12);
+    YYY_ASSERT_FLOAT_EQ(DC_Calculate(calc, float_args), expected, 0.000001f);
+    DC_Free(ctx, calc);
+    
+    DC_SetOption(ctx, DC_OPTION_DOUBLE, 0);
+    calc = DC_CompileCalculation(ctx, "x*y+2", 2, argnames, &err);
+    YYY_ASSERT_TRUE(calc != NULL);
+    YYY_ASSERT_FLOAT_EQ(DC_CalculateDouble(calc, deep_args), 1.625f, 0.0f);
+    DC_Free(ctx, calc);
+    
+    DC_FreeContext(ctx);
+    return 1;
+}
+
 static struct YYY_Test dc_test_tests[] = {
     YYY_TEST(zero_immediate_test),
     YYY_TEST(one_immediate_test),
@@ -148,6 +1478,32 @@ static struct YYY_Test dc_test_tests[] = {
     YYY_TEST(zero_arg_test),
     YYY_TEST(zero_of_two_arg_test),
     YYY_TEST(one_arg_test),
+    YYY_TEST(shared_page_test),
+    YYY_TEST(page_pool_test),
+    YYY_TEST(large_calculation_test),
+    YYY_TEST(deep_stack_test),
+    YYY_TEST(many_args_test),
+    YYY_TEST(trig_test),
+    YYY_TEST(batch_test),
+    YYY_TEST(native_function_test),
+    YYY_TEST(double_test),
+    YYY_TEST(operand_order_test),
+    YYY_TEST(cse_test),
+    YYY_TEST(fast_math_test),
+    YYY_TEST(strength_test),
+    YYY_TEST(pow_test),
+    YYY_TEST(builtin_test),
+    YYY_TEST(select_test),
+    YYY_TEST(let_test),
+    YYY_TEST(schema_test),
+    YYY_TEST(cache_test),
+    YYY_TEST(save_cache_test),
+    YYY_TEST(specialize_test),
+    YYY_TEST(tier_test),
+    YYY_TEST(from_bytecode_test),
+    YYY_TEST(gradient_test),
+    YYY_TEST(gradient_shared_test),
+    YYY_TEST(find_root_test),
 };
 
 YYY_TEST_FUNCTION(DC_Test_RunTests, dc_test_tests, "DCJIT")